@@ -46,6 +46,11 @@ extern "C" {
 
 #define MAX_PAYLOAD_SIZE        (1024)  //should not exceed 1024 bytes (see 4.6 RFC7252) (must be power of 2 to fit with blocksize option!)
 #define PREFERED_PAYLOAD_SIZE    (64)   //also size of inital pResp message payload buffer in user resource handler
+#ifdef COAP_TX_HEADROOM
+#define TX_HEADROOM (COAP_TX_HEADROOM) //[byte] reserved in front of response payloads for header, token and options (zero copy sending)
+#else
+#define TX_HEADROOM (48)
+#endif
 
 // Simulate network loss, set percentage of uploads or downloads that are dropped randomly:
 #define DEBUG_RANDOM_DROP_INCOMING_PERCENTAGE 0
@@ -72,6 +77,12 @@ extern "C" {
 #include "option-types/coap_option_observe.h"
 #include "coap_resource.h"
 #include "coap_interaction.h"
+#include "coap_upload.h"
+#include "coap_block2cache.h"
+#include "coap_respcache.h"
+#include "coap_conditional.h"
+#include "coap_observer_log.h"
+#include "coap_snapshot.h"
 #include "coap_main.h"
 #include "diagnostic.h"
 
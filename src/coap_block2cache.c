@@ -0,0 +1,215 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#include <inttypes.h>
+#include "coap.h"
+#include "coap_mem.h"
+
+static CoAP_Block2CacheEntry_t Block2Cache[BLOCK2_CACHE_ENTRIES];
+
+static void ReleaseEntry(CoAP_Block2CacheEntry_t* pEntry) {
+	CoAP_ReleasePayloadBuf(&(pEntry->pBuf)); //responses still being sent hold their own reference
+	CoAP_FreeOptionList(&(pEntry->pKey));
+	pEntry->pData = NULL;
+	pEntry->pRes = NULL;
+}
+
+static bool GetETagValue(CoAP_option_t* pETag, uint32_t* pVal) {
+	uint8_t* v;
+	if (pETag == NULL || pETag->Length != 4) {
+		return false;
+	}
+	v = pETag->Value;
+	*pVal = (uint32_t) v[0] << 24 | (uint32_t) v[1] << 16 | (uint32_t) v[2] << 8 | v[3];
+	return true;
+}
+
+static bool EntryMatches(CoAP_Block2CacheEntry_t* pEntry, CoAP_Res_t* pRes, CoAP_option_t* pOptList, uint32_t hash) {
+	return pEntry->pRes == pRes && pEntry->KeyHash == hash && CoAP_CacheKeyMatches(pEntry->pKey, pOptList);
+}
+
+static bool EntryExpired(CoAP_Block2CacheEntry_t* pEntry, uint32_t now) {
+	return timeAfter(now, pEntry->LastUse + BLOCK2_CACHE_TIMEOUT);
+}
+
+static void PurgeExpiredEntries(uint32_t now) {
+	int i;
+	for (i = 0; i < BLOCK2_CACHE_ENTRIES; i++) {
+		if (Block2Cache[i].pRes != NULL && EntryExpired(&Block2Cache[i], now)) {
+			ReleaseEntry(&Block2Cache[i]);
+		}
+	}
+}
+
+// Most recently used snapshot for the request key, restricted to the requested entity-tag if the client sent one
+static CoAP_Block2CacheEntry_t* FindEntry(CoAP_Res_t* pRes, CoAP_Message_t* pReq) {
+	CoAP_Block2CacheEntry_t* pFound = NULL;
+	CoAP_option_t* pReqETag = CoAP_FindOptionByNumber(pReq, OPT_NUM_ETAG);
+	uint32_t hash = CoAP_CacheKeyHash(pReq->pOptionsList);
+	uint32_t etag;
+	int i;
+
+	for (i = 0; i < BLOCK2_CACHE_ENTRIES; i++) {
+		CoAP_Block2CacheEntry_t* pEntry = &Block2Cache[i];
+		if (!pEntry->Complete || !EntryMatches(pEntry, pRes, pReq->pOptionsList, hash)) {
+			continue;
+		}
+		if (pReqETag != NULL && (!GetETagValue(pReqETag, &etag) || etag != pEntry->ETag)) {
+			continue;
+		}
+		if (pFound == NULL || timeAfter(pEntry->LastUse, pFound->LastUse)) {
+			pFound = pEntry;
+		}
+	}
+	return pFound;
+}
+
+// Snapshots the representation generated for pReq, it is used once CoAP_Block2CacheComplete(...)
+// found the handler to succeed
+void _rom CoAP_Block2CacheStore(CoAP_Message_t* pReq, const uint8_t* pData, uint32_t size, uint32_t etag) {
+	CoAP_Res_t* pRes = pReq->pResource;
+	uint32_t hash = CoAP_CacheKeyHash(pReq->pOptionsList);
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	CoAP_Block2CacheEntry_t* pEntry = NULL;
+	int i;
+
+	if (size > BLOCK2_CACHE_MAX_SIZE) {
+		return;
+	}
+	PurgeExpiredEntries(now);
+
+	for (i = 0; i < BLOCK2_CACHE_ENTRIES; i++) {
+		if (EntryMatches(&Block2Cache[i], pRes, pReq->pOptionsList, hash) && Block2Cache[i].ETag == etag && Block2Cache[i].Size == size) {
+			Block2Cache[i].LastUse = now; //unchanged representation, keep snapshot
+			return;
+		}
+	}
+
+	// free slot or least recently used one
+	for (i = 0; i < BLOCK2_CACHE_ENTRIES; i++) {
+		if (Block2Cache[i].pRes == NULL) {
+			pEntry = &Block2Cache[i];
+			break;
+		}
+		if (pEntry == NULL || timeAfter(pEntry->LastUse, Block2Cache[i].LastUse)) {
+			pEntry = &Block2Cache[i];
+		}
+	}
+	if (pEntry->pRes != NULL) {
+		ReleaseEntry(pEntry);
+	}
+
+	pEntry->pBuf = CoAP_AllocPayloadBuf((uint16_t) size);
+	if (pEntry->pBuf == NULL) {
+		return;
+	}
+	if (CoAP_CopyCacheKey(&(pEntry->pKey), pReq->pOptionsList) != COAP_OK) {
+		CoAP_ReleasePayloadBuf(&(pEntry->pBuf));
+		return;
+	}
+	pEntry->pData = PAYLOAD_BUF_DATA(pEntry->pBuf);
+	coap_memcpy(pEntry->pData, pData, size);
+	pEntry->pRes = pRes;
+	pEntry->KeyHash = hash;
+	pEntry->Complete = false;
+	pEntry->ETag = etag;
+	pEntry->Size = size;
+	pEntry->LastUse = now;
+}
+
+// Answers a GET for block N>0 of a resource with RES_FLAG_BLOCK2_CACHE from its snapshot
+// returns false if the resource handler has to generate the representation
+bool _rom CoAP_ServeBlock2FromCache(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pReq = pIA->pReqMsg;
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+	CoAP_Block2CacheEntry_t* pEntry;
+	CoAP_blockwise_option_t B2opt;
+	uint32_t now = CoAP.api.rtc1HzCnt();
+
+	if (!(pIA->pRes->Options.Flags & RES_FLAG_BLOCK2_CACHE) || pIA->pRes->IsPattern || pReq->Code != REQ_GET) {
+		return false;
+	}
+	if (GetBlock2OptionFromMsg(pReq, &B2opt) != COAP_OK || B2opt.BlockNum == 0) {
+		return false; //block 0 always refreshes the snapshot
+	}
+
+	PurgeExpiredEntries(now);
+	pEntry = FindEntry(pIA->pRes, pReq);
+	if (pEntry == NULL) {
+		return false;
+	}
+
+	// ETag first, so CoAP_SetPayload_CheckBlockOpt(...) does not snapshot again
+	AddETagValueToMsg(pResp, pEntry->ETag);
+	if (pEntry->HasCf) {
+		CoAP_AddCfOptionToMsg(pResp, pEntry->Cf);
+	}
+	if (CoAP_SetPayload_CheckBlockOpt(pReq, pResp, pEntry->pData, pEntry->Size, false) != COAP_OK) {
+		if (pResp->Code == EMPTY) {
+			pResp->Code = RESP_INTERNAL_SERVER_ERROR_5_00;
+		}
+		return true;
+	}
+	CoAP_SetSharedPayload(pResp, pEntry->pBuf, pResp->Payload, pResp->PayloadLength); //block refers to the snapshot, no copy
+	pResp->Code = RESP_SUCCESS_CONTENT_2_05;
+	pEntry->LastUse = now;
+
+	if (GetBlock2OptionFromMsg(pResp, &B2opt) == COAP_OK && !B2opt.MoreFlag) {
+		INFO("- Block2 snapshot of %" PRIu32 " bytes released after last block\r\n", pEntry->Size);
+		ReleaseEntry(pEntry);
+	}
+	return true;
+}
+
+// Called after the handler succeeded: takes the Content-Format of its response for the snapshot
+// the response was cut from and makes the snapshot available to the following block requests
+void _rom CoAP_Block2CacheComplete(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pReq = pIA->pReqMsg;
+	CoAP_option_t* pCf;
+	uint32_t hash, etag, cf;
+	int i;
+
+	if (!(pIA->pRes->Options.Flags & RES_FLAG_BLOCK2_CACHE) || pIA->pRes->IsPattern
+			|| !GetETagValue(CoAP_FindOptionByNumber(pIA->pRespMsg, OPT_NUM_ETAG), &etag)) {
+		return;
+	}
+	hash = CoAP_CacheKeyHash(pReq->pOptionsList);
+	pCf = CoAP_FindOptionByNumber(pIA->pRespMsg, OPT_NUM_CONTENT_FORMAT);
+	for (i = 0; i < BLOCK2_CACHE_ENTRIES; i++) {
+		CoAP_Block2CacheEntry_t* pEntry = &Block2Cache[i];
+		if (pEntry->ETag != etag || !EntryMatches(pEntry, pIA->pRes, pReq->pOptionsList, hash)) {
+			continue;
+		}
+		pEntry->HasCf = pCf != NULL && CoAP_GetUintFromOption(pCf, &cf) == COAP_OK;
+		pEntry->Cf = pEntry->HasCf ? (uint16_t) cf : 0;
+		pEntry->Complete = true;
+	}
+}
+
+// Drops all snapshots of a changed or removed resource
+void _rom CoAP_Block2CacheInvalidate(CoAP_Res_t* pRes) {
+	int i;
+	for (i = 0; i < BLOCK2_CACHE_ENTRIES; i++) {
+		if (Block2Cache[i].pRes == pRes) {
+			ReleaseEntry(&Block2Cache[i]);
+		}
+	}
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef COAP_BLOCK2CACHE_H_
+#define COAP_BLOCK2CACHE_H_
+
+#ifdef COAP_BLOCK2_CACHE_ENTRIES
+#define BLOCK2_CACHE_ENTRIES (COAP_BLOCK2_CACHE_ENTRIES) //max. number of representations snapshotted at once, the least recently used one is replaced
+#else
+#define BLOCK2_CACHE_ENTRIES (4)
+#endif
+#ifdef COAP_BLOCK2_CACHE_MAX_SIZE
+#define BLOCK2_CACHE_MAX_SIZE (COAP_BLOCK2_CACHE_MAX_SIZE) //[byte] larger representations are not snapshotted
+#else
+#define BLOCK2_CACHE_MAX_SIZE (8192)
+#endif
+#ifdef COAP_BLOCK2_CACHE_TIMEOUT
+#define BLOCK2_CACHE_TIMEOUT (COAP_BLOCK2_CACHE_TIMEOUT) //[s] snapshots are released after this time without a block request
+#else
+#define BLOCK2_CACHE_TIMEOUT (30)
+#endif
+
+// Snapshot of a blockwise representation (RFC7959) of a resource with RES_FLAG_BLOCK2_CACHE
+// for a GET with given Uri-Path, Uri-Query and Accept options
+typedef struct {
+	CoAP_Res_t* pRes;                               //NULL if unused
+	uint32_t KeyHash;
+	CoAP_option_t* pKey;                            //Uri-Path, Uri-Query and Accept options of the request
+	uint32_t ETag;
+	uint32_t LastUse;
+	uint32_t Size;
+	CoAP_PayloadBuf_t* pBuf;                        //shared with the blocks being sent
+	uint8_t* pData;                                 //within pBuf
+	bool Complete;                                  //handler returned successfully, Content-Format is known
+	bool HasCf;
+	uint16_t Cf;                                    //Content-Format of the response the snapshot was taken from
+} CoAP_Block2CacheEntry_t;
+
+void CoAP_Block2CacheStore(CoAP_Message_t* pReq, const uint8_t* pData, uint32_t size, uint32_t etag);
+void CoAP_Block2CacheComplete(CoAP_Interaction_t* pIA);
+bool CoAP_ServeBlock2FromCache(CoAP_Interaction_t* pIA);
+void CoAP_Block2CacheInvalidate(CoAP_Res_t* pRes);
+
+#endif /* COAP_BLOCK2CACHE_H_ */
@@ -0,0 +1,188 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#include "coap.h"
+
+static bool ETagEquals(CoAP_option_t* pA, CoAP_option_t* pB) {
+	return pA->Length == pB->Length && coap_memcmp(pA->Value, pB->Value, pA->Length) == 0;
+}
+
+// True if the request carries If-Match options and none of them matches pETag (NULL = no entity-tag known)
+bool _rom CoAP_IfMatchFails(CoAP_Message_t* pReq, CoAP_option_t* pETag) {
+	CoAP_option_t* pOpt;
+	bool hasIfMatch = false;
+
+	for (pOpt = pReq->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+		if (pOpt->Number != OPT_NUM_IF_MATCH) {
+			continue;
+		}
+		if (pOpt->Length == 0 || (pETag != NULL && ETagEquals(pOpt, pETag))) { //empty value matches any representation
+			return false;
+		}
+		hasIfMatch = true;
+	}
+	return hasIfMatch;
+}
+
+// Entity-tag of the current representation of the resource, from its ETag getter or the latest GET response.
+// pETag->Length is 0 if it is unknown, returns false if the resource has no representation.
+static bool _rom CurrentRepresentation(CoAP_Res_t* pRes, CoAP_option_t* pETag) {
+	uint8_t len = 0;
+	CoAP_Result_t res;
+
+	pETag->Length = 0;
+	if (pRes->ETagGetter == NULL) {
+		coap_memcpy(pETag->Value, pRes->LastETag, pRes->LastETagLength);
+		pETag->Length = pRes->LastETagLength;
+		return true;
+	}
+
+	res = pRes->ETagGetter(pRes, pETag->Value, &len);
+	if (res == COAP_NOT_FOUND) {
+		return false;
+	}
+	if (res == COAP_OK && len <= 8) {
+		pETag->Length = len;
+	}
+	return true;
+}
+
+static void _rom RespondPreconditionFailed(CoAP_Message_t* pResp) {
+	INFO("- Precondition failed\r\n");
+	CoAP_FreeOptionList(&(pResp->pOptionsList));
+	pResp->PayloadLength = 0;
+	pResp->Code = RESP_PRECONDITION_FAILED_4_12;
+}
+
+// Evaluates If-Match and If-None-Match (RFC7252, 5.10.8) of a request changing the resource against its current
+// representation, returns true if the request has been answered with 4.12 and the resource handler must not be called.
+// GET and FETCH are evaluated against their response instead, see CoAP_CheckResponsePrecondition(...)
+bool _rom CoAP_RejectOnPrecondition(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pReq = pIA->pReqMsg;
+	CoAP_option_t* pIfNoneMatch = CoAP_FindOptionByNumber(pReq, OPT_NUM_IF_NONE_MATCH);
+	CoAP_option_t* pIfMatch = CoAP_FindOptionByNumber(pReq, OPT_NUM_IF_MATCH);
+	CoAP_option_t etag;
+	uint8_t etagVal[8];
+	CoAP_blockwise_option_t B1opt;
+	bool exists;
+
+	if (pIA->PreconditionsChecked || (pIfNoneMatch == NULL && pIfMatch == NULL)
+			|| pReq->Code == REQ_GET || pReq->Code == REQ_FETCH) {
+		return false;
+	}
+	pIA->PreconditionsChecked = true; //not again if the handler postpones the response
+	if (GetBlock1OptionFromMsg(pReq, &B1opt) == COAP_OK && B1opt.BlockNum > 0) {
+		return false; //checked with the first block of an upload
+	}
+
+	etag.Number = OPT_NUM_ETAG;
+	etag.Value = etagVal;
+	exists = CurrentRepresentation(pIA->pRes, &etag);
+	if ((pIfNoneMatch != NULL && exists)
+			|| (pIfMatch != NULL && (!exists || CoAP_IfMatchFails(pReq, etag.Length > 0 ? &etag : NULL)))) {
+		RespondPreconditionFailed(pIA->pRespMsg);
+		return true;
+	}
+	return false;
+}
+
+// Evaluates If-Match and If-None-Match of a GET or FETCH against the entity-tag of its 2.05 response,
+// which is replaced by 4.12 if they fail
+void _rom CoAP_CheckResponsePrecondition(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pReq = pIA->pReqMsg;
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+
+	if ((pReq->Code != REQ_GET && pReq->Code != REQ_FETCH) || pResp->Code != RESP_SUCCESS_CONTENT_2_05) {
+		return;
+	}
+	if (CoAP_FindOptionByNumber(pReq, OPT_NUM_IF_NONE_MATCH) != NULL
+			|| CoAP_IfMatchFails(pReq, CoAP_FindOptionByNumber(pResp, OPT_NUM_ETAG))) {
+		RespondPreconditionFailed(pResp);
+	}
+}
+
+// Keeps the entity-tag of a 2.05 response to a GET without Uri-Query as the one of the current representation
+void _rom CoAP_RememberETag(CoAP_Interaction_t* pIA) {
+	CoAP_option_t* pETag = CoAP_FindOptionByNumber(pIA->pRespMsg, OPT_NUM_ETAG);
+
+	if (pIA->pReqMsg->Code != REQ_GET || pIA->pRespMsg->Code != RESP_SUCCESS_CONTENT_2_05
+			|| CoAP_FindOptionByNumber(pIA->pReqMsg, OPT_NUM_URI_QUERY) != NULL || pETag == NULL || pETag->Length > 8) {
+		return;
+	}
+	coap_memcpy(pIA->pRes->LastETag, pETag->Value, pETag->Length);
+	pIA->pRes->LastETagLength = (uint8_t) pETag->Length;
+}
+
+// The representation of the resource has changed, its entity-tag is unknown until the next GET
+void _rom CoAP_ForgetETag(CoAP_Res_t* pRes) {
+	pRes->LastETagLength = 0;
+}
+
+// Tags a 2.05 response of a resource with RES_FLAG_AUTO_ETAG with the hash of its payload unless the handler set an ETag.
+// Blocks of a blockwise transfer are not tagged, their payload is only a part of the representation.
+void _rom CoAP_AddAutoETag(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+
+	if (!(pIA->pRes->Options.Flags & RES_FLAG_AUTO_ETAG) || pResp->Code != RESP_SUCCESS_CONTENT_2_05
+			|| CoAP_FindOptionByNumber(pResp, OPT_NUM_ETAG) != NULL || CoAP_FindOptionByNumber(pResp, OPT_NUM_BLOCK2) != NULL) {
+		return;
+	}
+	AddETagOptionToMsg(pResp, pResp->Payload, pResp->PayloadLength);
+}
+
+// Turns a 2.05 response into 2.03 Valid if the GET request carries its entity-tag (RFC7252, 5.10.6.2),
+// the payload is dropped, only ETag, Max-Age and Observe are kept
+void _rom CoAP_RespondValidIfETagMatches(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pReq = pIA->pReqMsg;
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+	CoAP_option_t* pRespETag;
+	CoAP_option_t* pOpt;
+
+	if ((pReq->Code != REQ_GET && pReq->Code != REQ_FETCH) || pResp->Code != RESP_SUCCESS_CONTENT_2_05
+			|| CoAP_FindOptionByNumber(pResp, OPT_NUM_BLOCK2) != NULL) {
+		return;
+	}
+	pRespETag = CoAP_FindOptionByNumber(pResp, OPT_NUM_ETAG);
+	if (pRespETag == NULL) {
+		return;
+	}
+
+	for (pOpt = pReq->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+		if (pOpt->Number == OPT_NUM_ETAG && ETagEquals(pOpt, pRespETag)) {
+			break;
+		}
+	}
+	if (pOpt == NULL) {
+		return;
+	}
+
+	pOpt = pResp->pOptionsList;
+	while (pOpt != NULL) {
+		CoAP_option_t* pNext = pOpt->next;
+		if (pOpt->Number != OPT_NUM_ETAG && pOpt->Number != OPT_NUM_MAX_AGE && pOpt->Number != OPT_NUM_OBSERVE) {
+			CoAP_RemoveOptionFromList(&(pResp->pOptionsList), pOpt);
+		}
+		pOpt = pNext;
+	}
+	pResp->PayloadLength = 0;
+	pResp->Code = RESP_SUCCESS_VALID_2_03;
+	INFO("- Representation still valid, 2.03 without payload\r\n");
+}
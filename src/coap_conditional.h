@@ -0,0 +1,34 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef COAP_CONDITIONAL_H_
+#define COAP_CONDITIONAL_H_
+
+// Conditional requests and revalidation by entity-tags (RFC7252, 5.10.6 and 5.10.8)
+bool CoAP_RejectOnPrecondition(CoAP_Interaction_t* pIA);
+bool CoAP_IfMatchFails(CoAP_Message_t* pReq, CoAP_option_t* pETag);
+void CoAP_CheckResponsePrecondition(CoAP_Interaction_t* pIA);
+void CoAP_RememberETag(CoAP_Interaction_t* pIA);
+void CoAP_ForgetETag(CoAP_Res_t* pRes);
+void CoAP_AddAutoETag(CoAP_Interaction_t* pIA);
+void CoAP_RespondValidIfETagMatches(CoAP_Interaction_t* pIA);
+
+#endif /* COAP_CONDITIONAL_H_ */
@@ -25,6 +25,7 @@
 #include "coap_mem.h"
 
 CoAP_Result_t CoAP_HandleObservationInReq(CoAP_Interaction_t* pIA);
+static void CancelWaiting(CoAP_ReqHandle_t handle);
 
 static CoAP_Interaction_t* _rom CoAP_AllocNewInteraction() {
 	CoAP_Interaction_t* newInteraction = (CoAP_Interaction_t*) (CoAP_malloc0(sizeof(CoAP_Interaction_t)));
@@ -42,8 +43,19 @@ static CoAP_Interaction_t* _rom CoAP_AllocNewInteraction() {
 CoAP_Result_t _rom CoAP_FreeInteraction(CoAP_Interaction_t** pInteraction) {
 	DEBUG("Releasing Interaction...\r\n");
 	// coap_mem_stats();
+	CoAP_EndOutstandingRequest(*pInteraction);
 	CoAP_free_Message(&(*pInteraction)->pReqMsg);
+	if ((*pInteraction)->pSharedNotif != NULL) {
+		(*pInteraction)->pRespMsg->pOptionsList = NULL; //owned by the shared notification
+		CoAP_ReleaseSharedNotification(&((*pInteraction)->pSharedNotif));
+	}
 	CoAP_free_Message(&(*pInteraction)->pRespMsg);
+	if ((*pInteraction)->pObserver != NULL && (*pInteraction)->pObserver->pPendingIA == *pInteraction) {
+		(*pInteraction)->pObserver->pPendingIA = NULL;
+	}
+	if ((*pInteraction)->pBlkXfer != NULL && --((*pInteraction)->pBlkXfer->RefCnt) == 0) {
+		CoAP_free((void*) (*pInteraction)->pBlkXfer);
+	}
 	CoAP_free((void*) (*pInteraction));
 	// coap_mem_stats();
 	*pInteraction = NULL;
@@ -236,30 +248,402 @@ CoAP_Result_t _rom CoAP_EnqueueLastInteraction(CoAP_Interaction_t* pInteractionT
 	return CoAP_MoveInteractionToListEnd(&(CoAP.pInteractions), pInteractionToEnqueue);
 }
 
-//we act as a CoAP Client (sending requests) in this interaction
-CoAP_Result_t _rom CoAP_StartNewClientInteraction(CoAP_Message_t* pMsgReq, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_RespHandler_fn_t cb) {
-	if (pMsgReq == NULL || CoAP_MsgIsRequest(pMsgReq) == false)
-		return COAP_ERR_ARGUMENT;
-
+static CoAP_Interaction_t* _rom CoAP_NewClientInteraction(CoAP_Message_t* pMsgReq, SocketHandle_t socketHandle, NetEp_t* ServerEp) {
 	CoAP_Interaction_t* newIA = CoAP_AllocNewInteraction();
 	if (newIA == NULL)
-		return COAP_ERR_OUT_OF_MEMORY;
+		return NULL;
 
 	//attach request message
 	newIA->pReqMsg = pMsgReq;
 
 	newIA->socketHandle = socketHandle;
 	CopyEndpoints(&(newIA->RemoteEp), ServerEp);
-	newIA->RespCB = cb;
 
 	newIA->Role = COAP_ROLE_CLIENT;
 	newIA->State = COAP_STATE_READY_TO_REQUEST;
+	return newIA;
+}
+
+//we act as a CoAP Client (sending requests) in this interaction
+CoAP_Result_t _rom CoAP_StartNewClientInteraction(CoAP_Message_t* pMsgReq, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_RespHandler_fn_t cb) {
+	if (pMsgReq == NULL || CoAP_MsgIsRequest(pMsgReq) == false)
+		return COAP_ERR_ARGUMENT;
+
+	CoAP_Interaction_t* newIA = CoAP_NewClientInteraction(pMsgReq, socketHandle, ServerEp);
+	if (newIA == NULL)
+		return COAP_ERR_OUT_OF_MEMORY;
+
+	newIA->RespCB = cb;
+
+	CoAP_AppendInteractionToList(&(CoAP.pInteractions), newIA);
+
+	return COAP_OK;
+}
+
+static CoAP_ReqHandle_t _rom CoAP_NextReqHandle() {
+	static CoAP_ReqHandle_t lastHandle = COAP_INVALID_REQ_HANDLE;
+	lastHandle++;
+	if (lastHandle == COAP_INVALID_REQ_HANDLE) { //wrap around
+		lastHandle++;
+	}
+	return lastHandle;
+}
+
+CoAP_Result_t _rom CoAP_StartRequest(const CoAP_ReqParams_t* pParams, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_ReqHandle_t* pHandle) {
+	if (pHandle != NULL) {
+		*pHandle = COAP_INVALID_REQ_HANDLE;
+	}
+	if (pParams == NULL || ServerEp == NULL || pParams->Code == EMPTY || pParams->Code > REQ_LAST) {
+		ERROR("- Invalid request parameters\r\n");
+		return COAP_ERR_ARGUMENT;
+	}
+	if (pParams->Type != CON && pParams->Type != NON) {
+		ERROR("- Requests must be CON or NON\r\n");
+		return COAP_ERR_ARGUMENT;
+	}
+	if (pParams->Observe && pParams->Code != REQ_GET && pParams->Code != REQ_FETCH) {
+		ERROR("- Only GET and FETCH requests can be observed\r\n");
+		return COAP_ERR_ARGUMENT;
+	}
+	bool blockwise = (pParams->Sink != NULL || pParams->pRespBuf != NULL);
+	if (blockwise && pParams->Observe) {
+		ERROR("- Blockwise download of notifications not supported\r\n");
+		return COAP_ERR_ARGUMENT;
+	}
+
+	CoAP_Message_t* pReqMsg = CoAP_CreateTxMessage(pParams->Type, pParams->Code, CoAP_GetNextMid(), pParams->pPayload, pParams->PayloadLength, pParams->PayloadLength, CoAP_GenerateToken());
+	if (pReqMsg == NULL) {
+		INFO("- New Request failed: Out of Memory\r\n");
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+
+	if (pParams->UriString != NULL) {
+		CoAP_AppendUriOptionsFromString(&(pReqMsg->pOptionsList), pParams->UriString);
+	}
+	if (pParams->Observe) {
+		AddObserveOptionToMsg(pReqMsg, OBSERVE_OPT_REGISTER);
+	}
+	if (blockwise && pParams->BlockSize != 0) { // early negotiation (2.4 RFC7959)
+		CoAP_blockwise_option_t B2opt = { .Type = BLOCK_2, .BlockSize = pParams->BlockSize, .MoreFlag = false, .BlockNum = 0 };
+		AddBlkOptionToMsg(pReqMsg, &B2opt);
+	}
+	if (blockwise && pParams->BlockWindow > 1) { // ask for the total size, needed to request blocks ahead
+		CoAP_AppendUintOptionToList(&(pReqMsg->pOptionsList), OPT_NUM_SIZE2, 0);
+	}
+
+	CoAP_Interaction_t* newIA = CoAP_NewClientInteraction(pReqMsg, socketHandle, ServerEp);
+	if (newIA == NULL) {
+		INFO("- New Request failed: Out of Memory\r\n");
+		CoAP_free_Message(&pReqMsg);
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+
+	if (blockwise) {
+		newIA->pBlkXfer = (CoAP_BlockTransfer_t*) CoAP_malloc0(sizeof(CoAP_BlockTransfer_t));
+		if (newIA->pBlkXfer == NULL) {
+			INFO("- New Request failed: Out of Memory\r\n");
+			CoAP_FreeInteraction(&newIA);
+			return COAP_ERR_OUT_OF_MEMORY;
+		}
+		newIA->pBlkXfer->RefCnt = 1;
+		newIA->pBlkXfer->Window = pParams->BlockWindow > 1 ? pParams->BlockWindow : 1;
+		newIA->pBlkXfer->LastBlock = COAP_BLOCK_NUM_UNKNOWN;
+		newIA->pBlkXfer->Sink = pParams->Sink;
+		newIA->pBlkXfer->pBuf = pParams->pRespBuf;
+		newIA->pBlkXfer->BufSize = pParams->RespBufSize;
+		newIA->pBlkXfer->pLength = pParams->pRespLength;
+		if (pParams->pRespLength != NULL) {
+			*(pParams->pRespLength) = 0;
+		}
+	}
+
+	newIA->ReqHandle = CoAP_NextReqHandle();
+	newIA->Paced = true;
+	newIA->ReqDoneCB = pParams->cb;
+	newIA->pUserData = pParams->pUserData;
+	newIA->Observe = pParams->Observe;
+	if (pParams->Timeout != 0) {
+		newIA->HasDeadline = true;
+		newIA->Deadline = CoAP.api.rtc1HzCnt() + pParams->Timeout;
+	}
+
+	CoAP_AppendInteractionToList(&(CoAP.pInteractions), newIA);
+
+	if (pHandle != NULL) {
+		*pHandle = newIA->ReqHandle;
+	}
+	return COAP_OK;
+}
+
+// The interaction is only marked here since we might be called from within its own callback,
+// the actual delete happens on the next CoAP_doWork() processing it.
+CoAP_Result_t _rom CoAP_CancelRequest(CoAP_ReqHandle_t handle) {
+	CoAP_Interaction_t* pIA;
+	if (handle == COAP_INVALID_REQ_HANDLE) {
+		return COAP_ERR_ARGUMENT;
+	}
+
+	CoAP_Result_t res = COAP_NOT_FOUND;
+	CancelWaiting(handle); //back to the interaction list, so they are deleted like the others
+	for (pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+		if (pIA->Role == COAP_ROLE_CLIENT && pIA->ReqHandle == handle && !pIA->Canceled) {
+			INFO("- Request canceled by application\r\n");
+			pIA->Canceled = true;
+			pIA->SleepUntil = 0; // wakeup for removal
+			CoAP_EndOutstandingRequest(pIA);
+			res = COAP_OK;
+		}
+	}
+	return res;
+}
+
+// Requests the next block of a Block2 download, the new interaction inherits everything
+// but message id and token from pIA
+CoAP_Result_t _rom CoAP_StartBlockRequest(CoAP_Interaction_t* pIA, uint32_t blockNum) {
+	CoAP_Message_t* pOrigReq = pIA->pReqMsg;
+	CoAP_option_t* pOpt;
+
+	CoAP_Message_t* pReqMsg = CoAP_CreateTxMessage(pOrigReq->Type, pOrigReq->Code, CoAP_GetNextMid(), pOrigReq->Payload, pOrigReq->PayloadLength, pOrigReq->PayloadLength, CoAP_GenerateToken());
+	if (pReqMsg == NULL) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	for (pOpt = pOrigReq->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+		if (pOpt->Number != OPT_NUM_BLOCK2 && pOpt->Number != OPT_NUM_SIZE2) {
+			CoAP_CopyOptionToList(&(pReqMsg->pOptionsList), pOpt);
+		}
+	}
+	CoAP_blockwise_option_t B2opt = { .Type = BLOCK_2, .BlockSize = pIA->pBlkXfer->BlockSize, .MoreFlag = false, .BlockNum = blockNum };
+	AddBlkOptionToMsg(pReqMsg, &B2opt);
+
+	CoAP_Interaction_t* newIA = CoAP_NewClientInteraction(pReqMsg, pIA->socketHandle, &(pIA->RemoteEp));
+	if (newIA == NULL) {
+		CoAP_free_Message(&pReqMsg);
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	newIA->RespCB = pIA->RespCB;
+	newIA->ReqHandle = pIA->ReqHandle;
+	newIA->ReqDoneCB = pIA->ReqDoneCB;
+	newIA->pUserData = pIA->pUserData;
+	newIA->Paced = pIA->Paced;
+	newIA->HasDeadline = pIA->HasDeadline;
+	newIA->Deadline = pIA->Deadline;
+	newIA->pBlkXfer = pIA->pBlkXfer;
+	newIA->pBlkXfer->RefCnt++;
+	newIA->BlockNum = blockNum;
 
 	CoAP_AppendInteractionToList(&(CoAP.pInteractions), newIA);
+	return COAP_OK;
+}
+
+// Client requests outstanding per endpoint (4.7 RFC7252), only endpoints with outstanding or waiting requests have an entry
+typedef struct CoAP_InFlight {
+	struct CoAP_InFlight* next;
+	SocketHandle_t socketHandle;
+	NetEp_t Ep;
+	uint32_t Cnt;
+	CoAP_Interaction_t* pWaiting;                   //paced requests waiting for a free slot, oldest first
+	CoAP_Interaction_t* pWaitingLast;
+} CoAP_InFlight_t;
+
+static CoAP_InFlight_t* InFlightIndex[INFLIGHT_INDEX_SIZE];
+static uint32_t WaitingCnt = 0;
+static uint32_t LastWaitingExpiry = 0;
+
+static CoAP_InFlight_t** _rom FindInFlight(SocketHandle_t socketHandle, const NetEp_t* pEp) {
+	uint32_t hash = 2166136261u;
+	uint8_t addrLen = NetAddr_MAX_LENGTH;
+	uint8_t i;
+	CoAP_InFlight_t** ppEntry;
+
+	if (pEp->NetType == IPV4) {
+		addrLen = 4;
+	}
+	for (i = 0; i < addrLen; i++) {
+		hash = (hash ^ pEp->NetAddr.mem[i]) * 16777619u;
+	}
+	hash = (hash ^ pEp->NetPort) * 16777619u;
+	hash = (hash ^ (uint32_t) (uintptr_t) socketHandle) * 16777619u;
+
+	for (ppEntry = &InFlightIndex[hash % INFLIGHT_INDEX_SIZE]; *ppEntry != NULL; ppEntry = &((*ppEntry)->next)) {
+		if ((*ppEntry)->socketHandle == socketHandle && EpAreEqual(pEp, &((*ppEntry)->Ep))) {
+			break;
+		}
+	}
+	return ppEntry;
+}
+
+// Puts the interaction in front of all others, so it is processed by the next CoAP_doWork()
+static void _rom PushInteraction(CoAP_Interaction_t* pIA) {
+	pIA->next = CoAP.pInteractions;
+	CoAP.pInteractions = pIA;
+}
+
+static CoAP_Interaction_t* _rom PopWaiting(CoAP_InFlight_t* pEntry) {
+	CoAP_Interaction_t* pIA = pEntry->pWaiting;
+	pEntry->pWaiting = pIA->next;
+	if (pEntry->pWaiting == NULL) {
+		pEntry->pWaitingLast = NULL;
+	}
+	WaitingCnt--;
+	return pIA;
+}
 
+// Hands the oldest waiting request of the endpoint back to CoAP_doWork() if a slot is free,
+// the entry is released once nothing is outstanding or waiting anymore
+static void _rom ReleaseWaiting(CoAP_InFlight_t** ppEntry) {
+	CoAP_InFlight_t* pEntry = *ppEntry;
+	if (pEntry == NULL) {
+		return;
+	}
+	if (pEntry->pWaiting != NULL && pEntry->Cnt < NSTART) {
+		PushInteraction(PopWaiting(pEntry));
+	}
+	if (pEntry->Cnt == 0 && pEntry->pWaiting == NULL) {
+		*ppEntry = pEntry->next;
+		CoAP_free((void*) pEntry);
+	}
+}
+
+// Counts client requests which have been sent to the endpoint and are still waiting for their response
+uint32_t _rom CoAP_CountOutstandingRequests(SocketHandle_t socketHandle, NetEp_t* ServerEp) {
+	CoAP_InFlight_t* pEntry = *FindInFlight(socketHandle, ServerEp);
+	return pEntry != NULL ? pEntry->Cnt : 0;
+}
+
+// Called when the request of the client interaction is sent
+CoAP_Result_t _rom CoAP_AddOutstandingRequest(CoAP_Interaction_t* pIA) {
+	if (pIA->InFlight) {
+		return COAP_OK;
+	}
+	CoAP_InFlight_t** ppEntry = FindInFlight(pIA->socketHandle, &(pIA->RemoteEp));
+	if (*ppEntry == NULL) {
+		*ppEntry = (CoAP_InFlight_t*) CoAP_malloc0(sizeof(CoAP_InFlight_t));
+		if (*ppEntry == NULL) {
+			return COAP_ERR_OUT_OF_MEMORY;
+		}
+		(*ppEntry)->socketHandle = pIA->socketHandle;
+		CopyEndpoints(&((*ppEntry)->Ep), &(pIA->RemoteEp));
+	}
+	(*ppEntry)->Cnt++;
+	pIA->InFlight = true;
 	return COAP_OK;
 }
 
+// Called when the request has been answered or acknowledged, or is given up.
+// The freed slot goes to the oldest request waiting for the endpoint, a paced request ending before it got
+// its slot (canceled, deadline reached) passes its turn on.
+void _rom CoAP_EndOutstandingRequest(CoAP_Interaction_t* pIA) {
+	if (!pIA->InFlight && !(pIA->Paced && pIA->State == COAP_STATE_READY_TO_REQUEST)) {
+		return;
+	}
+	CoAP_InFlight_t** ppEntry = FindInFlight(pIA->socketHandle, &(pIA->RemoteEp));
+	if (pIA->InFlight && *ppEntry != NULL) {
+		(*ppEntry)->Cnt--;
+	}
+	pIA->InFlight = false;
+	ReleaseWaiting(ppEntry);
+}
+
+// Moves the paced request at the head of the interaction list to the wait queue of its endpoint (all NSTART slots taken),
+// so waiting requests cost nothing in CoAP_doWork() until CoAP_EndOutstandingRequest(...) releases them one by one
+void _rom CoAP_WaitForFreeSlot(CoAP_Interaction_t* pIA) {
+	CoAP_InFlight_t* pEntry = *FindInFlight(pIA->socketHandle, &(pIA->RemoteEp));
+	if (pEntry == NULL || CoAP.pInteractions != pIA) {
+		CoAP_EnqueueLastInteraction(pIA); //not expected, slots are taken
+		return;
+	}
+	CoAP.pInteractions = pIA->next;
+	pIA->next = NULL;
+	if (pEntry->pWaitingLast != NULL) {
+		pEntry->pWaitingLast->next = pIA;
+	} else {
+		pEntry->pWaiting = pIA;
+	}
+	pEntry->pWaitingLast = pIA;
+	WaitingCnt++;
+}
+
+// Hands waiting requests matching the filter back to CoAP_doWork(), which ends them
+static void _rom ReleaseWaitingIf(bool (*pMatches)(CoAP_Interaction_t* pIA, void* pCtx), void* pCtx) {
+	uint32_t i;
+	for (i = 0; i < INFLIGHT_INDEX_SIZE && WaitingCnt != 0; i++) {
+		CoAP_InFlight_t** ppEntry = &InFlightIndex[i];
+		while (*ppEntry != NULL) {
+			CoAP_InFlight_t* pEntry = *ppEntry;
+			CoAP_Interaction_t** ppIA = &(pEntry->pWaiting);
+			CoAP_Interaction_t* pLast = NULL;
+			while (*ppIA != NULL) {
+				CoAP_Interaction_t* pIA = *ppIA;
+				if (!pMatches(pIA, pCtx)) {
+					pLast = pIA;
+					ppIA = &(pIA->next);
+					continue;
+				}
+				*ppIA = pIA->next;
+				WaitingCnt--;
+				PushInteraction(pIA);
+			}
+			pEntry->pWaitingLast = pLast;
+			if (pEntry->Cnt == 0 && pEntry->pWaiting == NULL) {
+				*ppEntry = pEntry->next;
+				CoAP_free((void*) pEntry);
+			} else {
+				ppEntry = &(pEntry->next);
+			}
+		}
+	}
+}
+
+static bool _rom HasHandle(CoAP_Interaction_t* pIA, void* pCtx) {
+	return pIA->ReqHandle == *((CoAP_ReqHandle_t*) pCtx);
+}
+
+static bool _rom DeadlineReached(CoAP_Interaction_t* pIA, void* pCtx) {
+	return pIA->HasDeadline && timeAfter(*((uint32_t*) pCtx), pIA->Deadline);
+}
+
+// Canceled waiting requests are deleted by CoAP_doWork() like all others
+static void _rom CancelWaiting(CoAP_ReqHandle_t handle) {
+	ReleaseWaitingIf(HasHandle, &handle);
+}
+
+// Waiting requests whose deadline has been reached are ended by CoAP_doWork(), checked once per second
+void _rom CoAP_ExpireWaitingRequests() {
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	if (WaitingCnt == 0 || now == LastWaitingExpiry) {
+		return;
+	}
+	LastWaitingExpiry = now;
+	ReleaseWaitingIf(DeadlineReached, &now);
+}
+
+// Drops all waiting requests (CoAP_ClearPendingInteractions())
+void _rom CoAP_ClearWaitingRequests() {
+	uint32_t i;
+	for (i = 0; i < INFLIGHT_INDEX_SIZE; i++) {
+		CoAP_InFlight_t** ppEntry = &InFlightIndex[i];
+		while (*ppEntry != NULL) {
+			CoAP_InFlight_t* pEntry = *ppEntry;
+			CoAP_Interaction_t* pWaiting = pEntry->pWaiting;
+			pEntry->pWaiting = NULL;
+			pEntry->pWaitingLast = NULL;
+			while (pWaiting != NULL) {
+				CoAP_Interaction_t* pNext = pWaiting->next;
+				pWaiting->Paced = false; //nothing to pass on
+				CoAP_FreeInteraction(&pWaiting);
+				pWaiting = pNext;
+			}
+			if (pEntry->Cnt == 0) {
+				*ppEntry = pEntry->next;
+				CoAP_free((void*) pEntry);
+			} else {
+				ppEntry = &(pEntry->next);
+			}
+		}
+	}
+	WaitingCnt = 0;
+}
+
 CoAP_Result_t _rom CoAP_StartNewGetRequest(char* UriString, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_RespHandler_fn_t cb) {
 
 	CoAP_Message_t* pReqMsg = CoAP_CreateMessage(CON, REQ_GET, CoAP_GetNextMid(), NULL, 0, 0, CoAP_GenerateToken());
@@ -280,7 +664,7 @@ CoAP_Result_t _rom CoAP_StartNewRequest(CoAP_MessageCode_t type, const char* Uri
 		return COAP_ERR_ARGUMENT;
 	}
 
-	CoAP_Message_t* pReqMsg = CoAP_CreateMessage(CON, type, CoAP_GetNextMid(), buf, size, size, CoAP_GenerateToken());
+	CoAP_Message_t* pReqMsg = CoAP_CreateTxMessage(CON, type, CoAP_GetNextMid(), buf, size, size, CoAP_GenerateToken());
 
 	if (pReqMsg != NULL) {
 		CoAP_AppendUriOptionsFromString(&(pReqMsg->pOptionsList), UriString);
@@ -292,109 +676,295 @@ CoAP_Result_t _rom CoAP_StartNewRequest(CoAP_MessageCode_t type, const char* Uri
 	return COAP_ERR_OUT_OF_MEMORY;
 }
 
+void _rom CoAP_ReleaseSharedNotification(CoAP_SharedNotification_t** ppShared) {
+	if (*ppShared == NULL) {
+		return;
+	}
+	if (--((*ppShared)->RefCnt) == 0) {
+		CoAP_free_Message(&((*ppShared)->pMsg));
+		CoAP_free((void*) (*ppShared));
+	}
+	*ppShared = NULL;
+}
+
+// Calls the notifier of a resource with RES_FLAG_SHARED_NOTIFICATION once for the current update
+static CoAP_SharedNotification_t* _rom CreateSharedNotification(CoAP_Res_t* pRes) {
+	CoAP_Token_t noToken = { .Length = 0 };
+	CoAP_SharedNotification_t* pShared = (CoAP_SharedNotification_t*) CoAP_malloc0(sizeof(CoAP_SharedNotification_t));
+	if (pShared == NULL) {
+		return NULL;
+	}
+
+	pShared->RefCnt = 1;
+	pShared->pMsg = CoAP_CreateTxMessage(CON, RESP_SUCCESS_CONTENT_2_05, 0, NULL, 0, CoAP_ResponseSizeHint(pRes), noToken);
+	if (pShared->pMsg == NULL || pRes->Notifier(NULL, pShared->pMsg) != HANDLER_OK) {
+		CoAP_ReleaseSharedNotification(&pShared);
+		return NULL;
+	}
+	CoAP_LearnResponseSize(pRes, pShared->pMsg->PayloadLength);
+	if (pShared->pMsg->Code < RESP_ERROR_BAD_REQUEST_4_00) {
+		AddObserveOptionToMsg(pShared->pMsg, pRes->UpdateCnt); // Only 2.xx responses do include an Observe Option.
+	}
+	return pShared;
+}
+
+// Lets the response message of a notification interaction refer to a shared notification
+static void _rom AttachSharedNotification(CoAP_Interaction_t* pIA, CoAP_SharedNotification_t* pShared) {
+	CoAP_Message_t* pMsg = pIA->pRespMsg;
+
+	CoAP_ReleaseSharedNotification(&(pIA->pSharedNotif));
+	pShared->RefCnt++;
+	pIA->pSharedNotif = pShared;
+
+	pMsg->Code = pShared->pMsg->Code;
+	pMsg->pOptionsList = pShared->pMsg->pOptionsList;
+	if (pShared->pMsg->PayloadMode == PAYLOAD_OWNED && pShared->pMsg->pPayloadBuf != NULL) {
+		CoAP_SetSharedPayload(pMsg, pShared->pMsg->pPayloadBuf, pShared->pMsg->Payload, pShared->pMsg->PayloadLength);
+	} else { //kept alive by the reference to the shared notification
+		CoAP_SetForeignPayload(pMsg, pShared->pMsg->PayloadMode == PAYLOAD_STATIC ? PAYLOAD_STATIC : PAYLOAD_BORROWED,
+				pShared->pMsg->Payload, pShared->pMsg->PayloadLength);
+	}
+}
+
+// Renews the representation in a pending notification (RFC7641 "4.5.2.  Advanced Transmission")
+void _rom CoAP_RefreshNotification(CoAP_Interaction_t* pIA) {
+	CoAP_Res_t* pRes = pIA->pRes;
+
+	if (pIA->pSharedNotif != NULL) {
+		if (pRes->pNotification != NULL) {
+			AttachSharedNotification(pIA, pRes->pNotification);
+			if (pRes->pNotification->pMsg->Code < RESP_ERROR_BAD_REQUEST_4_00) {
+				return;
+			}
+		}
+		CoAP_RemoveInteractionsObserver(pIA, pIA->pRespMsg->Token); //notifier failed, the observation ends
+		return;
+	}
+
+	if (pRes->Notifier(pIA->pObserver, pIA->pRespMsg) == HANDLER_ERROR) {
+		RemoveObserveOptionFromMsg(pIA->pRespMsg);
+		CoAP_RemoveInteractionsObserver(pIA, pIA->pRespMsg->Token);
+	} else { //good response
+		UpdateObserveOptionInMsg(pIA->pRespMsg, pRes->UpdateCnt);
+	}
+}
+
 CoAP_Result_t _rom CoAP_StartNotifyInteractions(CoAP_Res_t* pRes) {
-	// TODO: find all notification interactions that match this resource
-	// CoAP.pInteractions->pRes == pRes && CoAP.pInteractions->Role == COAP_ROLE_NOTIFICATION
-	// and call the pRes->Notifier(...) to get a new response
-	// the new response is then send to the client and the interaction must wait for the ACK (or not for NON)
-	// While the interaction is waiting for an ACK or doing retries the pending response might change but NOT the messageId
-	// ------------
-
-	CoAP_Observer_t* pObserver = pRes->pListObservers;
-	CoAP_Interaction_t* newIA;
-	bool sameNotificationOngoing = false;
+	INFO("Notify observers for res at %p, description: %s\n", pRes, (pRes->pDescription == NULL)?"N/A":pRes->pDescription);
 
-	int cnt = 0;
-	while (pObserver != NULL) {
-		cnt++;
-		pObserver = pObserver->next;
+	if (pRes->Notifier == NULL) {
+		return COAP_OK;
 	}
-	INFO("Notify %d observers for res at %p, description: %s\n", cnt,pRes, (pRes->pDescription == NULL)?"N/A":pRes->pDescription);
 
+	if ((pRes->Options.Flags & RES_FLAG_SHARED_NOTIFICATION) && pRes->pListObservers != NULL) {
+		CoAP_ReleaseSharedNotification(&(pRes->pNotification));
+		pRes->pNotification = CreateSharedNotification(pRes);
+		if (pRes->pNotification == NULL) {
+			INFO("- Notifier failed, no notifications sent\r\n");
+			pRes->pNotifyCursor = NULL;
+			return COAP_ERR_OUT_OF_MEMORY;
+		}
+	}
 
+	// (Re)start the fan-out at the first observer, observers reached before
+	// by an unfinished fan-out get their pending notification updated
+	pRes->pNotifyCursor = pRes->pListObservers;
+	pRes->NotifyDueOnly = false;
+	return CoAP_ContinueNotifyInteractions(pRes, NOTIFY_FANOUT_BUDGET);
+}
 
-	//iterate over all observers of this resource and check if
-	//a) a new notification interaction has to be created
-	//or
-	//b) wait for currently pending notification to end
-	//or
-	//c) a currently pending older notification has be updated to the new resource representation
-	//   as stated in Observe RFC7641 ("4.5.2.  Advanced Transmission")
-	pObserver = pRes->pListObservers;
-	while (pObserver != NULL) {
+// Starts a notification of the current representation to one observer,
+// *ppNewIA is set to the new interaction that still has to be added to the interaction list
+static CoAP_Result_t _rom NotifyObserver(CoAP_Res_t* pRes, CoAP_Observer_t* pObserver, CoAP_Interaction_t** ppNewIA) {
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	CoAP_Interaction_t* newIA;
 
-		//search for pending notification of this resource to this observer and set update flag of representation
-		sameNotificationOngoing = false;
-		CoAP_Interaction_t* pIA;
-		for (pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
-			if (pIA->Role == COAP_ROLE_NOTIFICATION &&
-					pIA->pRes == pRes &&
-					pIA->socketHandle == pObserver->socketHandle &&
-					EpAreEqual(&(pIA->RemoteEp), &(pObserver->Ep))) {
-				sameNotificationOngoing = true;
+	*ppNewIA = NULL;
 
 #if USE_RFC7641_ADVANCED_TRANSMISSION == 1
-				pIA->UpdatePendingNotification = true; //will try to update the ongoing resource representation on ongoing transfer
-				pIA->SleepUntil = 0; // Wakeup interaction
+	// If there is already a running interaction for this notification
+	// it will be updated for next retry
+	// or just send another message with fresh data after it is finished
+	// Thus we do not need to create a new interaction
+	if (pObserver->pPendingIA != NULL) {
+		pObserver->pPendingIA->UpdatePendingNotification = true;
+		pObserver->pPendingIA->SleepUntil = 0; // Wakeup interaction
+		CoAP_ObserverNotified(pObserver, pRes, now);
+		return COAP_OK;
+	}
 #endif
 
-				break;
-			}
+	if ((pRes->Options.Flags & RES_FLAG_SHARED_NOTIFICATION) && pRes->pNotification == NULL) {
+		pRes->pNotification = CreateSharedNotification(pRes);
+		if (pRes->pNotification == NULL) {
+			return COAP_ERR_OUT_OF_MEMORY;
 		}
+	}
 
-#if USE_RFC7641_ADVANCED_TRANSMISSION == 1
-		// If there is already a running interaction for this notification
-		// it will be updated for next retry
-		// or just send another message with fresh data after it is finished
-		// Thus we do not need to create a new interaction
-		if (sameNotificationOngoing) {
-			pObserver = pObserver->next; //skip this observer, don't start a 2nd notification now
-			continue;
+	//Start new IA for this observer
+	newIA = CoAP_AllocNewInteraction();
+	if (newIA == NULL) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+
+	//Create fresh response message, it only needs an own payload buffer if the notifier is called per observer
+	if (pRes->pNotification != NULL) {
+		newIA->pRespMsg = CoAP_CreateMessage(pRes->pNotification->pMsg->Type, RESP_SUCCESS_CONTENT_2_05, CoAP_GetNextMid(), NULL, 0, 0, pObserver->Token);
+	} else {
+		newIA->pRespMsg = CoAP_CreateTxMessage(CON, RESP_SUCCESS_CONTENT_2_05, CoAP_GetNextMid(), NULL, 0, CoAP_ResponseSizeHint(pRes), pObserver->Token);
+	}
+	if (newIA->pRespMsg == NULL) {
+		CoAP_FreeInteraction(&newIA);
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+
+	if (pRes->pNotification != NULL) {
+		AttachSharedNotification(newIA, pRes->pNotification);
+	} else if (pRes->Notifier(pObserver, newIA->pRespMsg) != HANDLER_OK) { //<------ call notify handler of resource
+		CoAP_FreeInteraction(&newIA); //revert IA creation above
+		return COAP_OK;
+	}
+
+	newIA->Role = COAP_ROLE_NOTIFICATION;
+	newIA->State = COAP_STATE_READY_TO_NOTIFY;
+	newIA->RemoteEp = pObserver->Ep;
+	newIA->socketHandle = pObserver->socketHandle;
+	newIA->pRes = pRes;
+	newIA->ResGeneration = pRes->Generation;
+	CoAP_ObserverNotified(pObserver, pRes, now);
+
+	if (newIA->pRespMsg->Code >= RESP_ERROR_BAD_REQUEST_4_00) { //remove this observer from resource in case of non OK Code (see RFC7641, 3.2., 3rd paragraph)
+		CoAP_DetachObserver(pObserver, true); //error response is still sent
+	} else {
+		if (newIA->pSharedNotif == NULL) {
+			AddObserveOptionToMsg(newIA->pRespMsg, pRes->UpdateCnt); // Only 2.xx responses do include an Observe Option.
 		}
-#endif
+		newIA->pObserver = pObserver;
+		pObserver->pPendingIA = newIA;
+	}
 
-		//Start new IA for this observer
-		newIA = CoAP_AllocNewInteraction();
-		if (newIA == NULL) {
+	if (newIA->pRespMsg->Type == NON && pRes->UpdateCnt % 20 == 0) { //send every 20th message as CON even if notify handler defines the send out as NON to support "lazy" cancelation
+		newIA->pRespMsg->Type = CON;
+	}
+
+	*ppNewIA = newIA;
+	return COAP_OK;
+}
+
+// Starts a fan-out to the observers with held back updates or pmax keepalives due, beginning at pFirst.
+// The notifications get a new sequence number, the observers may have seen the current one already
+// and would drop it as stale (RFC7641, 3.4.). A shared notification is renewed once for that.
+CoAP_Result_t _rom CoAP_StartDueNotifyInteractions(CoAP_Res_t* pRes, CoAP_Observer_t* pFirst) {
+	pRes->UpdateCnt++;
+	if (pRes->Options.Flags & RES_FLAG_SHARED_NOTIFICATION) {
+		CoAP_ReleaseSharedNotification(&(pRes->pNotification));
+		pRes->pNotification = CreateSharedNotification(pRes);
+		if (pRes->pNotification == NULL) {
 			return COAP_ERR_OUT_OF_MEMORY;
 		}
+	}
 
-		//Create fresh response message
-		newIA->pRespMsg = CoAP_CreateMessage(CON, RESP_SUCCESS_CONTENT_2_05, CoAP_GetNextMid(), NULL, 0, PREFERED_PAYLOAD_SIZE, pObserver->Token);
-
-		//Call Notify Handler of resource and add to interaction list
-		if (newIA->pRespMsg != NULL && pRes->Notifier != NULL &&
-				pRes->Notifier(pObserver, newIA->pRespMsg) == HANDLER_OK) { //<------ call notify handler of resource
-
-			newIA->Role = COAP_ROLE_NOTIFICATION;
-			newIA->State = COAP_STATE_READY_TO_NOTIFY;
-			newIA->RemoteEp = pObserver->Ep;
-			newIA->socketHandle = pObserver->socketHandle;
-			newIA->pRes = pRes;
-			newIA->pObserver = pObserver;
-
-			if (newIA->pRespMsg->Code >= RESP_ERROR_BAD_REQUEST_4_00) { //remove this observer from resource in case of non OK Code (see RFC7641, 3.2., 3rd paragraph)
-				pObserver = pObserver->next; //next statement will free current observer so save its ancestor node right now
-				newIA->pObserver = NULL;
-				CoAP_RemoveObserverFromResource(&(newIA->pRes->pListObservers), newIA->socketHandle, &(pIA->RemoteEp), newIA->pRespMsg->Token);
-				continue;
-			} else {
-				AddObserveOptionToMsg(newIA->pRespMsg, pRes->UpdateCnt); // Only 2.xx responses do include an Observe Option.
-			}
+	pRes->pNotifyCursor = pFirst;
+	pRes->NotifyDueOnly = true;
+	return CoAP_ContinueNotifyInteractions(pRes, NOTIFY_FANOUT_BUDGET);
+}
 
-			if (newIA->pRespMsg->Type == NON && pRes->UpdateCnt % 20 == 0) { //send every 20th message as CON even if notify handler defines the send out as NON to support "lazy" cancelation
-				newIA->pRespMsg->Type = CON;
-			}
+// Creates the notification interactions for at most budget observers starting at pRes->pNotifyCursor.
+// For each observer that takes the update (see its conditional attributes)
+// a) a new notification interaction is created
+// or
+// b) a currently pending older notification is updated to the new resource representation
+//    as stated in Observe RFC7641 ("4.5.2.  Advanced Transmission")
+// If memory runs out the fan-out stops and is retried from CoAP_doWork().
+CoAP_Result_t _rom CoAP_ContinueNotifyInteractions(CoAP_Res_t* pRes, uint32_t budget) {
+	CoAP_Interaction_t* pNewList = NULL; //new interactions are appended all at once at the end
+	CoAP_Interaction_t* pNewLast = NULL;
+	CoAP_Result_t res = COAP_OK;
+	uint32_t now = CoAP.api.rtc1HzCnt();
+
+	while (pRes->pNotifyCursor != NULL && budget > 0) {
+		CoAP_Observer_t* pObserver = pRes->pNotifyCursor;
+		CoAP_Interaction_t* newIA;
+
+		if (pRes->NotifyDueOnly ? !(pObserver->AttrFlags != 0 && CoAP_ObserverNotificationDue(pObserver, now))
+				: !CoAP_ObserverTakesUpdate(pObserver, pRes, now)) {
+			pRes->pNotifyCursor = pObserver->next;
+			continue;
+		}
 
-			CoAP_AppendInteractionToList(&(CoAP.pInteractions), newIA);
+		res = NotifyObserver(pRes, pObserver, &newIA);
+		if (res != COAP_OK) {
+			break;
+		}
+		if (pRes->pNotifyCursor == pObserver) { //else observer has been removed and the cursor moved on
+			pRes->pNotifyCursor = pObserver->next;
+		}
+		budget--;
 
+		if (newIA == NULL) {
+			continue;
+		}
+		if (pNewList == NULL) {
+			pNewList = newIA;
 		} else {
-			CoAP_FreeInteraction(&newIA); //revert IA creation above
+			pNewLast->next = newIA;
 		}
+		pNewLast = newIA;
+	}
 
-		pObserver = pObserver->next;
+	if (pNewList != NULL) {
+		CoAP_Interaction_t** ppLast = &(CoAP.pInteractions);
+		while (*ppLast != NULL) {
+			ppLast = &((*ppLast)->next);
+		}
+		*ppLast = pNewList;
+	}
+
+	if (pRes->pNotifyCursor != NULL) {
+		CoAP.NotifyFanOutPending = true;
+	}
+	return res;
+}
+
+void _rom CoAP_ReleaseResourceInteractions(CoAP_Res_t* pRes, CoAP_MessageCode_t code) {
+	CoAP_Interaction_t* pIA = CoAP.pInteractions;
+
+	while (pIA != NULL) {
+		CoAP_Interaction_t* pNext = pIA->next;
+
+		//the generation tells an interaction of this resource from one of a removed resource at the same address
+		if (pIA->pRes == pRes && pIA->ResGeneration == pRes->Generation) {
+			if (pIA->Role == COAP_ROLE_NOTIFICATION) {
+				CoAP_DeleteInteraction(pIA); //superseded by the final notification below
+			} else {
+				pIA->pRes = NULL; //requests not answered yet get the error code, see handleServerInteraction(...)
+				if (pIA->pReqMsg != NULL) {
+					pIA->pReqMsg->pResource = NULL;
+				}
+			}
+		}
+		pIA = pNext;
+	}
+
+	//final notification without Observe option, see RFC7641, 3.2.
+	while (pRes->pListObservers != NULL) {
+		CoAP_Observer_t* pObserver = pRes->pListObservers;
+		CoAP_Interaction_t* newIA = CoAP_AllocNewInteraction();
+
+		if (newIA != NULL) {
+			newIA->pRespMsg = CoAP_CreateMessage(CON, code, CoAP_GetNextMid(), NULL, 0, 0, pObserver->Token);
+			if (newIA->pRespMsg == NULL) {
+				CoAP_FreeInteraction(&newIA);
+			} else {
+				newIA->Role = COAP_ROLE_NOTIFICATION;
+				newIA->State = COAP_STATE_READY_TO_NOTIFY;
+				newIA->RemoteEp = pObserver->Ep;
+				newIA->socketHandle = pObserver->socketHandle;
+				CoAP_AppendInteractionToList(&(CoAP.pInteractions), newIA);
+			}
+		}
+		CoAP_DetachObserver(pObserver, true);
 	}
-	return COAP_OK;
 }
 
 //we act as a CoAP Server (receiving requests) in this interaction
@@ -435,6 +1005,7 @@ CoAP_Result_t _rom CoAP_StartNewServerInteraction(CoAP_Message_t* pMsgReq, CoAP_
 
 	newIA->socketHandle = socketHandle;
 	newIA->pRes = pRes;
+	newIA->ResGeneration = pRes->Generation;
 	newIA->Role = COAP_ROLE_SERVER;
 	newIA->State = COAP_STATE_HANDLE_REQUEST;
 	newIA->ReqMetaInfo = pPacket->metaInfo;
@@ -446,87 +1017,94 @@ CoAP_Result_t _rom CoAP_StartNewServerInteraction(CoAP_Message_t* pMsgReq, CoAP_
 }
 
 CoAP_Result_t _rom CoAP_RemoveInteractionsObserver(CoAP_Interaction_t* pIA, CoAP_Token_t token) {
-	return CoAP_RemoveObserverFromResource(&((pIA->pRes)->pListObservers), pIA->socketHandle, &(pIA->RemoteEp), token);
+	if (pIA->pObserver != NULL && CoAP_TokenEqual(token, pIA->pObserver->Token)) { //notification of the observer, no lookup needed
+		CoAP_DetachObserver(pIA->pObserver, true);
+		return COAP_REMOVED;
+	}
+	if (pIA->pRes == NULL) {
+		return COAP_NOT_FOUND;
+	}
+	return CoAP_RemoveObserverFromResource(pIA->pRes, pIA->socketHandle, &(pIA->RemoteEp), token);
 }
 
 CoAP_Result_t _rom CoAP_HandleObservationInReq(CoAP_Interaction_t* pIA) {
-	if (pIA == NULL || pIA->pReqMsg == NULL) {
+	if (pIA == NULL || pIA->pReqMsg == NULL || pIA->pRes == NULL) {
 		return COAP_ERR_ARGUMENT;    //safety checks
 	}
 
 	CoAP_Result_t res;
 	uint32_t obsVal = 0;
 	CoAP_Observer_t* pObserver = NULL;
-	CoAP_Observer_t* pExistingObserver = (pIA->pRes)->pListObservers;
+	CoAP_option_t* pOptList = NULL;
 
-	if (pIA->pRes->Notifier == NULL) {
+	if (pIA->pRes->Notifier == NULL || pIA->pRes->IsPattern) {
 		return COAP_ERR_NOT_FOUND;            //resource does not support observe
 	}
 	if ((res = GetObserveOptionFromMsg(pIA->pReqMsg, &obsVal)) != COAP_OK) {
 		return res; //if no observe option in req function can't do anything
 	}
 
+	// Do NOT check the token. if socket and EP are the same, it's the same observer
+	// We do NOT allow to observe the same resource twice from the same observer
+	pObserver = CoAP_FindObserver(pIA->pRes, pIA->socketHandle, &(pIA->RemoteEp));
+
 	//Client registers
 	if (obsVal == OBSERVE_OPT_REGISTER) { // val == 0
 
-		//Alloc memory for new Observer
-		pObserver = CoAP_AllocNewObserver();
-		if (pObserver == NULL) {
-			return COAP_ERR_OUT_OF_MEMORY;
-		}
-
-		//Copy relevant information for observation from current interaction
-		pObserver->Ep = pIA->RemoteEp;
-		pObserver->socketHandle = pIA->socketHandle;
-		pObserver->Token = pIA->pReqMsg->Token;
-		pObserver->next = NULL;
-
 		//Copy relevant Options from Request (uri-query, observe)
 		//Note: uri-path is not relevant since observers are fixed to its resource
 		CoAP_option_t* pOption = pIA->pReqMsg->pOptionsList;
 		while (pOption != NULL) {
 			if (pOption->Number == OPT_NUM_URI_QUERY || pOption->Number == OPT_NUM_OBSERVE) {
 				//create copy from volatile Iinteraction msg options
-				if (CoAP_AppendOptionToList(&(pObserver->pOptList), pOption->Number, pOption->Value, pOption->Length) != COAP_OK) {
-					CoAP_FreeObserver(&pObserver);
+				if (CoAP_AppendOptionToList(&pOptList, pOption->Number, pOption->Value, pOption->Length) != COAP_OK) {
+					CoAP_FreeOptionList(&pOptList);
 					return COAP_ERR_OUT_OF_MEMORY;
 				}
 			}
 			pOption = pOption->next;
 		}
 
-		//delete eventually existing same observer
-		while (pExistingObserver != NULL) { //found right existing observation -> delete it
-			// Changed: Do NOT check the token. if socket and EP are the same, it's the same observer
-			// We do NOT allow to observe the same resource twice from the same observer
-			// CoAP_TokenEqual(pIA->pReqMsg->Token, pExistingObserver->Token) &&
-			if (pIA->socketHandle == pExistingObserver->socketHandle && EpAreEqual(&(pIA->RemoteEp), &(pExistingObserver->Ep))) {
-				CoAP_UnlinkObserverFromList(&((pIA->pRes)->pListObservers), pExistingObserver, true);
-				break;
-			}
-			pExistingObserver = pExistingObserver->next;
+		//existing observation is refreshed in place
+		if (pObserver != NULL) {
+			CoAP_FreeOptionList(&(pObserver->pOptList));
+			pObserver->pOptList = pOptList;
+			pObserver->Token = pIA->pReqMsg->Token;
+			pObserver->FailCount = 0;
+			CoAP_ParseObserveAttributes(pObserver);
+			CoAP_ObserverNotified(pObserver, pIA->pRes, CoAP.api.rtc1HzCnt()); //the response is the first notification
+			CoAP_LogObserverRegistered(pIA->pRes, pObserver, false);
+			return COAP_OK;
+		}
+
+		//Alloc memory for new Observer
+		pObserver = CoAP_AllocNewObserver();
+		if (pObserver == NULL) {
+			CoAP_FreeOptionList(&pOptList);
+			return COAP_ERR_OUT_OF_MEMORY;
 		}
 
-		//attach/update observer to resource
-		return CoAP_AppendObserverToList(&((pIA->pRes)->pListObservers), pObserver);
+		//Copy relevant information for observation from current interaction
+		pObserver->Ep = pIA->RemoteEp;
+		pObserver->socketHandle = pIA->socketHandle;
+		pObserver->Token = pIA->pReqMsg->Token;
+		pObserver->pOptList = pOptList;
+		CoAP_ParseObserveAttributes(pObserver);
+		CoAP_ObserverNotified(pObserver, pIA->pRes, CoAP.api.rtc1HzCnt()); //the response is the first notification
+
+		//attach observer to resource
+		return CoAP_AttachObserver(pIA->pRes, pObserver);
 
 		//Client cancels observation actively (this is an alternative to simply forget the req token and send rst on next notification)
 	} else if (obsVal == OBSERVE_OPT_DEREGISTER) { // val == 1
-		//find matching observer in resource observers-list
-		CoAP_RemoveInteractionsObserver(pIA, pIA->pReqMsg->Token); //remove observer identified by token, socketHandle and remote EP from resource
-
-		//delete/abort any pending notification interaction
-		CoAP_Interaction_t* pIApending;
-		for (pIApending = CoAP.pInteractions; pIApending != NULL; pIApending = pIApending->next) {
-			if (pIApending->Role == COAP_ROLE_NOTIFICATION) {
-				if (CoAP_TokenEqual(pIApending->pRespMsg->Token, pIA->pReqMsg->Token)
-						&& pIApending->socketHandle == pIA->socketHandle
-						&& EpAreEqual(&(pIApending->RemoteEp), &(pIA->RemoteEp))) {
-					INFO("Abort of pending notification interaction\r\n");
-					CoAP_DeleteInteraction(pIApending);
-					break;
-				}
+		//remove observer identified by token, socketHandle and remote EP from resource
+		if (pObserver != NULL && CoAP_TokenEqual(pObserver->Token, pIA->pReqMsg->Token)) {
+			//delete/abort any pending notification interaction
+			if (pObserver->pPendingIA != NULL) {
+				INFO("Abort of pending notification interaction\r\n");
+				CoAP_DeleteInteraction(pObserver->pPendingIA);
 			}
+			CoAP_DetachObserver(pObserver, true);
 		}
 
 	} else {
@@ -36,7 +36,7 @@ typedef enum {
 	COAP_STATE_HANDLE_REQUEST,                    // Remote request received & parsed -> invoke resource handler
 	COAP_STATE_RESOURCE_POSTPONE_EMPTY_ACK_SENT,// Wait some time for resource to become ready, meanwhile empty ack has been sent
 	COAP_STATE_RESPONSE_SENT,					// NON or piggy-ACK response has been sent -> wait some time then delete
-	COAP_STATE_RESPONSE_WAITING_LEISURE,		// CON response has been sent (+previous separate ACK of req)
+	COAP_STATE_RESPONSE_WAITING_LEISURE,		// response to multicast request is held back for a random leisure period
 												// -> wait for ACK or resent after some time
 
 	//[notificator]
@@ -48,6 +48,7 @@ typedef enum {
 	COAP_STATE_READY_TO_REQUEST,                // request is ready to send
 	COAP_STATE_WAITING_RESPONSE,                // resend request after some time if no response or ack has been received for some time
 	COAP_STATE_HANDLE_RESPONSE,                    // call client callback and delete after some time, ack maybe send too
+	COAP_STATE_OBSERVING,                       // registered as observer, waiting for notifications or Max-Age expiry
 
 	//[server]+[notificator]+[client]
 	COAP_STATE_FINISHED                            // can be deleted / freed
@@ -62,6 +63,60 @@ typedef enum {
 
 typedef CoAP_Result_t ( * CoAP_RespHandler_fn_t )(CoAP_Message_t* pRespMsg, CoAP_Message_t* pReqMsg, NetEp_t* Sender);
 
+// Handle of a client request started with CoAP_StartRequest(...)
+typedef uint32_t CoAP_ReqHandle_t;
+#define COAP_INVALID_REQ_HANDLE (0)
+
+// Called once when a client request started with CoAP_StartRequest(...) ends
+// result: COAP_OK if a response has been received (pRespMsg != NULL), else the reason of failure
+// (e.g. COAP_ERR_TIMEOUT, COAP_ERR_REMOTE_RST, COAP_ERR_OUT_OF_ATTEMPTS)
+// Observe requests call it for every fresh notification, the observation ends with the first
+// call carrying a response without observe option or a failure result.
+typedef void ( * CoAP_ReqDone_fn_t )(CoAP_ReqHandle_t handle, CoAP_Result_t result, CoAP_Message_t* pRespMsg, void* pUserData);
+
+// Receives the blocks of a Block2 download (RFC7959) in order, returning anything but COAP_OK aborts the transfer
+typedef CoAP_Result_t ( * CoAP_BlockSink_fn_t )(CoAP_ReqHandle_t handle, uint32_t offset, const uint8_t* pData, uint16_t length, void* pUserData);
+
+typedef struct {
+	CoAP_MessageType_t Type;                        // CON or NON
+	CoAP_MessageCode_t Code;                        // REQ_GET, REQ_POST, ...
+	const char* UriString;                          // e.g. "/sensors/temp?unit=C"
+	const uint8_t* pPayload;                        // optional, copied into the request
+	uint16_t PayloadLength;
+	uint32_t Timeout;                               // [s] deadline for the whole exchange, 0 = default timeouts only
+	CoAP_ReqDone_fn_t cb;                           // optional
+	void* pUserData;                                // passed unchanged to cb
+	bool Observe;                                   // register as observer (GET/FETCH only, RFC7641)
+
+	// Block2 download: if Sink or pRespBuf is set all blocks of a response are fetched before cb is called
+	CoAP_BlockSink_fn_t Sink;                       // optional, gets the blocks in order
+	uint8_t* pRespBuf;                              // optional, reassembled response payload
+	uint32_t RespBufSize;
+	uint32_t* pRespLength;                          // optional, number of payload bytes received
+	uint16_t BlockSize;                             // preferred block size, 0 = chosen by server
+	uint8_t BlockWindow;                            // max. block requests in flight (limited by NSTART), 0 = 1
+} CoAP_ReqParams_t;
+
+// State of a Block2 download shared by all block requests of one CoAP_StartRequest(...)
+typedef struct {
+	uint16_t RefCnt;                                // interactions referencing the transfer
+	bool Finished;                                  // final callback has been called
+	uint8_t Window;
+	uint16_t BlockSize;                             // 0 until the first block has been received
+	uint32_t NextToRequest;                         // block number
+	uint32_t NextToDeliver;                         // block number
+	uint32_t LastBlock;                             // block number, COAP_BLOCK_NUM_UNKNOWN without Size2
+	uint32_t Length;                                // payload bytes delivered so far
+	uint8_t ETag[8];                                // of block 0, all blocks must be of the same representation
+	uint8_t ETagLength;                             // 0 = block 0 had no ETag
+	CoAP_BlockSink_fn_t Sink;
+	uint8_t* pBuf;
+	uint32_t BufSize;
+	uint32_t* pLength;
+} CoAP_BlockTransfer_t;
+
+#define COAP_BLOCK_NUM_UNKNOWN (0xffffffffu)
+
 
 /*
  * There are 3 Types of interactions, defined by the Role: CLIENT, SERVER, NOTIFICATION
@@ -78,6 +133,14 @@ typedef CoAP_Result_t ( * CoAP_RespHandler_fn_t )(CoAP_Message_t* pRespMsg, CoAP
  *
  *
  */
+// Notification of a resource with RES_FLAG_SHARED_NOTIFICATION, generated once per update.
+// Option list and payload of pMsg are referenced by the notification messages to all observers,
+// which only carry their own type, message ID and token.
+typedef struct CoAP_SharedNotification {
+	uint32_t RefCnt;                                //resource (while latest) + interactions
+	CoAP_Message_t* pMsg;
+} CoAP_SharedNotification_t;
+
 typedef struct CoAP_Interaction {
 	struct CoAP_Interaction* next;                  //4 byte pointer (linked list of interactions)
 
@@ -85,14 +148,18 @@ typedef struct CoAP_Interaction {
 	CoAP_InteractionState_t State;
 
 	// An interaction is bound to a resource based on the requested URL
-	CoAP_Res_t* pRes;                               //Resource of IA
+	CoAP_Res_t* pRes;                               //Resource of IA, "NULL" if it has been removed meanwhile
+	uint32_t ResGeneration;                         //Generation of pRes when the IA has been bound to it
 	CoAP_Observer_t* pObserver;                     //"NULL" or link to Observer (Role=COAP_ROLE_NOTIFICATION)
+	CoAP_SharedNotification_t* pSharedNotif;        //"NULL" or notification the response message refers to
 
 	//Network State
 	NetEp_t RemoteEp;                               //[server]=>requesting EP, [client]=>serving EP
 	SocketHandle_t socketHandle;                    // Handle to identify the underlying Socket
 
 	//control vars
+	bool HandlerPostponed;                          //[server] resource handler returned HANDLER_POSTPONE, equivalent requests wait for it (RES_FLAG_COALESCE)
+	bool PreconditionsChecked;                      //[server] If-Match and If-None-Match have been evaluated, see CoAP_RejectOnPrecondition(...)
 	bool UpdatePendingNotification;                 //control flag for Observe RFC7641 ("4.5.2.  Advanced Transmission")
 	uint8_t RetransCounter;
 	uint32_t AckTimeout;
@@ -109,6 +176,28 @@ typedef struct CoAP_Interaction {
 	MetaInfo_t RespMetaInfo;
 
 	CoAP_RespHandler_fn_t RespCB;                   //response callback (if client)
+
+	//Request handle API (if client)
+	CoAP_ReqHandle_t ReqHandle;
+	CoAP_ReqDone_fn_t ReqDoneCB;
+	void* pUserData;
+	bool HasDeadline;
+	uint32_t Deadline;                              //exchange is given up after this time (if HasDeadline)
+	bool Canceled;                                  //deleted on next processing, no more callbacks
+	bool Paced;                                     //held back while NSTART requests to the endpoint are outstanding
+	bool InFlight;                                  //counted as outstanding request to the endpoint
+	uint32_t InFlightUntil;                         //NON request without response stops counting then (PROBING_RATE)
+
+	//Client side observe
+	bool Observe;                                   //request registered as observer
+	bool ObsEstablished;                            //server accepted the registration
+	uint32_t ObsSeq;                                //observe sequence number of the latest fresh notification
+	uint32_t ObsSeqTime;                            //reception time of the latest fresh notification
+	uint32_t ObsRefreshAt;                          //re-register if nothing fresh has been received until then
+
+	//Client side Block2 download
+	CoAP_BlockTransfer_t* pBlkXfer;                 //"NULL" or shared transfer state
+	uint32_t BlockNum;                              //requested block
 } CoAP_Interaction_t;
 
 //called by incoming request
@@ -119,9 +208,24 @@ CoAP_Result_t CoAP_StartNewServerInteraction(CoAP_Message_t* pMsgReq, CoAP_Res_t
 CoAP_Result_t CoAP_StartNewClientInteraction(CoAP_Message_t* pMsgReq, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_RespHandler_fn_t cb);
 CoAP_Result_t CoAP_StartNewGetRequest(char* UriString, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_RespHandler_fn_t cb);
 CoAP_Result_t CoAP_StartNewRequest(CoAP_MessageCode_t type, const char* UriString, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_RespHandler_fn_t cb, uint8_t *buf, size_t size);
+// Starts a CON or NON request and returns a handle which can be used to cancel it.
+// Any number of requests can be started, at most NSTART of them are outstanding per endpoint at a time,
+// the others wait in a queue of the endpoint and are released one by one as slots become free.
+// Requests of the functions above are sent right away, but count as outstanding as well.
+CoAP_Result_t CoAP_StartRequest(const CoAP_ReqParams_t* pParams, SocketHandle_t socketHandle, NetEp_t* ServerEp, CoAP_ReqHandle_t* pHandle);
+// Aborts a request started with CoAP_StartRequest(...) including all its block requests, its callback is not called anymore.
+// Can be called from within the callback, e.g. to end an observation (following notifications get a RST).
+CoAP_Result_t CoAP_CancelRequest(CoAP_ReqHandle_t handle);
 CoAP_Result_t CoAP_RemoveInteractionsObserver(CoAP_Interaction_t* pIA, CoAP_Token_t token);
 CoAP_Result_t CoAP_HandleObservationInReq(CoAP_Interaction_t* pIA);
+// Notifies all observers of the resource, NOTIFY_FANOUT_BUDGET at once and the remaining ones from CoAP_doWork()
 CoAP_Result_t CoAP_StartNotifyInteractions(CoAP_Res_t* pRes);
+CoAP_Result_t CoAP_ContinueNotifyInteractions(CoAP_Res_t* pRes, uint32_t budget);
+CoAP_Result_t CoAP_StartDueNotifyInteractions(CoAP_Res_t* pRes, CoAP_Observer_t* pFirst);
+void CoAP_RefreshNotification(CoAP_Interaction_t* pIA);
+// Unbinds all interactions from a resource which is about to be removed and ends its observations with the given code
+void CoAP_ReleaseResourceInteractions(CoAP_Res_t* pRes, CoAP_MessageCode_t code);
+void CoAP_ReleaseSharedNotification(CoAP_SharedNotification_t** ppShared);
 CoAP_Result_t CoAP_FreeInteraction(CoAP_Interaction_t** pInteraction);
 CoAP_Interaction_t* CoAP_GetLongestPendingInteraction();
 CoAP_Result_t CoAP_DeleteInteraction(CoAP_Interaction_t* pInteractionToDelete);
@@ -133,5 +237,12 @@ void CoAP_ClearInteractions(CoAP_Interaction_t** pInteraction);
 
 //client
 CoAP_Interaction_t* CoAP_FindInteractionByMessageIdAndEp(CoAP_Interaction_t* pList, uint16_t mID, NetEp_t* fromEp);
+uint32_t CoAP_CountOutstandingRequests(SocketHandle_t socketHandle, NetEp_t* ServerEp);
+CoAP_Result_t CoAP_AddOutstandingRequest(CoAP_Interaction_t* pIA);
+void CoAP_EndOutstandingRequest(CoAP_Interaction_t* pIA);
+void CoAP_WaitForFreeSlot(CoAP_Interaction_t* pIA);
+void CoAP_ExpireWaitingRequests();
+void CoAP_ClearWaitingRequests();
+CoAP_Result_t CoAP_StartBlockRequest(CoAP_Interaction_t* pIA, uint32_t blockNum);
 
 #endif
@@ -31,6 +31,64 @@ void hal_debug_puts(char* s) {
 	}
 }
 
+#if USE_MULTICAST_RESPONSE_SUPPRESSION == 1
+// Another member of the group answered the same multicast request with the same response already
+// -> drop our pending one. Returns true if pMsg has been consumed this way.
+// The response must have been overheard on the socket of the group the request was received on,
+// from another endpoint than the requesting one, and carry the (non empty) token of the request.
+static bool SuppressEquivalentMulticastResponse(CoAP_Message_t* pMsg, SocketHandle_t socketHandle, NetEp_t* pSender) {
+	CoAP_Interaction_t* pIA;
+	if (pMsg->Token.Length == 0) { //no way to tell which request it answers
+		return false;
+	}
+	for (pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+		if (pIA->Role != COAP_ROLE_SERVER || pIA->State != COAP_STATE_RESPONSE_WAITING_LEISURE || pIA->pRespMsg == NULL) {
+			continue;
+		}
+		if (pIA->socketHandle != socketHandle || pIA->RemoteEp.NetType != pSender->NetType
+				|| EpAreEqual(&(pIA->RemoteEp), pSender)) {
+			continue;
+		}
+		CoAP_Message_t* pOwn = pIA->pRespMsg;
+		if (CoAP_TokenEqual(pOwn->Token, pMsg->Token) && pOwn->Code == pMsg->Code
+				&& pOwn->PayloadLength == pMsg->PayloadLength
+				&& (pOwn->PayloadLength == 0 || coap_memcmp(pOwn->Payload, pMsg->Payload, pOwn->PayloadLength) == 0)) {
+			INFO("- Equivalent multicast response overheard, suppressing own response\r\n");
+			CoAP_DeleteInteraction(pIA);
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+// Attaches a response to the request of a client interaction.
+// Outdated notifications of an established observation are dropped (3.4 RFC7641).
+// Returns false if pMsg has not been taken over by the interaction.
+static bool AttachClientResponse(CoAP_Interaction_t* pIA, CoAP_Message_t* pMsg) {
+	uint32_t seq;
+	if (pIA->Observe && GetObserveOptionFromMsg(pMsg, &seq) == COAP_OK) {
+		uint32_t now = CoAP.api.rtc1HzCnt();
+		if (pIA->ObsEstablished && pIA->State != COAP_STATE_WAITING_RESPONSE
+				&& !CoAP_ObserveSeqIsFresh(pIA->ObsSeq, pIA->ObsSeqTime, seq, now)) {
+			INFO("- Dropping outdated notification, seq: %" PRIu32 "\r\n", seq);
+			return false;
+		}
+		pIA->ObsEstablished = true;
+		pIA->ObsSeq = seq;
+		pIA->ObsSeqTime = now;
+	}
+
+	if (pIA->pRespMsg != NULL) {
+		CoAP_free_Message(&(pIA->pRespMsg)); //free eventually present older response (todo: check if this is possible!?)
+	}
+	pIA->pRespMsg = pMsg; //attach just received message for further actions in IA [client] state-machine
+	pIA->State = COAP_STATE_HANDLE_RESPONSE;
+	CoAP_EndOutstandingRequest(pIA);
+	pIA->SleepUntil = 0; // Wakeup interaction
+	return true;
+}
+
 // Called by network interfaces to pass rawData which is parsed to CoAP messages.
 // lifetime of pckt only during function invoke
 // can be called from irq since more expensive work is done in CoAP_doWork loop
@@ -136,6 +194,9 @@ void _ram CoAP_HandleIncomingPacket(SocketHandle_t socketHandle, NetPacket_t* pP
 			goto END;
 		}
 		pIA->ResConfirmState = RST_SEND;
+		if (pIA->Role == COAP_ROLE_CLIENT) {
+			CoAP_EndOutstandingRequest(pIA);
+		}
 		goto END;
 	}
 	case ACK: {
@@ -145,18 +206,18 @@ void _ram CoAP_HandleIncomingPacket(SocketHandle_t socketHandle, NetPacket_t* pP
 			goto END;
 		}
 		pIA->ResConfirmState = ACK_SEND;
+		if (pIA->Role == COAP_ROLE_CLIENT) {
+			CoAP_EndOutstandingRequest(pIA); //an acknowledged request is not outstanding anymore (4.7 RFC7252)
+		}
 
 		//piA is NOT NULL in every case here
 		DEBUG("- piggybacked response received\r\n");
 		if (pMsg->Code != EMPTY) {
 			//no "simple" ACK => must be piggybacked RESPONSE to our [client] request. corresponding Interaction has been found before
 			if (pIA->Role == COAP_ROLE_CLIENT && CoAP_TokenEqual(pIA->pReqMsg->Token, pMsg->Token) && pIA->State == COAP_STATE_WAITING_RESPONSE) {
-				if (pIA->pRespMsg != NULL) {
-					CoAP_free_Message(&(pIA->pRespMsg)); //free eventually present older response (todo: check if this is possible!?)
+				if (AttachClientResponse(pIA, pMsg)) {
+					return;
 				}
-				pIA->pRespMsg = pMsg; //attach just received message for further actions in IA [client] state-machine & return
-				pIA->State = COAP_STATE_HANDLE_RESPONSE;
-				return;
 			} else {
 				INFO("- could not piggybacked response to any request!\r\n");
 			}
@@ -186,14 +247,11 @@ void _ram CoAP_HandleIncomingPacket(SocketHandle_t socketHandle, NetPacket_t* pP
 		} else { // pMsg carries a separate response (=no piggyback!) to our client request...
 			// find in interaction list request with same token & endpoint
 			for (pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
-				if (pIA->Role == COAP_ROLE_CLIENT && CoAP_TokenEqual(pIA->pReqMsg->Token, pMsg->Token) && EpAreEqual(&(pPacket->remoteEp), &(pIA->RemoteEp))) {
-					// 2nd case "updates" received response
-					if (pIA->State == COAP_STATE_WAITING_RESPONSE || pIA->State == COAP_STATE_HANDLE_RESPONSE) {
-						if (pIA->pRespMsg != NULL) {
-							CoAP_free_Message(&(pIA->pRespMsg)); //free eventually present older response (todo: check if this is possible!?)
-						}
-						pIA->pRespMsg = pMsg; //attach just received message for further actions in IA [client] state-machine & return
-						pIA->State = COAP_STATE_HANDLE_RESPONSE;
+				if (pIA->Role == COAP_ROLE_CLIENT && !pIA->Canceled && CoAP_TokenEqual(pIA->pReqMsg->Token, pMsg->Token) && EpAreEqual(&(pPacket->remoteEp), &(pIA->RemoteEp))) {
+					bool attached = false;
+					// 2nd case "updates" received response, 3rd case is a notification of an observed resource
+					if (pIA->State == COAP_STATE_WAITING_RESPONSE || pIA->State == COAP_STATE_HANDLE_RESPONSE || pIA->State == COAP_STATE_OBSERVING) {
+						attached = AttachClientResponse(pIA, pMsg);
 					}
 
 					if (pMsg->Type == CON) {
@@ -201,10 +259,19 @@ void _ram CoAP_HandleIncomingPacket(SocketHandle_t socketHandle, NetPacket_t* pP
 							pIA->ResConfirmState = ACK_SEND;
 						}
 					}
+					if (!attached) {
+						goto END;
+					}
 					return;
 				}
 			} // for loop
 
+#if USE_MULTICAST_RESPONSE_SUPPRESSION == 1
+			if (SuppressEquivalentMulticastResponse(pMsg, socketHandle, &(pPacket->remoteEp))) {
+				goto END;
+			}
+#endif
+
 			// no active interaction found to match remote msg to...
 			// no matching IA has been found! can't do anything with this msg -> Rejecting it (also NON msg) (see RFC7252, 4.3.)
 			CoAP_SendShortResp(RST, EMPTY, pMsg->MessageID, pMsg->Token, socketHandle, pPacket->remoteEp);
@@ -244,27 +311,6 @@ static CoAP_Result_t _rom SendResp(CoAP_Interaction_t* pIA, CoAP_InteractionStat
 	return COAP_OK;
 }
 
-static CoAP_Result_t _rom SendReq(CoAP_Interaction_t* pIA, CoAP_InteractionState_t nextIAState) {
-	CoAP_Result_t res = CoAP_SendMsg(pIA->pReqMsg, pIA->socketHandle, pIA->RemoteEp);
-	if (res == COAP_OK) {
-
-		if (pIA->pReqMsg->Type == CON) {
-			CoAP_EnableAckTimeout(pIA, pIA->RetransCounter); //enable timeout on waiting for ack
-		} //else NON (no special handling=
-
-		pIA->State = nextIAState; //move to next state
-
-		CoAP_EnqueueLastInteraction(pIA); //(re)enqueue interaction for further processing//todo: in die äußere statemachine
-
-	} else { //unexspected internal failure todo: try at least to send 4 byte RESP_INTERNAL_SERVER_ERROR_5_00
-		INFO("(!!!) SendReq(): Internal socket error on sending response! MiD: %d, CoapResult: %d\r\n", pIA->pReqMsg->MessageID, res);
-		CoAP_DeleteInteraction(pIA);
-		return COAP_ERR_SOCKET;
-	}
-
-	return COAP_OK;
-}
-
 //used on [server]
 static CoAP_Result_t _rom CheckRespStatus(CoAP_Interaction_t* pIA) {
 
@@ -357,6 +403,203 @@ CoAP_Socket_t* CoAP_NewSocket(SocketHandle_t handle) {
 	return socket;
 }
 
+void CoAP_SetMulticastGroupEstimate(uint32_t groupSize, uint32_t linkRate) {
+	CoAP.McGroupSize = groupSize;
+	CoAP.McLinkRate = linkRate;
+}
+
+// Returns the random delay [s] until the response to a multicast request is sent, 0 = no delay
+static uint32_t MulticastLeisure(CoAP_Message_t* pRespMsg) {
+	uint64_t maxLeisure = DEFAULT_LEISURE;
+
+	if (CoAP.McGroupSize != 0 && CoAP.McLinkRate != 0) {
+		// lb_Leisure = S * G / R, rounded up to the resolution of the 1Hz clock
+		uint64_t bytes = (uint64_t) CoAP_GetRawSizeOfMessage(pRespMsg) * CoAP.McGroupSize;
+		maxLeisure = (bytes + CoAP.McLinkRate - 1) / CoAP.McLinkRate;
+	}
+	if (maxLeisure > MAX_LEISURE) {
+		maxLeisure = MAX_LEISURE;
+	}
+	if (maxLeisure == 0) {
+		return 0;
+	}
+	// pick a random point within [0, maxLeisure]
+	return (uint32_t) ((uint32_t) CoAP.api.rand() % (maxLeisure + 1));
+}
+
+// Methods that may change the resource
+static bool IsUnsafeMethod(CoAP_MessageCode_t code) {
+	return code == REQ_POST || code == REQ_PUT || code == REQ_DELETE || code == REQ_PATCH || code == REQ_IPATCH;
+}
+
+// Requests with other options than these (e.g. Observe, Block2, ETag) are answered individually
+static bool IsCoalescable(CoAP_Interaction_t* pIA) {
+	CoAP_option_t* pOpt;
+
+	if (pIA->pRes == NULL || !(pIA->pRes->Options.Flags & RES_FLAG_COALESCE) || pIA->pReqMsg->Code != REQ_GET
+			|| pIA->ReqMetaInfo.Type == META_INFO_MULTICAST || pIA->ReqMetaInfo.Type == META_INFO_RF_PATH) {
+		return false;
+	}
+	for (pOpt = pIA->pReqMsg->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+		if (pOpt->Number != OPT_NUM_URI_HOST && pOpt->Number != OPT_NUM_URI_PORT && pOpt->Number != OPT_NUM_URI_PATH
+				&& pOpt->Number != OPT_NUM_URI_QUERY && pOpt->Number != OPT_NUM_ACCEPT) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static CoAP_option_t* NextCoalesceKeyOption(CoAP_option_t* pOpt) {
+	while (pOpt != NULL && (pOpt->Number == OPT_NUM_URI_HOST || pOpt->Number == OPT_NUM_URI_PORT)) {
+		pOpt = pOpt->next;
+	}
+	return pOpt;
+}
+
+// Same resource, Uri-Path, Uri-Query and Accept
+static bool AreEquivalentRequests(CoAP_Interaction_t* pA, CoAP_Interaction_t* pB) {
+	CoAP_option_t* pOptA;
+	CoAP_option_t* pOptB;
+
+	if (pA->pRes != pB->pRes || pA->ResGeneration != pB->ResGeneration || !IsCoalescable(pA) || !IsCoalescable(pB)) {
+		return false;
+	}
+	pOptA = NextCoalesceKeyOption(pA->pReqMsg->pOptionsList);
+	pOptB = NextCoalesceKeyOption(pB->pReqMsg->pOptionsList);
+	while (pOptA != NULL && pOptB != NULL) {
+		if (!CoAP_OptionsAreEqual(pOptA, pOptB)) {
+			return false;
+		}
+		pOptA = NextCoalesceKeyOption(pOptA->next);
+		pOptB = NextCoalesceKeyOption(pOptB->next);
+	}
+	return pOptA == NULL && pOptB == NULL;
+}
+
+static bool IsUnanswered(CoAP_Interaction_t* pIA) {
+	return pIA->Role == COAP_ROLE_SERVER && (pIA->State == COAP_STATE_HANDLE_REQUEST || pIA->State == COAP_STATE_RESOURCE_POSTPONE_EMPTY_ACK_SENT);
+}
+
+// True if the handler of an equivalent request is still busy (RES_FLAG_COALESCE), the request waits for its response then
+static bool WaitForEquivalentRequest(CoAP_Interaction_t* pIA) {
+	CoAP_Interaction_t* pOther;
+
+	if (!IsCoalescable(pIA)) {
+		return false;
+	}
+	for (pOther = CoAP.pInteractions; pOther != NULL; pOther = pOther->next) {
+		if (pOther != pIA && pOther->HandlerPostponed && IsUnanswered(pOther) && AreEquivalentRequests(pIA, pOther)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Copies code, options and payload of a response, the payload buffer is shared if possible
+static CoAP_Result_t CopyResponse(CoAP_Message_t* pFrom, CoAP_Message_t* pTo) {
+	CoAP_PayloadBuf_t* pBuf = CoAP_SharePayload(pFrom);
+	CoAP_option_t* pOpt;
+
+	CoAP_FreeOptionList(&(pTo->pOptionsList));
+	for (pOpt = pFrom->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+		if (CoAP_CopyOptionToList(&(pTo->pOptionsList), pOpt) != COAP_OK) {
+			CoAP_FreeOptionList(&(pTo->pOptionsList));
+			CoAP_ReleasePayloadBuf(&pBuf);
+			return COAP_ERR_OUT_OF_MEMORY;
+		}
+	}
+	if (pBuf != NULL) {
+		CoAP_SetSharedPayload(pTo, pBuf, pFrom->Payload, pFrom->PayloadLength);
+		CoAP_ReleasePayloadBuf(&pBuf);
+	} else if (pFrom->PayloadMode == PAYLOAD_STATIC) {
+		CoAP_SetForeignPayload(pTo, PAYLOAD_STATIC, pFrom->Payload, pFrom->PayloadLength);
+	} else if (CoAP_SetPayload(pTo, pFrom->Payload, pFrom->PayloadLength, true) != COAP_OK) {
+		CoAP_FreeOptionList(&(pTo->pOptionsList));
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	pTo->Code = pFrom->Code;
+	return COAP_OK;
+}
+
+// Answers all pending requests equivalent to the one of pIA with a copy of its 2.05 response (RES_FLAG_COALESCE),
+// the payload buffer is shared, type, message ID and token are the ones of each request
+static void AnswerEquivalentRequests(CoAP_Interaction_t* pIA) {
+	CoAP_Interaction_t* pOther = CoAP.pInteractions;
+	uint32_t cnt = 0;
+
+	if (!IsCoalescable(pIA) || pIA->pRespMsg->Code != RESP_SUCCESS_CONTENT_2_05) {
+		return; //waiting requests call the handler themselves
+	}
+	while (pOther != NULL) {
+		CoAP_Interaction_t* pNext = pOther->next; //answered interactions are moved to the list end
+
+		if (pOther != pIA && IsUnanswered(pOther) && AreEquivalentRequests(pIA, pOther)) {
+			CoAP_free_Message(&(pOther->pRespMsg)); //prepared by a postponed handler
+			pOther->pRespMsg = CoAP_AllocRespMsg(pOther->pReqMsg, EMPTY, 0);
+			if (pOther->pRespMsg != NULL && CopyResponse(pIA->pRespMsg, pOther->pRespMsg) != COAP_OK) {
+				CoAP_free_Message(&(pOther->pRespMsg));
+			}
+			if (pOther->pRespMsg != NULL) {
+				if (pOther->ReqConfirmState == ACK_SEND) { //separate response after empty ACK
+					pOther->pRespMsg->Type = CON;
+					pOther->pRespMsg->MessageID = CoAP_GetNextMid();
+				}
+				pOther->HandlerPostponed = false;
+				SendResp(pOther, COAP_STATE_RESPONSE_SENT);
+				cnt++;
+			}
+		}
+		pOther = pNext;
+	}
+	if (cnt > 0) {
+		INFO("- Response shared with %" PRIu32 " equivalent requests\r\n", cnt);
+	}
+}
+
+// Keeps a copy of the 2.05 response of the handler to a coalescable request for COALESCE_WINDOW
+static void KeepCoalescedResponse(CoAP_Interaction_t* pIA) {
+	CoAP_Res_t* pRes = pIA->pRes;
+	CoAP_Token_t noToken = { .Length = 0 };
+
+	if (!IsCoalescable(pIA) || pIA->pRespMsg->Code != RESP_SUCCESS_CONTENT_2_05) {
+		return;
+	}
+	CoAP_DropCoalescedResponse(pRes);
+	pRes->pCoalesced = CoAP_CreateMessage(ACK, EMPTY, 0, NULL, 0, 0, noToken);
+	if (pRes->pCoalesced == NULL || CopyResponse(pIA->pRespMsg, pRes->pCoalesced) != COAP_OK
+			|| CoAP_CopyCacheKey(&(pRes->pCoalescedKey), pIA->pReqMsg->pOptionsList) != COAP_OK) {
+		CoAP_DropCoalescedResponse(pRes);
+		return;
+	}
+	pRes->CoalescedAt = CoAP.api.rtc1HzCnt();
+}
+
+// Answers an equivalent request received within COALESCE_WINDOW with a copy of the kept response,
+// returns false if the resource handler has to be called
+static bool ServeCoalescedResponse(CoAP_Interaction_t* pIA) {
+	CoAP_Res_t* pRes = pIA->pRes;
+
+	if (pRes->pCoalesced == NULL || !IsCoalescable(pIA)) {
+		return false;
+	}
+	if (timeAfter(CoAP.api.rtc1HzCnt(), pRes->CoalescedAt + COALESCE_WINDOW)) {
+		CoAP_DropCoalescedResponse(pRes);
+		return false;
+	}
+	if (!CoAP_CacheKeyMatches(pRes->pCoalescedKey, pIA->pReqMsg->pOptionsList)
+			|| CopyResponse(pRes->pCoalesced, pIA->pRespMsg) != COAP_OK) {
+		return false;
+	}
+	INFO("- Response of an equivalent request shared\r\n");
+	return true;
+}
+
+// Drops the response kept for equivalent requests, e.g. because the resource has changed
+void _rom CoAP_DropCoalescedResponse(CoAP_Res_t* pRes) {
+	CoAP_free_Message(&(pRes->pCoalesced));
+	CoAP_FreeOptionList(&(pRes->pCoalescedKey));
+}
+
 static void handleServerInteraction(CoAP_Interaction_t* pIA) {
 	if (pIA->State == COAP_STATE_HANDLE_REQUEST ||
 			pIA->State == COAP_STATE_RESOURCE_POSTPONE_EMPTY_ACK_SENT ||
@@ -369,26 +612,21 @@ static void handleServerInteraction(CoAP_Interaction_t* pIA) {
 				CoAP_DeleteInteraction(pIA);
 				return;
 			}
-			// Multicast messages get a response after a leisure period.
-			if (pIA->State == COAP_STATE_HANDLE_REQUEST) {
-				pIA->State = COAP_STATE_RESPONSE_WAITING_LEISURE;
-
-				// Todo: Pick a random leisure period (See section 8.2 of [RFC7252])
-				CoAP_SetSleepInteraction(pIA, DEFAULT_LEISURE); // Don't respond right away'
-				CoAP_EnqueueLastInteraction(pIA);
-				INFO("Multicast request postponed processing until %" PRIu32 "\r\n", pIA->SleepUntil);
+			// Leisure period is over, response has been prepared before
+			if (pIA->State == COAP_STATE_RESPONSE_WAITING_LEISURE) {
+				SendResp(pIA, COAP_STATE_RESPONSE_SENT);
 				return;
 			}
 		}
 
-		if (((pIA->pReqMsg->Code == REQ_GET) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_GET))
+		if (pIA->pRes != NULL && (((pIA->pReqMsg->Code == REQ_GET) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_GET))
 				|| ((pIA->pReqMsg->Code == REQ_POST) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_POST))
 				|| ((pIA->pReqMsg->Code == REQ_PUT) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_PUT))
 				|| ((pIA->pReqMsg->Code == REQ_DELETE) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_DELETE))
 				|| ((pIA->pReqMsg->Code == REQ_FETCH) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_FETCH))
 				|| ((pIA->pReqMsg->Code == REQ_PATCH) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_PATCH))
 				|| ((pIA->pReqMsg->Code == REQ_IPATCH) && !((pIA->pRes->Options).AllowedMethods & RES_OPT_IPATCH))
-				) {
+				)) {
 			pIA->pRespMsg = CoAP_AllocRespMsg(pIA->pReqMsg, RESP_METHOD_NOT_ALLOWED_4_05, 0); //matches also TYPE + TOKEN to request
 
 			//o>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
@@ -401,14 +639,33 @@ static void handleServerInteraction(CoAP_Interaction_t* pIA) {
 
 		// Allocate new msg with payload buffer which can be directly used OR overwritten
 		// by resource handler with (ownstatic memory OR  "com_mem_get(...)" memory areas.
-		// Any non static memory will be freed along with message! see free_Payload(...) function, even if user overwrites payload pointer!
+		// Payload buffers of the stack are freed along with the message (or its last sharer), see CoAP_free_MsgPayload(...)
 		if (pIA->pRespMsg == NULL) { //if postponed before it would have been already allocated
-			pIA->pRespMsg = CoAP_AllocRespMsg(pIA->pReqMsg, EMPTY, PREFERED_PAYLOAD_SIZE); //matches also TYPE + TOKEN to request
+			pIA->pRespMsg = CoAP_AllocRespMsg(pIA->pReqMsg, EMPTY, CoAP_ResponseSizeHint(pIA->pRes)); //matches also TYPE + TOKEN to request
 		}
 
 		// Call of external set resource handler
 		// could change type and code of message (ACK & EMPTY above only a guess!)
-		CoAP_HandlerResult_t Res = pIA->pRes->Handler(pIA->pReqMsg, pIA->pRespMsg);
+		// Blocks of an upload to a resource with upload sink are answered by the stack, except the last one
+		// Later blocks of a snapshotted Block2 representation, fresh cached responses and the responses kept for equivalent
+		// requests (RES_FLAG_COALESCE) are served by the stack as well
+		// Requests to a resource removed meanwhile get a 4.04, see CoAP_RemoveResource(...), failed preconditions a 4.12
+		CoAP_HandlerResult_t Res = HANDLER_OK;
+		bool handlerCalled = false;
+		if (pIA->pRes == NULL || pIA->pRes->Removed) {
+			CoAP_FreeOptionList(&(pIA->pRespMsg->pOptionsList));
+			pIA->pRespMsg->PayloadLength = 0;
+			pIA->pRespMsg->Code = RESP_NOT_FOUND_4_04;
+		} else if (!CoAP_RejectOnPrecondition(pIA) && !CoAP_HandleUploadBlock(pIA) && !CoAP_ServeBlock2FromCache(pIA)
+				&& !CoAP_ServeResponseFromCache(pIA) && !ServeCoalescedResponse(pIA)) {
+			if (WaitForEquivalentRequest(pIA)) {
+				Res = HANDLER_POSTPONE; //answered together with the equivalent request
+			} else {
+				Res = pIA->pRes->Handler(pIA->pReqMsg, pIA->pRespMsg);
+				handlerCalled = true;
+			}
+			pIA->HandlerPostponed = (handlerCalled && Res == HANDLER_POSTPONE);
+		}
 
 		// make sure the handler returned valid response (either already allocated OR allocated by handler itself)
 		if (pIA->pRespMsg == NULL)
@@ -463,6 +720,21 @@ static void handleServerInteraction(CoAP_Interaction_t* pIA) {
 			}
 		}
 
+		if (handlerCalled && Res == HANDLER_OK) {
+			CoAP_LearnResponseSize(pIA->pRes, pIA->pRespMsg->PayloadLength); //RES_FLAG_ADAPTIVE_RESP_SIZE
+			CoAP_AddAutoETag(pIA); //RES_FLAG_AUTO_ETAG
+			CoAP_RememberETag(pIA); //for If-Match of later changes
+			CoAP_Block2CacheComplete(pIA); //RES_FLAG_BLOCK2_CACHE
+			CoAP_ResponseCacheStore(pIA); //RES_FLAG_RESPONSE_CACHE
+			KeepCoalescedResponse(pIA); //RES_FLAG_COALESCE
+			if (IsUnsafeMethod(pIA->pReqMsg->Code) && (pIA->pRespMsg->Code >> 5u) == 2u) {
+				CoAP_InvalidateResponseCache(pIA->pRes); //the resource may have changed, see 5.6 RFC7252
+				CoAP_ForgetETag(pIA->pRes);
+				CoAP_DropCoalescedResponse(pIA->pRes);
+			}
+		}
+		CoAP_CheckResponsePrecondition(pIA); //If-Match and If-None-Match of GET and FETCH
+
 		//Set response TYPE correctly if CON request, regardless of what the handler did to this resp msg field, it can't know it better :-)
 		//on NON requests the handler can decide if use CON or NON in response (default is also using NON in response)
 		if (pIA->pReqMsg->Type == CON) {
@@ -495,6 +767,23 @@ static void handleServerInteraction(CoAP_Interaction_t* pIA) {
 			}
 
 		}
+		CoAP_RespondValidIfETagMatches(pIA);
+
+		// Multicast requests get a response after a random leisure period (8.2 RFC7252)
+		if (pIA->ReqMetaInfo.Type == META_INFO_MULTICAST) {
+			uint32_t leisure = MulticastLeisure(pIA->pRespMsg);
+			if (leisure > 0) {
+				pIA->State = COAP_STATE_RESPONSE_WAITING_LEISURE;
+				// An interaction sleeps as long as SleepUntil is not in the past,
+				// so the response is sent "leisure" and not "leisure + 1" seconds from now
+				CoAP_SetSleepInteraction(pIA, leisure - 1);
+				CoAP_EnqueueLastInteraction(pIA);
+				INFO("Multicast response postponed until %" PRIu32 "\r\n", pIA->SleepUntil);
+				return;
+			}
+		}
+
+		AnswerEquivalentRequests(pIA);
 
 		//o>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 		SendResp(pIA, COAP_STATE_RESPONSE_SENT); //transmit response & move to next state
@@ -550,18 +839,12 @@ static void handleNotifyInteraction(CoAP_Interaction_t* pIA) {
 			//Implement RFC7641 (observe) "4.5.2.  Advanced Transmission"
 			//Effectively abort previous notification and send a fresher one
 			//retain transmission parameters of "pending" interaction
-			if (pIA->UpdatePendingNotification) {
+			if (pIA->UpdatePendingNotification && pIA->pObserver != NULL) { //observer may have been removed meanwhile
 				CoAP_MessageType_t TypeSave = pIA->pRespMsg->Type;
 				INFO("in retry: update pending IA\r\n");
 				pIA->UpdatePendingNotification = false;
 				pIA->pRespMsg->MessageID = CoAP_GetNextMid();
-				//call notifier
-				if (pIA->pRes->Notifier(pIA->pObserver, pIA->pRespMsg) == HANDLER_ERROR) {
-					RemoveObserveOptionFromMsg(pIA->pRespMsg);
-					CoAP_RemoveInteractionsObserver(pIA, pIA->pRespMsg->Token);
-				} else { //good response
-					UpdateObserveOptionInMsg(pIA->pRespMsg, pIA->pRes->UpdateCnt);
-				}
+				CoAP_RefreshNotification(pIA); //call notifier
 				// The pIA->pRes->Notifier might have change the response from CON -> NON
 				// On the interaction we like to preserve the original value
 				// e.g. one CON between many NON messages should be preserved
@@ -582,7 +865,7 @@ static void handleNotifyInteraction(CoAP_Interaction_t* pIA) {
 		case COAP_OK:
 
 #if USE_RFC7641_ADVANCED_TRANSMISSION == 1
-			if (pIA->UpdatePendingNotification) {
+			if (pIA->UpdatePendingNotification && pIA->pObserver != NULL) { //observer may have been removed meanwhile
 				//Implement RFC7641 (observe) "4.5.2.  Advanced Transmission" and send a fresher representation
 				//also reset transmission parameters (since previous transfer ended successfully)
 				pIA->State = COAP_STATE_READY_TO_NOTIFY;
@@ -591,13 +874,7 @@ static void handleNotifyInteraction(CoAP_Interaction_t* pIA) {
 				pIA->pRespMsg->MessageID = CoAP_GetNextMid();
 				pIA->ResConfirmState = NOT_SET;
 
-				//call notifier
-				if (pIA->pRes->Notifier(pIA->pObserver, pIA->pRespMsg) == HANDLER_ERROR) {
-					RemoveObserveOptionFromMsg(pIA->pRespMsg);
-					CoAP_RemoveInteractionsObserver(pIA, pIA->pRespMsg->Token);
-				} else { //good response
-					UpdateObserveOptionInMsg(pIA->pRespMsg, pIA->pRes->UpdateCnt);
-				}
+				CoAP_RefreshNotification(pIA); //call notifier
 				INFO("- Started new notification since resource has been updated!\r\n");
 				CoAP_EnqueueLastInteraction(pIA);
 				return;
@@ -618,17 +895,223 @@ static void handleNotifyInteraction(CoAP_Interaction_t* pIA) {
 	}
 }
 
+// Reports the outcome of a client interaction to the application and deletes the interaction
+// Block requests of the same download share the outcome, only the first one to end reports it.
+static void endClientInteraction(CoAP_Interaction_t* pIA, CoAP_Result_t result) {
+	CoAP_Message_t* pRespMsg = (result == COAP_OK) ? pIA->pRespMsg : NULL;
+	CoAP_BlockTransfer_t* pXfer = pIA->pBlkXfer;
+
+	if (pXfer == NULL || !pXfer->Finished) {
+		if (pXfer != NULL) {
+			pXfer->Finished = true;
+			CoAP_CancelRequest(pIA->ReqHandle); //drop remaining block requests
+		}
+		if (pIA->RespCB != NULL) {
+			pIA->RespCB(pRespMsg, pIA->pReqMsg, &(pIA->RemoteEp)); //call callback
+		}
+		if (pIA->ReqDoneCB != NULL) {
+			pIA->ReqDoneCB(pIA->ReqHandle, result, pRespMsg, pIA->pUserData);
+		}
+	}
+
+	CoAP_DeleteInteraction(pIA);
+}
+
+// Wakes the response to the block to be delivered next if it arrived early
+static void wakeNextBlock(CoAP_BlockTransfer_t* pXfer) {
+	CoAP_Interaction_t* pIA;
+	for (pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+		if (pIA->pBlkXfer == pXfer && pIA->State == COAP_STATE_HANDLE_RESPONSE && pIA->BlockNum == pXfer->NextToDeliver) {
+			pIA->SleepUntil = 0;
+			return;
+		}
+	}
+}
+
+// Block2 download (RFC7959): passes the received block on in order and requests the following ones
+static void handleClientBlockResponse(CoAP_Interaction_t* pIA) {
+	CoAP_BlockTransfer_t* pXfer = pIA->pBlkXfer;
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+	CoAP_blockwise_option_t B2opt = { .Type = BLOCK_2, .BlockSize = BLOCK_SIZE_NOT_USED, .MoreFlag = false, .BlockNum = 0 };
+	CoAP_Result_t res = COAP_OK;
+
+	if (pResp->Code < RESP_FIRST_2_00 || pResp->Code > RESP_SUCCESS_CONTINUE_2_31) {
+		endClientInteraction(pIA, COAP_OK); //error response of server ends the transfer
+		return;
+	}
+
+	if (GetBlock2OptionFromMsg(pResp, &B2opt) != COAP_OK) {
+		if (pIA->BlockNum != 0) {
+			INFO("- Block2 option missing in response to block request\r\n");
+			endClientInteraction(pIA, COAP_ERR_WRONG_OPTION);
+			return;
+		}
+		//whole representation fits into a single response
+	} else if (B2opt.BlockNum != pIA->BlockNum) {
+		INFO("- Got block %" PRIu32 " instead of %" PRIu32 "\r\n", B2opt.BlockNum, pIA->BlockNum);
+		endClientInteraction(pIA, COAP_ERR_WRONG_OPTION);
+		return;
+	}
+
+	CoAP_option_t* pETagOpt = CoAP_FindOptionByNumber(pResp, OPT_NUM_ETAG);
+	if (B2opt.BlockNum != 0) {
+		if (B2opt.BlockSize != pXfer->BlockSize) {
+			INFO("- Block size of block %" PRIu32 " changed\r\n", B2opt.BlockNum);
+			endClientInteraction(pIA, COAP_ERR_WRONG_OPTION);
+			return;
+		}
+		if ((pETagOpt == NULL ? 0 : pETagOpt->Length) != pXfer->ETagLength
+				|| (pETagOpt != NULL && coap_memcmp(pETagOpt->Value, pXfer->ETag, pXfer->ETagLength) != 0)) {
+			INFO("- ETag of block %" PRIu32 " differs, representation changed\r\n", B2opt.BlockNum);
+			endClientInteraction(pIA, COAP_ERR_WRONG_OPTION);
+			return;
+		}
+	}
+
+	if (B2opt.BlockNum != pXfer->NextToDeliver) {
+		CoAP_SetSleepInteraction(pIA, CLIENT_MAX_RESP_WAIT_TIME); //woken up by the preceding block
+		CoAP_EnqueueLastInteraction(pIA);
+		return;
+	}
+
+	if (B2opt.BlockNum == 0) {
+		CoAP_option_t* pSize2Opt = CoAP_FindOptionByNumber(pResp, OPT_NUM_SIZE2);
+		uint32_t size2 = 0;
+		if (pETagOpt != NULL && pETagOpt->Length <= sizeof(pXfer->ETag)) {
+			coap_memcpy(pXfer->ETag, pETagOpt->Value, pETagOpt->Length);
+			pXfer->ETagLength = (uint8_t) pETagOpt->Length;
+		}
+		pXfer->BlockSize = B2opt.BlockSize;
+		pXfer->NextToRequest = 1;
+		if (pXfer->BlockSize != 0 && pSize2Opt != NULL && CoAP_GetUintFromOption(pSize2Opt, &size2) == COAP_OK && size2 > 0) {
+			pXfer->LastBlock = (size2 - 1) / pXfer->BlockSize;
+		}
+	}
+
+	// 64 bit, so the checks below hold for any block number and size
+	uint64_t offset = (uint64_t) B2opt.BlockNum * pXfer->BlockSize;
+	if (offset + pResp->PayloadLength > UINT32_MAX) {
+		INFO("- Block %" PRIu32 " exceeds the maximum representation size\r\n", B2opt.BlockNum);
+		endClientInteraction(pIA, COAP_ERR_WRONG_OPTION);
+		return;
+	}
+	if (pXfer->Sink != NULL) {
+		res = pXfer->Sink(pIA->ReqHandle, (uint32_t) offset, pResp->Payload, pResp->PayloadLength, pIA->pUserData);
+	}
+	if (res == COAP_OK && pXfer->pBuf != NULL) {
+		if (offset + pResp->PayloadLength > pXfer->BufSize) {
+			INFO("- Response buffer too small for block %" PRIu32 "\r\n", B2opt.BlockNum);
+			res = COAP_ERR_OUT_OF_MEMORY;
+		} else {
+			coap_memcpy(&(pXfer->pBuf[offset]), pResp->Payload, pResp->PayloadLength);
+		}
+	}
+	if (res != COAP_OK) {
+		endClientInteraction(pIA, res);
+		return;
+	}
+	pXfer->Length = (uint32_t) offset + pResp->PayloadLength;
+	if (pXfer->pLength != NULL) {
+		*(pXfer->pLength) = pXfer->Length;
+	}
+	pXfer->NextToDeliver++;
+	wakeNextBlock(pXfer);
+
+	if (!B2opt.MoreFlag) {
+		endClientInteraction(pIA, COAP_OK); //last block
+		return;
+	}
+
+	// Without a known size only one block is requested at a time
+	uint32_t inFlight = pXfer->NextToRequest - pXfer->NextToDeliver;
+	while (inFlight == 0 || (pXfer->LastBlock != COAP_BLOCK_NUM_UNKNOWN && pXfer->NextToRequest <= pXfer->LastBlock && inFlight < pXfer->Window)) {
+		if (CoAP_StartBlockRequest(pIA, pXfer->NextToRequest) != COAP_OK) {
+			if (inFlight == 0) {
+				endClientInteraction(pIA, COAP_ERR_OUT_OF_MEMORY);
+				return;
+			}
+			break; //try again with next block received
+		}
+		pXfer->NextToRequest++;
+		inFlight++;
+	}
+
+	CoAP_DeleteInteraction(pIA);
+}
+
+// Passes a notification of an observed resource to the application and keeps the observation alive
+static void handleClientNotification(CoAP_Interaction_t* pIA) {
+	uint32_t maxAge = DEFAULT_MAX_AGE;
+	CoAP_option_t* pMaxAgeOpt = CoAP_FindOptionByNumber(pIA->pRespMsg, OPT_NUM_MAX_AGE);
+	if (pMaxAgeOpt != NULL) {
+		CoAP_GetUintFromOption(pMaxAgeOpt, &maxAge);
+	}
+
+	if (pIA->RespCB != NULL) {
+		pIA->RespCB(pIA->pRespMsg, pIA->pReqMsg, &(pIA->RemoteEp)); //call callback
+	}
+	if (pIA->ReqDoneCB != NULL) {
+		pIA->ReqDoneCB(pIA->ReqHandle, COAP_OK, pIA->pRespMsg, pIA->pUserData);
+	}
+	CoAP_free_Message(&(pIA->pRespMsg));
+
+	if (pIA->Canceled) { //by callback
+		CoAP_DeleteInteraction(pIA);
+		return;
+	}
+
+	pIA->HasDeadline = false; //registration done, observation lasts until canceled
+	pIA->State = COAP_STATE_OBSERVING;
+	pIA->ObsRefreshAt = CoAP.api.rtc1HzCnt() + maxAge + CLIENT_OBSERVE_REREGISTER_MARGIN;
+	pIA->SleepUntil = pIA->ObsRefreshAt; //woken up earlier by incoming notifications
+	CoAP_EnqueueLastInteraction(pIA);
+}
+
 static void handleClientInteraction(CoAP_Interaction_t* pIA) {
 
+	if (pIA->Canceled) {
+		CoAP_DeleteInteraction(pIA);
+		return;
+	}
+
+	if (pIA->HasDeadline && pIA->State != COAP_STATE_HANDLE_RESPONSE && timeAfter(CoAP.api.rtc1HzCnt(), pIA->Deadline)) {
+		INFO("- Request deadline reached, giving up! MiD: %d\r\n", pIA->pReqMsg->MessageID);
+		endClientInteraction(pIA, COAP_ERR_TIMEOUT);
+		return;
+	}
+
 	//------------------------------------------
 	if (pIA->State == COAP_STATE_READY_TO_REQUEST) {
 		//------------------------------------------
+		// respect the number of simultaneous outstanding interactions with one server (4.7 RFC7252)
+		if (pIA->Paced && CoAP_CountOutstandingRequests(pIA->socketHandle, &(pIA->RemoteEp)) >= NSTART) {
+			CoAP_WaitForFreeSlot(pIA);
+			return;
+		}
+		if (CoAP_AddOutstandingRequest(pIA) != COAP_OK) {
+			CoAP_EnqueueLastInteraction(pIA); //out of memory, try again later
+			return;
+		}
 		//o>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-		SendReq(pIA, COAP_STATE_WAITING_RESPONSE); //transmit response & move to next state
+		if (CoAP_SendMsg(pIA->pReqMsg, pIA->socketHandle, pIA->RemoteEp) == COAP_OK) { //transmit request & move to next state
+			if (pIA->pReqMsg->Type == CON) {
+				CoAP_EnableAckTimeout(pIA, pIA->RetransCounter); //enable timeout on waiting for ack
+			} else { //a NON request is outstanding until the endpoint could have received it at PROBING_RATE
+				pIA->InFlightUntil = CoAP.api.rtc1HzCnt() + 1 + CoAP_GetRawSizeOfMessage(pIA->pReqMsg) / PROBING_RATE;
+			}
+			pIA->State = COAP_STATE_WAITING_RESPONSE;
+			CoAP_EnqueueLastInteraction(pIA);
+		} else {
+			INFO("(!!!) Internal socket error on sending request! MiD: %d\r\n", pIA->pReqMsg->MessageID);
+			endClientInteraction(pIA, COAP_ERR_SOCKET);
+		}
 		//o>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 		//--------------------------------------------------
 	} else if (pIA->State == COAP_STATE_WAITING_RESPONSE) {
 		//--------------------------------------------------
+		if (pIA->InFlight && pIA->pReqMsg->Type == NON && timeAfter(CoAP.api.rtc1HzCnt(), pIA->InFlightUntil)) {
+			CoAP_EndOutstandingRequest(pIA); //still accepts a late response
+		}
 		CoAP_Result_t reqStatus = CheckReqStatus(pIA);
 		// INFO("Request Status: %s\n", ResultToString(reqStatus));
 		switch (reqStatus) {
@@ -643,45 +1126,63 @@ static void handleClientInteraction(CoAP_Interaction_t* pIA) {
 			} else {
 				INFO("(!!!) Internal socket error on sending request retry! MiD: %d\r\n",
 						pIA->pReqMsg->MessageID);
-				if (pIA->RespCB != NULL) {
-					pIA->RespCB(NULL, pIA->pReqMsg, &pIA->RemoteEp);
-				}
-				CoAP_DeleteInteraction(pIA);
+				endClientInteraction(pIA, COAP_ERR_SOCKET);
 			}
 			break;
 
 		case COAP_ERR_OUT_OF_ATTEMPTS: //check is resource is a lazy observe delete one
 		case COAP_ERR_REMOTE_RST:
 		case COAP_ERR_TIMEOUT:
+			endClientInteraction(pIA, reqStatus);
+			break;
 		default:
-			if (pIA->RespCB != NULL) {
-				pIA->RespCB(NULL, pIA->pReqMsg, &pIA->RemoteEp);
-			}
-			CoAP_DeleteInteraction(pIA);
+			endClientInteraction(pIA, COAP_ERR_UNKNOWN);
 		}
 		//--------------------------------------------------
 	} else if (pIA->State == COAP_STATE_HANDLE_RESPONSE) {
 		//--------------------------------------------------
-		DEBUG("- Got Response to Client request! -> calling Handler!\r\n");
-		if (pIA->RespCB != NULL) {
-			pIA->RespCB(pIA->pRespMsg, pIA->pReqMsg, &(pIA->RemoteEp)); //call callback
+		uint32_t seq;
+		if (pIA->pBlkXfer != NULL) {
+			handleClientBlockResponse(pIA);
+			return;
+		}
+		if (pIA->Observe && pIA->pRespMsg->Code >= RESP_FIRST_2_00 && pIA->pRespMsg->Code <= RESP_SUCCESS_CONTINUE_2_31
+				&& GetObserveOptionFromMsg(pIA->pRespMsg, &seq) == COAP_OK) {
+			DEBUG("- Got notification of observed resource! -> calling Handler!\r\n");
+			handleClientNotification(pIA);
+			return;
 		}
 
-//			pIA->State = COAP_STATE_FINISHED;
-//			CoAP_EnqueueLastInteraction(pIA);
-		CoAP_DeleteInteraction(
-				pIA); //direct delete, todo: eventually wait some time to send ACK instead of RST if out ACK to remote reponse was lost
+		DEBUG("- Got Response to Client request! -> calling Handler!\r\n");
+		//direct delete, todo: eventually wait some time to send ACK instead of RST if out ACK to remote reponse was lost
+		endClientInteraction(pIA, COAP_OK);
 
-	} else {
-		if (pIA->RespCB != NULL) {
-			pIA->RespCB(NULL, pIA->pReqMsg, &pIA->RemoteEp);
+		//--------------------------------------------------
+	} else if (pIA->State == COAP_STATE_OBSERVING) {
+		//--------------------------------------------------
+		if (timeAfter(CoAP.api.rtc1HzCnt(), pIA->ObsRefreshAt)) {
+			INFO("- Max-Age of observed resource expired, re-registering\r\n");
+			pIA->pReqMsg->MessageID = CoAP_GetNextMid(); //keep token (3.3.1 RFC7641)
+			pIA->RetransCounter = 0;
+			pIA->ReqConfirmState = NOT_SET;
+			pIA->ResConfirmState = NOT_SET;
+			pIA->State = COAP_STATE_READY_TO_REQUEST;
 		}
-		CoAP_DeleteInteraction(pIA); //unknown state, should not go here
+		CoAP_EnqueueLastInteraction(pIA);
+
+	} else {
+		endClientInteraction(pIA, COAP_ERR_UNKNOWN); //unknown state, should not go here
 	}
 }
 
 //must be called regularly
 void _rom CoAP_doWork() {
+	CoAP_ReclaimResources();
+	CoAP_PurgeIdleUploads();
+	CoAP_ExpireWaitingRequests();
+	CoAP_ResumeNotifyFanOuts();
+	CoAP_SendDueNotifications();
+
 	CoAP_Interaction_t* pIA = CoAP_GetLongestPendingInteraction();
 
 	if (pIA == NULL) {
@@ -726,5 +1227,6 @@ void _rom CoAP_doWork() {
 
 
 void _rom CoAP_ClearPendingInteractions() {
+    CoAP_ClearWaitingRequests();
     CoAP_ClearInteractions(&CoAP.pInteractions);
 }
@@ -29,8 +29,13 @@
 #define POSTPONE_WAIT_TIME_SEK (3)
 #define POSTPONE_MAX_WAIT_TIME (30)
 #define CLIENT_MAX_RESP_WAIT_TIME (45)
+#define CLIENT_OBSERVE_REREGISTER_MARGIN (5) //[s] grace time after Max-Age of an observed resource expired before re-registering
+#define DEFAULT_MAX_AGE (60) //[s] used if a response carries no Max-Age option
 
 #define USE_RFC7641_ADVANCED_TRANSMISSION (1) //Update representation of resource during retry of observe sendout
+#ifndef USE_MULTICAST_RESPONSE_SUPPRESSION
+#define USE_MULTICAST_RESPONSE_SUPPRESSION (0) //Drop a pending multicast response if an equivalent one of another group member has been overheard
+#endif
 
 #ifdef COAP_ACK_TIMEOUT
 #define ACK_TIMEOUT (COAP_ACK_TIMEOUT)
@@ -43,16 +48,60 @@
 #else
 #define MAX_RETRANSMIT (3)
 #endif
-#define NSTART (1) //todo implement
-#define DEFAULT_LEISURE (5) //todo implement
-#define PROBING_RATE (1)        //[client]
+#ifdef COAP_NSTART
+#define NSTART (COAP_NSTART) //max. outstanding client requests per endpoint
+#else
+#define NSTART (1)
+#endif
+#ifdef COAP_NOTIFY_FANOUT_BUDGET
+#define NOTIFY_FANOUT_BUDGET (COAP_NOTIFY_FANOUT_BUDGET) //max. notifications started per resource and call, the remaining ones follow in CoAP_doWork()
+#else
+#define NOTIFY_FANOUT_BUDGET (32)
+#endif
+#ifdef COAP_INFLIGHT_INDEX_SIZE
+#define INFLIGHT_INDEX_SIZE (COAP_INFLIGHT_INDEX_SIZE) //buckets of the outstanding client requests per endpoint, should be in the order of the number of servers
+#else
+#define INFLIGHT_INDEX_SIZE (16)
+#endif
+#ifdef COAP_OBSERVER_INDEX_SIZE
+#define OBSERVER_INDEX_SIZE (COAP_OBSERVER_INDEX_SIZE) //buckets of the observer index, should be in the order of the expected number of observers
+#else
+#define OBSERVER_INDEX_SIZE (128)
+#endif
+#ifdef COAP_RESOURCE_INDEX_SIZE
+#define RESOURCE_INDEX_SIZE (COAP_RESOURCE_INDEX_SIZE) //buckets of the resource index, should be in the order of the number of resources
+#else
+#define RESOURCE_INDEX_SIZE (64)
+#endif
+#ifdef COAP_OBSERVER_LOG_COMPACT_MIN
+#define OBSERVER_LOG_COMPACT_MIN (COAP_OBSERVER_LOG_COMPACT_MIN) //[records] the observer log is rewritten once it has this many records and more than twice the observers
+#else
+#define OBSERVER_LOG_COMPACT_MIN (64)
+#endif
+#ifdef COAP_DEFAULT_LEISURE
+#define DEFAULT_LEISURE (COAP_DEFAULT_LEISURE) //[s] upper bound of multicast response delay without group estimate
+#else
+#define DEFAULT_LEISURE (5)
+#endif
+#ifdef COAP_COALESCE_WINDOW
+#define COALESCE_WINDOW (COAP_COALESCE_WINDOW) //[s] equivalent requests to a resource with RES_FLAG_COALESCE share a 2.05 response this long
+#else
+#define COALESCE_WINDOW (1)
+#endif
+#define MAX_LEISURE (CLIENT_MAX_RESP_WAIT_TIME) //[s] a longer leisure period would outlast the clients waiting for a response
+#define PROBING_RATE (1)        //[client] [byte/s] average data rate to an endpoint that does not respond (4.7 RFC7252)
 
 
 typedef struct {
 	CoAP_Interaction_t *pInteractions;
 	CoAP_API_t api;
+	uint32_t McGroupSize;   //estimated number of multicast group members, 0 = unknown
+	uint32_t McLinkRate;    //[byte/s] estimated data rate of the multicast link
+	bool NotifyFanOutPending; //some resource has observers left to notify
 } CoAP_t;
 
 extern CoAP_t CoAP; //Stack global variables
 
+void CoAP_DropCoalescedResponse(CoAP_Res_t* pRes);
+
 #endif
@@ -33,6 +33,8 @@ static void _rom CoAP_InitToEmptyResetMsg(CoAP_Message_t* msg) {
 	msg->MessageID = 0;
 	msg->pOptionsList = NULL;
 	msg->Payload = NULL;
+	msg->PayloadMode = PAYLOAD_OWNED;
+	msg->pPayloadBuf = NULL;
 	CoAP_Token_t tok = {.Token= {0,0,0,0,0,0,0,0}, .Length = 0};
 	msg->Token = tok;
 	msg->Timestamp = 0;
@@ -51,17 +53,71 @@ bool CoAP_TokenEqual(CoAP_Token_t a, CoAP_Token_t b) {
 	return true;
 }
 
-void _rom CoAP_free_MsgPayload(CoAP_Message_t** Msg) {
-	return;
-	/*
-	if ((*Msg)->Payload == NULL)
-		return;
+CoAP_PayloadBuf_t* _rom CoAP_AllocPayloadBuf(uint16_t size) {
+	CoAP_PayloadBuf_t* pBuf = (CoAP_PayloadBuf_t*) CoAP_malloc(sizeof(CoAP_PayloadBuf_t) + TX_HEADROOM + size);
+	if (pBuf == NULL) {
+		return NULL;
+	}
+	pBuf->RefCnt = 1;
+	pBuf->Size = size;
+	return pBuf;
+}
 
-	// TODO: this will break us!!!
-	CoAP.api.free((void*) (*Msg)->Payload);
+void _rom CoAP_ReleasePayloadBuf(CoAP_PayloadBuf_t** ppBuf) {
+	if (*ppBuf != NULL && --((*ppBuf)->RefCnt) == 0) {
+		CoAP_free((void*) *ppBuf);
+	}
+	*ppBuf = NULL;
+}
+
+// Releases the payload buffer referenced by the message, borrowed and static payloads are left alone
+void _rom CoAP_free_MsgPayload(CoAP_Message_t** Msg) {
+	CoAP_ReleasePayloadBuf(&((*Msg)->pPayloadBuf));
 	(*Msg)->Payload = NULL;
+	(*Msg)->PayloadLength = 0;
 	(*Msg)->PayloadBufSize = 0;
-	*/
+	(*Msg)->PayloadMode = PAYLOAD_OWNED;
+}
+
+// Zero copy sending is possible if the whole headroom of the payload buffer is in front of the payload
+static bool _rom PayloadHasHeadroom(CoAP_Message_t* pMsg) {
+	return pMsg->PayloadMode == PAYLOAD_OWNED && pMsg->pPayloadBuf != NULL && pMsg->Payload == PAYLOAD_BUF_DATA(pMsg->pPayloadBuf);
+}
+
+// True if size bytes can be written to the payload without affecting other messages or caches
+bool _rom CoAP_PayloadIsWritable(CoAP_Message_t* pMsg, uint16_t size) {
+	return pMsg->PayloadMode == PAYLOAD_OWNED && pMsg->PayloadBufSize >= size
+			&& (pMsg->pPayloadBuf == NULL || pMsg->pPayloadBuf->RefCnt == 1);
+}
+
+// Lets the message refer to pPayload within pBuf (e.g. held by a cache) without copying it, the payload gets read only
+void _rom CoAP_SetSharedPayload(CoAP_Message_t* pMsg, CoAP_PayloadBuf_t* pBuf, uint8_t* pPayload, uint16_t length) {
+	pBuf->RefCnt++; //before release, pBuf may already be referenced by the msg
+	CoAP_ReleasePayloadBuf(&(pMsg->pPayloadBuf));
+	pMsg->pPayloadBuf = pBuf;
+	pMsg->Payload = pPayload;
+	pMsg->PayloadLength = length;
+	pMsg->PayloadBufSize = 0;
+	pMsg->PayloadMode = PAYLOAD_OWNED;
+}
+
+// Reference to the payload buffer of the message for sharing it, the payload gets read only.
+// NULL if the payload is not located in a payload buffer.
+CoAP_PayloadBuf_t* _rom CoAP_SharePayload(CoAP_Message_t* pMsg) {
+	if (pMsg->PayloadMode != PAYLOAD_OWNED || pMsg->pPayloadBuf == NULL) {
+		return NULL;
+	}
+	pMsg->pPayloadBuf->RefCnt++;
+	pMsg->PayloadBufSize = 0;
+	return pMsg->pPayloadBuf;
+}
+
+// Payload located in memory the message does not own, the buffer held by the message stays referenced
+void _rom CoAP_SetForeignPayload(CoAP_Message_t* pMsg, CoAP_PayloadMode_t mode, uint8_t* pPayload, uint16_t length) {
+	pMsg->Payload = pPayload;
+	pMsg->PayloadLength = length;
+	pMsg->PayloadBufSize = 0; //protect "external to msg" buffer
+	pMsg->PayloadMode = mode;
 }
 
 bool _rom CoAP_MsgIsRequest(CoAP_Message_t* pMsg) {
@@ -129,7 +185,66 @@ static uint16_t _rom CoAP_getRespMsgID(CoAP_Message_t* ReqMsg) {
 }
 
 CoAP_Message_t* _rom CoAP_AllocRespMsg(CoAP_Message_t* ReqMsg, CoAP_MessageCode_t Code, uint16_t PayloadMaxSize) {
-	return CoAP_CreateMessage(CoAP_getRespMsgType(ReqMsg), Code, CoAP_getRespMsgID(ReqMsg), NULL, 0, PayloadMaxSize, ReqMsg->Token);
+	return CoAP_CreateTxMessage(CoAP_getRespMsgType(ReqMsg), Code, CoAP_getRespMsgID(ReqMsg), NULL, 0, PayloadMaxSize, ReqMsg->Token);
+}
+
+// Like CoAP_CreateMessage(...) but with the payload in a payload buffer,
+// so the message is sent and shared without copying its payload
+CoAP_Message_t* _rom CoAP_CreateTxMessage(CoAP_MessageType_t Type,
+		CoAP_MessageCode_t Code,
+		uint16_t MessageID,
+		const uint8_t* pPayloadInitialContent,
+		uint16_t PayloadInitialContentLength,
+		uint16_t PayloadMaxSize,
+		CoAP_Token_t Token) {
+	CoAP_Message_t* pMsg;
+
+	if (PayloadInitialContentLength > PayloadMaxSize) {
+		ERROR("Initial Content bigger than field size!");
+		return NULL;
+	}
+	pMsg = CoAP_CreateMessage(Type, Code, MessageID, NULL, 0, 0, Token);
+	if (pMsg == NULL || PayloadMaxSize == 0) {
+		return pMsg;
+	}
+	if (CoAP_ReservePayload(pMsg, PayloadMaxSize) == NULL) {
+		CoAP_free_Message(&pMsg);
+		return NULL;
+	}
+	if (pPayloadInitialContent != NULL) {
+		coap_memcpy((void*) pMsg->Payload, (void*) pPayloadInitialContent, PayloadInitialContentLength);
+	}
+	pMsg->PayloadLength = PayloadInitialContentLength;
+	return pMsg;
+}
+
+uint8_t* _rom CoAP_ReservePayload(CoAP_Message_t* pMsgResp, uint16_t size) {
+	CoAP_PayloadBuf_t* pBuf;
+
+	if (size > MAX_PAYLOAD_SIZE) {
+		ERROR("payload > MAX_PAYLOAD_SIZE");
+		return NULL;
+	}
+	if (PayloadHasHeadroom(pMsgResp) && CoAP_PayloadIsWritable(pMsgResp, size)) {
+		return pMsgResp->Payload;
+	}
+	pBuf = CoAP_AllocPayloadBuf(size);
+	if (pBuf == NULL) {
+		return NULL;
+	}
+	CoAP_free_MsgPayload(&pMsgResp);
+	pMsgResp->pPayloadBuf = pBuf;
+	pMsgResp->Payload = PAYLOAD_BUF_DATA(pBuf);
+	pMsgResp->PayloadBufSize = size;
+	return pMsgResp->Payload;
+}
+
+CoAP_Result_t _rom CoAP_CommitPayload(CoAP_Message_t* pMsgResp, uint16_t length) {
+	if (!PayloadHasHeadroom(pMsgResp) || length > pMsgResp->PayloadBufSize) {
+		return COAP_ERR_ARGUMENT;
+	}
+	pMsgResp->PayloadLength = length;
+	return COAP_OK;
 }
 
 CoAP_Message_t* _rom CoAP_CreateMessage(CoAP_MessageType_t Type,
@@ -300,7 +415,8 @@ int CoAP_GetRawSizeOfMessage(CoAP_Message_t* Msg) {
 	return TotalMsgBytes;
 }
 
-static CoAP_Result_t _rom CoAP_BuildDatagram(uint8_t* destArr, uint16_t* pDestArrSize, CoAP_Message_t* Msg) {
+// Header, token, options and payload marker, i.e. everything in front of the payload
+static CoAP_Result_t _rom CoAP_BuildDatagramHead(uint8_t* destArr, uint16_t* pDestArrSize, CoAP_Message_t* Msg) {
 	uint16_t offset = 0;
 	uint8_t TokenLength;
 
@@ -342,9 +458,18 @@ static CoAP_Result_t _rom CoAP_BuildDatagram(uint8_t* destArr, uint16_t* pDestAr
 	if (Msg->PayloadLength != 0) {
 		destArr[offset] = 0xff; //Payload Marker
 		offset++;
+	}
 
-		coap_memcpy((void*) &(destArr[offset]), (void*) (Msg->Payload), Msg->PayloadLength);
+	*pDestArrSize = offset; // => Size of Datagram array without payload
+	return COAP_OK;
+}
 
+static CoAP_Result_t _rom CoAP_BuildDatagram(uint8_t* destArr, uint16_t* pDestArrSize, CoAP_Message_t* Msg) {
+	uint16_t offset = 0;
+
+	CoAP_BuildDatagramHead(destArr, &offset, Msg);
+	if (Msg->PayloadLength != 0) {
+		coap_memcpy((void*) &(destArr[offset]), (void*) (Msg->Payload), Msg->PayloadLength);
 		offset += Msg->PayloadLength;
 	}
 
@@ -394,6 +519,7 @@ CoAP_Result_t _rom CoAP_SendMsg(CoAP_Message_t* Msg, SocketHandle_t socketHandle
 
 	NetTransmit_fn SendPacket = pSocket->Tx;
 	uint8_t quickBuf[16]; //speed up sending of tiny messages
+	bool inPlace = false;
 
 	if (SendPacket == NULL) {
 		ERROR("SendPacket function not found! handle: %p\r\n", socketHandle);
@@ -406,7 +532,11 @@ CoAP_Result_t _rom CoAP_SendMsg(CoAP_Message_t* Msg, SocketHandle_t socketHandle
 
 	//Alloc raw memory
 	pked.size = CoAP_GetRawSizeOfMessage(Msg);
-	if (pked.size <= 16) { //for small messages don't take overhead of mem allocation
+	if (Msg->Code != EMPTY && Msg->PayloadLength != 0 && PayloadHasHeadroom(Msg)
+			&& pked.size - Msg->PayloadLength <= TX_HEADROOM) { //zero copy: head is encoded right in front of the payload
+		inPlace = true;
+		pked.pData = Msg->Payload - (pked.size - Msg->PayloadLength);
+	} else if (pked.size <= 16) { //for small messages don't take overhead of mem allocation
 		pked.pData = quickBuf;
 	} else {
 		pked.pData = (uint8_t*) CoAP_malloc(pked.size);
@@ -415,7 +545,12 @@ CoAP_Result_t _rom CoAP_SendMsg(CoAP_Message_t* Msg, SocketHandle_t socketHandle
 	}
 
 	// serialize msg
-	CoAP_BuildDatagram((pked.pData), &bytesToSend, Msg);
+	if (inPlace) {
+		CoAP_BuildDatagramHead((pked.pData), &bytesToSend, Msg);
+		bytesToSend += Msg->PayloadLength;
+	} else {
+		CoAP_BuildDatagram((pked.pData), &bytesToSend, Msg);
+	}
 
 	if (bytesToSend != pked.size) {
 		INFO("(!!!) Bytes to Send = %d estimated = %d\r\n", bytesToSend, CoAP_GetRawSizeOfMessage(Msg));
@@ -452,14 +587,14 @@ CoAP_Result_t _rom CoAP_SendMsg(CoAP_Message_t* Msg, SocketHandle_t socketHandle
 		Msg->Timestamp = CoAP.api.rtc1HzCnt();
 		CoAP_PrintMsg(Msg);
 		INFO("o>>>>>>>>>>OK>>>>>>>>>>\r\n");
-		if (pked.pData != quickBuf) {
+		if (pked.pData != quickBuf && !inPlace) {
 			CoAP_free(pked.pData);
 		}
 		return COAP_OK;
 	} else {
 		CoAP_PrintMsg(Msg);
 		INFO("o>>>>>>>>>>FAIL>>>>>>>>>>\r\n");
-		if (pked.pData != quickBuf) {
+		if (pked.pData != quickBuf && !inPlace) {
 			CoAP_free(pked.pData);
 		}
 		return COAP_ERR_NETWORK;
@@ -476,6 +611,17 @@ void _rom CoAP_InitIds() {
 	currToken = CoAP.api.rand() & 0xffu;
 }
 
+// State of the message ID and token generators, kept over warm restarts by CoAP_SnapshotState(...)
+void _rom CoAP_GetIds(uint16_t* pMid, uint8_t* pToken) {
+	*pMid = MId;
+	*pToken = currToken;
+}
+
+void _rom CoAP_SetIds(uint16_t mid, uint8_t token) {
+	MId = mid;
+	currToken = token;
+}
+
 uint16_t _rom CoAP_GetNextMid() {
 	MId++;
 	return MId;
@@ -495,15 +641,10 @@ CoAP_Result_t _rom CoAP_addNewPayloadToMessage(CoAP_Message_t* Msg, uint8_t* pDa
 	}
 
 	if (size) {
-		if (Msg->PayloadBufSize >= size) {
-			coap_memcpy(Msg->Payload, pData, size); //use existing buffer
-		} else { // will move payload buf outside of msg memory frame!
-			CoAP_free_MsgPayload(&Msg); //free old buffer
-			Msg->Payload = (uint8_t*) CoAP.api.malloc(size); //alloc a different new buffer
-			Msg->PayloadBufSize = size;
-
-			coap_memcpy(Msg->Payload, pData, size);
+		if (!CoAP_PayloadIsWritable(Msg, size) && CoAP_ReservePayload(Msg, size) == NULL) { // will move payload buf outside of msg memory frame!
+			return COAP_ERR_OUT_OF_MEMORY;
 		}
+		coap_memcpy(Msg->Payload, pData, size);
 	} else {
 		CoAP_free_MsgPayload(&Msg);
 	}
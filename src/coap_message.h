@@ -49,10 +49,20 @@ CoAP_Result_t CoAP_SendEmptyAck(uint16_t MessageID, SocketHandle_t socketHandle,
 CoAP_Result_t CoAP_SendEmptyRST(uint16_t MessageID, SocketHandle_t socketHandle, NetEp_t receiver);
 CoAP_Result_t CoAP_SendShortResp(CoAP_MessageType_t Type, CoAP_MessageCode_t Code, uint16_t MessageID, CoAP_Token_t token, SocketHandle_t socketHandle, NetEp_t receiver);
 CoAP_Message_t* CoAP_AllocRespMsg(CoAP_Message_t* ReqMsg, CoAP_MessageCode_t Code, uint16_t PayloadMaxSize);
+CoAP_Message_t* CoAP_CreateTxMessage(CoAP_MessageType_t Type, CoAP_MessageCode_t Code,
+		uint16_t MessageID, const uint8_t* pPayloadInitialContent, uint16_t PayloadInitialContentLength, uint16_t PayloadMaxSize, CoAP_Token_t Token);
 
 CoAP_Result_t CoAP_free_Message(CoAP_Message_t** Msg);
 void CoAP_free_MsgPayload(CoAP_Message_t** Msg);
 
+#define PAYLOAD_BUF_DATA(pBuf) (&((pBuf)->Data[TX_HEADROOM]))
+CoAP_PayloadBuf_t* CoAP_AllocPayloadBuf(uint16_t size);
+void CoAP_ReleasePayloadBuf(CoAP_PayloadBuf_t** ppBuf);
+bool CoAP_PayloadIsWritable(CoAP_Message_t* pMsg, uint16_t size);
+void CoAP_SetSharedPayload(CoAP_Message_t* pMsg, CoAP_PayloadBuf_t* pBuf, uint8_t* pPayload, uint16_t length);
+CoAP_PayloadBuf_t* CoAP_SharePayload(CoAP_Message_t* pMsg);
+void CoAP_SetForeignPayload(CoAP_Message_t* pMsg, CoAP_PayloadMode_t mode, uint8_t* pPayload, uint16_t length);
+
 bool CoAP_MsgIsRequest(CoAP_Message_t* pMsg);
 bool CoAP_MsgIsResponse(CoAP_Message_t* pMsg);
 bool CoAP_MsgIsOlderThan(CoAP_Message_t* pMsg, uint32_t timespan);
@@ -67,6 +77,8 @@ CoAP_Result_t CoAP_addTextPayload(CoAP_Message_t* Msg, char* PayloadStr);
 CoAP_Result_t CoAP_addNewPayloadToMessage(CoAP_Message_t* Msg, uint8_t* pData, uint16_t size);
 
 void CoAP_InitIds();
+void CoAP_GetIds(uint16_t* pMid, uint8_t* pToken);
+void CoAP_SetIds(uint16_t mid, uint8_t token);
 uint16_t CoAP_GetNextMid();
 CoAP_Token_t CoAP_GenerateToken();
 const char *CoAP_CodeName(CoAP_MessageCode_t code);
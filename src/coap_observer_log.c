@@ -0,0 +1,430 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#include <inttypes.h>
+#include "coap.h"
+#include "coap_mem.h"
+
+static const uint8_t LogMagic[] = {'C', 'O', 'B', 'L', OBSERVER_LOG_VERSION};
+#define LOG_HEADER_SIZE (sizeof(LogMagic) + 4u) //magic and generation
+
+static CoAP_ObserverLogBackend_t Backend;
+static bool BackendSet = false;
+static bool Replaying = false;   //observers restored from the log are not logged again
+static uint8_t ActiveRegion = 0; //records are appended to this region
+static uint32_t Generation = 0;  //of the image in the active region, the newer intact image wins on start
+static uint32_t LogRecords = 0;  //records in the active region
+static uint32_t LiveObservers = 0;
+static bool LogFull = false;     //the observers did not fit into a region, not compacted again until one is removed
+
+static uint16_t _rom Crc16Append(uint16_t crc, const uint8_t* pData, uint32_t len) {
+	uint8_t i;
+
+	while (len--) {
+		crc ^= (uint16_t) (*pData++) << 8u;
+		for (i = 0; i < 8; i++) {
+			crc = (crc & 0x8000u) ? (uint16_t) ((crc << 1u) ^ 0x1021u) : (uint16_t) (crc << 1u);
+		}
+	}
+	return crc;
+}
+
+// CRC-16/CCITT-FALSE
+uint16_t _rom CoAP_Crc16(const uint8_t* pData, uint32_t len) {
+	return Crc16Append(0xffff, pData, len);
+}
+
+// Appends to a region, pImageCrc (if not NULL) follows all bytes written to a new image
+static bool _rom Append(uint8_t region, const uint8_t* pData, uint32_t len, uint16_t* pImageCrc) {
+	if (pImageCrc != NULL) {
+		*pImageCrc = Crc16Append(*pImageCrc, pData, len);
+	}
+	return Backend.append(region, pData, len, Backend.pCtx);
+}
+
+// Stores endpoint, socket, token and resource URI of an observer as options,
+// the observe options of the observer (e.g. uri-query) are only added if withObserveOptions is set
+CoAP_Result_t _rom CoAP_ObserverToOptions(CoAP_Res_t* pRes, CoAP_Observer_t* pObserver, bool withObserveOptions, CoAP_option_t** pOptList) {
+	CoAP_Result_t res;
+	CoAP_option_t* pOpt;
+
+	res = CoAP_AppendOptionToList(pOptList, OPT_NUM_URI_HOST, (uint8_t*) &(pObserver->Ep), sizeof(NetEp_t)); //IP+Port of external Observer
+	if (res == COAP_OK) {
+		res = CoAP_AppendOptionToList(pOptList, OPT_NUM_URI_PORT, (uint8_t*) &(pObserver->socketHandle), sizeof(SocketHandle_t)); //socketHandle as pseudo "Port"
+	}
+	if (res == COAP_OK) {
+		res = CoAP_AppendOptionToList(pOptList, OPT_NUM_LOBARO_TOKEN_SAVE, (uint8_t*) &(pObserver->Token), sizeof(CoAP_Token_t));
+	}
+	for (pOpt = pRes->pUri; res == COAP_OK && pOpt != NULL; pOpt = pOpt->next) {
+		res = CoAP_CopyOptionToList(pOptList, pOpt);
+	}
+	for (pOpt = pObserver->pOptList; withObserveOptions && res == COAP_OK && pOpt != NULL; pOpt = pOpt->next) {
+		res = CoAP_CopyOptionToList(pOptList, pOpt);
+	}
+
+	if (res != COAP_OK) {
+		CoAP_FreeOptionList(pOptList);
+	}
+	return res;
+}
+
+// Counterpart of CoAP_ObserverToOptions(...), returns the observed resource or NULL if it does not exist (anymore)
+CoAP_Res_t* _rom CoAP_ObserverFromOptions(CoAP_option_t* pOptList, CoAP_Observer_t* pObserver) {
+	CoAP_option_t* pOpt;
+
+	for (pOpt = pOptList; pOpt != NULL; pOpt = pOpt->next) {
+		switch (pOpt->Number) {
+			case OPT_NUM_URI_HOST:
+				coap_memcpy((void*) &(pObserver->Ep), pOpt->Value, pOpt->Length < sizeof(NetEp_t) ? pOpt->Length : sizeof(NetEp_t));
+				break;
+			case OPT_NUM_URI_PORT: //"hack" netID, remove if netID removal cleanup done!
+				coap_memcpy((void*) &(pObserver->socketHandle), pOpt->Value, pOpt->Length < sizeof(SocketHandle_t) ? pOpt->Length : sizeof(SocketHandle_t));
+				break;
+			case OPT_NUM_URI_PATH:
+				break; //dont copy path to observe struct (it's connected to its resource anyway!)
+			case OPT_NUM_LOBARO_TOKEN_SAVE:
+				coap_memcpy((void*) &(pObserver->Token), pOpt->Value, pOpt->Length < sizeof(CoAP_Token_t) ? pOpt->Length : sizeof(CoAP_Token_t));
+				break;
+			default:
+				CoAP_CopyOptionToList(&(pObserver->pOptList), pOpt);
+				break;
+		}
+	}
+
+	return CoAP_FindResourceByUri(NULL, pOptList);
+}
+
+static bool _rom AppendRecord(uint8_t region, uint8_t type, CoAP_Res_t* pRes, CoAP_Observer_t* pObserver, uint16_t* pImageCrc) {
+	CoAP_option_t* pOptList = NULL;
+	uint16_t len;
+	uint16_t crc;
+	uint8_t* pRec;
+	bool ok = false;
+
+	if (CoAP_ObserverToOptions(pRes, pObserver, type == OBSERVER_LOG_REGISTER, &pOptList) != COAP_OK) {
+		return false;
+	}
+
+	len = CoAP_NeededMem4PackOptions(pOptList);
+	pRec = len <= OBSERVER_LOG_MAX_RECORD ? (uint8_t*) CoAP_malloc(len + 5u) : NULL;
+	if (pRec != NULL) {
+		pRec[0] = type;
+		pRec[1] = (uint8_t) (len >> 8u);
+		pRec[2] = (uint8_t) len;
+		pack_OptionsFromList(&pRec[3], &len, pOptList);
+		crc = CoAP_Crc16(pRec, len + 3u);
+		pRec[len + 3u] = (uint8_t) (crc >> 8u);
+		pRec[len + 4u] = (uint8_t) crc;
+		ok = Append(region, pRec, len + 5u, pImageCrc);
+		CoAP_free(pRec);
+	}
+
+	CoAP_FreeOptionList(&pOptList);
+	return ok;
+}
+
+static bool _rom AppendCommit(uint8_t region, uint16_t imageCrc) {
+	uint8_t rec[7] = { OBSERVER_LOG_COMMIT, 0, 2, (uint8_t) (imageCrc >> 8u), (uint8_t) imageCrc };
+	uint16_t crc = CoAP_Crc16(rec, 5);
+
+	rec[5] = (uint8_t) (crc >> 8u);
+	rec[6] = (uint8_t) crc;
+	return Append(region, rec, sizeof(rec), NULL);
+}
+
+// Checks the image of a region against the CRC in its commit record,
+// *pGeneration is set to the generation of an intact image
+static bool _rom ImageIntact(uint8_t region, uint32_t* pGeneration) {
+	uint8_t buf[32];
+	uint16_t crc;
+	uint32_t offset = LOG_HEADER_SIZE;
+
+	if (Backend.read(region, 0, buf, LOG_HEADER_SIZE, Backend.pCtx) != LOG_HEADER_SIZE || memcmp(buf, LogMagic, sizeof(LogMagic)) != 0) {
+		return false;
+	}
+	*pGeneration = (uint32_t) buf[5] << 24 | (uint32_t) buf[6] << 16 | (uint32_t) buf[7] << 8 | buf[8];
+	crc = CoAP_Crc16(buf, LOG_HEADER_SIZE);
+
+	while (true) {
+		uint16_t len;
+		uint32_t pos, n = Backend.read(region, offset, buf, 7, Backend.pCtx);
+
+		if (n < 3) {
+			return false; //no commit record
+		}
+		len = (uint16_t) ((buf[1] << 8u) | buf[2]);
+		if (buf[0] == OBSERVER_LOG_COMMIT) {
+			return n == 7 && len == 2 && CoAP_Crc16(buf, 5) == (uint16_t) ((buf[5] << 8u) | buf[6])
+					&& crc == (uint16_t) ((buf[3] << 8u) | buf[4]);
+		}
+		if (len > OBSERVER_LOG_MAX_RECORD || (buf[0] != OBSERVER_LOG_REGISTER && buf[0] != OBSERVER_LOG_DEREGISTER)) {
+			return false;
+		}
+		for (pos = 0; pos < len + 5u; pos += n) {
+			n = len + 5u - pos < sizeof(buf) ? len + 5u - pos : sizeof(buf);
+			if (Backend.read(region, offset + pos, buf, n, Backend.pCtx) != n) {
+				return false;
+			}
+			crc = Crc16Append(crc, buf, n);
+		}
+		offset += len + 5u;
+	}
+}
+
+// Writes one register record per current observer as new image to the inactive region.
+// The active region is only given up once the new image is complete and reads back intact,
+// an image that cannot take all observers is never committed.
+static void _rom Compact() {
+	uint8_t region = ActiveRegion ^ 1u;
+	uint8_t head[LOG_HEADER_SIZE];
+	uint16_t crc = 0xffff;
+	uint32_t generation = Generation + 1u;
+	uint32_t records = 0;
+	bool full = false;
+	CoAP_Res_t* pRes;
+	CoAP_Observer_t* pObserver;
+
+	coap_memcpy(head, LogMagic, sizeof(LogMagic));
+	head[5] = (uint8_t) (generation >> 24u);
+	head[6] = (uint8_t) (generation >> 16u);
+	head[7] = (uint8_t) (generation >> 8u);
+	head[8] = (uint8_t) generation;
+
+	LiveObservers = 0;
+	if (!Backend.erase(region, Backend.pCtx) || !Append(region, head, sizeof(head), &crc)) {
+		ERROR("- Observer log could not be rewritten\r\n");
+		return;
+	}
+
+	for (pRes = CoAP_GetResourceList(); pRes != NULL; pRes = pRes->next) {
+		for (pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) {
+			LiveObservers++;
+			if (!full && !AppendRecord(region, OBSERVER_LOG_REGISTER, pRes, pObserver, &crc)) {
+				full = true;
+			}
+			records++;
+		}
+	}
+
+	if (full) {
+		ERROR("- Observer log full, %"PRIu32" observers do not fit, old log kept\r\n", LiveObservers);
+		LogFull = true;
+		return;
+	}
+	if (!AppendCommit(region, crc) || !ImageIntact(region, &generation) || generation != Generation + 1u) {
+		ERROR("- Observer log compaction failed, old log kept\r\n");
+		return;
+	}
+	Backend.erase(ActiveRegion, Backend.pCtx);
+	ActiveRegion = region;
+	Generation = generation;
+	LogRecords = records;
+	LogFull = false;
+	INFO("Observer log compacted: %"PRIu32" observers\r\n", LiveObservers);
+}
+
+static void _rom LogObserver(uint8_t type, CoAP_Res_t* pRes, CoAP_Observer_t* pObserver) {
+	if (type == OBSERVER_LOG_DEREGISTER) {
+		LogFull = false; //the observers may fit again
+	}
+	if (!AppendRecord(ActiveRegion, type, pRes, pObserver, NULL)) {
+		if (!LogFull) {
+			Compact(); //log full, the compacted log has the change already
+		}
+		return;
+	}
+	LogRecords++;
+	if (!LogFull && LogRecords >= OBSERVER_LOG_COMPACT_MIN && LogRecords > 2 * LiveObservers) {
+		Compact();
+	}
+}
+
+void _rom CoAP_LogObserverRegistered(CoAP_Res_t* pRes, CoAP_Observer_t* pObserver, bool isNew) {
+	if (!BackendSet || Replaying) {
+		return;
+	}
+	if (isNew) {
+		LiveObservers++;
+	}
+	LogObserver(OBSERVER_LOG_REGISTER, pRes, pObserver);
+}
+
+void _rom CoAP_LogObserverDeregistered(CoAP_Res_t* pRes, CoAP_Observer_t* pObserver) {
+	if (!BackendSet || Replaying) {
+		return;
+	}
+	if (LiveObservers > 0) {
+		LiveObservers--;
+	}
+	LogObserver(OBSERVER_LOG_DEREGISTER, pRes, pObserver);
+}
+
+static void _rom ApplyRecord(uint8_t type, uint8_t* pData, uint16_t len) {
+	CoAP_option_t* pOptList = NULL;
+	uint8_t* pPayload;
+	CoAP_Observer_t* pObserver;
+	CoAP_Observer_t* pExisting;
+	CoAP_Res_t* pRes;
+
+	if (parse_OptionsFromRaw(pData, len, &pPayload, &pOptList) != COAP_OK) {
+		CoAP_FreeOptionList(&pOptList);
+		return;
+	}
+
+	pObserver = CoAP_AllocNewObserver();
+	if (pObserver == NULL) {
+		ERROR("- Observer log replay out of memory\r\n");
+		CoAP_FreeOptionList(&pOptList);
+		return;
+	}
+	pRes = CoAP_ObserverFromOptions(pOptList, pObserver);
+	CoAP_FreeOptionList(&pOptList);
+	if (pRes == NULL) {
+		INFO("- Observed Resource not found!\r\n");
+		CoAP_FreeObserver(&pObserver);
+		return;
+	}
+
+	pExisting = CoAP_FindObserver(pRes, pObserver->socketHandle, &(pObserver->Ep));
+	if (type == OBSERVER_LOG_DEREGISTER) {
+		if (pExisting != NULL && CoAP_TokenEqual(pExisting->Token, pObserver->Token)) {
+			CoAP_DetachObserver(pExisting, true);
+		}
+		CoAP_FreeObserver(&pObserver);
+		return;
+	}
+
+	//a later registration of the same endpoint replaces the earlier one
+	if (pExisting != NULL) {
+		CoAP_DetachObserver(pExisting, true);
+	}
+	CoAP_ParseObserveAttributes(pObserver);
+	pObserver->LastNotify = CoAP.api.rtc1HzCnt();
+	CoAP_AttachObserver(pRes, pObserver);
+}
+
+// Replays all intact records of the active region, returns false if its log is damaged.
+// Reading stops at a record with an implausible header, the rest of the log is lost then.
+static bool _rom Replay() {
+	uint32_t offset = LOG_HEADER_SIZE;
+	bool intact = true;
+
+	Replaying = true;
+	while (true) {
+		uint8_t recHead[3];
+		uint16_t len;
+		uint8_t* pRec;
+		uint32_t n = Backend.read(ActiveRegion, offset, recHead, sizeof(recHead), Backend.pCtx);
+
+		if (n == 0) {
+			break; //end of log
+		}
+		len = (uint16_t) ((recHead[1] << 8u) | recHead[2]);
+		if (n != sizeof(recHead) || len > OBSERVER_LOG_MAX_RECORD
+				|| (recHead[0] != OBSERVER_LOG_REGISTER && recHead[0] != OBSERVER_LOG_DEREGISTER && recHead[0] != OBSERVER_LOG_COMMIT)) {
+			intact = false;
+			break;
+		}
+
+		pRec = (uint8_t*) CoAP_malloc(len + 5u);
+		if (pRec == NULL) {
+			ERROR("- Observer log replay out of memory\r\n");
+			intact = false; //rewritten with the observers restored so far
+			break;
+		}
+		if (Backend.read(ActiveRegion, offset, pRec, len + 5u, Backend.pCtx) != len + 5u) {
+			CoAP_free(pRec);
+			intact = false; //incomplete last record
+			break;
+		}
+		if (CoAP_Crc16(pRec, len + 3u) == (uint16_t) ((pRec[len + 3u] << 8u) | pRec[len + 4u])) {
+			if (pRec[0] != OBSERVER_LOG_COMMIT) {
+				ApplyRecord(pRec[0], &pRec[3], len);
+			}
+		} else {
+			INFO("- Observer log record at offset %"PRIu32" damaged, skipped\r\n", offset);
+			intact = false;
+		}
+		CoAP_free(pRec);
+
+		LogRecords++;
+		offset += len + 5u;
+	}
+	Replaying = false;
+
+	if (!intact) {
+		INFO("- Observer log damaged, rewriting it\r\n");
+	}
+	return intact;
+}
+
+CoAP_Result_t _rom CoAP_SetObserverLog(const CoAP_ObserverLogBackend_t* pBackend) {
+	CoAP_Res_t* pRes;
+	CoAP_Observer_t* pObserver;
+	uint32_t generation0 = 0, generation1 = 0;
+	bool intact0, intact1;
+
+	if (pBackend == NULL) {
+		BackendSet = false;
+		return COAP_OK;
+	}
+	if (pBackend->append == NULL || pBackend->read == NULL || pBackend->erase == NULL) {
+		return COAP_ERR_ARGUMENT;
+	}
+
+	Backend = *pBackend;
+	BackendSet = true;
+	LogRecords = 0;
+	LiveObservers = 0;
+	LogFull = false;
+
+	// the newer intact image, there are two after power loss between a compaction and the erasure of the old image
+	intact0 = ImageIntact(0, &generation0);
+	intact1 = ImageIntact(1, &generation1);
+	if (!intact0 && !intact1) {
+		INFO("- No observer log found\r\n");
+		ActiveRegion = 1; //first image goes to region 0
+		Generation = 0;
+		Compact();
+		return CoAP_GetObserverLogStatus();
+	}
+	ActiveRegion = (intact1 && (!intact0 || (int32_t) (generation1 - generation0) > 0)) ? 1 : 0;
+	Generation = ActiveRegion == 1 ? generation1 : generation0;
+
+	if (!Replay()) {
+		Compact();
+		return CoAP_GetObserverLogStatus();
+	}
+
+	for (pRes = CoAP_GetResourceList(); pRes != NULL; pRes = pRes->next) {
+		for (pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) {
+			LiveObservers++;
+		}
+	}
+	if (LogRecords >= OBSERVER_LOG_COMPACT_MIN && LogRecords > 2 * LiveObservers) {
+		Compact();
+	}
+	return CoAP_GetObserverLogStatus();
+}
+
+CoAP_Result_t _rom CoAP_GetObserverLogStatus() {
+	return LogFull ? COAP_ERR_OUT_OF_MEMORY : COAP_OK;
+}
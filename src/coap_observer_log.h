@@ -0,0 +1,44 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef COAP_OBSERVER_LOG_H_
+#define COAP_OBSERVER_LOG_H_
+
+// Region layout: magic "COBL", version byte, generation (4, big endian), then records of
+// [type (1)][length (2)][observer packed as options (length)][CRC16 over type, length and options (2)].
+// The image written by a compaction ends with a commit record holding the CRC16 of all bytes before it,
+// records appended later follow the commit record. A region without intact image is not used.
+#define OBSERVER_LOG_VERSION    (2)
+#define OBSERVER_LOG_MAX_RECORD (1024) //[byte] longer records are taken as corruption
+
+#define OBSERVER_LOG_REGISTER   (1)
+#define OBSERVER_LOG_DEREGISTER (2)
+#define OBSERVER_LOG_COMMIT     (3)
+
+uint16_t CoAP_Crc16(const uint8_t* pData, uint32_t len);
+
+CoAP_Result_t CoAP_ObserverToOptions(CoAP_Res_t* pRes, CoAP_Observer_t* pObserver, bool withObserveOptions, CoAP_option_t** pOptList);
+CoAP_Res_t* CoAP_ObserverFromOptions(CoAP_option_t* pOptList, CoAP_Observer_t* pObserver);
+
+void CoAP_LogObserverRegistered(CoAP_Res_t* pRes, CoAP_Observer_t* pObserver, bool isNew);
+void CoAP_LogObserverDeregistered(CoAP_Res_t* pRes, CoAP_Observer_t* pObserver);
+
+#endif /* COAP_OBSERVER_LOG_H_ */
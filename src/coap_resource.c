@@ -24,10 +24,50 @@
 #include <inttypes.h>
 
 static CoAP_Res_t* pResList = NULL;
+static CoAP_Res_t* pResListTail = NULL;
 static uint32_t ResListMembers = 0;
 
-uint8_t TempPage[2048];
+// Resources are indexed by a hash of their uri-path, requests are routed without walking the list
+static CoAP_Res_t* ResIndex[RESOURCE_INDEX_SIZE];
+// Resources with "{name}" or "*" segments are tried in order of creation if no exact match exists
+static CoAP_Res_t* pPatternRes = NULL;
+static CoAP_Res_t** ppPatternResTail = &pPatternRes;
 
+//removed resources (chained by nextInIndex) waiting to be released, see CoAP_ReclaimResources()
+static CoAP_Res_t* pRetiredRes = NULL;
+
+CoAP_Res_t* _rom CoAP_GetResourceList() {
+	return pResList;
+}
+
+// Packs all observers into pDest (one option set with payload marker per observer),
+// only the needed size is returned if pDest is NULL
+static CoAP_Result_t _rom PackObservers(uint8_t* pDest, uint32_t* pSize) {
+	CoAP_Res_t* pRes;
+	CoAP_Observer_t* pObserver;
+	CoAP_option_t* pOptList = NULL;
+	uint16_t BytesWritten;
+
+	*pSize = 0;
+	for (pRes = pResList; pRes != NULL; pRes = pRes->next) { //iterate over all resources
+		for (pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) { //iterate over all observers of this resource
+			if (CoAP_ObserverToOptions(pRes, pObserver, true, &pOptList) != COAP_OK) {
+				return COAP_ERR_OUT_OF_MEMORY;
+			}
+
+			if (pDest == NULL) {
+				BytesWritten = CoAP_NeededMem4PackOptions(pOptList);
+			} else {
+				pack_OptionsFromList(&pDest[*pSize], &BytesWritten, pOptList);
+				pDest[*pSize + BytesWritten] = 0xff; //add pseudo "payload"-marker to make reparsing easier
+			}
+			*pSize += BytesWritten + 1;
+
+			CoAP_FreeOptionList(&pOptList); //free options
+		}
+	}
+	return COAP_OK;
+}
 
 /**
  * Save resource and observe information as options to non volatile storage
@@ -36,141 +76,378 @@ uint8_t TempPage[2048];
  * @return
  */
 CoAP_Result_t _rom CoAP_NVsaveObservers(WriteBuf_fn writeBufFn) {
-	CoAP_Res_t* pList = pResList; //List of internal resources
-	CoAP_option_t* pOptList = NULL;
-	uint8_t* pTempPage = TempPage;
 	uint32_t TotalPageBytes = 0;
-	bool UriPathHasBeenEncoded = false; //uri path options are only encoded one time for each resource and not for every observer
+	uint8_t* pPage;
+	CoAP_Result_t res;
 
-	while (pList != NULL) { //iterate over all resources
-		UriPathHasBeenEncoded = false; //reset for next resource
-
-		if (pList->pListObservers != NULL) { //Resource has active observers
+	if ((res = PackObservers(NULL, &TotalPageBytes)) != COAP_OK) {
+		return res;
+	}
+	pPage = (uint8_t*) CoAP.api.malloc(TotalPageBytes + 1);
+	if (pPage == NULL) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	if ((res = PackObservers(pPage, &TotalPageBytes)) == COAP_OK) {
+		pPage[TotalPageBytes++] = 0xff; //empty dataset ends the page, like erased flash
+		INFO("writing: %"PRIu32" bytes to flash\r\n", TotalPageBytes);
+		writeBufFn(pPage, TotalPageBytes);
+	}
+	CoAP.api.free(pPage);
+	return res;
+}
 
-			CoAP_Observer_t* pObserverList = pList->pListObservers;
+/**
+ * Load and attach observers
+ * @param pRawPage pointer to the non volatile memory to load the observer from
+ * @param size bytes readable at pRawPage, e.g. the size written by CoAP_NVsaveObservers(...) or of the flash page
+ * @return
+ */
+CoAP_Result_t _rom CoAP_NVloadObservers(uint8_t* pRawPage, uint32_t size) {
+	CoAP_option_t* pOptList = NULL;
+	CoAP_Res_t* pRes = NULL;
+	uint8_t* pEnd = pRawPage + size;
 
-			while (pObserverList != NULL) { //iterate over all observers of this resource
+	//stops at the first empty dataset (e.g. erased flash), at the end of the page or if the last dataset had no "payload-marker"
+	while (pRawPage != NULL && pRawPage < pEnd
+			&& parse_OptionsFromRaw(pRawPage, (uint16_t) (pEnd - pRawPage > 0xffff ? 0xffff : pEnd - pRawPage), &pRawPage, &pOptList) == COAP_OK
+			&& pOptList != NULL) { //finds "payload-marker" and sets pointer to its beginning. in this context this is the next stored observe dataset
+		INFO("found flash stored options:\r\n");
+		CoAP_printOptionsList(pOptList);
 
-				//Store Uri of external Oberserver as option
-				CoAP_AppendOptionToList(&pOptList, OPT_NUM_URI_HOST, (uint8_t*) &(pObserverList->Ep), sizeof(NetEp_t)); //IP+Port of external Observer
-				CoAP_AppendOptionToList(&pOptList, OPT_NUM_URI_PORT, (uint8_t*) &(pObserverList->socketHandle), sizeof(SocketHandle_t)); //socketHandle as pseudo "Port"
+		//(re)create observer for resource
+		CoAP_Observer_t* pNewObserver = CoAP_AllocNewObserver();
 
-				CoAP_option_t* pOptionsTemp = pList->pUri;
+		if (pNewObserver == NULL) {
+			INFO("pNewObserver out of Mem!\r\n");
+			CoAP_FreeOptionList(&pOptList);
+			//todo: do anything different to simple continue
+			continue;
+		}
 
-				//Copy uri-path option of resource
-				if (UriPathHasBeenEncoded == false) {
-					while (pOptionsTemp != NULL) {
-						CoAP_CopyOptionToList(&pOptList, pOptionsTemp); //todo check for sufficent memory or implement cross linking to save memory
-						pOptionsTemp = pOptionsTemp->next;
-					}
-					UriPathHasBeenEncoded = true; //store uri path of resource only once
-				}
+		//Map Stored option to resource
+		pRes = CoAP_ObserverFromOptions(pOptList, pNewObserver);
+		CoAP_FreeOptionList(&pOptList); //free temp options
+		if (pRes == NULL) {
+			INFO("- Observed Resource not found!\r\n");
+			//todo: del observe res?
+			CoAP_FreeObserver(&pNewObserver);
+			continue;
+		}
 
-				//Also copy any other options of observe structure (e.g. uri-query)
-				pOptionsTemp = pObserverList->pOptList;
-				while (pOptionsTemp != NULL) {
-					CoAP_CopyOptionToList(&pOptList, pOptionsTemp); //todo check for sufficent memory or implement cross linking to save memory
-					pOptionsTemp = pOptionsTemp->next;
-				}
+		//attach observer to resource
+		CoAP_ParseObserveAttributes(pNewObserver);
+		pNewObserver->LastNotify = CoAP.api.rtc1HzCnt();
+		CoAP_AttachObserver(pRes, pNewObserver);
+	}
 
-				CoAP_AppendOptionToList(&pOptList, OPT_NUM_LOBARO_TOKEN_SAVE, (uint8_t*) &(pObserverList->Token), 8);
+	CoAP_PrintAllResources();
+	//CoAP_FindResourceByUri
+	return COAP_OK;
+}
 
-				uint16_t BytesWritten = 0;
-				pack_OptionsFromList(pTempPage, &BytesWritten, pOptList);
 
-				pTempPage[BytesWritten] = 0xff; //add pseudo "payload"-marker to make reparsing easier
-				TotalPageBytes += BytesWritten + 1;
-				pTempPage = pTempPage + TotalPageBytes;
+// One link of the cached /.well-known/core document
+typedef struct {
+	CoAP_Res_t* pRes;
+	uint32_t Offset;
+	uint32_t Length;
+} WellKnownLink_t;
+
+// Filtered document of a recent query, valid until the links are rebuilt
+typedef struct {
+	CoAP_option_t* pKey; //Uri-Path, Uri-Query and Accept of the request, NULL = unused
+	uint32_t KeyHash;
+	uint32_t Size;
+	uint32_t ResumeLink; //first link of the block after the last one generated
+	uint32_t ResumePos; //position of ResumeLink in the filtered document
+	uint32_t LastUse;
+	uint32_t ETag; //hash of the links and the query
+} WellKnownQuery_t;
+
+#define WELL_KNOWN_QUERY_ENTRIES (4)
+
+// Links of all resources (without separators), rebuilt if LinkDocGeneration has changed
+static struct {
+	uint32_t Generation; //0 = not built
+	char* pDoc;
+	WellKnownLink_t* pLinks;
+	uint32_t Count;
+	uint32_t Hash; //of the links, the same links give the same ETags in every run
+	WellKnownQuery_t Queries[WELL_KNOWN_QUERY_ENTRIES];
+	uint32_t QueryUseCnt;
+} WellKnown;
+
+static uint32_t LinkDocGeneration = 1; //changed with every resource or link attribute change
+
+static uint32_t _rom PutLinkStr(char* pDst, uint32_t pos, const char* pStr, uint32_t len) {
+	if (pDst != NULL) {
+		coap_memcpy(&pDst[pos], pStr, len);
+	}
+	return len;
+}
 
-				INFO("Wrote Observer Option List:\r\n");
-				CoAP_printOptionsList(pOptList);
+// Writes the link (RFC6690) of a resource to pDst if not NULL, returns its length
+static uint32_t _rom PutLink(CoAP_Res_t* pRes, char* pDst) {
+	CoAP_option_t* pOpt;
+	char num[12];
+	uint32_t n = 0;
+
+	n += PutLinkStr(pDst, n, "<", 1);
+	for (pOpt = pRes->pUri; pOpt != NULL; pOpt = pOpt->next) {
+		if (pOpt->Number == OPT_NUM_URI_PATH) {
+			n += PutLinkStr(pDst, n, "/", 1);
+			n += PutLinkStr(pDst, n, (const char*) pOpt->Value, pOpt->Length);
+		}
+	}
+	n += PutLinkStr(pDst, n, ">", 1);
 
-				CoAP_FreeOptionList(&pOptList); //free options
-				pObserverList = pObserverList->next;
-			}
+	if (pRes->Options.Cf != COAP_CF_LINK_FORMAT) {
+		if (pRes->pDescription != NULL) {
+			n += PutLinkStr(pDst, n, ";title=\"", 8);
+			n += PutLinkStr(pDst, n, pRes->pDescription, coap_strlen(pRes->pDescription));
+			n += PutLinkStr(pDst, n, "\"", 1);
 		}
+		n += PutLinkStr(pDst, n, ";ct=", 4);
+		n += PutLinkStr(pDst, n, num, coap_sprintf(num, "%u", (unsigned int) pRes->Options.Cf));
+	}
+	if (pRes->pRt != NULL) {
+		n += PutLinkStr(pDst, n, ";rt=\"", 5);
+		n += PutLinkStr(pDst, n, pRes->pRt, coap_strlen(pRes->pRt));
+		n += PutLinkStr(pDst, n, "\"", 1);
+	}
+	if (pRes->pIf != NULL) {
+		n += PutLinkStr(pDst, n, ";if=\"", 5);
+		n += PutLinkStr(pDst, n, pRes->pIf, coap_strlen(pRes->pIf));
+		n += PutLinkStr(pDst, n, "\"", 1);
+	}
+	if (pRes->Options.Cf != COAP_CF_LINK_FORMAT && pRes->Notifier != NULL) {
+		n += PutLinkStr(pDst, n, ";obs", 4);
+	}
+	return n;
+}
+
+static bool _rom UpdateWellKnown() {
+	CoAP_Res_t* pRes;
+	uint32_t size = 0;
+	uint32_t i = 0;
 
-		pList = pList->next;
+	if (WellKnown.Generation == LinkDocGeneration) {
+		return true;
 	}
 
-	pTempPage = TempPage;
-	INFO("writing: %ld bytes to flash\r\n", TotalPageBytes);
-	writeBufFn(pTempPage, TotalPageBytes);
-	return COAP_OK;
+	CoAP.api.free(WellKnown.pDoc);
+	CoAP.api.free(WellKnown.pLinks);
+	WellKnown.Generation = 0;
+	WellKnown.Count = 0;
+	for (i = 0; i < WELL_KNOWN_QUERY_ENTRIES; i++) {
+		CoAP_FreeOptionList(&(WellKnown.Queries[i].pKey));
+	}
+	i = 0;
+
+	for (pRes = pResList; pRes != NULL; pRes = pRes->next) {
+		size += PutLink(pRes, NULL);
+	}
+	WellKnown.pDoc = (char*) CoAP.api.malloc(size + 1);
+	WellKnown.pLinks = (WellKnownLink_t*) CoAP.api.malloc((ResListMembers + 1) * sizeof(WellKnownLink_t));
+	if (WellKnown.pDoc == NULL || WellKnown.pLinks == NULL) {
+		CoAP.api.free(WellKnown.pDoc);
+		CoAP.api.free(WellKnown.pLinks);
+		WellKnown.pDoc = NULL;
+		WellKnown.pLinks = NULL;
+		return false;
+	}
+
+	size = 0;
+	WellKnown.Hash = ETAG_HASH_INIT;
+	for (pRes = pResList; pRes != NULL; pRes = pRes->next, i++) {
+		WellKnown.pLinks[i].pRes = pRes;
+		WellKnown.pLinks[i].Offset = size;
+		WellKnown.pLinks[i].Length = PutLink(pRes, &(WellKnown.pDoc[size]));
+		WellKnown.Hash = CoAP_ETagHashAppend(WellKnown.Hash, (const uint8_t*) &(WellKnown.pDoc[size]), WellKnown.pLinks[i].Length);
+		WellKnown.Hash = CoAP_ETagHashAppend(WellKnown.Hash, (const uint8_t*) ",", 1); //links end where the document has separators
+		size += WellKnown.pLinks[i].Length;
+	}
+	WellKnown.Count = i;
+	WellKnown.Generation = LinkDocGeneration;
+	INFO("- /.well-known/core rebuilt: %"PRIu32" links, %"PRIu32" bytes\r\n", i, size);
+	return true;
 }
 
-/**
- * Load and attach observers
- * @param pRawPage pointer to the non volatile memory to load the observer from
- * @return
- */
-CoAP_Result_t _rom CoAP_NVloadObservers(uint8_t* pRawPage) {
-	CoAP_option_t* pOptList = NULL;
-	CoAP_Res_t* pRes = NULL;
-	CoAP_Res_t* pResTemp = NULL;
+// RFC6690 4.1: the value matches exactly or, if the filter ends with '*', as prefix
+static bool _rom LinkValueMatches(const char* pVal, uint32_t valLen, const uint8_t* pFilter, uint16_t filterLen) {
+	if (filterLen > 0 && pFilter[filterLen - 1] == '*') {
+		return valLen >= filterLen - 1u && memcmp(pVal, pFilter, filterLen - 1u) == 0;
+	}
+	return valLen == filterLen && memcmp(pVal, pFilter, filterLen) == 0;
+}
 
-	while (parse_OptionsFromRaw(pRawPage, 2048, &pRawPage, &pOptList) == COAP_OK) { //finds "payload-marker" and sets pointer to its beginning. in this context this is the next stored observe dataset
-		INFO("found flash stored options:\r\n");
-		CoAP_printOptionsList(pOptList);
+// Attributes like rt and if may hold several values separated by space
+static bool _rom LinkAttrMatches(const char* pAttr, const uint8_t* pFilter, uint16_t filterLen) {
+	while (pAttr != NULL && *pAttr != '\0') {
+		uint32_t len = 0;
+		while (pAttr[len] != '\0' && pAttr[len] != ' ') {
+			len++;
+		}
+		if (len > 0 && LinkValueMatches(pAttr, len, pFilter, filterLen)) {
+			return true;
+		}
+		pAttr += len;
+		while (*pAttr == ' ') {
+			pAttr++;
+		}
+	}
+	return false;
+}
 
-		//Map Stored option to resource
-		pResTemp = CoAP_FindResourceByUri(pResList, pOptList);
-		if (pResTemp != NULL) pRes = pResTemp;
-		else {
-			INFO("- Observed Resource not found!\r\n");
-			//todo: del observe res?
+// All uri-query filters ("href=", "rt=", "if=", "ct=", "title=") have to match, unknown ones never do
+static bool _rom LinkMatchesQuery(WellKnownLink_t* pLink, CoAP_option_t* pOpt) {
+	CoAP_Res_t* pRes = pLink->pRes;
+	char num[12];
+
+	for (; pOpt != NULL; pOpt = pOpt->next) {
+		const uint8_t* pEq;
+		const uint8_t* pFilter;
+		uint16_t nameLen;
+		uint16_t filterLen;
+		bool match;
+
+		if (pOpt->Number != OPT_NUM_URI_QUERY) {
 			continue;
 		}
+		pEq = memchr(pOpt->Value, '=', pOpt->Length);
+		if (pEq == NULL) {
+			return false;
+		}
+		nameLen = (uint16_t) (pEq - pOpt->Value);
+		pFilter = pEq + 1;
+		filterLen = (uint16_t) (pOpt->Length - nameLen - 1);
+
+		if (nameLen == 4 && memcmp(pOpt->Value, "href", 4) == 0) {
+			const char* pHref = &(WellKnown.pDoc[pLink->Offset + 1]);
+			const char* pEnd = memchr(pHref, '>', pLink->Length - 1);
+			match = pEnd != NULL && LinkValueMatches(pHref, (uint32_t) (pEnd - pHref), pFilter, filterLen);
+		} else if (nameLen == 2 && memcmp(pOpt->Value, "rt", 2) == 0) {
+			match = LinkAttrMatches(pRes->pRt, pFilter, filterLen);
+		} else if (nameLen == 2 && memcmp(pOpt->Value, "if", 2) == 0) {
+			match = LinkAttrMatches(pRes->pIf, pFilter, filterLen);
+		} else if (nameLen == 2 && memcmp(pOpt->Value, "ct", 2) == 0) {
+			match = LinkValueMatches(num, coap_sprintf(num, "%u", (unsigned int) pRes->Options.Cf), pFilter, filterLen);
+		} else if (nameLen == 5 && memcmp(pOpt->Value, "title", 5) == 0) {
+			match = pRes->pDescription != NULL && LinkValueMatches(pRes->pDescription, coap_strlen(pRes->pDescription), pFilter, filterLen);
+		} else {
+			match = false;
+		}
+		if (!match) {
+			return false;
+		}
+	}
+	return true;
+}
 
+// Walks the links matching the query (separated by ','), copies the part within offset and length to pDest (if not NULL)
+// and returns the total size of the filtered document. With pQueryEntry the walk starts at the link the block
+// before ended in and remembers where the next block starts.
+static uint32_t _rom WalkLinks(CoAP_option_t* pQuery, uint32_t offset, uint8_t* pDest, uint16_t length,
+		WellKnownQuery_t* pQueryEntry) {
+	uint32_t pos = 0;
+	uint32_t i = 0;
+
+	if (pQueryEntry != NULL && pQueryEntry->ResumePos <= offset) {
+		i = pQueryEntry->ResumeLink;
+		pos = pQueryEntry->ResumePos;
+	}
 
-		//(re)create observer for resource
-		CoAP_Observer_t* pNewObserver = CoAP_AllocNewObserver();
+	for (; i < WellKnown.Count; i++) {
+		WellKnownLink_t* pLink = &(WellKnown.pLinks[i]);
+		const char* pSrc = &(WellKnown.pDoc[pLink->Offset]);
+		uint32_t sep;
+		uint32_t len;
 
-		if (pNewObserver == NULL) {
-			INFO("pNewObserver out of Mem!\r\n");
-			//todo: do anything different to simple continue
+		if (!LinkMatchesQuery(pLink, pQuery)) {
 			continue;
 		}
+		sep = pos > 0 ? 1 : 0; //separator in front of all but the first link
+		len = sep + pLink->Length;
 
-		CoAP_option_t* pOpt = pOptList;
-		while (pOpt != NULL) {
-			INFO(".");
-
-			switch (pOpt->Number) {
-				case OPT_NUM_URI_HOST:
-					coap_memcpy((void*) &(pNewObserver->Ep), pOpt->Value, sizeof(NetEp_t));
-					break;
-				case OPT_NUM_URI_PORT: //"hack" netID, remove if netID removal cleanup done!
-					coap_memcpy((void*) &(pNewObserver->socketHandle), pOpt->Value, sizeof(SocketHandle_t));
-					break;
-				case OPT_NUM_URI_PATH:
-					break; //dont copy path to observe struct (it's connected to its resource anyway!)
-				case OPT_NUM_LOBARO_TOKEN_SAVE:
-					coap_memcpy((void*) &(pNewObserver->Token), pOpt->Value, 8);
-					break;
-				default:
-					CoAP_CopyOptionToList(&(pNewObserver->pOptList), pOpt);
-					break;
+		if (pDest != NULL) {
+			if (pQueryEntry != NULL && pos <= offset + length) {
+				pQueryEntry->ResumeLink = i;
+				pQueryEntry->ResumePos = pos;
+			}
+			if (pos >= offset + length) {
+				break;
+			}
+			if (pos + len > offset) {
+				uint32_t from = pos < offset ? offset - pos : 0;
+				uint32_t to = pos + len > offset + length ? offset + length - pos : len;
+				uint32_t j;
+				for (j = from; j < to; j++) {
+					pDest[pos + j - offset] = j < sep ? ',' : (uint8_t) pSrc[j - sep];
+				}
 			}
-
-			pOpt = pOpt->next;
 		}
+		pos += len;
+	}
+	return pos;
+}
 
-		//attach observer to resource
-		CoAP_AppendObserverToList(&(pRes->pListObservers), pNewObserver);
+// The filtered document follows from the links and the query (Uri-Path, Uri-Query and Accept)
+static uint32_t _rom WellKnownETag(uint32_t keyHash) {
+	return CoAP_ETagHashAppend(WellKnown.Hash, (const uint8_t*) &keyHash, sizeof(keyHash));
+}
 
-		CoAP_FreeOptionList(&pOptList); //free temp options
+// Returns the entry of the query with the size and ETag of its filtered document, walks all links only for new queries.
+// NULL if no entry could be allocated, size and ETag are set anyway.
+static WellKnownQuery_t* _rom FindWellKnownQuery(CoAP_option_t* pOptList, uint32_t* pSize, uint32_t* pETag) {
+	uint32_t hash = CoAP_CacheKeyHash(pOptList);
+	WellKnownQuery_t* pEntry = &(WellKnown.Queries[0]);
+	int i;
+
+	for (i = 0; i < WELL_KNOWN_QUERY_ENTRIES; i++) {
+		WellKnownQuery_t* pQ = &(WellKnown.Queries[i]);
+		if (pQ->pKey != NULL && pQ->KeyHash == hash && CoAP_CacheKeyMatches(pQ->pKey, pOptList)) {
+			pQ->LastUse = ++WellKnown.QueryUseCnt;
+			*pSize = pQ->Size;
+			*pETag = pQ->ETag;
+			return pQ;
+		}
+		//replaces an unused or the least recently used entry
+		if (pEntry->pKey != NULL && (pQ->pKey == NULL || (int32_t) (pQ->LastUse - pEntry->LastUse) < 0)) {
+			pEntry = pQ;
+		}
 	}
 
-	CoAP_PrintAllResources();
-	//CoAP_FindResourceByUri
-	return COAP_OK;
+	*pSize = WalkLinks(pOptList, 0, NULL, 0, NULL);
+	*pETag = WellKnownETag(hash);
+	CoAP_FreeOptionList(&(pEntry->pKey));
+	if (CoAP_CopyCacheKey(&(pEntry->pKey), pOptList) != COAP_OK) {
+		return NULL;
+	}
+	pEntry->KeyHash = hash;
+	pEntry->Size = *pSize;
+	pEntry->ETag = *pETag;
+	pEntry->ResumeLink = 0;
+	pEntry->ResumePos = 0;
+	pEntry->LastUse = ++WellKnown.QueryUseCnt;
+	return pEntry;
 }
 
+// Context of the producer, lives on the stack of WellKnown_GetHandler
+typedef struct {
+	CoAP_option_t* pQuery;
+	WellKnownQuery_t* pEntry;
+} WellKnownProducerCtx_t;
+
+static CoAP_Result_t _rom WellKnown_Producer(uint32_t offset, uint8_t* pDest, uint16_t length, void* pCtx) {
+	WellKnownProducerCtx_t* pProducerCtx = (WellKnownProducerCtx_t*) pCtx;
+	WalkLinks(pProducerCtx->pQuery, offset, pDest, length, pProducerCtx->pEntry);
+	return COAP_OK;
+}
 
 CoAP_HandlerResult_t _rom WellKnown_GetHandler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
-//	static uint8_t wellknownStr[500];
-//	uint8_t* pWr = wellknownStr;
+	WellKnownProducerCtx_t ctx;
+	uint32_t size;
+	uint32_t etag;
 
 	if (pReq->Code != REQ_GET) {
 		uint8_t errMsg[] = {"CoAP GET only!"};
@@ -179,54 +456,52 @@ CoAP_HandlerResult_t _rom WellKnown_GetHandler(CoAP_Message_t* pReq, CoAP_Messag
 		return HANDLER_ERROR;
 	}
 
-	CoAP_Res_t* pList = pResList; //List of internal resources
-	uint8_t* pStr = (uint8_t*) CoAP.api.malloc((ResListMembers + 1) * 64); //first estimation of needed memory
-	uint8_t* pStrStart = pStr;
-
-	if (pStr == NULL) {
+	if (!UpdateWellKnown()) {
 		INFO("- WellKnown_GetHandler(): Ouf memory error!\r\n");
 		return HANDLER_ERROR;
 	}
-	memset(pStr, 0, (ResListMembers + 1) * 64);
 
-	INFO("- WellKnown_GetHandler(): res cnt:%u temp alloc:%u\r\n", (unsigned int) ResListMembers, (unsigned int) (ResListMembers + 2) * 64);
+	//size and ETag of the filtered document are kept per query, later blocks do not walk all links again
+	ctx.pQuery = pReq->pOptionsList;
+	ctx.pEntry = FindWellKnownQuery(pReq->pOptionsList, &size, &etag);
+	AddETagValueToMsg(pResp, etag);
 
-	//TODO: Implement non ram version, e.g. write to memory to eeprom
-	while (pList != NULL) {
-		CoAP_option_t* pUriOpt = pList->pUri;
+	//only the requested block is generated, from the cached links
+	if (CoAP_SetPayload_Producer(pReq, pResp, size, WellKnown_Producer, &ctx) != COAP_OK) {
+		return HANDLER_ERROR;
+	}
+	CoAP_AddCfOptionToMsg(pResp, COAP_CF_LINK_FORMAT);
 
-		*pStr++ = '<';
-		while (pUriOpt != NULL) {
-			*pStr++ = '/';
-			coap_memcpy(pStr, pUriOpt->Value, pUriOpt->Length);
-			pStr += pUriOpt->Length;
-			pUriOpt = pUriOpt->next;
-		}
-		*pStr++ = '>';
-		if (pList->Options.Cf != COAP_CF_LINK_FORMAT) {
-			if( pList->pDescription != NULL ) {
-				pStr += coap_sprintf((char *) pStr, ";title=\"%s\"", pList->pDescription);
-			}
-			
-			pStr += coap_sprintf((char *) pStr, ";ct=%d", pList->Options.Cf);
-			
-			if (pList->Notifier != NULL) {
-				pStr += coap_sprintf((char*) pStr, ";obs");
-			}
-		}
-		*pStr++ = ',';
+	return HANDLER_OK;
+}
 
-		pList = pList->next;
+CoAP_Result_t _rom CoAP_SetResourceLinkAttributes(CoAP_Res_t* pRes, const char* rt, const char* ifDesc) {
+	char* pRt = NULL;
+	char* pIf = NULL;
 
-		//TODO: implement growing of buf/overwrite check
+	if (pRes == NULL) {
+		return COAP_ERR_ARGUMENT;
+	}
+	if (rt != NULL && (pRt = (char*) CoAP.api.malloc(coap_strlen(rt) + 1)) == NULL) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	if (ifDesc != NULL && (pIf = (char*) CoAP.api.malloc(coap_strlen(ifDesc) + 1)) == NULL) {
+		CoAP.api.free(pRt);
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	if (pRt != NULL) {
+		coap_strcpy(pRt, rt);
+	}
+	if (pIf != NULL) {
+		coap_strcpy(pIf, ifDesc);
 	}
 
-	CoAP_SetPayload(pResp, pStrStart, (uint16_t) coap_strlen((char*) pStrStart), true);
-	CoAP.api.free(pStrStart);
-
-	CoAP_AddCfOptionToMsg(pResp, COAP_CF_LINK_FORMAT);
-
-	return HANDLER_OK;
+	CoAP.api.free(pRes->pRt);
+	CoAP.api.free(pRes->pIf);
+	pRes->pRt = pRt;
+	pRes->pIf = pIf;
+	LinkDocGeneration++;
+	return COAP_OK;
 }
 
 void _rom CoAP_InitResources() {
@@ -237,75 +512,178 @@ void _rom CoAP_InitResources() {
 static CoAP_Result_t _rom CoAP_AppendResourceToList(CoAP_Res_t** pListStart, CoAP_Res_t* pResToAdd) {
 	if (pResToAdd == NULL) return COAP_ERR_ARGUMENT;
 
+	pResToAdd->next = NULL;
 	if (*pListStart == NULL) //List empty? create new first element
 	{
 		*pListStart = pResToAdd;
-		(*pListStart)->next = NULL;
 	} else //append new element at end
 	{
-		CoAP_Res_t* pRes = *pListStart;
-		while (pRes->next != NULL) pRes = pRes->next;
-
-		pRes->next = pResToAdd;
-		pRes = pRes->next;
-		pRes->next = NULL;
+		pResListTail->next = pResToAdd;
 	}
+	pResListTail = pResToAdd;
 	return COAP_OK;
 }
 
+// FNV-1a over all uri-path segments, other options are ignored
+static uint32_t _rom UriPathHash(CoAP_option_t* pOptList) {
+	uint32_t hash = 2166136261u;
+	uint16_t i;
+
+	for (; pOptList != NULL; pOptList = pOptList->next) {
+		if (pOptList->Number != OPT_NUM_URI_PATH) {
+			continue;
+		}
+		for (i = 0; i < pOptList->Length; i++) {
+			hash = (hash ^ pOptList->Value[i]) * 16777619u;
+		}
+		hash = (hash ^ '/') * 16777619u;
+	}
+	return hash;
+}
+
 CoAP_Result_t _rom CoAP_FreeResource(CoAP_Res_t** pResource) {
 	CoAP_FreeOptionList(&(*pResource)->pUri);
+	CoAP_FreeUploads(*pResource);
+	CoAP_Block2CacheInvalidate(*pResource);
+	CoAP_InvalidateResponseCache(*pResource);
+	CoAP_DropCoalescedResponse(*pResource);
+	CoAP_ReleaseSharedNotification(&((*pResource)->pNotification));
+	while ((*pResource)->pListObservers != NULL) {
+		CoAP_DetachObserver((*pResource)->pListObservers, true);
+	}
 
 	CoAP.api.free((*pResource)->pDescription);
+	CoAP.api.free((*pResource)->pRt);
+	CoAP.api.free((*pResource)->pIf);
 	CoAP.api.free((void*) (*pResource));
+	LinkDocGeneration++;
 	*pResource = NULL;
 	return COAP_OK;
 }
 
-//static CoAp_Result_t CoAP_UnlinkResourceFromList(CoAP_Res_t** pListStart, CoAP_Res_t* pResToRemove, bool FreeUnlinked)
-//{
-//	CoAP_Res_t* currP;
-//	CoAP_Res_t* prevP;
-//
-//  // For 1st node, indicate there is no previous.
-//  prevP = NULL;
-//
-//   //Visit each node, maintaining a pointer to
-//   //the previous node we just visited.
-//  for (currP = *pListStart; currP != NULL;
-//		  prevP = currP, currP = currP->next) {
-//
-//    if (currP == pResToRemove) {  // Found it.
-//      if (prevP == NULL) {
-//        //Fix beginning pointer.
-//        *pListStart = currP->next;
-//      } else {
-//        //Fix previous node's next to
-//        //skip over the removed node.
-//        prevP->next = currP->next;
-//      }
-//
-//      // Deallocate the node.
-//      if(FreeUnlinked) CoAP_FreeResource(&currP);
-//      //Done searching.
-//      ResListMembers--;
-//      return COAP_OK;
-//    }
-//  }
-//  return COAP_OK;
-//}
+// Unlinks pRes from the resource list and the uri index (or the pattern list), false if it is not linked.
+// pRes->next is kept, a loop over the resource list standing on pRes (e.g. in a notifier) continues normally.
+static bool _rom CoAP_UnlinkResourceFromList(CoAP_Res_t* pResToRemove) {
+	CoAP_Res_t** ppRes;
+	CoAP_Res_t* pPrev = NULL;
+
+	for (ppRes = &pResList; *ppRes != pResToRemove; ppRes = &((*ppRes)->next)) {
+		if (*ppRes == NULL) {
+			return false;
+		}
+		pPrev = *ppRes;
+	}
+	*ppRes = pResToRemove->next;
+	if (pResListTail == pResToRemove) {
+		pResListTail = pPrev;
+	}
+
+	if (pResToRemove->IsPattern) {
+		for (ppRes = &pPatternRes; *ppRes != pResToRemove; ppRes = &((*ppRes)->nextInIndex));
+		*ppRes = pResToRemove->nextInIndex;
+		if (ppPatternResTail == &(pResToRemove->nextInIndex)) {
+			ppPatternResTail = ppRes;
+		}
+	} else {
+		for (ppRes = &ResIndex[pResToRemove->UriHash % RESOURCE_INDEX_SIZE]; *ppRes != pResToRemove; ppRes = &((*ppRes)->nextInIndex));
+		*ppRes = pResToRemove->nextInIndex;
+	}
+
+	pResToRemove->nextInIndex = NULL;
+	ResListMembers--;
+	return true;
+}
+
+CoAP_Result_t _rom CoAP_RemoveResource(CoAP_Res_t* pRes) {
+	if (pRes == NULL || pRes->Removed || !CoAP_UnlinkResourceFromList(pRes)) {
+		return COAP_ERR_NOT_FOUND;
+	}
+	INFO("Removing resource at %p\r\n", pRes);
+
+	pRes->Removed = true;
+	pRes->nextInIndex = pRetiredRes;
+	pRetiredRes = pRes;
+	LinkDocGeneration++;
+	return COAP_OK;
+}
+
+// Releases removed resources, called while no handler or notifier is running
+void _rom CoAP_ReclaimResources() {
+	while (pRetiredRes != NULL) {
+		CoAP_Res_t* pRes = pRetiredRes;
+		pRetiredRes = pRes->nextInIndex;
+
+		CoAP_ReleaseResourceInteractions(pRes, RESP_NOT_FOUND_4_04);
+		CoAP_FreeResource(&pRes);
+	}
+}
+
+// Initial payload buffer size for responses of the resource, never less than PREFERED_PAYLOAD_SIZE
+// as handlers may write that much directly to the payload of the response
+uint16_t _rom CoAP_ResponseSizeHint(CoAP_Res_t* pRes) {
+	uint16_t size = PREFERED_PAYLOAD_SIZE;
+
+	if (pRes == NULL) {
+		return size;
+	}
+	if ((pRes->Options.Flags & RES_FLAG_ADAPTIVE_RESP_SIZE) && pRes->RespSize != 0) {
+		size = pRes->RespSize;
+	} else if (pRes->Options.RespSizeHint != 0) {
+		size = pRes->Options.RespSizeHint;
+	}
+	if (size < PREFERED_PAYLOAD_SIZE) {
+		size = PREFERED_PAYLOAD_SIZE;
+	}
+	return size > MAX_PAYLOAD_SIZE ? MAX_PAYLOAD_SIZE : size;
+}
+
+// Follows a larger payload at once, so the next response fits into its initial buffer,
+// and shrinks towards smaller ones by 1/8 of the difference per response (RES_FLAG_ADAPTIVE_RESP_SIZE)
+void _rom CoAP_LearnResponseSize(CoAP_Res_t* pRes, uint16_t length) {
+	if (pRes == NULL || !(pRes->Options.Flags & RES_FLAG_ADAPTIVE_RESP_SIZE)) {
+		return;
+	}
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+	if (length >= pRes->RespSize) {
+		pRes->RespSize = length;
+	} else {
+		pRes->RespSize -= (uint16_t) ((pRes->RespSize - length + 7) / 8);
+	}
+}
 
 CoAP_Res_t* _rom CoAP_FindResourceByUri(CoAP_Res_t* pResListToSearchIn, CoAP_option_t* pOptionsToMatch) {
 	CoAP_Res_t* pList = pResList;
-	if (pResListToSearchIn != NULL) {
-		pList = pResListToSearchIn;
+	uint32_t hash;
+
+	if (pResListToSearchIn != NULL && pResListToSearchIn != pResList) {
+		for (pList = pResListToSearchIn; pList != NULL; pList = pList->next) {
+			if (CoAP_UriOptionsAreEqual(pList->pUri, pOptionsToMatch)) {
+				return pList;
+			}
+		}
+		return NULL;
+	}
+
+	hash = UriPathHash(pOptionsToMatch);
+	for (pList = ResIndex[hash % RESOURCE_INDEX_SIZE]; pList != NULL; pList = pList->nextInIndex) {
+		if (pList->UriHash == hash && CoAP_UriOptionsAreEqual(pList->pUri, pOptionsToMatch)) {
+			return pList;
+		}
 	}
 
-	for (; pList != NULL; pList = pList->next) {
+	//the pattern itself (e.g. stored observers) before any path it matches
+	for (pList = pPatternRes; pList != NULL; pList = pList->nextInIndex) {
 		if (CoAP_UriOptionsAreEqual(pList->pUri, pOptionsToMatch)) {
 			return pList;
 		}
 	}
+	for (pList = pPatternRes; pList != NULL; pList = pList->nextInIndex) {
+		if (CoAP_UriMatchesPattern(pList->pUri, pOptionsToMatch)) {
+			return pList;
+		}
+	}
 
 	return NULL;
 }
@@ -346,20 +724,179 @@ CoAP_Res_t* _rom CoAP_CreateResource(char* Uri, char* Descr, CoAP_ResOpts_t Opti
 	pRes->Handler = pHandlerFkt;
 	pRes->Notifier = pNotifierFkt;
 
+	//linked only when complete, lookups never see a half initialized resource
+	pRes->UriHash = UriPathHash(pRes->pUri);
+	pRes->IsPattern = CoAP_UriIsPattern(pRes->pUri);
 	CoAP_AppendResourceToList(&pResList, pRes);
+	if (pRes->IsPattern) {
+		pRes->nextInIndex = NULL;
+		*ppPatternResTail = pRes;
+		ppPatternResTail = &(pRes->nextInIndex);
+	} else { //appended, the oldest of resources with the same uri is found like in the resource list
+		CoAP_Res_t** ppBucket = &ResIndex[pRes->UriHash % RESOURCE_INDEX_SIZE];
+		while (*ppBucket != NULL) {
+			ppBucket = &((*ppBucket)->nextInIndex);
+		}
+		pRes->nextInIndex = NULL;
+		*ppBucket = pRes;
+	}
 
 	ResListMembers++;
+	LinkDocGeneration++;
+	pRes->Generation = LinkDocGeneration;
 
 	return pRes;
 }
 
+CoAP_Result_t _rom CoAP_CreateResources(const CoAP_ResDef_t* pDefs, uint32_t count) {
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (CoAP_CreateResource(pDefs[i].Uri, pDefs[i].Descr, pDefs[i].Options, pDefs[i].Handler, pDefs[i].Notifier) == NULL) {
+			ERROR("- Resource %s could not be created\r\n", pDefs[i].Uri);
+			return COAP_ERR_OUT_OF_MEMORY;
+		}
+	}
+	return COAP_OK;
+}
+
+CoAP_Result_t _rom CoAP_SetResourceUploadSink(CoAP_Res_t* pRes, CoAP_ResourceUploadSink_fPtr_t pSinkFkt) {
+	if (pRes == NULL) {
+		return COAP_ERR_ARGUMENT;
+	}
+	if (pSinkFkt == NULL) {
+		CoAP_FreeUploads(pRes);
+	}
+	pRes->UploadSink = pSinkFkt;
+	return COAP_OK;
+}
+
+CoAP_Result_t _rom CoAP_SetResourceETagGetter(CoAP_Res_t* pRes, CoAP_ResourceETagGetter_fPtr_t pGetterFkt) {
+	if (pRes == NULL) {
+		return COAP_ERR_ARGUMENT;
+	}
+	pRes->ETagGetter = pGetterFkt;
+	return COAP_OK;
+}
+
+// Calls the notifier to compare its output with the one of the latest notified update,
+// the first observer stands in for all of them
+static bool _rom NotifierOutputChanged(CoAP_Res_t* pRes) {
+	CoAP_Token_t noToken = { .Length = 0 };
+	CoAP_Observer_t* pObserver = (pRes->Options.Flags & RES_FLAG_SHARED_NOTIFICATION) ? NULL : pRes->pListObservers;
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	uint32_t hash = ETAG_HASH_INIT;
+	uint32_t maxAge = DEFAULT_MAX_AGE;
+	CoAP_option_t* pOpt;
+
+	CoAP_Message_t* pMsg = CoAP_CreateMessage(CON, RESP_SUCCESS_CONTENT_2_05, 0, NULL, 0, PREFERED_PAYLOAD_SIZE, noToken);
+	if (pMsg == NULL || pRes->Notifier(pObserver, pMsg) != HANDLER_OK) {
+		CoAP_free_Message(&pMsg);
+		return true; //let the regular notification deal with it
+	}
+
+	hash = CoAP_ETagHashAppend(hash, (uint8_t*) &(pMsg->Code), sizeof(pMsg->Code));
+	for (pOpt = pMsg->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+		hash = CoAP_ETagHashAppend(hash, (uint8_t*) &(pOpt->Number), sizeof(pOpt->Number));
+		hash = CoAP_ETagHashAppend(hash, pOpt->Value, pOpt->Length);
+		if (pOpt->Number == OPT_NUM_MAX_AGE) {
+			CoAP_GetUintFromOption(pOpt, &maxAge);
+		}
+	}
+	hash = CoAP_ETagHashAppend(hash, pMsg->Payload, pMsg->PayloadLength);
+	CoAP_free_Message(&pMsg);
+
+	if (pRes->HasNotifyHash && hash == pRes->NotifyHash) {
+		if (!(pRes->Options.Flags & RES_FLAG_UNCHANGED_KEEPALIVE) || !timeAfter(now, pRes->NotifyTime + pRes->NotifyMaxAge)) {
+			return false;
+		}
+		INFO("- Unchanged notification sent after Max-Age\r\n");
+	}
+
+	pRes->HasNotifyHash = true;
+	pRes->NotifyHash = hash;
+	pRes->NotifyTime = now;
+	pRes->NotifyMaxAge = maxAge;
+	return true;
+}
+
+static void _rom StartResourceUpdate(CoAP_Res_t* pRes) {
+	CoAP_InvalidateResponseCache(pRes);
+	CoAP_ForgetETag(pRes);
+	CoAP_DropCoalescedResponse(pRes);
+	if ((pRes->Options.Flags & RES_FLAG_SKIP_UNCHANGED) && pRes->Notifier != NULL && pRes->pListObservers != NULL
+			&& !NotifierOutputChanged(pRes)) {
+		INFO("- Notifier output unchanged, no notifications sent\r\n");
+		return;
+	}
 
-CoAP_Result_t _rom CoAP_NotifyResourceObservers(CoAP_Res_t* pRes) {
 	pRes->UpdateCnt++;
+	CoAP_Block2CacheInvalidate(pRes); //representation changed
 	CoAP_StartNotifyInteractions(pRes); //async start of update interaction
+}
+
+CoAP_Result_t _rom CoAP_NotifyResourceObservers(CoAP_Res_t* pRes) {
+	if (pRes->Removed) {
+		return COAP_ERR_NOT_FOUND;
+	}
+	pRes->HasValue = false; //observers with gt/lt/st attributes take it as a change
+	StartResourceUpdate(pRes);
 	return COAP_OK;
 }
 
+// Like CoAP_NotifyResourceObservers(...) for resources representing a single value,
+// which is checked against the gt, lt and st attributes of the observers
+CoAP_Result_t _rom CoAP_NotifyResourceObserversValue(CoAP_Res_t* pRes, float value) {
+	if (pRes->Removed) {
+		return COAP_ERR_NOT_FOUND;
+	}
+	pRes->Value = value;
+	pRes->HasValue = true;
+	StartResourceUpdate(pRes);
+	return COAP_OK;
+}
+
+// Continues notification fan-outs that ran out of budget or memory
+void _rom CoAP_ResumeNotifyFanOuts() {
+	CoAP_Res_t* pRes;
+
+	if (!CoAP.NotifyFanOutPending) {
+		return;
+	}
+	CoAP.NotifyFanOutPending = false;
+	for (pRes = pResList; pRes != NULL; pRes = pRes->next) {
+		if (pRes->pNotifyCursor != NULL) {
+			CoAP_ContinueNotifyInteractions(pRes, NOTIFY_FANOUT_BUDGET);
+		}
+	}
+}
+
+// Sends notifications held back by pmin and pmax keepalives, checked once a second
+void _rom CoAP_SendDueNotifications() {
+	static uint32_t lastCheck = 0;
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	CoAP_Res_t* pRes;
+
+	if (now == lastCheck) {
+		return;
+	}
+	lastCheck = now;
+
+	for (pRes = pResList; pRes != NULL; pRes = pRes->next) {
+		CoAP_Observer_t* pObserver;
+		if (pRes->Notifier == NULL || pRes->pNotifyCursor != NULL) {
+			continue; //a running fan-out goes first, due observers are picked up in a later second
+		}
+		for (pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) {
+			if (pObserver->AttrFlags != 0 && CoAP_ObserverNotificationDue(pObserver, now)) {
+				break;
+			}
+		}
+		if (pObserver != NULL) {
+			CoAP_StartDueNotifyInteractions(pRes, pObserver); //out of memory is retried by the fan-out or next second
+		}
+	}
+}
 
 void _rom CoAP_PrintResource(CoAP_Res_t* pRes) {
 	CoAP_printUriOptionsList(pRes->pUri);
@@ -387,19 +924,13 @@ void _rom CoAP_PrintAllResources() {
 }
 
 
-CoAP_Result_t _rom CoAP_RemoveObserverFromResource(CoAP_Observer_t** pObserverList, SocketHandle_t socketHandle, NetEp_t* pRemoteEP, CoAP_Token_t token) {
-	CoAP_Observer_t* pObserver = *pObserverList;
-
-	while (pObserver != NULL) { //found right existing observation -> delete it
+CoAP_Result_t _rom CoAP_RemoveObserverFromResource(CoAP_Res_t* pRes, SocketHandle_t socketHandle, NetEp_t* pRemoteEP, CoAP_Token_t token) {
+	CoAP_Observer_t* pObserver = CoAP_FindObserver(pRes, socketHandle, pRemoteEP);
 
-		if (CoAP_TokenEqual(token, pObserver->Token) && socketHandle == pObserver->socketHandle && EpAreEqual(pRemoteEP, &(pObserver->Ep))) {
-
-			INFO("- (!) Unlinking observer from resource\r\n");
-			CoAP_UnlinkObserverFromList(pObserverList, pObserver, true);
-			return COAP_REMOVED;
-
-		}
-		pObserver = pObserver->next;
+	if (pObserver != NULL && CoAP_TokenEqual(token, pObserver->Token)) { //found right existing observation -> delete it
+		INFO("- (!) Unlinking observer from resource\r\n");
+		CoAP_DetachObserver(pObserver, true);
+		return COAP_REMOVED;
 	}
 	return COAP_ERR_NOT_FOUND;
 }
@@ -27,9 +27,14 @@ typedef uint32_t (* CoAP_ResourceGetETag_fPtr_t)();
 typedef bool (* WriteBuf_fn)(uint8_t* data, uint32_t len);
 
 
+CoAP_Res_t* CoAP_GetResourceList();
 CoAP_Res_t* CoAP_FindResourceByUri(CoAP_Res_t* pResListToSearchIn, CoAP_option_t* pOptionsToMatch);
 CoAP_Result_t CoAP_NotifyResourceObservers(CoAP_Res_t* pRes);
+CoAP_Result_t CoAP_NotifyResourceObserversValue(CoAP_Res_t* pRes, float value);
 CoAP_Result_t CoAP_FreeResource(CoAP_Res_t** pResource);
+void CoAP_ReclaimResources();
+uint16_t CoAP_ResponseSizeHint(CoAP_Res_t* pRes);
+void CoAP_LearnResponseSize(CoAP_Res_t* pRes, uint16_t length);
 
 void CoAP_PrintResource(CoAP_Res_t* pRes);
 void CoAP_PrintAllResources();
@@ -37,8 +42,11 @@ void CoAP_PrintAllResources();
 void CoAP_InitResources();
 
 CoAP_Result_t CoAP_NVsaveObservers(WriteBuf_fn writeBufFn);
-CoAP_Result_t CoAP_NVloadObservers(uint8_t* pRawPage);
+CoAP_Result_t CoAP_NVloadObservers(uint8_t* pRawPage, uint32_t size);
 
-CoAP_Result_t CoAP_RemoveObserverFromResource(CoAP_Observer_t** pObserverList, SocketHandle_t socketHandle, NetEp_t* pRemoteEP, CoAP_Token_t token);
+void CoAP_ResumeNotifyFanOuts();
+void CoAP_SendDueNotifications();
+
+CoAP_Result_t CoAP_RemoveObserverFromResource(CoAP_Res_t* pRes, SocketHandle_t socketHandle, NetEp_t* pRemoteEP, CoAP_Token_t token);
 
 #endif /* SRC_COAP_COAP_RESOURCES_H_ */
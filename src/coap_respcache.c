@@ -0,0 +1,231 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#include <inttypes.h>
+#include "coap.h"
+#include "coap_mem.h"
+
+static CoAP_RespCacheEntry_t RespCache[RESPONSE_CACHE_ENTRIES];
+
+static bool IsKeyOption(CoAP_option_t* pOpt) {
+	return pOpt->Number == OPT_NUM_URI_PATH || pOpt->Number == OPT_NUM_URI_QUERY || pOpt->Number == OPT_NUM_ACCEPT;
+}
+
+static CoAP_option_t* NextKeyOption(CoAP_option_t* pOpt) {
+	while (pOpt != NULL && !IsKeyOption(pOpt)) {
+		pOpt = pOpt->next;
+	}
+	return pOpt;
+}
+
+// FNV-1a over number and value of all key options of the request
+uint32_t _rom CoAP_CacheKeyHash(CoAP_option_t* pOptList) {
+	uint32_t hash = 2166136261u;
+	CoAP_option_t* pOpt;
+	uint16_t i;
+
+	for (pOpt = NextKeyOption(pOptList); pOpt != NULL; pOpt = NextKeyOption(pOpt->next)) {
+		hash = (hash ^ (uint8_t) pOpt->Number) * 16777619u;
+		for (i = 0; i < pOpt->Length; i++) {
+			hash = (hash ^ pOpt->Value[i]) * 16777619u;
+		}
+		hash = (hash ^ 0xff) * 16777619u;
+	}
+	return hash;
+}
+
+// pKey was copied by CoAP_CopyCacheKey(...)
+bool _rom CoAP_CacheKeyMatches(CoAP_option_t* pKey, CoAP_option_t* pOptList) {
+	CoAP_option_t* pOpt = NextKeyOption(pOptList);
+
+	while (pKey != NULL && pOpt != NULL) {
+		if (!CoAP_OptionsAreEqual(pKey, pOpt)) {
+			return false;
+		}
+		pKey = pKey->next;
+		pOpt = NextKeyOption(pOpt->next);
+	}
+	return pKey == NULL && pOpt == NULL;
+}
+
+// Copies the key options of a request, the list is left empty on error
+CoAP_Result_t _rom CoAP_CopyCacheKey(CoAP_option_t** ppKey, CoAP_option_t* pOptList) {
+	CoAP_option_t* pOpt;
+
+	for (pOpt = NextKeyOption(pOptList); pOpt != NULL; pOpt = NextKeyOption(pOpt->next)) {
+		if (CoAP_CopyOptionToList(ppKey, pOpt) != COAP_OK) {
+			CoAP_FreeOptionList(ppKey);
+			return COAP_ERR_OUT_OF_MEMORY;
+		}
+	}
+	return COAP_OK;
+}
+
+static void ReleaseEntry(CoAP_RespCacheEntry_t* pEntry) {
+	CoAP_FreeOptionList(&(pEntry->pKey));
+	CoAP_FreeOptionList(&(pEntry->pOptList));
+	CoAP_ReleasePayloadBuf(&(pEntry->pPayloadBuf));
+	pEntry->pPayload = NULL;
+	pEntry->pRes = NULL;
+}
+
+static void PurgeExpiredEntries(uint32_t now) {
+	int i;
+	for (i = 0; i < RESPONSE_CACHE_ENTRIES; i++) {
+		if (RespCache[i].pRes != NULL && timeAfter(now, RespCache[i].Expires)) {
+			ReleaseEntry(&RespCache[i]);
+		}
+	}
+}
+
+static CoAP_RespCacheEntry_t* FindEntry(CoAP_Res_t* pRes, CoAP_option_t* pOptList) {
+	uint32_t hash = CoAP_CacheKeyHash(pOptList);
+	int i;
+
+	for (i = 0; i < RESPONSE_CACHE_ENTRIES; i++) {
+		if (RespCache[i].pRes == pRes && RespCache[i].KeyHash == hash && CoAP_CacheKeyMatches(RespCache[i].pKey, pOptList)) {
+			return &RespCache[i];
+		}
+	}
+	return NULL;
+}
+
+// Only plain GETs are cached, blockwise transfers are left to the block2 cache and
+// observe (de)registrations always reach the handler and the observe handling
+static bool IsCacheableRequest(CoAP_Interaction_t* pIA) {
+	return (pIA->pRes->Options.Flags & RES_FLAG_RESPONSE_CACHE) && pIA->pReqMsg->Code == REQ_GET
+			&& CoAP_FindOptionByNumber(pIA->pReqMsg, OPT_NUM_BLOCK2) == NULL
+			&& CoAP_FindOptionByNumber(pIA->pReqMsg, OPT_NUM_OBSERVE) == NULL;
+}
+
+// Keeps the 2.05 response of the resource handler for its Max-Age, the payload buffer is shared with the response if possible
+void _rom CoAP_ResponseCacheStore(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+	CoAP_RespCacheEntry_t* pEntry;
+	CoAP_option_t* pOpt;
+	uint32_t maxAge = DEFAULT_MAX_AGE;
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	int i;
+
+	if (!IsCacheableRequest(pIA) || pResp->Code != RESP_SUCCESS_CONTENT_2_05
+			|| pResp->PayloadLength > RESPONSE_CACHE_MAX_SIZE || CoAP_FindOptionByNumber(pResp, OPT_NUM_BLOCK2) != NULL) {
+		return;
+	}
+	pOpt = CoAP_FindOptionByNumber(pResp, OPT_NUM_MAX_AGE);
+	if (pOpt != NULL && CoAP_GetUintFromOption(pOpt, &maxAge) != COAP_OK) {
+		return;
+	}
+	if (maxAge == 0) {
+		return;
+	}
+	PurgeExpiredEntries(now);
+
+	// same key, free slot or least recently used one
+	pEntry = FindEntry(pIA->pRes, pIA->pReqMsg->pOptionsList);
+	if (pEntry == NULL) {
+		for (i = 0; i < RESPONSE_CACHE_ENTRIES; i++) {
+			if (RespCache[i].pRes == NULL) {
+				pEntry = &RespCache[i];
+				break;
+			}
+			if (pEntry == NULL || timeAfter(pEntry->LastUse, RespCache[i].LastUse)) {
+				pEntry = &RespCache[i];
+			}
+		}
+	}
+	if (pEntry->pRes != NULL) {
+		ReleaseEntry(pEntry);
+	}
+
+	if (pResp->PayloadLength > 0) {
+		pEntry->pPayloadBuf = CoAP_SharePayload(pResp);
+		if (pEntry->pPayloadBuf != NULL) {
+			pEntry->pPayload = pResp->Payload;
+		} else { //static or borrowed payload
+			pEntry->pPayloadBuf = CoAP_AllocPayloadBuf(pResp->PayloadLength);
+			if (pEntry->pPayloadBuf == NULL) {
+				return;
+			}
+			pEntry->pPayload = PAYLOAD_BUF_DATA(pEntry->pPayloadBuf);
+			coap_memcpy(pEntry->pPayload, pResp->Payload, pResp->PayloadLength);
+		}
+	}
+	if (CoAP_CopyCacheKey(&(pEntry->pKey), pIA->pReqMsg->pOptionsList) != COAP_OK) {
+		ReleaseEntry(pEntry);
+		return;
+	}
+	for (pOpt = pResp->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+		if (pOpt->Number != OPT_NUM_MAX_AGE && CoAP_CopyOptionToList(&(pEntry->pOptList), pOpt) != COAP_OK) {
+			ReleaseEntry(pEntry);
+			return;
+		}
+	}
+
+	pEntry->pRes = pIA->pRes;
+	pEntry->KeyHash = CoAP_CacheKeyHash(pIA->pReqMsg->pOptionsList);
+	pEntry->Code = pResp->Code;
+	pEntry->PayloadLength = pResp->PayloadLength;
+	pEntry->Expires = now + maxAge;
+	pEntry->LastUse = now;
+}
+
+// Answers a GET to a resource with RES_FLAG_RESPONSE_CACHE with a stored response that is still fresh,
+// returns false if the resource handler has to be called
+bool _rom CoAP_ServeResponseFromCache(CoAP_Interaction_t* pIA) {
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+	CoAP_RespCacheEntry_t* pEntry;
+	CoAP_option_t* pOpt;
+	uint32_t now = CoAP.api.rtc1HzCnt();
+
+	if (!IsCacheableRequest(pIA)) {
+		return false;
+	}
+	PurgeExpiredEntries(now);
+	pEntry = FindEntry(pIA->pRes, pIA->pReqMsg->pOptionsList);
+	if (pEntry == NULL) {
+		return false;
+	}
+
+	if (pEntry->pPayloadBuf != NULL) {
+		CoAP_SetSharedPayload(pResp, pEntry->pPayloadBuf, pEntry->pPayload, pEntry->PayloadLength);
+	} else {
+		pResp->PayloadLength = 0;
+	}
+	CoAP_FreeOptionList(&(pResp->pOptionsList));
+	for (pOpt = pEntry->pOptList; pOpt != NULL; pOpt = pOpt->next) {
+		CoAP_CopyOptionToList(&(pResp->pOptionsList), pOpt);
+	}
+	CoAP_AppendUintOptionToList(&(pResp->pOptionsList), OPT_NUM_MAX_AGE, pEntry->Expires - now); //remaining freshness
+	pResp->Code = pEntry->Code;
+	pEntry->LastUse = now;
+	INFO("- Response served from cache (fresh for %" PRIu32 " s)\r\n", pEntry->Expires - now);
+	return true;
+}
+
+// Drops all cached responses of a changed or removed resource
+void _rom CoAP_InvalidateResponseCache(CoAP_Res_t* pRes) {
+	int i;
+	for (i = 0; i < RESPONSE_CACHE_ENTRIES; i++) {
+		if (RespCache[i].pRes == pRes) {
+			ReleaseEntry(&RespCache[i]);
+		}
+	}
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef COAP_RESPCACHE_H_
+#define COAP_RESPCACHE_H_
+
+#ifdef COAP_RESPONSE_CACHE_ENTRIES
+#define RESPONSE_CACHE_ENTRIES (COAP_RESPONSE_CACHE_ENTRIES) //max. number of cached responses, the least recently used one is replaced
+#else
+#define RESPONSE_CACHE_ENTRIES (8)
+#endif
+#ifdef COAP_RESPONSE_CACHE_MAX_SIZE
+#define RESPONSE_CACHE_MAX_SIZE (COAP_RESPONSE_CACHE_MAX_SIZE) //[byte] responses with a larger payload are not cached
+#else
+#define RESPONSE_CACHE_MAX_SIZE (512)
+#endif
+
+// Response of a resource with RES_FLAG_RESPONSE_CACHE to a GET with given Uri-Path, Uri-Query and Accept options
+typedef struct {
+	CoAP_Res_t* pRes;                               //NULL if unused
+	uint32_t KeyHash;
+	CoAP_option_t* pKey;                            //Uri-Path, Uri-Query and Accept options of the request
+	uint32_t Expires;                               //end of the Max-Age of the response
+	uint32_t LastUse;
+	CoAP_MessageCode_t Code;
+	CoAP_option_t* pOptList;                        //response options, Max-Age is set on each hit
+	uint16_t PayloadLength;
+	CoAP_PayloadBuf_t* pPayloadBuf;                 //shared with the responses served from it
+	uint8_t* pPayload;                              //within pPayloadBuf
+} CoAP_RespCacheEntry_t;
+
+// Cache key: Uri-Path, Uri-Query and Accept options of a request (also used by the block2 cache)
+uint32_t CoAP_CacheKeyHash(CoAP_option_t* pOptList);
+bool CoAP_CacheKeyMatches(CoAP_option_t* pKey, CoAP_option_t* pOptList);
+CoAP_Result_t CoAP_CopyCacheKey(CoAP_option_t** ppKey, CoAP_option_t* pOptList);
+
+void CoAP_ResponseCacheStore(CoAP_Interaction_t* pIA);
+bool CoAP_ServeResponseFromCache(CoAP_Interaction_t* pIA);
+
+#endif /* COAP_RESPCACHE_H_ */
@@ -0,0 +1,433 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#include <inttypes.h>
+#include "coap.h"
+#include "coap_mem.h"
+
+static const uint8_t SnapshotMagic[] = {'C', 'S', 'N', 'P', SNAPSHOT_VERSION, sizeof(NetEp_t), sizeof(SocketHandle_t), sizeof(MetaInfo_t)};
+
+typedef struct {
+	uint8_t* pBuf; //NULL to count bytes only
+	uint32_t Size;
+	uint32_t Pos;
+	uint32_t Now;
+	bool Ok;
+} Writer_t;
+
+typedef struct {
+	const uint8_t* pBuf;
+	uint32_t Size;
+	uint32_t Pos;
+	uint32_t Now;
+	bool Ok;
+} Reader_t;
+
+static void _rom Put(Writer_t* w, const void* pData, uint32_t len) {
+	if (w->pBuf != NULL && w->Pos + len <= w->Size) {
+		coap_memcpy(&(w->pBuf[w->Pos]), pData, len);
+	}
+	w->Pos += len;
+}
+
+static void _rom PutU8(Writer_t* w, uint8_t v) {
+	Put(w, &v, sizeof(v));
+}
+
+static void _rom PutTime(Writer_t* w, uint32_t t) {
+	int32_t delta = (int32_t) (t - w->Now);
+	Put(w, &delta, sizeof(delta));
+}
+
+static void _rom PutOptions(Writer_t* w, CoAP_option_t* pOptList) {
+	uint16_t len = CoAP_NeededMem4PackOptions(pOptList);
+
+	Put(w, &len, sizeof(len));
+	if (w->pBuf != NULL && w->Pos + len <= w->Size) {
+		pack_OptionsFromList(&(w->pBuf[w->Pos]), &len, pOptList);
+	}
+	w->Pos += len;
+}
+
+// Resources are identified by their URI, NULL is stored as no options at all
+static void _rom PutResource(Writer_t* w, CoAP_Res_t* pRes) {
+	PutU8(w, pRes != NULL);
+	if (pRes != NULL) {
+		PutOptions(w, pRes->pUri);
+	}
+}
+
+static void _rom PutMessage(Writer_t* w, CoAP_Message_t* pMsg) {
+	PutU8(w, pMsg != NULL);
+	if (pMsg == NULL) {
+		return;
+	}
+	PutU8(w, (uint8_t) pMsg->Type);
+	PutU8(w, (uint8_t) pMsg->Code);
+	Put(w, &(pMsg->MessageID), sizeof(pMsg->MessageID));
+	Put(w, &(pMsg->Token), sizeof(CoAP_Token_t));
+	PutTime(w, pMsg->Timestamp);
+	PutOptions(w, pMsg->pOptionsList);
+	Put(w, &(pMsg->PayloadLength), sizeof(pMsg->PayloadLength));
+	Put(w, pMsg->Payload, pMsg->PayloadLength);
+}
+
+static bool _rom Get(Reader_t* r, void* pData, uint32_t len) {
+	if (!r->Ok || r->Pos + len > r->Size) {
+		r->Ok = false;
+		memset(pData, 0, len);
+		return false;
+	}
+	coap_memcpy(pData, &(r->pBuf[r->Pos]), len);
+	r->Pos += len;
+	return true;
+}
+
+static uint8_t _rom GetU8(Reader_t* r) {
+	uint8_t v;
+	Get(r, &v, sizeof(v));
+	return v;
+}
+
+static uint32_t _rom GetTime(Reader_t* r) {
+	int32_t delta;
+	Get(r, &delta, sizeof(delta));
+	return r->Now + (uint32_t) delta;
+}
+
+static void _rom GetOptions(Reader_t* r, CoAP_option_t** pOptList) {
+	uint16_t len;
+	uint8_t* pPayload;
+
+	if (!Get(r, &len, sizeof(len)) || r->Pos + len > r->Size) {
+		r->Ok = false;
+		return;
+	}
+	if (parse_OptionsFromRaw((uint8_t*) &(r->pBuf[r->Pos]), len, &pPayload, pOptList) != COAP_OK) {
+		CoAP_FreeOptionList(pOptList);
+		r->Ok = false;
+		return;
+	}
+	r->Pos += len;
+}
+
+static CoAP_Res_t* _rom GetResource(Reader_t* r) {
+	CoAP_option_t* pUri = NULL;
+	CoAP_Res_t* pRes;
+
+	if (!GetU8(r)) {
+		return NULL;
+	}
+	GetOptions(r, &pUri);
+	pRes = r->Ok ? CoAP_FindResourceByUri(NULL, pUri) : NULL;
+	CoAP_FreeOptionList(&pUri);
+	return pRes;
+}
+
+static CoAP_Message_t* _rom GetMessage(Reader_t* r) {
+	CoAP_MessageType_t type;
+	CoAP_MessageCode_t code;
+	uint16_t mid;
+	CoAP_Token_t token;
+	uint32_t timestamp;
+	CoAP_option_t* pOptList = NULL;
+	uint16_t payloadLength;
+	CoAP_Message_t* pMsg;
+
+	if (!GetU8(r)) {
+		return NULL;
+	}
+	type = (CoAP_MessageType_t) GetU8(r);
+	code = (CoAP_MessageCode_t) GetU8(r);
+	Get(r, &mid, sizeof(mid));
+	Get(r, &token, sizeof(token));
+	timestamp = GetTime(r);
+	GetOptions(r, &pOptList);
+	Get(r, &payloadLength, sizeof(payloadLength));
+	if (!r->Ok || payloadLength > MAX_PAYLOAD_SIZE || r->Pos + payloadLength > r->Size) {
+		CoAP_FreeOptionList(&pOptList);
+		r->Ok = false;
+		return NULL;
+	}
+
+	pMsg = CoAP_CreateMessage(type, code, mid, &(r->pBuf[r->Pos]), payloadLength, payloadLength, token);
+	r->Pos += payloadLength;
+	if (pMsg == NULL) {
+		CoAP_FreeOptionList(&pOptList);
+		return NULL;
+	}
+	pMsg->Timestamp = timestamp;
+	pMsg->pOptionsList = pOptList;
+	return pMsg;
+}
+
+static void _rom PutState(Writer_t* w) {
+	CoAP_Res_t* pRes;
+	CoAP_Observer_t* pObserver;
+	CoAP_Interaction_t* pIA;
+	CoAP_option_t* pOptList = NULL;
+	uint16_t mid;
+	uint8_t token;
+	uint32_t cnt = 0;
+	uint16_t crc;
+
+	Put(w, SnapshotMagic, sizeof(SnapshotMagic));
+	CoAP_GetIds(&mid, &token);
+	Put(w, &mid, sizeof(mid));
+	PutU8(w, token);
+
+	//Observe sequence numbers
+	for (pRes = CoAP_GetResourceList(); pRes != NULL; pRes = pRes->next) {
+		cnt++;
+	}
+	Put(w, &cnt, sizeof(cnt));
+	for (pRes = CoAP_GetResourceList(); pRes != NULL; pRes = pRes->next) {
+		PutResource(w, pRes);
+		Put(w, &(pRes->UpdateCnt), sizeof(pRes->UpdateCnt));
+	}
+
+	cnt = 0;
+	for (pRes = CoAP_GetResourceList(); pRes != NULL; pRes = pRes->next) {
+		for (pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) {
+			cnt++;
+		}
+	}
+	Put(w, &cnt, sizeof(cnt));
+	for (pRes = CoAP_GetResourceList(); pRes != NULL; pRes = pRes->next) {
+		for (pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) {
+			if (CoAP_ObserverToOptions(pRes, pObserver, true, &pOptList) != COAP_OK) {
+				w->Ok = false;
+				return;
+			}
+			PutOptions(w, pOptList);
+			CoAP_FreeOptionList(&pOptList);
+			PutU8(w, pObserver->FailCount);
+			PutU8(w, pObserver->UpdatePending);
+			Put(w, &(pObserver->LastValue), sizeof(pObserver->LastValue));
+			PutTime(w, pObserver->LastNotify);
+		}
+	}
+
+	//client requests end with the restart, their callbacks and user data can not be restored
+	cnt = 0;
+	for (pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+		if (pIA->Role != COAP_ROLE_CLIENT) {
+			cnt++;
+		}
+	}
+	Put(w, &cnt, sizeof(cnt));
+	for (pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+		if (pIA->Role == COAP_ROLE_CLIENT) {
+			continue;
+		}
+		PutU8(w, (uint8_t) pIA->Role);
+		PutU8(w, (uint8_t) pIA->State);
+		PutResource(w, pIA->pRes);
+		PutU8(w, pIA->pObserver != NULL);
+		Put(w, &(pIA->RemoteEp), sizeof(NetEp_t));
+		Put(w, &(pIA->socketHandle), sizeof(SocketHandle_t));
+		PutU8(w, pIA->UpdatePendingNotification);
+		PutU8(w, pIA->RetransCounter);
+		PutTime(w, pIA->AckTimeout);
+		PutTime(w, pIA->SleepUntil);
+		PutU8(w, (uint8_t) pIA->ReqConfirmState);
+		Put(w, &(pIA->ReqMetaInfo), sizeof(MetaInfo_t));
+		PutU8(w, (uint8_t) pIA->ResConfirmState);
+		Put(w, &(pIA->RespMetaInfo), sizeof(MetaInfo_t));
+		PutMessage(w, pIA->pReqMsg);
+		PutMessage(w, pIA->pRespMsg); //shared notifications are stored as ordinary messages
+	}
+
+	if (w->pBuf != NULL && w->Pos <= w->Size) {
+		crc = CoAP_Crc16(w->pBuf, w->Pos);
+		Put(w, &crc, sizeof(crc));
+	} else {
+		w->Pos += sizeof(crc);
+	}
+}
+
+CoAP_Result_t _rom CoAP_SnapshotState(uint8_t* pBuf, uint32_t bufSize, uint32_t* pLength) {
+	Writer_t w = {.pBuf = pBuf, .Size = bufSize, .Pos = 0, .Now = CoAP.api.rtc1HzCnt(), .Ok = true};
+
+	PutState(&w);
+	*pLength = w.Pos;
+	if (!w.Ok) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	if (pBuf != NULL && w.Pos > bufSize) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	INFO("State snapshot: %"PRIu32" bytes\r\n", w.Pos);
+	return COAP_OK;
+}
+
+static void _rom GetObserver(Reader_t* r) {
+	CoAP_option_t* pOptList = NULL;
+	CoAP_Observer_t* pObserver;
+	CoAP_Observer_t* pExisting;
+	CoAP_Res_t* pRes;
+
+	GetOptions(r, &pOptList);
+	pObserver = CoAP_AllocNewObserver();
+	if (pObserver == NULL) {
+		CoAP_FreeOptionList(&pOptList);
+		r->Ok = false; //out of memory
+		return;
+	}
+	pRes = CoAP_ObserverFromOptions(pOptList, pObserver);
+	CoAP_FreeOptionList(&pOptList);
+	CoAP_ParseObserveAttributes(pObserver);
+
+	pObserver->FailCount = GetU8(r);
+	pObserver->UpdatePending = GetU8(r);
+	Get(r, &(pObserver->LastValue), sizeof(pObserver->LastValue));
+	pObserver->LastNotify = GetTime(r);
+
+	if (!r->Ok || pRes == NULL) {
+		CoAP_FreeObserver(&pObserver);
+		return;
+	}
+
+	//e.g. already restored from the observer log
+	pExisting = CoAP_FindObserver(pRes, pObserver->socketHandle, &(pObserver->Ep));
+	if (pExisting != NULL && CoAP_TokenEqual(pExisting->Token, pObserver->Token)) {
+		pExisting->FailCount = pObserver->FailCount;
+		pExisting->UpdatePending = pObserver->UpdatePending;
+		pExisting->LastValue = pObserver->LastValue;
+		pExisting->LastNotify = pObserver->LastNotify;
+		CoAP_FreeObserver(&pObserver);
+		return;
+	}
+	if (pExisting != NULL) {
+		CoAP_DetachObserver(pExisting, true);
+	}
+	CoAP_AttachObserver(pRes, pObserver);
+}
+
+static void _rom GetInteraction(Reader_t* r, CoAP_Interaction_t*** pppTail) {
+	CoAP_Interaction_t* pIA = (CoAP_Interaction_t*) CoAP_malloc0(sizeof(CoAP_Interaction_t));
+	bool hasObserver;
+
+	if (pIA == NULL) {
+		r->Ok = false; //out of memory, the interactions restored so far are kept
+		return;
+	}
+	memset(pIA, 0, sizeof(CoAP_Interaction_t));
+
+	pIA->Role = (CoAP_InteractionRole_t) GetU8(r);
+	pIA->State = (CoAP_InteractionState_t) GetU8(r);
+	pIA->pRes = GetResource(r);
+	if (pIA->pRes != NULL) {
+		pIA->ResGeneration = pIA->pRes->Generation;
+	}
+	hasObserver = GetU8(r);
+	Get(r, &(pIA->RemoteEp), sizeof(NetEp_t));
+	Get(r, &(pIA->socketHandle), sizeof(SocketHandle_t));
+	pIA->UpdatePendingNotification = GetU8(r);
+	pIA->RetransCounter = GetU8(r);
+	pIA->AckTimeout = GetTime(r);
+	pIA->SleepUntil = GetTime(r);
+	pIA->ReqConfirmState = (CoAP_ConfirmationState_t) GetU8(r);
+	Get(r, &(pIA->ReqMetaInfo), sizeof(MetaInfo_t));
+	pIA->ResConfirmState = (CoAP_ConfirmationState_t) GetU8(r);
+	Get(r, &(pIA->RespMetaInfo), sizeof(MetaInfo_t));
+	pIA->pReqMsg = GetMessage(r);
+	pIA->pRespMsg = GetMessage(r);
+
+	if (!r->Ok || (pIA->Role != COAP_ROLE_SERVER && pIA->Role != COAP_ROLE_NOTIFICATION)) {
+		r->Ok = false;
+		CoAP_FreeInteraction(&pIA);
+		return;
+	}
+
+	if (pIA->pReqMsg != NULL) {
+		pIA->pReqMsg->pResource = pIA->pRes;
+	}
+	if (hasObserver && pIA->pRes != NULL) {
+		pIA->pObserver = CoAP_FindObserver(pIA->pRes, pIA->socketHandle, &(pIA->RemoteEp));
+		if (pIA->pObserver != NULL) {
+			pIA->pObserver->pPendingIA = pIA;
+		}
+	}
+
+	**pppTail = pIA;
+	*pppTail = &(pIA->next);
+}
+
+CoAP_Result_t _rom CoAP_RestoreState(const uint8_t* pImage, uint32_t length) {
+	Reader_t r = {.pBuf = pImage, .Size = length, .Pos = 0, .Now = CoAP.api.rtc1HzCnt(), .Ok = true};
+	uint8_t magic[sizeof(SnapshotMagic)];
+	uint16_t crc;
+	uint16_t mid;
+	uint8_t token;
+	uint32_t cnt;
+	CoAP_Interaction_t** ppTail;
+
+	if (length < sizeof(SnapshotMagic) + sizeof(crc)) {
+		return COAP_ERR_ARGUMENT;
+	}
+	coap_memcpy(&crc, &pImage[length - sizeof(crc)], sizeof(crc));
+	if (crc != CoAP_Crc16(pImage, length - sizeof(crc))) {
+		ERROR("- State snapshot damaged\r\n");
+		return COAP_ERR_ARGUMENT;
+	}
+	r.Size -= sizeof(crc);
+
+	Get(&r, magic, sizeof(magic));
+	if (memcmp(magic, SnapshotMagic, sizeof(magic)) != 0) {
+		ERROR("- State snapshot of other version or platform\r\n");
+		return COAP_ERR_ARGUMENT;
+	}
+
+	Get(&r, &mid, sizeof(mid));
+	token = GetU8(&r);
+	CoAP_SetIds(mid, token);
+
+	Get(&r, &cnt, sizeof(cnt));
+	while (r.Ok && cnt--) {
+		CoAP_Res_t* pRes = GetResource(&r);
+		uint32_t updateCnt;
+		Get(&r, &updateCnt, sizeof(updateCnt));
+		if (pRes != NULL) {
+			pRes->UpdateCnt = updateCnt;
+		}
+	}
+
+	Get(&r, &cnt, sizeof(cnt));
+	while (r.Ok && cnt--) {
+		GetObserver(&r);
+	}
+
+	//restored interactions go behind the ones created since start up
+	for (ppTail = &(CoAP.pInteractions); *ppTail != NULL; ppTail = &((*ppTail)->next)) {
+	}
+	Get(&r, &cnt, sizeof(cnt));
+	while (r.Ok && cnt--) {
+		GetInteraction(&r, &ppTail);
+	}
+
+	if (!r.Ok) {
+		ERROR("- State snapshot only partially restored\r\n");
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	INFO("State restored from snapshot\r\n");
+	return COAP_OK;
+}
@@ -0,0 +1,174 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#include <inttypes.h>
+#include "coap.h"
+#include "coap_mem.h"
+
+static uint32_t UploadCnt = 0; //uploads in progress of all resources
+static uint32_t LastPurge = 0;
+
+// Unlinks and frees an upload, the sink is told about the abort if requested
+static void DropUpload(CoAP_Res_t* pRes, CoAP_Upload_t* pUpload, CoAP_Message_t* pReq, bool abort) {
+	CoAP_Upload_t** ppUpload;
+	for (ppUpload = &(pRes->pListUploads); *ppUpload != NULL; ppUpload = &((*ppUpload)->next)) {
+		if (*ppUpload == pUpload) {
+			*ppUpload = pUpload->next;
+			break;
+		}
+	}
+
+	if (abort && pRes->UploadSink != NULL) {
+		pRes->UploadSink(pReq, pUpload->NextNum * pUpload->BlockSize, NULL, 0, true, &(pUpload->pCtx));
+	}
+	CoAP_free(pUpload);
+	UploadCnt--;
+}
+
+static void PurgeIdleUploads(CoAP_Res_t* pRes) {
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	CoAP_Upload_t* pUpload = pRes->pListUploads;
+
+	while (pUpload != NULL) {
+		CoAP_Upload_t* pNext = pUpload->next;
+		if (timeAfter(now, pUpload->LastActivity + UPLOAD_IDLE_TIMEOUT)) {
+			INFO("- Block1 upload timed out after %" PRIu32 " blocks\r\n", pUpload->NextNum);
+			DropUpload(pRes, pUpload, NULL, true);
+		}
+		pUpload = pNext;
+	}
+}
+
+static CoAP_Upload_t* FindUpload(CoAP_Res_t* pRes, CoAP_Interaction_t* pIA, CoAP_option_t* pReqTag) {
+	uint8_t tagLength = pReqTag != NULL ? (uint8_t) pReqTag->Length : 0;
+	CoAP_Upload_t* pUpload;
+
+	for (pUpload = pRes->pListUploads; pUpload != NULL; pUpload = pUpload->next) {
+		if (pUpload->socketHandle == pIA->socketHandle && EpAreEqual(&(pUpload->Ep), &(pIA->RemoteEp))
+				&& pUpload->RequestTagLength == tagLength
+				&& (tagLength == 0 || coap_memcmp(pUpload->RequestTag, pReqTag->Value, tagLength) == 0)) {
+			return pUpload;
+		}
+	}
+	return NULL;
+}
+
+// Block1 uploads to resources with an upload sink. Every block is passed to the sink and answered
+// with 2.31 by the engine, only the last one is left to the resource handler.
+// Returns true if the request has been answered (code of pIA->pRespMsg set), false if the handler has to be called.
+bool _rom CoAP_HandleUploadBlock(CoAP_Interaction_t* pIA) {
+	CoAP_Res_t* pRes = pIA->pRes;
+	CoAP_Message_t* pReq = pIA->pReqMsg;
+	CoAP_Message_t* pResp = pIA->pRespMsg;
+	CoAP_blockwise_option_t B1opt;
+
+	if (pRes->UploadSink == NULL || GetBlock1OptionFromMsg(pReq, &B1opt) != COAP_OK) {
+		return false;
+	}
+	if (CoAP_FindOptionByNumber(pResp, OPT_NUM_BLOCK1) != NULL) {
+		return false; //last block has been passed before, handler postponed its response
+	}
+
+	CoAP_option_t* pReqTag = CoAP_FindOptionByNumber(pReq, OPT_NUM_REQUEST_TAG);
+	if (pReqTag != NULL && pReqTag->Length > sizeof(((CoAP_Upload_t*) 0)->RequestTag)) {
+		pResp->Code = RESP_BAD_OPTION_4_02;
+		return true;
+	}
+	if (B1opt.MoreFlag && pReq->PayloadLength != B1opt.BlockSize) {
+		INFO("- Block1 payload does not match block size\r\n");
+		pResp->Code = RESP_ERROR_BAD_REQUEST_4_00;
+		return true;
+	}
+
+	CoAP_Upload_t* pUpload = FindUpload(pRes, pIA, pReqTag);
+
+	if (B1opt.BlockNum == 0) { //(re)start
+		if (pUpload != NULL) {
+			DropUpload(pRes, pUpload, pReq, true);
+		}
+		pUpload = (CoAP_Upload_t*) CoAP_malloc0(sizeof(CoAP_Upload_t));
+		if (pUpload == NULL) {
+			pResp->Code = RESP_SERVICE_UNAVAILABLE_5_03;
+			return true;
+		}
+		pUpload->socketHandle = pIA->socketHandle;
+		CopyEndpoints(&(pUpload->Ep), &(pIA->RemoteEp));
+		if (pReqTag != NULL) {
+			pUpload->RequestTagLength = (uint8_t) pReqTag->Length;
+			coap_memcpy(pUpload->RequestTag, pReqTag->Value, pReqTag->Length);
+		}
+		pUpload->BlockSize = B1opt.BlockSize;
+		pUpload->next = pRes->pListUploads;
+		pRes->pListUploads = pUpload;
+		UploadCnt++;
+	} else if (pUpload == NULL || pUpload->BlockSize != B1opt.BlockSize || B1opt.BlockNum > pUpload->NextNum) {
+		INFO("- Block1 %" PRIu32 " out of sequence\r\n", B1opt.BlockNum);
+		if (pUpload != NULL) {
+			DropUpload(pRes, pUpload, pReq, true);
+		}
+		pResp->Code = RESP_REQUEST_ENTITY_INCOMPLETE_4_08;
+		return true;
+	} else if (B1opt.BlockNum < pUpload->NextNum) { //retransmission, already passed to sink
+		AddBlkOptionToMsg(pResp, &B1opt);
+		pResp->Code = RESP_SUCCESS_CONTINUE_2_31;
+		return true;
+	}
+
+	CoAP_Result_t res = pRes->UploadSink(pReq, B1opt.BlockNum * pUpload->BlockSize, pReq->Payload, pReq->PayloadLength, !B1opt.MoreFlag, &(pUpload->pCtx));
+	if (res != COAP_OK) {
+		INFO("- Block1 upload rejected by sink\r\n");
+		DropUpload(pRes, pUpload, pReq, false);
+		pResp->Code = (res == COAP_ERR_OUT_OF_MEMORY) ? RESP_REQUEST_ENTITY_TOO_LARGE_4_13 : RESP_INTERNAL_SERVER_ERROR_5_00;
+		return true;
+	}
+	pUpload->NextNum = B1opt.BlockNum + 1;
+	pUpload->LastActivity = CoAP.api.rtc1HzCnt();
+
+	AddBlkOptionToMsg(pResp, &B1opt); //acknowledge block
+	if (B1opt.MoreFlag) {
+		pResp->Code = RESP_SUCCESS_CONTINUE_2_31;
+		return true;
+	}
+
+	DropUpload(pRes, pUpload, pReq, false); //complete
+	return false;
+}
+
+// Drops uploads of all resources that did not get a new block for UPLOAD_IDLE_TIMEOUT,
+// called from CoAP_doWork() but walks the resources at most once per second and only while uploads are in progress
+void _rom CoAP_PurgeIdleUploads() {
+	uint32_t now = CoAP.api.rtc1HzCnt();
+	CoAP_Res_t* pRes;
+
+	if (UploadCnt == 0 || now == LastPurge) {
+		return;
+	}
+	LastPurge = now;
+	for (pRes = CoAP_GetResourceList(); pRes != NULL && UploadCnt != 0; pRes = pRes->next) {
+		PurgeIdleUploads(pRes);
+	}
+}
+
+void _rom CoAP_FreeUploads(CoAP_Res_t* pRes) {
+	while (pRes->pListUploads != NULL) {
+		DropUpload(pRes, pRes->pListUploads, NULL, true);
+	}
+}
@@ -0,0 +1,48 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef COAP_UPLOAD_H_
+#define COAP_UPLOAD_H_
+
+#ifdef COAP_UPLOAD_IDLE_TIMEOUT
+#define UPLOAD_IDLE_TIMEOUT (COAP_UPLOAD_IDLE_TIMEOUT) //[s] unfinished Block1 uploads are dropped after this time without a new block
+#else
+#define UPLOAD_IDLE_TIMEOUT (60)
+#endif
+
+// Block1 upload (RFC7959) in progress, identified by endpoint and Request-Tag per resource
+typedef struct CoAP_Upload {
+	struct CoAP_Upload* next;
+	SocketHandle_t socketHandle;
+	NetEp_t Ep;
+	uint8_t RequestTagLength;
+	uint8_t RequestTag[8];
+	uint16_t BlockSize;
+	uint32_t NextNum;                               //next expected block number
+	uint32_t LastActivity;
+	void* pCtx;                                     //owned by the upload sink
+} CoAP_Upload_t;
+
+bool CoAP_HandleUploadBlock(CoAP_Interaction_t* pIA);
+void CoAP_PurgeIdleUploads();
+void CoAP_FreeUploads(CoAP_Res_t* pRes);
+
+#endif /* COAP_UPLOAD_H_ */
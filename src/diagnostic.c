@@ -38,6 +38,8 @@ char* InteractionStateToString(CoAP_InteractionState_t state) {
 		return "WAITING_RESPONSE";
 	case COAP_STATE_HANDLE_RESPONSE:
 		return "HANDLE_RESPONSE";
+	case COAP_STATE_OBSERVING:
+		return "OBSERVING";
 	case COAP_STATE_FINISHED:
 		return "FINISHED";
 	default:
@@ -170,12 +170,15 @@ typedef struct {
 
 typedef enum {
 	// Core Options
+	OPT_NUM_IF_MATCH = 1,
 	OPT_NUM_URI_PATH = 11,
 	OPT_NUM_URI_HOST = 3,
 	OPT_NUM_ETAG = 4,
+	OPT_NUM_IF_NONE_MATCH = 5,
 	OPT_NUM_OBSERVE = 6,
 	OPT_NUM_URI_PORT = 7,
 	OPT_NUM_CONTENT_FORMAT = 12,
+	OPT_NUM_MAX_AGE = 14,
 	OPT_NUM_URI_QUERY = 15,
 	OPT_NUM_ACCEPT = 17,
 	// Blockwise transfers
@@ -183,6 +186,7 @@ typedef enum {
 	OPT_NUM_BLOCK1 = 27,
 	OPT_NUM_SIZE2 = 28,
 	OPT_NUM_SIZE1 = 60,
+	OPT_NUM_REQUEST_TAG = 292,
 	OPT_NUM_LOBARO_TOKEN_SAVE = 350
 } CoAP_KnownOptionNumbers_t;
 
@@ -250,6 +254,21 @@ typedef struct {
 // Delcare CoAP_Res so it can be used in CoAP_Message_t
 struct CoAP_Res;
 
+// Where the payload of a message is located and who frees it
+typedef enum {
+	PAYLOAD_OWNED = 0, // in the message memory or in the payload buffer referenced by the message
+	PAYLOAD_BORROWED,  // in memory of another stack object that outlives the message (e.g. a shared notification)
+	PAYLOAD_STATIC     // in application memory, never freed by the stack
+} CoAP_PayloadMode_t;
+
+// Reference counted payload buffer, shared by messages and caches without copying.
+// The payload is located behind TX_HEADROOM bytes for header, token and options of a datagram.
+typedef struct {
+	uint16_t RefCnt;
+	uint16_t Size;                              // payload bytes
+	uint8_t Data[];
+} CoAP_PayloadBuf_t;
+
 typedef struct {
 	uint32_t Timestamp; //set by parse/send network routines
 	//VER is implicit = 1
@@ -258,10 +277,12 @@ typedef struct {
 	CoAP_MessageCode_t Code;                    // [1] Code
 	uint16_t MessageID;                         // [2] Message ID (maps ACK msg to coresponding CON msg)
 	uint16_t PayloadLength;                     // [2]
-	uint16_t PayloadBufSize;                    // [2] size of allocated msg payload buffer
+	uint16_t PayloadBufSize;                    // [2] size of allocated msg payload buffer, 0 if the payload must not be written
+	CoAP_PayloadMode_t PayloadMode;             // [1]
 	CoAP_Token_t Token;                         // [9] Token (1 byte Length + up to 8 Byte for the token content)
 	CoAP_option_t *pOptionsList;                // [4] linked list of Options
 	uint8_t *Payload;                           // [4] MUST be last in struct! Because of mem allocation scheme which tries to allocate message mem and payload mem in ONE big data chunk
+	CoAP_PayloadBuf_t *pPayloadBuf;             // [4] reference held by the msg, NULL if none
 
 	struct CoAP_Res *pResource;                      // Pointer the the resource this message is intended for.
 } CoAP_Message_t; //total of 25 Bytes
@@ -276,8 +297,23 @@ typedef struct CoAP_Observer {
 	uint8_t FailCount;           // [1B]
 	CoAP_Token_t Token;          // [9B]
 	CoAP_option_t *pOptList;     // [xxB](uri-host) <- will be removed if attached, uri-query, observe (for seq number)
+	struct CoAP_Interaction *pPendingIA; // [4B] notification interaction in progress (not saved while sleeping)
+	struct CoAP_Res *pRes;       // [4B] observed resource (not saved while sleeping)
+
+	// Conditional attributes (pmin, pmax, gt, lt, st) from Uri-Query, see CoAP_ParseObserveAttributes(...)
+	uint8_t AttrFlags;           // [1B] OBS_ATTR_xxx
+	bool UpdatePending;          // [1B] update held back until pmin has passed
+	uint32_t Pmin;               // [4B] [s] min. time between notifications
+	uint32_t Pmax;               // [4B] [s] max. time between notifications
+	float Gt;                    // [4B] notify if value is greater than
+	float Lt;                    // [4B] notify if value is less than
+	float St;                    // [4B] notify if value changed by at least
+	float LastValue;             // [4B] value sent with the last notification
+	uint32_t LastNotify;         // [4B] time of the last notification
 
 	struct CoAP_Observer *next;  // [4B] pointer (linked list) (not saved while sleeping)
+	struct CoAP_Observer *prev;  // [4B] pointer (linked list) (not saved while sleeping)
+	struct CoAP_Observer *nextInIndex; // [4B] pointer (observer index bucket) (not saved while sleeping)
 } CoAP_Observer_t;
 
 //################################
@@ -293,6 +329,16 @@ typedef struct CoAP_Observer {
 #define RES_OPT_PATCH  (1 << REQ_PATCH)  // 1<<6
 #define RES_OPT_IPATCH (1 << REQ_IPATCH) // 1<<7
 
+//Bitfields for resource Flags
+#define RES_FLAG_BLOCK2_CACHE (1 << 0) // snapshot blockwise GET representations, later blocks are served without calling the handler
+#define RES_FLAG_SHARED_NOTIFICATION (1 << 1) // notifier is called once per update (with pObserver = NULL), all observers get the same options and payload
+#define RES_FLAG_SKIP_UNCHANGED (1 << 2) // updates are only notified if the notifier output changed, it is called once more per update to find out
+#define RES_FLAG_UNCHANGED_KEEPALIVE (1 << 3) // with RES_FLAG_SKIP_UNCHANGED: notify unchanged output anyway once its Max-Age has expired
+#define RES_FLAG_RESPONSE_CACHE (1 << 4) // GET responses (without Observe) are cached for their Max-Age per Uri-Path, Uri-Query and Accept, hits are served without calling the handler, a 2.xx to PUT, POST, DELETE, PATCH or iPATCH drops them
+#define RES_FLAG_AUTO_ETAG (1 << 5) // 2.05 responses without ETag get the hash of their payload as ETag, so clients can revalidate with 2.03 Valid
+#define RES_FLAG_COALESCE (1 << 6) // equivalent GETs (same Uri-Path, Uri-Query and Accept) pending at the same time or received within COAP_COALESCE_WINDOW share one handler call and its 2.05 response
+#define RES_FLAG_ADAPTIVE_RESP_SIZE (1 << 7) // the initial response payload buffer follows the payload sizes of previous responses
+
 typedef enum {
 	HANDLER_OK = 0,
 	HANDLER_POSTPONE = 1,
@@ -303,23 +349,77 @@ typedef CoAP_HandlerResult_t (*CoAP_ResourceHandler_fPtr_t)(CoAP_Message_t *pReq
 // TODO: Can we use the CoAP_ResourceHandler_fPtr_t signature also for notifiers?
 typedef CoAP_HandlerResult_t (*CoAP_ResourceNotifier_fPtr_t)(CoAP_Observer_t *pObserver, CoAP_Message_t *pResp);
 
+// Receives Block1 uploads (RFC7959) to a resource block by block and in order, see CoAP_SetResourceUploadSink(...)
+// offset: position of pData within the upload, a new upload starts with offset 0
+// last: final block, the resource handler is called with this block afterwards
+// ppCtx: per upload state of the sink, NULL at offset 0
+// pData == NULL signals an aborted upload (pReq is NULL on timeout)
+// Returning COAP_ERR_OUT_OF_MEMORY rejects the upload with 4.13, any other error with 5.00
+typedef CoAP_Result_t (*CoAP_ResourceUploadSink_fPtr_t)(CoAP_Message_t *pReq, uint32_t offset, const uint8_t *pData, uint16_t length, bool last, void **ppCtx);
+
+// Returns the entity-tag of the current representation of a resource, see CoAP_SetResourceETagGetter(...)
+// pETag: buffer of 8 bytes, *pLength is set to the length of the entity-tag (0 = none)
+// Returning COAP_NOT_FOUND tells that the resource has no representation at the moment
+typedef CoAP_Result_t (*CoAP_ResourceETagGetter_fPtr_t)(struct CoAP_Res *pRes, uint8_t *pETag, uint8_t *pLength);
+
 typedef struct {
 	uint16_t Cf;    // Content-Format
 	uint16_t AllowedMethods; // Bitwise resource options //todo: Send Response as CON or NON
 	uint16_t ETag;
+	uint16_t Flags; // RES_FLAG_xxx
+	uint16_t RespSizeHint; // [byte] initial payload buffer of responses and notifications, 0 = default (never less than 64)
 } CoAP_ResOpts_t;
 
 typedef struct CoAP_Res {
 	struct CoAP_Res *next; //4 byte pointer (linked list)
+	struct CoAP_Res *nextInIndex; //resource index bucket
+	uint32_t UriHash; //hash of the uri-path, see CoAP_FindResourceByUri(...)
+	bool IsPattern; //uri has "{name}" or "*" segments, see CoAP_CreateResource(...)
+	uint32_t Generation; //unique per created resource, a resource allocated at the address of a removed one differs
+	bool Removed; //unlinked by CoAP_RemoveResource(...), released with the next CoAP_doWork()
 	char *pDescription;
+	char *pRt; //resource type link attribute, see CoAP_SetResourceLinkAttributes(...)
+	char *pIf; //interface description link attribute
 	uint32_t UpdateCnt; // Used as value for the Observe option
 	CoAP_ResOpts_t Options;
 	CoAP_option_t *pUri; //linked list of this resource URI options
 	CoAP_Observer_t *pListObservers; //linked list of this resource observers
+	CoAP_Observer_t *pNotifyCursor; //next observer to notify, NULL if no notification fan-out is in progress
+	bool NotifyDueOnly; //the fan-out only reaches observers with a held back update or pmax keepalive due
+	struct CoAP_SharedNotification *pNotification; //latest notification if RES_FLAG_SHARED_NOTIFICATION is set
+	float Value; //value of the latest update, see CoAP_NotifyResourceObserversValue(...)
+	bool HasValue;
+	bool HasNotifyHash;
+	uint32_t NotifyHash; //hash of the latest notified notifier output (RES_FLAG_SKIP_UNCHANGED)
+	uint32_t NotifyTime; //time of the latest notified update
+	uint32_t NotifyMaxAge; //[s] Max-Age of the latest notified update
+	uint16_t RespSize; //[byte] typical payload size of the latest responses (RES_FLAG_ADAPTIVE_RESP_SIZE), 0 = none yet
 	CoAP_ResourceHandler_fPtr_t Handler;
 	CoAP_ResourceNotifier_fPtr_t Notifier; //maybe "NULL" if resource not observable
+	CoAP_ResourceUploadSink_fPtr_t UploadSink; //maybe "NULL" if Block1 uploads are reassembled by the handler
+	struct CoAP_Upload *pListUploads; //Block1 uploads in progress
+	CoAP_ResourceETagGetter_fPtr_t ETagGetter; //maybe "NULL", see CoAP_SetResourceETagGetter(...)
+	uint8_t LastETag[8]; //of the latest 2.05 to a GET without Uri-Query, used if there is no ETagGetter
+	uint8_t LastETagLength; //0 = unknown
+	CoAP_Message_t *pCoalesced; //latest 2.05 to a GET (RES_FLAG_COALESCE), copied for equivalent requests within the coalescing window
+	CoAP_option_t *pCoalescedKey; //Uri-Path, Uri-Query and Accept of its request
+	uint32_t CoalescedAt;
 } CoAP_Res_t;
 
+// Storage of the observer log, see CoAP_SetObserverLog(...)
+// The log needs two regions (0 and 1) of the same size, e.g. two flash sectors or files. Records are only ever
+// appended to the active region, a compaction writes a new image to the other one and switches over to it once
+// the image is complete and reads back intact.
+typedef struct {
+	// Appends len bytes to the end of the region, false if the region is full or failed
+	bool (*append)(uint8_t region, const uint8_t *pData, uint32_t len, void *pCtx);
+	// Reads up to len bytes at offset of the region, returns the number of bytes read (less at its end)
+	uint32_t (*read)(uint8_t region, uint32_t offset, uint8_t *pData, uint32_t len, void *pCtx);
+	// Empties the region
+	bool (*erase)(uint8_t region, void *pCtx);
+	void *pCtx;
+} CoAP_ObserverLogBackend_t;
+
 //################################
 // Initialization
 //################################
@@ -363,6 +463,12 @@ CoAP_Socket_t *CoAP_NewSocket(SocketHandle_t handle);
 /**
  * All resources must be created explicitly.
  * One reason is that the stack handles observer state per resource.
+ * A segment "{name}" of the Uri matches any single segment and a trailing "*" segment all remaining ones,
+ * e.g. "dev/{id}/temp" or "files/<wildcard>" with "*" as wildcard segment.
+ * The handler gets the matched segments by CoAP_GetUriParam(...).
+ * Exact matches are preferred, otherwise patterns are tried in order of creation.
+ * Pattern resources can not be observed and do not use RES_FLAG_BLOCK2_CACHE, both are bound to the resource
+ * and not to the requested path.
  * @param Uri
  * @param Descr
  * @param Options
@@ -373,6 +479,93 @@ CoAP_Socket_t *CoAP_NewSocket(SocketHandle_t handle);
 CoAP_Res_t *CoAP_CreateResource(char *Uri, char *Descr, CoAP_ResOpts_t Options, CoAP_ResourceHandler_fPtr_t pHandlerFkt,
 								CoAP_ResourceNotifier_fPtr_t pNotifierFkt);
 
+/**
+ * Sets the resource type (rt) and interface description (if) attributes of the resource link
+ * in /.well-known/core (RFC6690), which can be used as filter in discovery requests, e.g. "?rt=temperature".
+ * @param pRes
+ * @param rt several types are separated by space, "NULL" for none
+ * @param ifDesc "NULL" for none
+ * @return
+ */
+CoAP_Result_t CoAP_SetResourceLinkAttributes(CoAP_Res_t *pRes, const char *rt, const char *ifDesc);
+
+/**
+ * Removes a resource while the stack keeps running, e.g. when the device behind it is gone.
+ * Its observers get a final 4.04 notification and are removed, pending notifications are dropped
+ * and requests that have not been answered yet (e.g. postponed ones) are answered with 4.04.
+ * The resource is not found by requests anymore right after the call and the same Uri can be created again.
+ * Its memory is released at the start of the next CoAP_doWork(), when no handler or notifier is running,
+ * so a resource can also be removed from within its own handler or notifier.
+ * Like all resource functions it may only be called from the thread that calls CoAP_doWork(), see PortingGuide.md.
+ * @param pRes
+ * @return COAP_ERR_NOT_FOUND if pRes is not a (still) existing resource
+ */
+CoAP_Result_t CoAP_RemoveResource(CoAP_Res_t *pRes);
+
+/**
+ * Drops the cached responses of a resource with RES_FLAG_RESPONSE_CACHE, e.g. after a change that is not
+ * announced by CoAP_NotifyResourceObservers(...), which invalidates them as well.
+ * @param pRes
+ */
+void CoAP_InvalidateResponseCache(CoAP_Res_t *pRes);
+
+// Entry of a static resource table, see CoAP_CreateResources(...)
+typedef struct {
+	char *Uri;
+	char *Descr;
+	CoAP_ResOpts_t Options;
+	CoAP_ResourceHandler_fPtr_t Handler;
+	CoAP_ResourceNotifier_fPtr_t Notifier;
+} CoAP_ResDef_t;
+
+/**
+ * Creates all resources of a table, e.g. a const array defined at compile time.
+ * @param pDefs
+ * @param count number of entries in pDefs
+ * @return COAP_ERR_OUT_OF_MEMORY if a resource could not be created, the ones before are kept
+ */
+CoAP_Result_t CoAP_CreateResources(const CoAP_ResDef_t *pDefs, uint32_t count);
+
+/**
+ * Let the stack handle Block1 uploads to the resource: each block is passed to the sink and acknowledged
+ * with 2.31 Continue, the resource handler is only called for the last block.
+ * Uploads are kept apart by endpoint and Request-Tag option.
+ * @param pRes
+ * @param pSinkFkt "NULL" to leave Block1 handling to the resource handler
+ * @return
+ */
+CoAP_Result_t CoAP_SetResourceUploadSink(CoAP_Res_t *pRes, CoAP_ResourceUploadSink_fPtr_t pSinkFkt);
+
+/**
+ * Tells the stack the entity-tag of the current representation of the resource, which the If-Match and
+ * If-None-Match options of PUT, POST, DELETE, PATCH and iPATCH requests are evaluated against before the handler is called.
+ * Without it the entity-tag of the latest 2.05 response to a GET without Uri-Query is used, which is forgotten on every
+ * successful change by one of these methods or CoAP_NotifyResourceObservers(...). If no entity-tag is known only
+ * "If-Match" with an empty value passes. GET and FETCH are evaluated against the ETag of their own response.
+ * @param pRes
+ * @param pGetterFkt "NULL" to use the entity-tag of the latest GET response
+ * @return
+ */
+CoAP_Result_t CoAP_SetResourceETagGetter(CoAP_Res_t *pRes, CoAP_ResourceETagGetter_fPtr_t pGetterFkt);
+
+/**
+ * Persist observers in an append-only log: every registration and deregistration is appended as
+ * a checksummed record, the log is compacted to the current observers once it has grown large.
+ * The compacted image is written to the inactive region, so power loss during a compaction keeps the old log.
+ * Observers found in the log are restored, so all resources must be created before.
+ * A damaged record at the end of the log (e.g. power loss while appending) is dropped.
+ * @param pBackend storage of the log, copied. "NULL" stops logging
+ * @return COAP_ERR_OUT_OF_MEMORY if the restored observers do not fit into a region, see CoAP_GetObserverLogStatus()
+ */
+CoAP_Result_t CoAP_SetObserverLog(const CoAP_ObserverLogBackend_t *pBackend);
+
+/**
+ * Tells whether the observer log keeps up with the observers. If they do not fit into a region the last complete
+ * log is kept and changes are no longer logged, compaction is tried again once an observer has been removed.
+ * @return COAP_OK or COAP_ERR_OUT_OF_MEMORY if the log is full
+ */
+CoAP_Result_t CoAP_GetObserverLogStatus();
+
 //#####################
 // Message API
 //#####################
@@ -382,12 +575,47 @@ CoAP_Res_t *CoAP_CreateResource(char *Uri, char *Descr, CoAP_ResOpts_t Options,
 // pMsgResp: The response message
 // pPayload: The payload to be send
 // payloadTotalSize: The size of pPayload
-// payloadIsVolatile: Set to true for volatile memory.
+// payloadIsVolatile: Set to true for volatile memory, the payload is copied.
 //   If false, pPayload MUST point to static memory that is not freed before the interaction ends
-//   which is hard to detect.
+//   which is hard to detect (PAYLOAD_STATIC).
 CoAP_Result_t
 CoAP_SetPayload(CoAP_Message_t *pMsgResp, uint8_t *pPayload, size_t payloadTotalSize, bool payloadIsVolatile);
 
+// Zero copy alternative to CoAP_SetPayload in resource handlers: returns a buffer of at least size bytes
+// (at most MAX_PAYLOAD_SIZE) to write the payload to, NULL if out of memory.
+// The buffer is part of the transmit buffer, header and options are encoded right in front of it on sending.
+// The payload is sent once its length is set by CoAP_CommitPayload(...).
+uint8_t *CoAP_ReservePayload(CoAP_Message_t *pMsgResp, uint16_t size);
+
+// Sets the length of the payload written to the buffer returned by CoAP_ReservePayload(...)
+CoAP_Result_t CoAP_CommitPayload(CoAP_Message_t *pMsgResp, uint16_t length);
+
+// Generates "length" bytes of a representation starting at "offset" into pDest
+typedef CoAP_Result_t (*CoAP_PayloadProducer_fn_t)(uint32_t offset, uint8_t *pDest, uint16_t length, void *pCtx);
+
+// Set payload in resource handlers for representations that are too large to keep in memory.
+// Only the block asked for by the request (Block2 option) is generated by the producer,
+// representations bigger than MAX_PAYLOAD_SIZE are sent blockwise.
+// Blockwise representations need an ETag, added to pMsgResp before (e.g. a version counter of the data),
+// COAP_ERR_ARGUMENT is returned otherwise. Block requests with If-Match options not matching it
+// are answered with 4.12 (COAP_ERR_WRONG_REQUEST is returned, the handler should return HANDLER_ERROR).
+// pMsgReq: The request message
+// pMsgResp: The response message
+// payloadTotalSize: The size of the whole representation
+// producer: Called once with offset and length of the block to send
+// pCtx: Passed unchanged to producer
+CoAP_Result_t CoAP_SetPayload_Producer(CoAP_Message_t *pMsgReq, CoAP_Message_t *pMsgResp, uint32_t payloadTotalSize,
+									   CoAP_PayloadProducer_fn_t producer, void *pCtx);
+
+// Copies the path segment matched by the index-th "{name}" or "*" segment of the resource uri
+// into pBuf as zero terminated string ("*" gives all remaining segments separated by '/').
+// pReq: The request message passed to the resource handler
+// Returns COAP_NOT_FOUND if the resource has no such segment, COAP_ERR_ARGUMENT if pBuf is too small
+CoAP_Result_t CoAP_GetUriParam(CoAP_Message_t *pReq, uint8_t index, char *pBuf, uint16_t bufSize);
+
+// Like CoAP_GetUriParam(...) with the segment selected by name, e.g. "id" for "{id}" or "*"
+CoAP_Result_t CoAP_GetUriParamByName(CoAP_Message_t *pReq, const char *name, char *pBuf, uint16_t bufSize);
+
 // Adds an option to the CoAP message
 CoAP_Result_t CoAP_AddOption(CoAP_Message_t *pMsg, uint16_t OptNumber, uint8_t *buf, uint16_t length);
 
@@ -402,12 +630,26 @@ CoAP_Result_t CoAP_AddOption(CoAP_Message_t *pMsg, uint16_t OptNumber, uint8_t *
 // but can be considered constant over runtime.
 void CoAP_HandleIncomingPacket(SocketHandle_t socketHandle, NetPacket_t *pPacket);
 
+// Estimated size of the multicast groups and data rate [byte/s] of the link they are reached by.
+// Responses to multicast requests are delayed by a random leisure period bounded by
+// size(response) * groupSize / linkRate (see 8.2 RFC7252), or DEFAULT_LEISURE if unknown (0).
+void CoAP_SetMulticastGroupEstimate(uint32_t groupSize, uint32_t linkRate);
+
 // doWork must be called regularly to process pending interactions
 void CoAP_doWork();
 
 // drop all unfinished work
 void CoAP_ClearPendingInteractions();
 
+// Serializes the server side state for a warm restart: pending server and notification interactions
+// (including responses kept to answer duplicate requests), observers, Observe sequence numbers and
+// the message ID and token generators. Client requests are not included.
+// With pBuf == NULL only the needed size is returned in pLength.
+CoAP_Result_t CoAP_SnapshotState(uint8_t *pBuf, uint32_t bufSize, uint32_t *pLength);
+
+// Restores a snapshot taken by the same firmware, after CoAP_Init(), socket and resource creation
+CoAP_Result_t CoAP_RestoreState(const uint8_t *pImage, uint32_t length);
+
 // Endpoint api
 NetInterfaceType_t CoAP_ParseNetAddress(NetAddr_t *addr, const char *s);
 #ifdef __cplusplus
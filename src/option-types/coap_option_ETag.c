@@ -24,31 +24,40 @@
 
 
 
-CoAP_Result_t _rom AddETagOptionToMsg(CoAP_Message_t* msg, uint8_t* pData, uint32_t size)
+// FNV-1a hash of a representation, used as its entity-tag
+// Representations in several parts are hashed by starting with ETAG_HASH_INIT
+uint32_t _rom CoAP_ETagHashAppend(uint32_t hash, const uint8_t* pData, uint32_t size)
 {
-	uint32_t hash=0;
 	uint32_t i;
 
-	//TODO use a hash function
 	for(i=0; i < size; i++)
 	{
-		hash+= pData[i];
+		hash ^= pData[i];
+		hash *= 16777619u;
 	}
+	return hash;
+}
+
+uint32_t _rom CoAP_ETagHash(const uint8_t* pData, uint32_t size)
+{
+	return CoAP_ETagHashAppend(ETAG_HASH_INIT, pData, size);
+}
 
+CoAP_Result_t _rom AddETagValueToMsg(CoAP_Message_t* msg, uint32_t etag)
+{
 	uint8_t wBuf[4];
-	/*
-	wBuf[0]=hash & 0xff;
-	wBuf[1] = (hash >> 8) & 0xff;
-	wBuf[2] = (hash >> 16) & 0xff;
-	wBuf[3] = (hash >> 24) & 0xff;
-	*/
-
-	wBuf[0]=1;
-	wBuf[1] = 2;
-	wBuf[2] = 3;
-	wBuf[3] = 4;
-
-	return CoAP_AppendOptionToList(&(msg->pOptionsList), OPT_NUM_ETAG,wBuf, 4);
+
+	wBuf[0] = (etag >> 24) & 0xff;
+	wBuf[1] = (etag >> 16) & 0xff;
+	wBuf[2] = (etag >> 8) & 0xff;
+	wBuf[3] = etag & 0xff;
+
+	return CoAP_AppendOptionToList(&(msg->pOptionsList), OPT_NUM_ETAG, wBuf, 4);
+}
+
+CoAP_Result_t _rom AddETagOptionToMsg(CoAP_Message_t* msg, uint8_t* pData, uint32_t size)
+{
+	return AddETagValueToMsg(msg, CoAP_ETagHash(pData, size));
 }
 
 CoAP_Result_t _rom GetETagOptionFromMsg(CoAP_Message_t* msg, uint8_t* val, uint8_t* pLen) { //len  [1..8]
@@ -27,6 +27,11 @@ CoAP_Result_t Add64BitETagOptionToMsg(CoAP_Message_t* msg, uint64_t val);
 CoAP_Result_t Get64BitETagOptionFromMsg(CoAP_Message_t* msg, uint64_t* pVal);
 
 
+#define ETAG_HASH_INIT (2166136261u)
+
+uint32_t CoAP_ETagHashAppend(uint32_t hash, const uint8_t* pData, uint32_t size);
+uint32_t CoAP_ETagHash(const uint8_t* pData, uint32_t size);
+CoAP_Result_t AddETagValueToMsg(CoAP_Message_t* msg, uint32_t etag);
 CoAP_Result_t AddETagOptionToMsg(CoAP_Message_t* msg, uint8_t*pData, uint32_t size);
 CoAP_Result_t GetETagOptionFromMsg(CoAP_Message_t* msg, uint8_t* val, uint8_t* pLen);//len  [1..8]
 
@@ -218,16 +218,12 @@ CoAP_Result_t _rom CoAP_SetPayload(CoAP_Message_t* pMsgResp, uint8_t* pPayload,
 	if (pPayload != pMsgResp->Payload) {
 		//set payload to beginning of given external payload buf
 		if (payloadIsVolatile) {
-			if (pMsgResp->PayloadBufSize < BytesToSend) {
-				CoAP_free_MsgPayload(&pMsgResp); //this is save in any case because free routine checks location
-				pMsgResp->Payload = (uint8_t*) CoAP.api.malloc(BytesToSend); //alloc new buffer to copy data to send to
-				pMsgResp->PayloadBufSize = BytesToSend;
+			if (CoAP_ReservePayload(pMsgResp, (uint16_t) BytesToSend) == NULL) { //copied once, sent without further copy
+				return COAP_ERR_OUT_OF_MEMORY;
 			}
 			coap_memcpy(pMsgResp->Payload, pPayload, BytesToSend);
-			pMsgResp->PayloadBufSize = BytesToSend;
 		} else {
-			pMsgResp->Payload = pPayload; //use external set buffer (will not be freed, MUST be static!!!)
-			pMsgResp->PayloadBufSize = 0; //protect external buf from unwanted overwrite
+			CoAP_SetForeignPayload(pMsgResp, PAYLOAD_STATIC, pPayload, BytesToSend); //use external set buffer (will not be freed, MUST be static!!!)
 		}
 	} // [else] => no need to alter payload buf beside change payload length before return
 
@@ -235,19 +231,13 @@ CoAP_Result_t _rom CoAP_SetPayload(CoAP_Message_t* pMsgResp, uint8_t* pPayload,
 	return COAP_OK;
 }
 
-//Copy from external payload buffer to response msg payload, and grow buffer if needed
-//1) pPayload is static (-> payloadIsVolatile = false) -> pPayload pointer will be directly used
-//2) pPayload is volatile (-> payloadIsVolatile = true) -> pPayload will be copied into new buffer
-//3) pPayload equals pMsgResp->Payload only blockwise memove ops are performed (-> copyPl = no meaning) -> a memory shunk within pPayload will be directly used
-CoAP_Result_t _rom CoAP_SetPayload_CheckBlockOpt(CoAP_Message_t* pMsgReq, CoAP_Message_t* pMsgResp, uint8_t* pPayload, uint16_t payloadTotalSize, bool payloadIsVolatile)
+// Selects the part of a representation with payloadTotalSize bytes to send in pMsgResp
+// and adds the Block2 (and Size2 if asked for) option to it
+static CoAP_Result_t _rom SelectBlock2(CoAP_Message_t* pMsgReq, CoAP_Message_t* pMsgResp, uint32_t payloadTotalSize, uint32_t* pOffset, uint16_t* pBytesToSend)
 {
 	CoAP_blockwise_option_t B2opt = { .Type = BLOCK_2 };
-	int32_t BytesToSend = 0;
 
-	if (payloadTotalSize == 0) {
-		pMsgResp->PayloadLength = 0;
-		return COAP_OK;
-	}
+	*pOffset = 0;
 
 	//is block2 option included in request (control usage)?
 	if (pMsgReq != NULL && GetBlock2OptionFromMsg(pMsgReq, &B2opt) == COAP_OK) //=found
@@ -257,20 +247,21 @@ CoAP_Result_t _rom CoAP_SetPayload_CheckBlockOpt(CoAP_Message_t* pMsgReq, CoAP_M
 			B2opt.BlockSize = MAX_PAYLOAD_SIZE; //choose a smaller value (our maximum)
 		}
 
-		int32_t TotalBytesLeft = ((int32_t) (payloadTotalSize)) - (int32_t) ((B2opt.BlockSize) * (B2opt.BlockNum));
-		if (TotalBytesLeft <= 0) {
+		*pOffset = (uint32_t) (B2opt.BlockSize) * (B2opt.BlockNum);
+		if (*pOffset >= payloadTotalSize) {
 			CoAP_addTextPayload(pMsgResp, "block not existing");
 			pMsgResp->Code = RESP_BAD_OPTION_4_02;
 			return COAP_ERR_WRONG_OPTION;
 		}
 
+		uint32_t TotalBytesLeft = payloadTotalSize - *pOffset;
 		if (TotalBytesLeft > B2opt.BlockSize) {
-			BytesToSend = B2opt.BlockSize;
+			*pBytesToSend = B2opt.BlockSize;
 			B2opt.MoreFlag = true;
 		}
 		else
 		{
-			BytesToSend = TotalBytesLeft;
+			*pBytesToSend = (uint16_t) TotalBytesLeft;
 			B2opt.MoreFlag = false;
 		}
 
@@ -278,53 +269,124 @@ CoAP_Result_t _rom CoAP_SetPayload_CheckBlockOpt(CoAP_Message_t* pMsgReq, CoAP_M
 		RemoveAllBlockOptionsFromMsg(pMsgResp, BLOCK_2); //if called more than one a block 2 can already be present, clean up
 		AddBlkOptionToMsg(pMsgResp, &B2opt);
 
-		if (pPayload == pMsgResp->Payload) { //no need to alter payload buf beside move contents
-			coap_memmove(pMsgResp->Payload, &(pMsgResp->Payload[(B2opt.BlockSize) * (B2opt.BlockNum)]), BytesToSend);
-		} else {
-			//set payload to calculated position of given external payload buf
-
-			if (payloadIsVolatile) {
-				if (pMsgResp->PayloadBufSize < BytesToSend) {
-					CoAP_free_MsgPayload(&pMsgResp); //this is save in any case because free routine checks location
-					pMsgResp->Payload = (uint8_t*) CoAP.api.malloc(BytesToSend); //alloc new buffer to copy data to send to
-					pMsgResp->PayloadBufSize = BytesToSend;
-				}
-				coap_memcpy(pMsgResp->Payload, &(pPayload[(B2opt.BlockSize) * (B2opt.BlockNum)]), BytesToSend);
-				pMsgResp->PayloadBufSize = BytesToSend;
-			} else {
-				pMsgResp->Payload = &(pPayload[(B2opt.BlockSize) * (B2opt.BlockNum)]); //use external set buffer (will not be freed, MUST be static!)
-				pMsgResp->PayloadBufSize = 0; //protect "external to msg" buffer
-			}
-		}
-
 	} else { //no block2 in request
 
 		if (payloadTotalSize > MAX_PAYLOAD_SIZE) { //must use blockwise transfer?
-
 			B2opt.BlockSize = MAX_PAYLOAD_SIZE;
 			B2opt.BlockNum = 0;
 			B2opt.MoreFlag = true;
 			AddBlkOptionToMsg(pMsgResp, &B2opt);
-			BytesToSend = MAX_PAYLOAD_SIZE;
+			*pBytesToSend = MAX_PAYLOAD_SIZE;
 		} else {
-			BytesToSend = payloadTotalSize;
+			*pBytesToSend = (uint16_t) payloadTotalSize;
 		}
+	}
 
-		if (pPayload != pMsgResp->Payload) {
-			//set payload to beginning of given external payload buf
-			if (payloadIsVolatile) {
-				if (pMsgResp->PayloadBufSize < BytesToSend) {
-					CoAP_free_MsgPayload(&pMsgResp); //this is save in any case because free routine checks location
-					pMsgResp->Payload = (uint8_t*) CoAP.api.malloc(BytesToSend); //alloc new buffer to copy data to send to
-					pMsgResp->PayloadBufSize = BytesToSend;
-				}
-				coap_memcpy(pMsgResp->Payload, &(pPayload[0]), BytesToSend);
-				pMsgResp->PayloadBufSize = BytesToSend;
-			} else {
-				pMsgResp->Payload = &(pPayload[0]); //use external set buffer (will not be freed, MUST be static!!!)
-				pMsgResp->PayloadBufSize = 0; //protect external buf from unwanted overwrite
-			}
-		} // [else] => no need to alter payload buf beside change payload length before return
+	//client asks for the total size (4 RFC7959)?
+	if (pMsgReq != NULL && CoAP_FindOptionByNumber(pMsgReq, OPT_NUM_SIZE2) != NULL && CoAP_FindOptionByNumber(pMsgResp, OPT_NUM_SIZE2) == NULL) {
+		CoAP_AppendUintOptionToList(&(pMsgResp->pOptionsList), OPT_NUM_SIZE2, payloadTotalSize);
+	}
+	return COAP_OK;
+}
+
+static CoAP_Result_t _rom ReservePayloadBuf(CoAP_Message_t* pMsgResp, uint16_t size)
+{
+	if (!CoAP_PayloadIsWritable(pMsgResp, size) && CoAP_ReservePayload(pMsgResp, size) == NULL) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	return COAP_OK;
+}
+
+//Copy from external payload buffer to response msg payload, and grow buffer if needed
+//1) pPayload is static (-> payloadIsVolatile = false) -> pPayload pointer will be directly used
+//2) pPayload is volatile (-> payloadIsVolatile = true) -> pPayload will be copied into new buffer
+//3) pPayload equals pMsgResp->Payload only blockwise memove ops are performed (-> copyPl = no meaning) -> a memory shunk within pPayload will be directly used
+CoAP_Result_t _rom CoAP_SetPayload_CheckBlockOpt(CoAP_Message_t* pMsgReq, CoAP_Message_t* pMsgResp, uint8_t* pPayload, uint32_t payloadTotalSize, bool payloadIsVolatile)
+{
+	uint32_t Offset = 0;
+	uint16_t BytesToSend = 0;
+	CoAP_Result_t res;
+
+	if (payloadTotalSize == 0) {
+		pMsgResp->PayloadLength = 0;
+		return COAP_OK;
+	}
+
+	res = SelectBlock2(pMsgReq, pMsgResp, payloadTotalSize, &Offset, &BytesToSend);
+	if (res != COAP_OK) {
+		return res;
+	}
+
+	//blockwise representation of a resource with block2 cache: tag and snapshot it for the following blocks
+	if (BytesToSend < payloadTotalSize && pMsgReq != NULL && pMsgReq->pResource != NULL
+			&& (pMsgReq->pResource->Options.Flags & RES_FLAG_BLOCK2_CACHE)
+			&& !pMsgReq->pResource->IsPattern
+			&& CoAP_FindOptionByNumber(pMsgResp, OPT_NUM_ETAG) == NULL) {
+		uint32_t etag = CoAP_ETagHash(pPayload, payloadTotalSize);
+		CoAP_Block2CacheStore(pMsgReq, pPayload, payloadTotalSize, etag);
+		AddETagValueToMsg(pMsgResp, etag);
+	}
+
+	if (pPayload == pMsgResp->Payload) { //no need to alter payload buf beside move contents
+		if (Offset != 0) {
+			coap_memmove(pMsgResp->Payload, &(pPayload[Offset]), BytesToSend);
+		}
+	} else if (payloadIsVolatile) {
+		if (ReservePayloadBuf(pMsgResp, BytesToSend) != COAP_OK) {
+			return COAP_ERR_OUT_OF_MEMORY;
+		}
+		coap_memcpy(pMsgResp->Payload, &(pPayload[Offset]), BytesToSend);
+	} else {
+		CoAP_SetForeignPayload(pMsgResp, PAYLOAD_STATIC, &(pPayload[Offset]), BytesToSend); //use external set buffer (will not be freed, MUST be static!)
+	}
+
+	pMsgResp->PayloadLength = BytesToSend;
+	return COAP_OK;
+}
+
+// Like CoAP_SetPayload_CheckBlockOpt(...) but only the requested block of the representation
+// is generated by the producer, so its size is not limited by available RAM
+CoAP_Result_t _rom CoAP_SetPayload_Producer(CoAP_Message_t* pMsgReq, CoAP_Message_t* pMsgResp, uint32_t payloadTotalSize, CoAP_PayloadProducer_fn_t producer, void* pCtx)
+{
+	uint32_t Offset = 0;
+	uint16_t BytesToSend = 0;
+	CoAP_Result_t res;
+
+	if (producer == NULL) {
+		return COAP_ERR_ARGUMENT;
+	}
+	if (payloadTotalSize == 0) {
+		pMsgResp->PayloadLength = 0;
+		return COAP_OK;
+	}
+
+	res = SelectBlock2(pMsgReq, pMsgResp, payloadTotalSize, &Offset, &BytesToSend);
+	if (res != COAP_OK) {
+		return res;
+	}
+
+	//blocks are generated on demand, only the entity-tag tells the client if they belong to the same representation (2.4 RFC7959)
+	if (BytesToSend < payloadTotalSize) {
+		CoAP_option_t* pETag = CoAP_FindOptionByNumber(pMsgResp, OPT_NUM_ETAG);
+		if (pETag == NULL) {
+			ERROR("- Blockwise producer representation needs an ETag\r\n");
+			return COAP_ERR_ARGUMENT;
+		}
+		if (pMsgReq != NULL && CoAP_IfMatchFails(pMsgReq, pETag)) {
+			INFO("- Block of another representation requested\r\n");
+			RemoveAllBlockOptionsFromMsg(pMsgResp, BLOCK_2);
+			pMsgResp->Code = RESP_PRECONDITION_FAILED_4_12;
+			return COAP_ERR_WRONG_REQUEST;
+		}
+	}
+
+	if (ReservePayloadBuf(pMsgResp, BytesToSend) != COAP_OK) {
+		return COAP_ERR_OUT_OF_MEMORY;
+	}
+	res = producer(Offset, pMsgResp->Payload, BytesToSend, pCtx);
+	if (res != COAP_OK) {
+		pMsgResp->PayloadLength = 0;
+		return res;
 	}
 
 	pMsgResp->PayloadLength = BytesToSend;
@@ -63,6 +63,22 @@ CoAP_Result_t _rom UpdateObserveOptionInMsg(CoAP_Message_t* msg, uint32_t val)
 	return AddObserveOptionToMsg(msg, val);
 }
 
+// Is a notification with sequence number "seq" received at "now" newer than
+// the last one (lastSeq, received at lastTime)? See 3.4 RFC7641
+bool _rom CoAP_ObserveSeqIsFresh(uint32_t lastSeq, uint32_t lastTime, uint32_t seq, uint32_t now) {
+	const uint32_t halfRange = (1u << 23u); // observe values are 24 bit
+	lastSeq &= 0xffffffu;
+	seq &= 0xffffffu;
+
+	if (lastSeq < seq && seq - lastSeq < halfRange) {
+		return true;
+	}
+	if (lastSeq > seq && lastSeq - seq > halfRange) {
+		return true;
+	}
+	return timeAfter(now, lastTime + 128 + 1); // T2 > T1 + 128s
+}
+
 CoAP_Result_t _rom GetObserveOptionFromMsg(CoAP_Message_t* msg, uint32_t* val) {
 
 	CoAP_option_t* pOpts = msg->pOptionsList;
@@ -92,6 +108,130 @@ CoAP_Result_t _rom GetObserveOptionFromMsg(CoAP_Message_t* msg, uint32_t* val) {
 	return COAP_NOT_FOUND;
 }
 
+// Parses a decimal attribute value like "-12.5"
+static bool _rom ParseAttrValue(const uint8_t* pStr, uint8_t len, float* pVal)
+{
+	float val = 0.0f;
+	float scale = 1.0f;
+	bool fraction = false;
+	bool negative = false;
+	uint8_t i = 0;
+
+	if (len > 0 && (pStr[0] == '-' || pStr[0] == '+')) {
+		negative = (pStr[0] == '-');
+		i++;
+	}
+	if (i == len) {
+		return false;
+	}
+	for (; i < len; i++) {
+		if (pStr[i] == '.' && !fraction) {
+			fraction = true;
+		} else if (pStr[i] >= '0' && pStr[i] <= '9') {
+			if (fraction) {
+				scale /= 10.0f;
+				val += (pStr[i] - '0') * scale;
+			} else {
+				val = val * 10.0f + (pStr[i] - '0');
+			}
+		} else {
+			return false;
+		}
+	}
+	*pVal = negative ? -val : val;
+	return true;
+}
+
+// Reads the conditional attributes pmin, pmax, gt, lt and st (draft-ietf-core-conditional-attributes)
+// from the Uri-Query options saved with the observer, unknown or malformed ones are ignored
+// (periods must be non-negative and fit into 32 bit)
+void _rom CoAP_ParseObserveAttributes(CoAP_Observer_t* pObserver)
+{
+	static const char* const names[] = { "pmin=", "pmax=", "gt=", "lt=", "st=" };
+	CoAP_option_t* pOpt;
+	uint8_t* pVal;
+	uint8_t len;
+	float val;
+	int i;
+
+	pObserver->AttrFlags = 0;
+	pObserver->UpdatePending = false;
+
+	for (pOpt = pObserver->pOptList; pOpt != NULL; pOpt = pOpt->next) {
+		for (i = 0; i < 5; i++) {
+			pVal = CoAP_GetUriQueryVal(pOpt, names[i], &len);
+			if (pVal == NULL || !ParseAttrValue(pVal, len, &val)) {
+				continue;
+			}
+			if (((1 << i) & (OBS_ATTR_PMIN | OBS_ATTR_PMAX)) && !(val >= 0.0f && val < 4294967296.0f)) {
+				INFO("- Observe attribute %s%.*s rejected, not a valid period\r\n", names[i], (int) len, (char*) pVal);
+				continue;
+			}
+			switch (1 << i) {
+			case OBS_ATTR_PMIN: pObserver->Pmin = (uint32_t) val; break;
+			case OBS_ATTR_PMAX: pObserver->Pmax = (uint32_t) val; break;
+			case OBS_ATTR_GT: pObserver->Gt = val; break;
+			case OBS_ATTR_LT: pObserver->Lt = val; break;
+			case OBS_ATTR_ST: pObserver->St = val; break;
+			}
+			pObserver->AttrFlags |= (uint8_t) (1 << i);
+		}
+	}
+
+	// pmax must be greater than pmin, otherwise it is ignored
+	if ((pObserver->AttrFlags & OBS_ATTR_PMAX) && (pObserver->AttrFlags & OBS_ATTR_PMIN) && pObserver->Pmax <= pObserver->Pmin) {
+		pObserver->AttrFlags &= ~OBS_ATTR_PMAX;
+	}
+}
+
+// Decides if an update of the resource is notified to the observer now (true).
+// An update that matches the value conditions but comes before pmin has passed
+// is held back and sent later by CoAP_ObserverNotificationDue(...).
+bool _rom CoAP_ObserverTakesUpdate(CoAP_Observer_t* pObserver, CoAP_Res_t* pRes, uint32_t now)
+{
+	uint8_t valueAttrs = pObserver->AttrFlags & (OBS_ATTR_GT | OBS_ATTR_LT | OBS_ATTR_ST);
+
+	if (pObserver->AttrFlags == 0) {
+		return true;
+	}
+
+	//without a value every update counts as a change
+	if (valueAttrs != 0 && pRes->HasValue) {
+		float v = pRes->Value;
+		float diff = v > pObserver->LastValue ? v - pObserver->LastValue : pObserver->LastValue - v;
+		if (!(((pObserver->AttrFlags & OBS_ATTR_GT) && v > pObserver->Gt)
+				|| ((pObserver->AttrFlags & OBS_ATTR_LT) && v < pObserver->Lt)
+				|| ((pObserver->AttrFlags & OBS_ATTR_ST) && diff >= pObserver->St))) {
+			return false;
+		}
+	}
+
+	if ((pObserver->AttrFlags & OBS_ATTR_PMIN) && !timeAfter(now, pObserver->LastNotify + pObserver->Pmin)) {
+		pObserver->UpdatePending = true;
+		return false;
+	}
+	return true;
+}
+
+// True if a held back update or a pmax keepalive has to be sent now
+bool _rom CoAP_ObserverNotificationDue(CoAP_Observer_t* pObserver, uint32_t now)
+{
+	if (pObserver->UpdatePending
+			&& (!(pObserver->AttrFlags & OBS_ATTR_PMIN) || timeAfter(now, pObserver->LastNotify + pObserver->Pmin))) {
+		return true;
+	}
+	return (pObserver->AttrFlags & OBS_ATTR_PMAX) && timeAfter(now, pObserver->LastNotify + pObserver->Pmax);
+}
+
+void _rom CoAP_ObserverNotified(CoAP_Observer_t* pObserver, CoAP_Res_t* pRes, uint32_t now)
+{
+	pObserver->UpdatePending = false;
+	pObserver->LastNotify = now;
+	if (pRes->HasValue) {
+		pObserver->LastValue = pRes->Value;
+	}
+}
+
 CoAP_Observer_t* _rom CoAP_AllocNewObserver()
 {
 	CoAP_Observer_t* newObserver = (CoAP_Observer_t*) (CoAP_malloc0(sizeof(CoAP_Observer_t)));
@@ -108,6 +248,15 @@ CoAP_Result_t _rom CoAP_FreeObserver(CoAP_Observer_t** pObserver)
 	INFO("Releasing pObserver\r\n");
 	//coap_mem_stats();
 
+	if ((*pObserver)->pRes != NULL) {
+		CoAP_DetachObserver(*pObserver, false);
+	}
+
+	//a notification still in progress carries on without its observer
+	if ((*pObserver)->pPendingIA != NULL) {
+		(*pObserver)->pPendingIA->pObserver = NULL;
+	}
+
 	CoAP_FreeOptionList(&((*pObserver)->pOptList));
 	CoAP_free((void*) (*pObserver));
 	*pObserver = NULL;
@@ -115,61 +264,100 @@ CoAP_Result_t _rom CoAP_FreeObserver(CoAP_Observer_t** pObserver)
 	return COAP_OK;
 }
 
-//does not copy!
-CoAP_Result_t _rom CoAP_AppendObserverToList(CoAP_Observer_t** pListStart, CoAP_Observer_t* pObserverToAdd)
+// Observers of all resources are indexed by resource, socket and endpoint,
+// there is at most one observation per endpoint and resource.
+static CoAP_Observer_t* ObserverIndex[OBSERVER_INDEX_SIZE];
+
+static uint32_t _rom ObserverIndexPos(CoAP_Res_t* pRes, SocketHandle_t socketHandle, const NetEp_t* pEp)
 {
-	if (pObserverToAdd == NULL)
-		return COAP_ERR_ARGUMENT;
+	uint32_t hash = 2166136261u;
+	uint8_t addrLen = NetAddr_MAX_LENGTH;
+	uint8_t i;
 
-	if (*pListStart == NULL) //List empty? create new first element
-	{
-		*pListStart = pObserverToAdd;
-		(*pListStart)->next = NULL;
+	if (pEp->NetType == IPV4) {
+		addrLen = 4;
+	}
+	for (i = 0; i < addrLen; i++) {
+		hash = (hash ^ pEp->NetAddr.mem[i]) * 16777619u;
 	}
-	else //append new element at end
-	{
-		CoAP_Observer_t* pObs = *pListStart;
-		while (pObs->next != NULL) {
-			pObs = pObs->next;
+	hash = (hash ^ pEp->NetPort) * 16777619u;
+	hash = (hash ^ (uint32_t) (uintptr_t) socketHandle) * 16777619u;
+	hash = (hash ^ (uint32_t) (uintptr_t) pRes) * 16777619u;
+	return hash % OBSERVER_INDEX_SIZE;
+}
+
+CoAP_Observer_t* _rom CoAP_FindObserver(CoAP_Res_t* pRes, SocketHandle_t socketHandle, const NetEp_t* pEp)
+{
+	CoAP_Observer_t* pObs;
+
+	for (pObs = ObserverIndex[ObserverIndexPos(pRes, socketHandle, pEp)]; pObs != NULL; pObs = pObs->nextInIndex) {
+		if (pObs->pRes == pRes && pObs->socketHandle == socketHandle && EpAreEqual(pEp, &(pObs->Ep))) {
+			return pObs;
 		}
+	}
+	return NULL;
+}
+
+//does not copy!
+CoAP_Result_t _rom CoAP_AttachObserver(CoAP_Res_t* pRes, CoAP_Observer_t* pObserverToAdd)
+{
+	uint32_t pos;
+
+	if (pRes == NULL || pObserverToAdd == NULL)
+		return COAP_ERR_ARGUMENT;
 
-		pObs->next = pObserverToAdd;
-		pObs = pObs->next;
-		pObs->next = NULL;
+	//insert at list start, a fan-out in progress is about an update from before this registration
+	pObserverToAdd->pRes = pRes;
+	pObserverToAdd->prev = NULL;
+	pObserverToAdd->next = pRes->pListObservers;
+	if (pRes->pListObservers != NULL) {
+		pRes->pListObservers->prev = pObserverToAdd;
 	}
+	pRes->pListObservers = pObserverToAdd;
+
+	pos = ObserverIndexPos(pRes, pObserverToAdd->socketHandle, &(pObserverToAdd->Ep));
+	pObserverToAdd->nextInIndex = ObserverIndex[pos];
+	ObserverIndex[pos] = pObserverToAdd;
+
+	CoAP_LogObserverRegistered(pRes, pObserverToAdd, true);
 	return COAP_OK;
 }
 
-CoAP_Result_t _rom CoAP_UnlinkObserverFromList(CoAP_Observer_t** pListStart, CoAP_Observer_t* pObserverToRemove, bool FreeUnlinked)
+CoAP_Result_t _rom CoAP_DetachObserver(CoAP_Observer_t* pObserverToRemove, bool FreeDetached)
 {
-	CoAP_Observer_t* currP;
-	CoAP_Observer_t* prevP;
+	CoAP_Res_t* pRes = pObserverToRemove->pRes;
+	CoAP_Observer_t** ppObs;
 
-	// For 1st node, indicate there is no previous.
-	prevP = NULL;
+	if (pRes == NULL)
+		return COAP_ERR_ARGUMENT;
 
-	//Visit each node, maintaining a pointer to
-	//the previous node we just visited.
-	for (currP = *pListStart; currP != NULL; prevP = currP, currP = currP->next) {
+	if (pRes->pNotifyCursor == pObserverToRemove) {
+		pRes->pNotifyCursor = pObserverToRemove->next;
+	}
 
-		if (currP == pObserverToRemove) {  // Found it.
-			if (prevP == NULL) {
-				//Fix beginning pointer.
-				*pListStart = currP->next;
-			} else {
-				//Fix previous node's next to
-				//skip over the removed node.
-				prevP->next = currP->next;
-			}
+	if (pObserverToRemove->prev != NULL) {
+		pObserverToRemove->prev->next = pObserverToRemove->next;
+	} else {
+		pRes->pListObservers = pObserverToRemove->next;
+	}
+	if (pObserverToRemove->next != NULL) {
+		pObserverToRemove->next->prev = pObserverToRemove->prev;
+	}
 
-			// Deallocate the node.
-			if (FreeUnlinked) {
-				CoAP_FreeObserver(&currP);
-			}
-			//Done searching.
-			return COAP_OK;
+	for (ppObs = &ObserverIndex[ObserverIndexPos(pRes, pObserverToRemove->socketHandle, &(pObserverToRemove->Ep))]; *ppObs != NULL; ppObs = &((*ppObs)->nextInIndex)) {
+		if (*ppObs == pObserverToRemove) {
+			*ppObs = pObserverToRemove->nextInIndex;
+			break;
 		}
 	}
+
+	pObserverToRemove->pRes = NULL;
+	pObserverToRemove->next = pObserverToRemove->prev = pObserverToRemove->nextInIndex = NULL;
+
+	CoAP_LogObserverDeregistered(pRes, pObserverToRemove);
+	if (FreeDetached) {
+		CoAP_FreeObserver(&pObserverToRemove);
+	}
 	return COAP_OK;
 }
 
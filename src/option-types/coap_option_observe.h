@@ -25,13 +25,26 @@
 #define OBSERVE_OPT_REGISTER (0)
 #define OBSERVE_OPT_DEREGISTER (1)
 
+//Bitfields for observer AttrFlags
+#define OBS_ATTR_PMIN (1 << 0)
+#define OBS_ATTR_PMAX (1 << 1)
+#define OBS_ATTR_GT   (1 << 2)
+#define OBS_ATTR_LT   (1 << 3)
+#define OBS_ATTR_ST   (1 << 4)
+
 CoAP_Result_t AddObserveOptionToMsg(CoAP_Message_t *msg, uint32_t val);
 CoAP_Result_t GetObserveOptionFromMsg(CoAP_Message_t *msg, uint32_t *val);
 CoAP_Result_t RemoveObserveOptionFromMsg(CoAP_Message_t *msg);
 CoAP_Result_t UpdateObserveOptionInMsg(CoAP_Message_t *msg, uint32_t val);
+bool CoAP_ObserveSeqIsFresh(uint32_t lastSeq, uint32_t lastTime, uint32_t seq, uint32_t now);
+void CoAP_ParseObserveAttributes(CoAP_Observer_t *pObserver);
+bool CoAP_ObserverTakesUpdate(CoAP_Observer_t *pObserver, CoAP_Res_t *pRes, uint32_t now);
+bool CoAP_ObserverNotificationDue(CoAP_Observer_t *pObserver, uint32_t now);
+void CoAP_ObserverNotified(CoAP_Observer_t *pObserver, CoAP_Res_t *pRes, uint32_t now);
 CoAP_Observer_t *CoAP_AllocNewObserver();
 CoAP_Result_t CoAP_FreeObserver(CoAP_Observer_t **pObserver);
-CoAP_Result_t CoAP_AppendObserverToList(CoAP_Observer_t **pListStart, CoAP_Observer_t *pObserverToAdd);
-CoAP_Result_t CoAP_UnlinkObserverFromList(CoAP_Observer_t **pListStart, CoAP_Observer_t *pObserverToRemove, bool FreeUnlinked);
+CoAP_Observer_t *CoAP_FindObserver(CoAP_Res_t *pRes, SocketHandle_t socketHandle, const NetEp_t *pEp);
+CoAP_Result_t CoAP_AttachObserver(CoAP_Res_t *pRes, CoAP_Observer_t *pObserverToAdd);
+CoAP_Result_t CoAP_DetachObserver(CoAP_Observer_t *pObserverToRemove, bool FreeDetached);
 
 #endif
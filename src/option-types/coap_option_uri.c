@@ -148,6 +148,109 @@ bool _rom CoAP_UriOptionsAreEqual(CoAP_option_t* OptListA, CoAP_option_t* OptLis
 }
 
 
+static CoAP_option_t* _rom NextUriPath(CoAP_option_t* pOpt) {
+	while (pOpt != NULL && pOpt->Number != OPT_NUM_URI_PATH) {
+		pOpt = pOpt->next;
+	}
+	return pOpt;
+}
+
+// "{name}" matches any single segment
+static bool _rom IsParamSegment(CoAP_option_t* pOpt) {
+	return pOpt->Length >= 2 && pOpt->Value[0] == '{' && pOpt->Value[pOpt->Length - 1] == '}';
+}
+
+// a trailing "*" matches all remaining segments (also none)
+static bool _rom IsWildcardSegment(CoAP_option_t* pOpt) {
+	return pOpt->Length == 1 && pOpt->Value[0] == '*' && NextUriPath(pOpt->next) == NULL;
+}
+
+bool _rom CoAP_UriIsPattern(CoAP_option_t* pUri) {
+	for (pUri = NextUriPath(pUri); pUri != NULL; pUri = NextUriPath(pUri->next)) {
+		if (IsParamSegment(pUri) || IsWildcardSegment(pUri)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool _rom CoAP_UriMatchesPattern(CoAP_option_t* pPattern, CoAP_option_t* pOptionsToMatch) {
+	CoAP_option_t* pPat = NextUriPath(pPattern);
+	CoAP_option_t* pSeg = NextUriPath(pOptionsToMatch);
+
+	for (; pPat != NULL; pPat = NextUriPath(pPat->next), pSeg = NextUriPath(pSeg->next)) {
+		if (IsWildcardSegment(pPat)) {
+			return true;
+		}
+		if (pSeg == NULL) {
+			return false;
+		}
+		if (!IsParamSegment(pPat) && !CoAP_OptionsAreEqual(pPat, pSeg)) {
+			return false;
+		}
+	}
+	return pSeg == NULL;
+}
+
+// Copies the segment(s) captured by the pattern segment selected by index (name == NULL) or name
+static CoAP_Result_t _rom GetUriParam(CoAP_Message_t* pReq, int index, const char* name, char* pBuf, uint16_t bufSize) {
+	CoAP_option_t* pPat;
+	CoAP_option_t* pSeg;
+	uint16_t len = 0;
+	int n = 0;
+
+	if (pReq == NULL || pReq->pResource == NULL || pBuf == NULL || bufSize == 0) {
+		return COAP_ERR_ARGUMENT;
+	}
+
+	pSeg = NextUriPath(pReq->pOptionsList);
+	for (pPat = NextUriPath(pReq->pResource->pUri); pPat != NULL; pPat = NextUriPath(pPat->next)) {
+		bool wildcard = IsWildcardSegment(pPat);
+		bool selected;
+
+		if (!wildcard && !IsParamSegment(pPat)) {
+			pSeg = pSeg != NULL ? NextUriPath(pSeg->next) : NULL;
+			continue;
+		}
+		if (name == NULL) {
+			selected = (n++ == index);
+		} else if (wildcard) {
+			selected = (coap_strlen(name) == 1 && name[0] == '*');
+		} else {
+			selected = (coap_strlen(name) == pPat->Length - 2u && memcmp(name, &(pPat->Value[1]), pPat->Length - 2u) == 0);
+		}
+
+		if (selected) {
+			//"*" captures the rest of the path with '/' between the segments
+			for (; pSeg != NULL; pSeg = wildcard ? NextUriPath(pSeg->next) : NULL) {
+				if (len + (len > 0) + pSeg->Length >= bufSize) {
+					return COAP_ERR_ARGUMENT; //buffer too small
+				}
+				if (len > 0) {
+					pBuf[len++] = '/';
+				}
+				coap_memcpy(&pBuf[len], pSeg->Value, pSeg->Length);
+				len += pSeg->Length;
+			}
+			pBuf[len] = '\0';
+			return COAP_OK;
+		}
+		pSeg = pSeg != NULL ? NextUriPath(pSeg->next) : NULL;
+	}
+	return COAP_NOT_FOUND;
+}
+
+CoAP_Result_t _rom CoAP_GetUriParam(CoAP_Message_t* pReq, uint8_t index, char* pBuf, uint16_t bufSize) {
+	return GetUriParam(pReq, index, NULL, pBuf, bufSize);
+}
+
+CoAP_Result_t _rom CoAP_GetUriParamByName(CoAP_Message_t* pReq, const char* name, char* pBuf, uint16_t bufSize) {
+	if (name == NULL) {
+		return COAP_ERR_ARGUMENT;
+	}
+	return GetUriParam(pReq, 0, name, pBuf, bufSize);
+}
+
 void _rom CoAP_printUriOptionsList(CoAP_option_t* pOptListBegin) {
 	bool queryPos = false;
 	int j;
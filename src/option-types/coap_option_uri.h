@@ -28,6 +28,8 @@ CoAP_Result_t CoAP_AppendUriOptionsFromString(CoAP_option_t** pUriOptionsListBeg
 CoAP_Result_t CoAP_AddUriOptionsToMsgFromString(CoAP_Message_t* msg, char* UriStr);
 
 bool CoAP_UriOptionsAreEqual(CoAP_option_t* OptListA, CoAP_option_t* OptListB);
+bool CoAP_UriIsPattern(CoAP_option_t* pUri);
+bool CoAP_UriMatchesPattern(CoAP_option_t* pPattern, CoAP_option_t* pOptionsToMatch);
 
 uint8_t* CoAP_GetUriQueryVal(CoAP_option_t* pUriOpt, const char* prefixStr, uint8_t* pValueLen); //searches only option in parameter
 uint8_t* CoAP_GetUriQueryValFromMsg(CoAP_Message_t* pMsg, const char* prefixStr, uint8_t* pValueLen); //searches all options in message
@@ -12,71 +12,55 @@
  * all copies or substantial portions of the Software.
  */
 
-#include <gtest/gtest.h>
-#include <coap.h>
-#include <stdint.h>
+#include "coap_test.h"
 
-typedef int16_t bufsize;
-extern "C" void	bstats(bufsize *curalloc, bufsize *totfree, bufsize *maxfree, long *nget, long *nrel);
+uint32_t CoapTest::Now = 1000;
+std::vector<TxDatagram> CoapTest::Sent;
+long CoapTest::Allocations = 0;
+bool CoapTest::TxFails = false;
+bool CoapTest::MallocFails = false;
+int CoapTest::RandValue = -1;
 
-// Test fixture class. For these very basic tests, we only allocate some memory in the fixture.
-class BasicTest : public testing::Test {
- protected:
-  virtual void SetUp() {
-	  // CoAP_Init can only be called once with the same memory address,
-	  // because internally bpool is called, which does not check if the same
-	  // address range is already in the managed memory pool.
-	  // Leads to an endless loop otherwise.
-	  static bool initialized = false;
-	  if (!initialized) {
-
-		  CoAP_API_t coapApi;
-		  coapApi.debugPuts = NULL;
-		  coapApi.rtc1HzCnt = NULL;
-
-		  CoAP_Config_t coapCfg;
-		  coapCfg.Memory = CoAP_WorkMemory;
-		  coapCfg.MemorySize = sizeof(CoAP_WorkMemory);
-
-		  CoAP_Init(coapApi, coapCfg);
-		  initialized = true;
-	  }
-  }
-
-  uint8_t CoAP_WorkMemory[4096] = { 0 };
+// For these very basic tests, the fixture only initializes the stack.
+class BasicTest : public CoapTest {
 };
 
 TEST_F(BasicTest, MemoryTest) {
-	bufsize curalloc, curalloc2, totfree, maxfree;
-	long nget,nrel;
+	long before = Allocations;
 
-	bstats(&curalloc, &totfree, &maxfree, &nget, &nrel);
-	
-	void* buf = coap_mem_get(16);
+	void* buf = CoAP_malloc(16);
 	ASSERT_NE(buf, nullptr) << "Failed to allocate memory";
-	
-	int i = coap_mem_size((uint8_t*)buf);
-	ASSERT_EQ(i, 16) << "Buffer should be 16 bytes";
-	
-	coap_mem_release(buf);
-	bstats(&curalloc2, &totfree, &maxfree, &nget, &nrel);
-	ASSERT_EQ(curalloc, curalloc2) << "Available memory should be the same after get/release";
+	ASSERT_EQ(before + 1, Allocations);
+
+	CoAP_free(buf);
+	ASSERT_EQ(before, Allocations) << "Available memory should be the same after get/release";
 }
 
 TEST_F(BasicTest, AllocSocketTest) {
 	SocketHandle_t socketHandle = (SocketHandle_t) 0;
-	uint16_t LocalPort = 1234;
 
 	CoAP_Socket_t* pSocket;
-	pSocket=RetrieveSocket(socketHandle);
+	pSocket = RetrieveSocket(socketHandle);
 	ASSERT_EQ(pSocket, nullptr) << "Interface id should not be in use";
-	
+
 	pSocket = AllocSocket();
 	ASSERT_NE(pSocket, nullptr) << "Failed to allocate a socket";
-	
 
 	// No real implementation, just for type check during test yet
 	pSocket->Handle = nullptr;
 	pSocket->Tx  = nullptr;
 	pSocket->Alive = true;
-}
\ No newline at end of file
+}
+
+TEST_F(BasicTest, ParsesOwnDatagram) {
+	CoAP_Message_t* pMsg = Msg(CON, REQ_GET, 0x1234, Token(1), "a/b?c=d");
+	ASSERT_EQ(COAP_OK, CoAP_SendMsg(pMsg, Sock(), Ep(1)));
+	CoAP_free_Message(&pMsg);
+
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg parsed(Sent[0]);
+	EXPECT_EQ(CON, parsed->Type);
+	EXPECT_EQ(REQ_GET, parsed->Code);
+	EXPECT_EQ(0x1234, parsed->MessageID);
+	EXPECT_TRUE(CoAP_TokenEqual(Token(1), parsed->Token));
+}
@@ -0,0 +1,81 @@
+#include "coap_test.h"
+
+// Blockwise GET representations snapshotted by RES_FLAG_BLOCK2_CACHE
+class Block2CacheTest : public CoapTest {
+protected:
+	static int HandlerCalls;
+	static bool Fails;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		HandlerCalls = 0;
+		Fails = false;
+		CreateResource("b2", Opts(RES_OPT_GET, RES_FLAG_BLOCK2_CACHE), Handler);
+	}
+
+	// 100 bytes of the first character of the Uri-Query ('x' without one), Content-Format set after the payload
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		uint8_t payload[100];
+		CoAP_option_t* pQuery = CoAP_FindOptionByNumber(pReq, OPT_NUM_URI_QUERY);
+		HandlerCalls++;
+		memset(payload, pQuery != NULL && pQuery->Length > 0 ? pQuery->Value[0] : 'x', sizeof(payload));
+		CoAP_SetPayload_CheckBlockOpt(pReq, pResp, payload, sizeof(payload), true);
+		CoAP_AddCfOptionToMsg(pResp, COAP_CF_JSON);
+		return Fails ? HANDLER_ERROR : HANDLER_OK;
+	}
+
+	// GET of a 32 byte block, the response is the last sent datagram
+	void Get(const char* uri, uint32_t num) {
+		static uint16_t mid = 0x500;
+		CoAP_Message_t* pReq = Msg(CON, REQ_GET, mid++, Token((uint8_t) num), uri);
+		AddBlockOption(pReq, OPT_NUM_BLOCK2, num, false, 32);
+		Receive(Ep(1), pReq);
+		Work(4);
+	}
+};
+
+int Block2CacheTest::HandlerCalls;
+bool Block2CacheTest::Fails;
+
+TEST_F(Block2CacheTest, LaterBlocksAreServedFromSnapshot) {
+	Get("b2", 0);
+	Get("b2", 1);
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg resp(Sent[1]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ((1u << 4) | 0x08 | 1, resp.UintOption(OPT_NUM_BLOCK2));
+	EXPECT_EQ(std::string(32, 'x'), resp.Payload());
+	EXPECT_EQ(1, HandlerCalls);
+}
+
+TEST_F(Block2CacheTest, SnapshotIsKeyedByQuery) {
+	Get("b2?a", 0);
+	Get("b2?b", 0);
+	Get("b2?a", 1);
+	ASSERT_EQ(3u, Sent.size());
+	ParsedMsg resp(Sent[2]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ(std::string(32, 'a'), resp.Payload());
+	EXPECT_EQ(2, HandlerCalls);
+}
+
+TEST_F(Block2CacheTest, SnapshotKeepsContentFormatOfResponse) {
+	Get("b2", 0);
+	Get("b2", 1);
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg resp(Sent[1]);
+	ASSERT_NE(nullptr, resp.Option(OPT_NUM_CONTENT_FORMAT));
+	EXPECT_EQ((uint32_t) COAP_CF_JSON, resp.UintOption(OPT_NUM_CONTENT_FORMAT));
+	EXPECT_EQ(1, HandlerCalls);
+}
+
+TEST_F(Block2CacheTest, SnapshotOfFailedHandlerIsNotServed) {
+	Fails = true;
+	Get("b2", 0);
+	Fails = false;
+	Get("b2", 1);
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg resp(Sent[1]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ(2, HandlerCalls);
+}
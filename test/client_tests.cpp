@@ -0,0 +1,450 @@
+#include "coap_test.h"
+
+// Client requests (CoAP_StartRequest, NSTART)
+class ClientTest : public CoapTest {
+protected:
+	struct Done {
+		Done() : Calls(0), Result(COAP_OK), Code(EMPTY) {
+		}
+		int Calls;
+		CoAP_Result_t Result;
+		CoAP_MessageCode_t Code;
+		std::string Payload;
+	};
+
+	static void ReqDone(CoAP_ReqHandle_t handle, CoAP_Result_t result, CoAP_Message_t* pRespMsg, void* pUserData) {
+		(void) handle;
+		Done* pDone = (Done*) pUserData;
+		pDone->Calls++;
+		pDone->Result = result;
+		if (pRespMsg != NULL) {
+			pDone->Code = pRespMsg->Code;
+			pDone->Payload.assign((const char*) pRespMsg->Payload, pRespMsg->PayloadLength);
+		}
+	}
+
+	CoAP_ReqHandle_t Start(CoAP_MessageType_t type, const char* uri, Done* pDone, const NetEp_t& ep = Ep(1), uint32_t timeout = 0) {
+		CoAP_ReqParams_t params;
+		memset(&params, 0, sizeof(params));
+		params.Timeout = timeout;
+		params.Type = type;
+		params.Code = REQ_GET;
+		params.UriString = uri;
+		params.cb = ReqDone;
+		params.pUserData = pDone;
+		CoAP_ReqHandle_t handle = COAP_INVALID_REQ_HANDLE;
+		NetEp_t serverEp = ep;
+		EXPECT_EQ(COAP_OK, CoAP_StartRequest(&params, Sock(), &serverEp, &handle));
+		return handle;
+	}
+
+	// Answers the request sent as datagram i with a piggybacked response
+	void Answer(size_t i, const char* payload) {
+		ParsedMsg req(Sent[i]);
+		NetEp_t ep = Sent[i].Ep; // Sent may grow while receiving
+		Receive(ep, Msg(ACK, RESP_SUCCESS_CONTENT_2_05, req->MessageID, req->Token, NULL, payload));
+	}
+};
+
+TEST_F(ClientTest, QueuesRequestsBeyondNstart) {
+	Done done[3];
+	Start(CON, "a", &done[0]);
+	Start(CON, "b", &done[1]);
+	Start(CON, "c", &done[2]);
+	Work(10);
+	ASSERT_EQ(1u, Sent.size()) << "only NSTART (1) requests may be outstanding";
+
+	Answer(0, "A");
+	Work(10);
+	EXPECT_EQ(1, done[0].Calls);
+	EXPECT_EQ("A", done[0].Payload);
+	ASSERT_EQ(2u, Sent.size()) << "next request is sent once the first one is answered";
+
+	Answer(1, "B");
+	Work(10);
+	ASSERT_EQ(3u, Sent.size());
+	Answer(2, "C");
+	Work(10);
+	EXPECT_EQ(1, done[2].Calls);
+	EXPECT_EQ(COAP_OK, done[2].Result);
+}
+
+TEST_F(ClientTest, NstartIsPerEndpoint) {
+	Done done[2];
+	Start(CON, "a", &done[0], Ep(1));
+	Start(CON, "a", &done[1], Ep(2));
+	Work(10);
+	EXPECT_EQ(2u, Sent.size());
+}
+
+TEST_F(ClientTest, EmptyAckEndsOutstandingRequest) {
+	Done done[2];
+	Start(CON, "a", &done[0]);
+	Start(CON, "b", &done[1]);
+	Work(10);
+	ASSERT_EQ(1u, Sent.size());
+
+	ParsedMsg req(Sent[0]);
+	CoAP_Token_t noToken;
+	memset(&noToken, 0, sizeof(noToken));
+	Receive(Sent[0].Ep, Msg(ACK, EMPTY, req->MessageID, noToken)); // separate response follows later
+	Work(10);
+	EXPECT_EQ(2u, Sent.size()) << "an acknowledged request is not outstanding anymore (4.7 RFC7252)";
+}
+
+TEST_F(ClientTest, CancelFreesSlot) {
+	Done done[2];
+	CoAP_ReqHandle_t first = Start(CON, "a", &done[0]);
+	Start(CON, "b", &done[1]);
+	Work(10);
+	ASSERT_EQ(1u, Sent.size());
+
+	EXPECT_EQ(COAP_OK, CoAP_CancelRequest(first));
+	Work(10);
+	EXPECT_EQ(2u, Sent.size());
+	EXPECT_EQ(0, done[0].Calls);
+}
+
+TEST_F(ClientTest, UnansweredNonRequestReleasesSlotAtProbingRate) {
+	Done done[2];
+	Start(NON, "a", &done[0]);
+	Start(NON, "b", &done[1]);
+	Work(10);
+	ASSERT_EQ(1u, Sent.size());
+
+	// PROBING_RATE is 1 byte/s, the request datagram is far smaller than 20 bytes
+	Advance(20);
+	EXPECT_EQ(2u, Sent.size()) << "a NON request without response must not block the endpoint for CLIENT_MAX_RESP_WAIT_TIME";
+	EXPECT_EQ(0, done[0].Calls) << "a late response can still be received";
+}
+
+TEST_F(ClientTest, SocketErrorFreesSlot) {
+	Done done[2];
+	Start(CON, "a", &done[0]);
+	TxFails = true;
+	Work(1);
+	TxFails = false;
+	EXPECT_EQ(1, done[0].Calls);
+	EXPECT_EQ(COAP_ERR_SOCKET, done[0].Result);
+
+	Start(CON, "b", &done[1]);
+	Work(10);
+	EXPECT_EQ(1u, Sent.size());
+}
+
+TEST_F(ClientTest, LegacyRequestsAreNotHeldBack) {
+	NetEp_t ep = Ep(1);
+	EXPECT_EQ(COAP_OK, CoAP_StartNewRequest(REQ_GET, "a", Sock(), &ep, NULL, NULL, 0));
+	EXPECT_EQ(COAP_OK, CoAP_StartNewRequest(REQ_GET, "b", Sock(), &ep, NULL, NULL, 0));
+	Work(10);
+	EXPECT_EQ(2u, Sent.size()) << "NSTART only applies to CoAP_StartRequest(...)";
+}
+
+TEST_F(ClientTest, LegacyRequestsCountAsOutstanding) {
+	Done done;
+	NetEp_t ep = Ep(1);
+	EXPECT_EQ(COAP_OK, CoAP_StartNewRequest(REQ_GET, "a", Sock(), &ep, NULL, NULL, 0));
+	Work(10);
+	Start(CON, "b", &done);
+	Work(10);
+	ASSERT_EQ(1u, Sent.size());
+
+	Answer(0, "A");
+	Work(10);
+	EXPECT_EQ(2u, Sent.size());
+}
+
+TEST_F(ClientTest, WaitingRequestsDoNotDelayOthers) {
+	const size_t n = 1000;
+	std::vector<Done> done(n);
+	for (size_t i = 0; i < n; i++) {
+		Start(CON, "a", &done[i]);
+	}
+	Work((int) n);
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(1u, CountInteractions()) << "waiting requests are kept aside";
+
+	Done other;
+	Start(CON, "b", &other, Ep(2));
+	Work(2);
+	ASSERT_EQ(2u, Sent.size());
+	EXPECT_EQ(2, Sent[1].Ep.NetAddr.IPv4.u8[3]);
+	Answer(1, "B");
+	Work(2);
+	EXPECT_EQ(1, other.Calls);
+
+	// each freed slot goes to the oldest waiting request right away
+	Sent.erase(Sent.begin() + 1);
+	for (size_t i = 0; i < n; i++) {
+		ASSERT_EQ(i + 1, Sent.size());
+		Answer(i, "A");
+		Work(2);
+		EXPECT_EQ(1, done[i].Calls);
+		if (i + 1 < n) {
+			EXPECT_EQ(0, done[i + 1].Calls);
+		}
+	}
+	EXPECT_EQ(0u, CountInteractions());
+}
+
+TEST_F(ClientTest, CancelWaitingRequest) {
+	Done done[3];
+	Start(CON, "a", &done[0]);
+	CoAP_ReqHandle_t second = Start(CON, "b", &done[1]);
+	Start(CON, "c", &done[2]);
+	Work(10);
+	ASSERT_EQ(1u, Sent.size());
+
+	EXPECT_EQ(COAP_OK, CoAP_CancelRequest(second));
+	Work(10);
+	Answer(0, "A");
+	Work(10);
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg req(Sent[1]);
+	ASSERT_NE(nullptr, req.Option(OPT_NUM_URI_PATH));
+	EXPECT_EQ('c', req.Option(OPT_NUM_URI_PATH)->Value[0]);
+	EXPECT_EQ(0, done[1].Calls);
+	EXPECT_EQ(COAP_NOT_FOUND, CoAP_CancelRequest(second));
+}
+
+TEST_F(ClientTest, WaitingRequestReachesDeadline) {
+	Done done[2];
+	Start(CON, "a", &done[0]);
+	Start(CON, "b", &done[1], Ep(1), 3);
+	Work(10);
+	ASSERT_EQ(1u, Sent.size());
+
+	Advance(5);
+	EXPECT_EQ(0, done[0].Calls);
+	EXPECT_EQ(1, done[1].Calls);
+	EXPECT_EQ(COAP_ERR_TIMEOUT, done[1].Result);
+	EXPECT_EQ(1u, CountInteractions());
+}
+
+TEST_F(ClientTest, ClearDropsWaitingRequests) {
+	long before = Allocations;
+	Done done[3];
+	for (int i = 0; i < 3; i++) {
+		Start(CON, "a", &done[i]);
+	}
+	Work(10);
+	CoAP_ClearPendingInteractions();
+	EXPECT_EQ(before, Allocations);
+	EXPECT_EQ(0u, CountInteractions());
+}
+
+TEST_F(ClientTest, ObserveDeliversFreshNotificationsOnly) {
+	Done done;
+	CoAP_ReqParams_t params;
+	memset(&params, 0, sizeof(params));
+	params.Type = CON;
+	params.Code = REQ_GET;
+	params.UriString = "temp";
+	params.cb = ReqDone;
+	params.pUserData = &done;
+	params.Observe = true;
+	NetEp_t ep = Ep(1);
+	CoAP_ReqHandle_t handle;
+	ASSERT_EQ(COAP_OK, CoAP_StartRequest(&params, Sock(), &ep, &handle));
+	Work(4);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg req(Sent[0]);
+	ASSERT_NE(nullptr, req.Option(OPT_NUM_OBSERVE));
+	EXPECT_EQ(0u, req.UintOption(OPT_NUM_OBSERVE));
+
+	CoAP_Message_t* pResp = Msg(ACK, RESP_SUCCESS_CONTENT_2_05, req->MessageID, req->Token, NULL, "1");
+	AddUintOption(pResp, OPT_NUM_OBSERVE, 5);
+	AddUintOption(pResp, OPT_NUM_MAX_AGE, 10);
+	Receive(ep, pResp);
+	Work(4);
+	EXPECT_EQ(1, done.Calls);
+	EXPECT_EQ("1", done.Payload);
+
+	CoAP_Message_t* pNotif = Msg(NON, RESP_SUCCESS_CONTENT_2_05, 0x700, req->Token, NULL, "2");
+	AddUintOption(pNotif, OPT_NUM_OBSERVE, 6);
+	AddUintOption(pNotif, OPT_NUM_MAX_AGE, 10);
+	Receive(ep, pNotif);
+	Work(4);
+	EXPECT_EQ(2, done.Calls);
+	EXPECT_EQ("2", done.Payload);
+
+	pNotif = Msg(NON, RESP_SUCCESS_CONTENT_2_05, 0x701, req->Token, NULL, "old"); // reordered by the network
+	AddUintOption(pNotif, OPT_NUM_OBSERVE, 4);
+	Receive(ep, pNotif);
+	Work(4);
+	EXPECT_EQ(2, done.Calls) << "outdated notification must be dropped (3.4 RFC7641)";
+
+	// re-registration with the same token once Max-Age has expired
+	Sent.clear();
+	Advance(10 + CLIENT_OBSERVE_REREGISTER_MARGIN + 1);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg rereg(Sent[0]);
+	EXPECT_TRUE(CoAP_TokenEqual(req->Token, rereg->Token));
+	EXPECT_NE(req->MessageID, rereg->MessageID);
+	EXPECT_EQ(0u, rereg.UintOption(OPT_NUM_OBSERVE));
+
+	// canceled observation rejects further notifications
+	EXPECT_EQ(COAP_OK, CoAP_CancelRequest(handle));
+	Work(4);
+	Sent.clear();
+	pNotif = Msg(CON, RESP_SUCCESS_CONTENT_2_05, 0x702, req->Token, NULL, "3");
+	AddUintOption(pNotif, OPT_NUM_OBSERVE, 7);
+	Receive(ep, pNotif);
+	EXPECT_EQ(2, done.Calls);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg rst(Sent[0]);
+	EXPECT_EQ(RST, rst->Type);
+}
+
+// Block2 download into a response buffer, the server is played by the test
+class BlockDownloadTest : public ClientTest {
+protected:
+	uint8_t Buf[64];
+	uint32_t Length;
+	Done Result;
+
+	void StartDownload(uint32_t bufSize, CoAP_MessageType_t type = CON, uint8_t window = 0) {
+		memset(Buf, 0, sizeof(Buf));
+		CoAP_ReqParams_t params;
+		memset(&params, 0, sizeof(params));
+		params.Type = type;
+		params.BlockWindow = window;
+		params.Code = REQ_GET;
+		params.UriString = "big";
+		params.cb = ReqDone;
+		params.pUserData = &Result;
+		params.pRespBuf = Buf;
+		params.RespBufSize = bufSize;
+		params.pRespLength = &Length;
+		params.BlockSize = 16;
+		NetEp_t ep = Ep(1);
+		ASSERT_EQ(COAP_OK, CoAP_StartRequest(&params, Sock(), &ep, NULL));
+		Work(4);
+	}
+
+	// Answers the latest request with the block of the given number
+	void AnswerBlock(uint32_t num, bool more, const char* payload, const char* etag = NULL, uint16_t size = 16) {
+		ASSERT_FALSE(Sent.empty());
+		Receive(Ep(1), Block(Sent.size() - 1, num, more, payload, etag, size));
+		Work(4);
+	}
+
+	// Response to request i, piggybacked or separate like the request was sent
+	CoAP_Message_t* Block(size_t i, uint32_t num, bool more, const char* payload, const char* etag = NULL, uint16_t size = 16) {
+		static uint16_t mid = 0xb00;
+		ParsedMsg req(Sent[i]);
+		CoAP_Message_t* pResp = Msg(req->Type == CON ? ACK : NON, RESP_SUCCESS_CONTENT_2_05, req->Type == CON ? req->MessageID : mid++, req->Token, NULL, payload);
+		AddBlockOption(pResp, OPT_NUM_BLOCK2, num, more, size);
+		if (etag != NULL) {
+			CoAP_AppendOptionToList(&(pResp->pOptionsList), OPT_NUM_ETAG, (uint8_t*) etag, (uint16_t) strlen(etag));
+		}
+		return pResp;
+	}
+
+	uint32_t RequestedBlock() {
+		ParsedMsg req(Sent.back());
+		return req.UintOption(OPT_NUM_BLOCK2) >> 4;
+	}
+};
+
+TEST_F(BlockDownloadTest, ReassemblesBlocks) {
+	StartDownload(sizeof(Buf));
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(0u, RequestedBlock());
+	AnswerBlock(0, true, "0123456789abcdef");
+	ASSERT_EQ(2u, Sent.size());
+	EXPECT_EQ(1u, RequestedBlock());
+	EXPECT_EQ(0, Result.Calls) << "callback is called once after the last block";
+	AnswerBlock(1, false, "ghijk");
+
+	EXPECT_EQ(1, Result.Calls);
+	EXPECT_EQ(COAP_OK, Result.Result);
+	EXPECT_EQ(21u, Length);
+	EXPECT_EQ(0, memcmp(Buf, "0123456789abcdefghijk", 21));
+}
+
+TEST_F(BlockDownloadTest, StopsAtEndOfBuffer) {
+	StartDownload(20);
+	AnswerBlock(0, true, "0123456789abcdef");
+	AnswerBlock(1, true, "ghijklmnopqrstuv");
+
+	EXPECT_EQ(1, Result.Calls);
+	EXPECT_EQ(COAP_ERR_OUT_OF_MEMORY, Result.Result);
+	EXPECT_EQ(16u, Length);
+	EXPECT_EQ(0, Buf[16]) << "nothing written behind the buffer";
+}
+
+TEST_F(BlockDownloadTest, RejectsUnrequestedBlock) {
+	StartDownload(sizeof(Buf));
+	AnswerBlock(0, true, "0123456789abcdef");
+	AnswerBlock(0xfffff, true, "0123456789abcdef"); // highest block number of a 3 byte option
+
+	EXPECT_EQ(1, Result.Calls);
+	EXPECT_EQ(COAP_ERR_WRONG_OPTION, Result.Result);
+	EXPECT_EQ(16u, Length);
+}
+
+TEST_F(BlockDownloadTest, RejectsChangedETag) {
+	StartDownload(sizeof(Buf));
+	AnswerBlock(0, true, "0123456789abcdef", "v1");
+	AnswerBlock(1, true, "ghijklmnopqrstuv", "v1");
+	EXPECT_EQ(0, Result.Calls);
+	AnswerBlock(2, false, "wxyz", "v2"); // representation changed in between
+
+	EXPECT_EQ(1, Result.Calls);
+	EXPECT_EQ(COAP_ERR_WRONG_OPTION, Result.Result);
+	EXPECT_EQ(32u, Length);
+}
+
+TEST_F(BlockDownloadTest, RejectsMissingETag) {
+	StartDownload(sizeof(Buf));
+	AnswerBlock(0, true, "0123456789abcdef", "v1");
+	AnswerBlock(1, false, "ghijk");
+
+	EXPECT_EQ(1, Result.Calls);
+	EXPECT_EQ(COAP_ERR_WRONG_OPTION, Result.Result);
+	EXPECT_EQ(16u, Length);
+}
+
+TEST_F(BlockDownloadTest, RejectsChangedBlockSize) {
+	StartDownload(sizeof(Buf));
+	AnswerBlock(0, true, "0123456789abcdef");
+	AnswerBlock(1, false, "ghijk", NULL, 32); // would be placed at offset 32
+
+	EXPECT_EQ(1, Result.Calls);
+	EXPECT_EQ(COAP_ERR_WRONG_OPTION, Result.Result);
+	EXPECT_EQ(16u, Length);
+	EXPECT_EQ(0, Buf[16]);
+}
+
+TEST_F(BlockDownloadTest, EarlyBlockWaitsAsleep) {
+	StartDownload(sizeof(Buf), NON, 2);
+	ASSERT_EQ(1u, Sent.size());
+	CoAP_Message_t* pFirst = Block(0, 0, true, "0123456789abcdef");
+	AddUintOption(pFirst, OPT_NUM_SIZE2, 36);
+	Receive(Ep(1), pFirst);
+	Work(4);
+	ASSERT_EQ(2u, Sent.size());
+	Advance(30); // unanswered NON request releases its slot, block 2 is requested meanwhile
+	ASSERT_EQ(3u, Sent.size());
+
+	Receive(Ep(1), Block(2, 2, false, "wxyz"));
+	Work(4);
+	CoAP_Interaction_t* pEarly = NULL;
+	for (CoAP_Interaction_t* pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+		if (pIA->State == COAP_STATE_HANDLE_RESPONSE) {
+			pEarly = pIA;
+		}
+	}
+	ASSERT_NE(nullptr, pEarly);
+	EXPECT_TRUE(timeAfter(pEarly->SleepUntil, Now)) << "no busy waiting for the preceding block";
+	EXPECT_EQ(0, Result.Calls);
+
+	Receive(Ep(1), Block(1, 1, true, "ghijklmnopqrstuv"));
+	Work(4);
+	EXPECT_EQ(1, Result.Calls);
+	EXPECT_EQ(COAP_OK, Result.Result);
+	EXPECT_EQ(36u, Length);
+	EXPECT_EQ(0, memcmp(Buf, "0123456789abcdefghijklmnopqrstuvwxyz", 36));
+	EXPECT_EQ(0u, CountInteractions());
+}
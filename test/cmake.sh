@@ -18,6 +18,5 @@ cd ${TRAVIS_BUILD_DIR}/buildtest
 cmake -DCMAKE_CXX_COMPILER=$CMAKE_CXX_COMPILER ${TRAVIS_BUILD_DIR}/test/
 make
 
-echo "Tests disabled until fixed."
-# make test
+make test
 cd ${TRAVIS_BUILD_DIR}
\ No newline at end of file
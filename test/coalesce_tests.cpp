@@ -0,0 +1,186 @@
+#include "coap_test.h"
+
+// Equivalent GETs sharing one handler call and its response (RES_FLAG_COALESCE)
+class CoalesceTest : public CoapTest {
+protected:
+	static std::string Value;
+	static int FailCalls; // handler calls left answering with 5.03
+	static int HandlerCalls;
+	static bool PostponeOnce;
+	CoAP_Res_t* pRes;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Value = "v0";
+		FailCalls = 0;
+		HandlerCalls = 0;
+		PostponeOnce = false;
+		pRes = CreateResource("co", Opts(RES_OPT_GET | RES_OPT_PUT, RES_FLAG_COALESCE), Handler);
+	}
+
+	// GET answers with Value, PUT sets it
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		HandlerCalls++;
+		if (PostponeOnce) {
+			PostponeOnce = false;
+			return HANDLER_POSTPONE;
+		}
+		if (pReq->Code == REQ_PUT) {
+			Value.assign((const char*) pReq->Payload, pReq->PayloadLength);
+			pResp->Code = RESP_SUCCESS_CHANGED_2_04;
+			return HANDLER_OK;
+		}
+		if (FailCalls > 0) {
+			FailCalls--;
+			pResp->Code = RESP_SERVICE_UNAVAILABLE_5_03;
+		}
+		CoAP_AppendUintOptionToList(&(pResp->pOptionsList), OPT_NUM_MAX_AGE, 30);
+		CoAP_SetPayload(pResp, (uint8_t*) Value.data(), Value.size(), true);
+		return HANDLER_OK;
+	}
+
+	// Request of client n (10.0.0.n with token n)
+	static void Request(uint8_t n, const char* uri = "co", CoAP_MessageCode_t code = REQ_GET, const char* payload = NULL) {
+		static uint16_t mid = 0xd00;
+		Receive(Ep(n), Msg(CON, code, mid++, Token(n), uri, payload));
+		Work(4);
+	}
+
+	// Responses sent to client n
+	static std::vector<size_t> SentTo(uint8_t n) {
+		std::vector<size_t> idx;
+		for (size_t i = 0; i < Sent.size(); i++) {
+			if (Sent[i].Ep.NetAddr.IPv4.u8[3] == n) {
+				idx.push_back(i);
+			}
+		}
+		return idx;
+	}
+
+	// Payload of the latest response with code to client n, "-" if there is none
+	static std::string Response(uint8_t n, CoAP_MessageCode_t code = RESP_SUCCESS_CONTENT_2_05) {
+		std::vector<size_t> idx = SentTo(n);
+		for (size_t i = idx.size(); i > 0; i--) {
+			ParsedMsg msg(Sent[idx[i - 1]]);
+			if (msg->Code == code) {
+				EXPECT_TRUE(CoAP_TokenEqual(Token(n), msg->Token));
+				EXPECT_EQ(30u, msg.UintOption(OPT_NUM_MAX_AGE));
+				return msg.Payload();
+			}
+		}
+		return "-";
+	}
+
+	static void AckSent() {
+		std::vector<TxDatagram> sent(Sent);
+		for (size_t i = 0; i < sent.size(); i++) {
+			ParsedMsg msg(sent[i]);
+			if (msg->Type == CON) {
+				CoAP_Token_t noToken = { 0 };
+				Receive(sent[i].Ep, Msg(ACK, EMPTY, msg->MessageID, noToken));
+			}
+		}
+	}
+};
+
+std::string CoalesceTest::Value;
+int CoalesceTest::FailCalls;
+int CoalesceTest::HandlerCalls;
+bool CoalesceTest::PostponeOnce;
+
+TEST_F(CoalesceTest, PendingRequestsShareHandlerCall) {
+	PostponeOnce = true;
+	Request(1);
+	Request(2);
+	Request(3);
+	EXPECT_EQ(1, HandlerCalls);
+	EXPECT_EQ(3u, Sent.size()); // empty ACKs
+
+	Advance(POSTPONE_WAIT_TIME_SEK + 1);
+	EXPECT_EQ(2, HandlerCalls);
+	EXPECT_EQ("v0", Response(1));
+	EXPECT_EQ("v0", Response(2));
+	EXPECT_EQ("v0", Response(3));
+}
+
+TEST_F(CoalesceTest, RequestsWithinWindowShareResponse) {
+	Request(1);
+	Value = "v1";
+	Request(2);
+	EXPECT_EQ(1, HandlerCalls);
+	EXPECT_EQ("v0", Response(2));
+
+	Advance(COALESCE_WINDOW + 1);
+	Request(3);
+	EXPECT_EQ(2, HandlerCalls);
+	EXPECT_EQ("v1", Response(3));
+}
+
+TEST_F(CoalesceTest, OtherQueryIsNotShared) {
+	Request(1, "co?a");
+	Request(2, "co?b");
+	EXPECT_EQ(2, HandlerCalls);
+	Request(3, "co?b");
+	EXPECT_EQ(2, HandlerCalls);
+}
+
+TEST_F(CoalesceTest, ErrorIsNotShared) {
+	FailCalls = 2;
+	Request(1);
+	Request(2);
+	EXPECT_EQ(2, HandlerCalls);
+
+	PostponeOnce = true;
+	FailCalls = 1;
+	Request(3);
+	Request(4);
+	Advance(POSTPONE_WAIT_TIME_SEK + 1);
+	EXPECT_EQ("v0", Response(3, RESP_SERVICE_UNAVAILABLE_5_03));
+	EXPECT_EQ("v0", Response(4)); // by its own handler call
+	EXPECT_EQ(5, HandlerCalls);
+}
+
+TEST_F(CoalesceTest, ChangeDropsKeptResponse) {
+	Request(1);
+	Request(2, "co", REQ_PUT, "v1");
+	Request(3);
+	EXPECT_EQ("v1", Response(3));
+
+	Value = "v2";
+	EXPECT_EQ(COAP_OK, CoAP_NotifyResourceObservers(pRes));
+	Request(4);
+	EXPECT_EQ("v2", Response(4));
+	EXPECT_EQ(4, HandlerCalls);
+}
+
+TEST_F(CoalesceTest, SharedResponsesOutliveEachOther) {
+	PostponeOnce = true;
+	Request(1);
+	Request(2);
+	Request(3);
+	Advance(POSTPONE_WAIT_TIME_SEK + 1);
+	Value = "changed";
+
+	// only the leader acknowledges, the others get retransmissions of their own copy
+	std::vector<TxDatagram> sent(Sent);
+	Sent.clear();
+	for (size_t i = 0; i < sent.size(); i++) {
+		ParsedMsg msg(sent[i]);
+		if (msg->Type == CON && sent[i].Ep.NetAddr.IPv4.u8[3] == 1) {
+			CoAP_Token_t noToken = { 0 };
+			Receive(sent[i].Ep, Msg(ACK, EMPTY, msg->MessageID, noToken));
+		}
+	}
+	Advance(ACK_TIMEOUT * 2);
+	EXPECT_TRUE(SentTo(1).empty());
+	EXPECT_EQ("v0", Response(2));
+	EXPECT_EQ("v0", Response(3));
+
+	AckSent();
+	Work(4);
+	CoAP_ClearPendingInteractions();
+	long allocations = Allocations;
+	RemoveResource(pRes);
+	Work();
+	EXPECT_GT(allocations, Allocations); // kept response released with the resource
+}
@@ -1,13 +1,13 @@
 #include <iostream>
 extern "C" {
-#include <sys/timeb.h> 
+#include <sys/time.h>
 }
 
 time_t millis(void)
 {
-	struct timeb start;
-	ftime(&start);
-    return (start.time * 1000 + start.millitm);
+	struct timeval start;
+	gettimeofday(&start, NULL);
+    return (start.tv_sec * 1000 + start.tv_usec / 1000);
 }
 
 // Generic implementations for coap_interface.h
@@ -0,0 +1,293 @@
+/*******************************************************************************
+ * Copyright (c)  2015  Dipl.-Ing. Tobias Rohde, http://www.lobaro.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef COAP_TEST_H_
+#define COAP_TEST_H_
+
+#include <gtest/gtest.h>
+#include <coap.h>
+extern "C" {
+#include <coap_mem.h>
+}
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Datagram sent by the stack
+struct TxDatagram {
+	std::vector<uint8_t> Data;
+	NetEp_t Ep;
+};
+
+// Message parsed from a sent datagram, freed with the wrapper
+class ParsedMsg {
+public:
+	explicit ParsedMsg(const TxDatagram& dgram) : pMsg(NULL) {
+		std::vector<uint8_t> data(dgram.Data);
+		EXPECT_EQ(COAP_OK, CoAP_ParseMessageFromDatagram(data.data(), (uint16_t) data.size(), &pMsg));
+	}
+	~ParsedMsg() {
+		CoAP_free_Message(&pMsg);
+	}
+	CoAP_Message_t* operator->() const {
+		return pMsg;
+	}
+	CoAP_Message_t* get() const {
+		return pMsg;
+	}
+	CoAP_option_t* Option(uint16_t number) const {
+		return CoAP_FindOptionByNumber(pMsg, number);
+	}
+	uint32_t UintOption(uint16_t number) const {
+		uint32_t val = 0;
+		CoAP_option_t* pOpt = Option(number);
+		if (pOpt != NULL) {
+			CoAP_GetUintFromOption(pOpt, &val);
+		}
+		return val;
+	}
+	std::string Payload() const {
+		return std::string((const char*) pMsg->Payload, pMsg->PayloadLength);
+	}
+
+private:
+	ParsedMsg(const ParsedMsg&);
+	ParsedMsg& operator=(const ParsedMsg&);
+	CoAP_Message_t* pMsg;
+};
+
+// Runs the stack on a fake 1Hz clock with a socket that records all sent datagrams.
+// The stack is initialized once per process, resources created by CreateResource(...)
+// and all interactions are dropped after each test.
+class CoapTest : public testing::Test {
+protected:
+	static uint32_t Now;
+	static std::vector<TxDatagram> Sent;
+	static long Allocations; // malloc() calls not yet freed
+	static bool TxFails;
+	static bool MallocFails; // malloc() returns NULL while set
+	static int RandValue; // returned by the rand() api function if >= 0
+
+	static SocketHandle_t Sock() {
+		return (SocketHandle_t) 1;
+	}
+
+	virtual void SetUp() {
+		static bool initialized = false;
+		if (!initialized) {
+			CoAP_API_t api;
+			api.rtc1HzCnt = Clock;
+			api.debugPuts = Puts;
+			api.malloc = Malloc;
+			api.free = Free;
+			api.rand = Rand;
+			CoAP_Init(api);
+			CoAP_Socket_t* pSocket = CoAP_NewSocket(Sock());
+			pSocket->Tx = Tx;
+			initialized = true;
+		}
+		Now += 1000; // leaves all time windows of earlier tests
+		Sent.clear();
+		TxFails = false;
+		MallocFails = false;
+		RandValue = -1;
+	}
+
+	virtual void TearDown() {
+		MallocFails = false;
+		CoAP_ClearPendingInteractions();
+		for (size_t i = 0; i < Resources.size(); i++) {
+			CoAP_RemoveResource(Resources[i]);
+		}
+		Resources.clear();
+		CoAP_doWork(); // reclaims the removed resources
+		CoAP_ClearPendingInteractions(); // final notifications to their observers
+	}
+
+	CoAP_Res_t* CreateResource(const char* uri, CoAP_ResOpts_t opts, CoAP_ResourceHandler_fPtr_t handler,
+			CoAP_ResourceNotifier_fPtr_t notifier = NULL) {
+		CoAP_Res_t* pRes = CoAP_CreateResource((char*) uri, (char*) "test", opts, handler, notifier);
+		if (pRes != NULL) {
+			Resources.push_back(pRes);
+		}
+		return pRes;
+	}
+
+	// Removes a resource created by CreateResource(...) before the end of the test
+	void RemoveResource(CoAP_Res_t* pRes) {
+		for (size_t i = 0; i < Resources.size(); i++) {
+			if (Resources[i] == pRes) {
+				Resources.erase(Resources.begin() + i);
+				break;
+			}
+		}
+		EXPECT_EQ(COAP_OK, CoAP_RemoveResource(pRes));
+	}
+
+	static CoAP_ResOpts_t Opts(uint16_t methods, uint16_t flags = 0) {
+		CoAP_ResOpts_t opts;
+		memset(&opts, 0, sizeof(opts));
+		opts.AllowedMethods = methods;
+		opts.Flags = flags;
+		return opts;
+	}
+
+	static NetEp_t Ep(uint8_t host, uint16_t port = 5683) {
+		NetEp_t ep;
+		memset(&ep, 0, sizeof(ep));
+		ep.NetType = IPV4;
+		ep.NetAddr.IPv4.u8[0] = 10;
+		ep.NetAddr.IPv4.u8[3] = host;
+		ep.NetPort = port;
+		return ep;
+	}
+
+	static CoAP_Token_t Token(uint8_t id) {
+		CoAP_Token_t token;
+		memset(&token, 0, sizeof(token));
+		token.Length = 2;
+		token.Token[0] = 0xa5;
+		token.Token[1] = id;
+		return token;
+	}
+
+	// Builds a message, uri may contain a query ("res?a=1")
+	static CoAP_Message_t* Msg(CoAP_MessageType_t type, CoAP_MessageCode_t code, uint16_t mid, CoAP_Token_t token,
+			const char* uri = NULL, const char* payload = NULL) {
+		uint16_t len = payload != NULL ? (uint16_t) strlen(payload) : 0;
+		CoAP_Message_t* pMsg = CoAP_CreateMessage(type, code, mid, (const uint8_t*) payload, len, len, token);
+		if (uri != NULL) {
+			CoAP_AppendUriOptionsFromString(&(pMsg->pOptionsList), uri);
+		}
+		return pMsg;
+	}
+
+	static void AddUintOption(CoAP_Message_t* pMsg, uint16_t number, uint32_t val) {
+		uint8_t buf[4];
+		uint8_t len = 0;
+		uint8_t i;
+		for (i = 0; i < 4; i++) {
+			if ((val >> (8 * (3 - i))) != 0 || len > 0) {
+				buf[len++] = (uint8_t) (val >> (8 * (3 - i)));
+			}
+		}
+		CoAP_AppendOptionToList(&(pMsg->pOptionsList), number, buf, len);
+	}
+
+	static void AddBlockOption(CoAP_Message_t* pMsg, uint16_t number, uint32_t num, bool more, uint16_t size) {
+		uint32_t szx = 0;
+		while ((16u << szx) < size) {
+			szx++;
+		}
+		AddUintOption(pMsg, number, (num << 4) | (more ? 0x08 : 0) | szx);
+	}
+
+	// Passes pMsg as datagram from ep to the stack and frees it
+	static void Receive(const NetEp_t& ep, CoAP_Message_t* pMsg, MetaInfoType_t meta = META_INFO_NONE) {
+		size_t before = Sent.size();
+		bool txFails = TxFails;
+		TxFails = false;
+		EXPECT_EQ(COAP_OK, CoAP_SendMsg(pMsg, Sock(), ep));
+		TxFails = txFails;
+		std::vector<uint8_t> data(Sent[before].Data);
+		Sent.resize(before);
+		CoAP_free_Message(&pMsg);
+
+		NetPacket_t packet;
+		memset(&packet, 0, sizeof(packet));
+		packet.pData = data.data();
+		packet.size = (uint16_t) data.size();
+		packet.remoteEp = ep;
+		packet.metaInfo.Type = meta;
+		CoAP_HandleIncomingPacket(Sock(), &packet);
+	}
+
+	static void Work(int calls = 1) {
+		for (int i = 0; i < calls; i++) {
+			CoAP_doWork();
+		}
+	}
+
+	// Lets time pass second by second, processing interactions in between
+	static void Advance(uint32_t seconds, int callsPerSecond = 4) {
+		for (uint32_t i = 0; i < seconds; i++) {
+			Now++;
+			Work(callsPerSecond);
+		}
+	}
+
+	static size_t CountInteractions() {
+		size_t cnt = 0;
+		for (CoAP_Interaction_t* pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+			cnt++;
+		}
+		return cnt;
+	}
+
+private:
+	std::vector<CoAP_Res_t*> Resources;
+
+	static uint32_t Clock() {
+		return Now;
+	}
+	static void Puts(const char* s) {
+		if (getenv("COAP_TEST_VERBOSE") != NULL) {
+			fputs(s, stdout);
+		}
+	}
+	static int Rand() {
+		return RandValue >= 0 ? RandValue : rand();
+	}
+	static void* Malloc(size_t size) {
+		if (MallocFails) {
+			return NULL;
+		}
+		void* p = malloc(size);
+		if (p != NULL) {
+			Allocations++;
+		}
+		return p;
+	}
+	static void Free(void* p) {
+		if (p != NULL) {
+			Allocations--;
+		}
+		free(p);
+	}
+	static bool Tx(SocketHandle_t socketHandle, NetPacket_t* pPacket) {
+		(void) socketHandle;
+		if (TxFails) {
+			return false;
+		}
+		TxDatagram dgram;
+		dgram.Data.assign(pPacket->pData, pPacket->pData + pPacket->size);
+		dgram.Ep = pPacket->remoteEp;
+		Sent.push_back(dgram);
+		return true;
+	}
+};
+
+#endif /* COAP_TEST_H_ */
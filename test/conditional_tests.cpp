@@ -0,0 +1,144 @@
+#include "coap_test.h"
+
+// Conditional requests with If-Match and If-None-Match (RFC7252, 5.10.8)
+class ConditionalTest : public CoapTest {
+protected:
+	static uint32_t Version; // ETag of the representation
+	static bool Exists;
+	static bool PostponeOnce;
+	static int GetCalls;
+	static int PutCalls;
+	static int GetterCalls;
+	CoAP_Res_t* pRes;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Version = 1;
+		Exists = true;
+		PostponeOnce = false;
+		GetCalls = 0;
+		PutCalls = 0;
+		GetterCalls = 0;
+		pRes = CreateResource("cond", Opts(RES_OPT_GET | RES_OPT_PUT), Handler);
+	}
+
+	// GET answers with ETag Version, PUT increments it
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		if (pReq->Code == REQ_GET) {
+			GetCalls++;
+			AddETagValueToMsg(pResp, Version);
+			CoAP_SetPayload(pResp, (uint8_t*) "v", 1, true);
+			return HANDLER_OK;
+		}
+		PutCalls++;
+		if (PostponeOnce) {
+			PostponeOnce = false;
+			return HANDLER_POSTPONE;
+		}
+		Version++;
+		Exists = true;
+		pResp->Code = RESP_SUCCESS_CHANGED_2_04;
+		return HANDLER_OK;
+	}
+
+	static CoAP_Result_t Getter(CoAP_Res_t* pRes, uint8_t* pETag, uint8_t* pLength) {
+		(void) pRes;
+		GetterCalls++;
+		if (!Exists) {
+			return COAP_NOT_FOUND;
+		}
+		pETag[0] = (uint8_t) (Version >> 24);
+		pETag[1] = (uint8_t) (Version >> 16);
+		pETag[2] = (uint8_t) (Version >> 8);
+		pETag[3] = (uint8_t) Version;
+		*pLength = 4;
+		return COAP_OK;
+	}
+
+	// ifMatch: 0 for none, ~0 for an empty If-Match
+	CoAP_MessageCode_t Request(CoAP_MessageCode_t code, uint32_t ifMatch, bool ifNoneMatch = false) {
+		static uint16_t mid = 0xc00;
+		Sent.clear();
+		CoAP_Message_t* pReq = Msg(CON, code, mid++, Token(1), "cond", code == REQ_PUT ? "new" : NULL);
+		if (ifMatch == ~0u) {
+			CoAP_AppendOptionToList(&(pReq->pOptionsList), OPT_NUM_IF_MATCH, NULL, 0);
+		} else if (ifMatch != 0) {
+			AddETagValueToMsg(pReq, ifMatch);
+			CoAP_FindOptionByNumber(pReq, OPT_NUM_ETAG)->Number = OPT_NUM_IF_MATCH;
+		}
+		if (ifNoneMatch) {
+			CoAP_AppendOptionToList(&(pReq->pOptionsList), OPT_NUM_IF_NONE_MATCH, NULL, 0);
+		}
+		Receive(Ep(1), pReq);
+		Work(4);
+		EXPECT_EQ(1u, Sent.size());
+		return Sent.empty() ? EMPTY : ParsedMsg(Sent.back())->Code;
+	}
+};
+
+uint32_t ConditionalTest::Version;
+bool ConditionalTest::Exists;
+bool ConditionalTest::PostponeOnce;
+int ConditionalTest::GetCalls;
+int ConditionalTest::PutCalls;
+int ConditionalTest::GetterCalls;
+
+TEST_F(ConditionalTest, GetIsEvaluatedAgainstItsResponse) {
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Request(REQ_GET, 1));
+	EXPECT_EQ(1, GetCalls);
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, Request(REQ_GET, 7));
+	ParsedMsg resp(Sent[0]);
+	EXPECT_EQ(0u, resp->PayloadLength);
+	EXPECT_EQ(nullptr, resp.Option(OPT_NUM_ETAG));
+	EXPECT_EQ(2, GetCalls);
+}
+
+TEST_F(ConditionalTest, PutIsNotProbedByGetHandler) {
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceETagGetter(pRes, Getter));
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, Request(REQ_PUT, 1));
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, Request(REQ_PUT, 1));
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, Request(REQ_PUT, 2));
+	EXPECT_EQ(0, GetCalls);
+	EXPECT_EQ(2, PutCalls);
+	EXPECT_EQ(3, GetterCalls);
+}
+
+TEST_F(ConditionalTest, IfNoneMatchCreatesOnlyOnce) {
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceETagGetter(pRes, Getter));
+	Exists = false;
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, Request(REQ_PUT, ~0u));
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, Request(REQ_PUT, 0, true));
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, Request(REQ_PUT, 0, true));
+	EXPECT_EQ(1, PutCalls);
+}
+
+TEST_F(ConditionalTest, PutUsesETagOfLatestGet) {
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, Request(REQ_PUT, 1)); // no entity-tag known yet
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, Request(REQ_PUT, ~0u));
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Request(REQ_GET, 0));
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, Request(REQ_PUT, 2));
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, Request(REQ_PUT, 3)); // forgotten with the change
+	EXPECT_EQ(2, PutCalls);
+}
+
+TEST_F(ConditionalTest, NotificationForgetsETag) {
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Request(REQ_GET, 0));
+	EXPECT_EQ(COAP_OK, CoAP_NotifyResourceObservers(pRes));
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, Request(REQ_PUT, 1));
+}
+
+TEST_F(ConditionalTest, PostponedRequestIsEvaluatedOnce) {
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceETagGetter(pRes, Getter));
+	PostponeOnce = true;
+	Request(REQ_PUT, 1);
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(EMPTY, ParsedMsg(Sent[0])->Code); // separate response follows
+
+	Version = 5; // changed while postponed, the request had passed already
+	Sent.clear();
+	Advance(POSTPONE_WAIT_TIME_SEK + 1);
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, ParsedMsg(Sent[0])->Code);
+	EXPECT_EQ(1, GetterCalls);
+	EXPECT_EQ(2, PutCalls);
+}
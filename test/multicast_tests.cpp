@@ -0,0 +1,100 @@
+#include "coap_test.h"
+
+// Responses to multicast requests (leisure, response suppression)
+class MulticastTest : public CoapTest {
+protected:
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		CreateResource("mc", Opts(RES_OPT_GET), Handler);
+	}
+
+	virtual void TearDown() {
+		CoAP_SetMulticastGroupEstimate(0, 0);
+		CoapTest::TearDown();
+	}
+
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		CoAP_SetPayload(pResp, (uint8_t*) "hello", 5, true);
+		return HANDLER_OK;
+	}
+
+	static size_t CountContent() {
+		size_t cnt = 0;
+		for (size_t i = 0; i < Sent.size(); i++) {
+			ParsedMsg msg(Sent[i]);
+			if (msg->Code == RESP_SUCCESS_CONTENT_2_05) {
+				cnt++;
+			}
+		}
+		return cnt;
+	}
+
+	// Multicast request from ep, answered after a leisure period of "leisure" seconds
+	void McRequest(const NetEp_t& ep, CoAP_Token_t token, int leisure) {
+		RandValue = leisure;
+		Receive(ep, Msg(NON, REQ_GET, 0x100, token, "mc"), META_INFO_MULTICAST);
+		Work(4);
+		RandValue = -1;
+	}
+};
+
+TEST_F(MulticastTest, ResponseAfterExactLeisure) {
+	McRequest(Ep(1), Token(1), 3);
+	EXPECT_EQ(0u, CountContent());
+	Advance(2);
+	EXPECT_EQ(0u, CountContent()) << "sent before the leisure period is over";
+	Advance(1);
+	EXPECT_EQ(1u, CountContent());
+}
+
+TEST_F(MulticastTest, LargeGroupEstimateIsBounded) {
+	CoAP_SetMulticastGroupEstimate(0xffffffffu, 1);
+	McRequest(Ep(1), Token(1), 1000);
+	Advance(CLIENT_MAX_RESP_WAIT_TIME + 1);
+	EXPECT_EQ(1u, CountContent());
+}
+
+TEST_F(MulticastTest, MaximumLeisureDoesNotOverflow) {
+	// find the size of the response to choose an estimate of exactly 0xffffffff seconds
+	Receive(Ep(1), Msg(NON, REQ_GET, 0x100, Token(1), "mc"));
+	Work(4);
+	ASSERT_EQ(1u, Sent.size());
+	CoAP_SetMulticastGroupEstimate(0xffffffffu, (uint32_t) Sent[0].Data.size());
+	Sent.clear();
+	Advance(1);
+
+	McRequest(Ep(1), Token(2), 7);
+	Advance(7);
+	EXPECT_EQ(1u, CountContent());
+}
+
+TEST_F(MulticastTest, SuppressedByOverheardEquivalentResponse) {
+	McRequest(Ep(1), Token(1), 3);
+	Receive(Ep(2), Msg(NON, RESP_SUCCESS_CONTENT_2_05, 0x200, Token(1), NULL, "hello")); // other group member
+	Advance(5);
+	EXPECT_EQ(0u, CountContent());
+}
+
+TEST_F(MulticastTest, NotSuppressedByDifferentResponse) {
+	McRequest(Ep(1), Token(1), 3);
+	Receive(Ep(2), Msg(NON, RESP_SUCCESS_CONTENT_2_05, 0x200, Token(1), NULL, "other"));
+	Advance(5);
+	EXPECT_EQ(1u, CountContent());
+}
+
+TEST_F(MulticastTest, NotSuppressedByResponseFromRequester) {
+	McRequest(Ep(1), Token(1), 3);
+	Receive(Ep(1), Msg(NON, RESP_SUCCESS_CONTENT_2_05, 0x200, Token(1), NULL, "hello"));
+	Advance(5);
+	EXPECT_EQ(1u, CountContent());
+}
+
+TEST_F(MulticastTest, NotSuppressedWithoutToken) {
+	CoAP_Token_t noToken;
+	memset(&noToken, 0, sizeof(noToken));
+	McRequest(Ep(1), noToken, 3);
+	Receive(Ep(2), Msg(NON, RESP_SUCCESS_CONTENT_2_05, 0x200, noToken, NULL, "hello"));
+	Advance(5);
+	EXPECT_EQ(1u, CountContent());
+}
@@ -0,0 +1,692 @@
+#include "coap_test.h"
+
+// Server side observe (RFC7641): registration, fan-out and notifications of resource "obs"
+class ObserveTest : public CoapTest {
+protected:
+	static std::string Value;
+	static int NotifierCalls;
+	CoAP_Res_t* pRes;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Value = "v0";
+		NotifierCalls = 0;
+		pRes = CreateResource("obs", Opts(RES_OPT_GET), Handler, Notifier);
+	}
+
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		CoAP_SetPayload(pResp, (uint8_t*) Value.data(), Value.size(), true);
+		return HANDLER_OK;
+	}
+
+	static CoAP_HandlerResult_t Notifier(CoAP_Observer_t* pObserver, CoAP_Message_t* pResp) {
+		(void) pObserver;
+		NotifierCalls++;
+		CoAP_SetPayload(pResp, (uint8_t*) Value.data(), Value.size(), true);
+		return HANDLER_OK;
+	}
+
+	// Observer n is at 10.0.0.1:(1000 + n) with token n
+	static NetEp_t ObserverEp(uint16_t n) {
+		return Ep(1, (uint16_t) (1000 + n));
+	}
+
+	// Registers (observe = 0) or deregisters (observe = 1) observer n and drops the response
+	void Register(uint16_t n, const char* uri = "obs", uint32_t observe = 0, uint8_t token = 0) {
+		static uint16_t mid = 0x600;
+		CoAP_Message_t* pReq = Msg(CON, REQ_GET, mid++, Token(token != 0 ? token : (uint8_t) n), uri);
+		AddUintOption(pReq, OPT_NUM_OBSERVE, observe);
+		Receive(ObserverEp(n), pReq);
+		Work(4);
+		Sent.clear();
+	}
+
+	size_t CountObservers() const {
+		size_t cnt = 0;
+		for (CoAP_Observer_t* pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) {
+			cnt++;
+		}
+		return cnt;
+	}
+
+	void Update(const char* value) {
+		Value = value;
+		EXPECT_EQ(COAP_OK, CoAP_NotifyResourceObservers(pRes));
+	}
+
+	// Acknowledges all CON messages sent so far
+	static void AckSent() {
+		std::vector<TxDatagram> sent(Sent);
+		for (size_t i = 0; i < sent.size(); i++) {
+			ParsedMsg msg(sent[i]);
+			if (msg->Type == CON) {
+				CoAP_Token_t noToken = { 0 };
+				Receive(sent[i].Ep, Msg(ACK, EMPTY, msg->MessageID, noToken));
+			}
+		}
+	}
+
+	// Number of notifications sent per observer port
+	static std::map<uint16_t, int> NotificationsPerObserver() {
+		std::map<uint16_t, int> cnt;
+		for (size_t i = 0; i < Sent.size(); i++) {
+			ParsedMsg msg(Sent[i]);
+			if (msg->Code == RESP_SUCCESS_CONTENT_2_05 && msg.Option(OPT_NUM_OBSERVE) != NULL) {
+				cnt[Sent[i].Ep.NetPort]++;
+			}
+		}
+		return cnt;
+	}
+};
+
+std::string ObserveTest::Value;
+int ObserveTest::NotifierCalls;
+
+TEST_F(ObserveTest, FanOutBeyondBudgetReachesAllObservers) {
+	const uint16_t observers = NOTIFY_FANOUT_BUDGET * 2 + 5;
+	for (uint16_t n = 0; n < observers; n++) {
+		Register(n);
+	}
+	Update("v1");
+	Work(observers * 2);
+
+	std::map<uint16_t, int> cnt = NotificationsPerObserver();
+	ASSERT_EQ(observers, cnt.size());
+	for (std::map<uint16_t, int>::iterator it = cnt.begin(); it != cnt.end(); ++it) {
+		EXPECT_EQ(1, it->second) << "port " << it->first;
+	}
+	ParsedMsg last(Sent.back());
+	EXPECT_EQ("v1", last.Payload());
+}
+
+TEST_F(ObserveTest, FanOutIsResumedAfterOutOfMemory) {
+	const uint16_t observers = 5;
+	for (uint16_t n = 0; n < observers; n++) {
+		Register(n);
+	}
+	MallocFails = true;
+	Update("v1");
+	Work(2);
+	EXPECT_EQ(0u, Sent.size());
+	MallocFails = false;
+	Work(observers * 2);
+
+	EXPECT_EQ(observers, NotificationsPerObserver().size());
+}
+
+TEST_F(ObserveTest, PendingNotificationIsUpdatedInPlace) {
+	Register(0);
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size()); // not acknowledged
+	size_t interactions = CountInteractions();
+
+	Update("v2");
+	EXPECT_EQ(interactions, CountInteractions());
+	Advance(10); // retransmission
+	ASSERT_LE(2u, Sent.size());
+	ParsedMsg retry(Sent.back());
+	EXPECT_EQ("v2", retry.Payload());
+}
+
+TEST_F(ObserveTest, AcknowledgedNotificationEndsInteraction) {
+	Register(0);
+	size_t interactions = CountInteractions();
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	AckSent();
+	Work(2);
+	EXPECT_EQ(interactions, CountInteractions());
+}
+
+TEST_F(ObserveTest, SharedNotificationCallsNotifierOncePerUpdate) {
+	const uint16_t observers = 10;
+	pRes->Options.Flags |= RES_FLAG_SHARED_NOTIFICATION;
+	for (uint16_t n = 0; n < observers; n++) {
+		Register(n);
+	}
+	Update("v1");
+	Work(observers * 2);
+
+	EXPECT_EQ(1, NotifierCalls);
+	ASSERT_EQ(observers, Sent.size());
+	std::map<uint16_t, int> mids;
+	for (size_t i = 0; i < Sent.size(); i++) {
+		ParsedMsg msg(Sent[i]);
+		uint16_t n = (uint16_t) (Sent[i].Ep.NetPort - 1000);
+		EXPECT_EQ(Token((uint8_t) n).Token[1], msg->Token.Token[1]);
+		EXPECT_EQ("v1", msg.Payload());
+		EXPECT_EQ(pRes->UpdateCnt, msg.UintOption(OPT_NUM_OBSERVE));
+		mids[msg->MessageID]++;
+	}
+	EXPECT_EQ(observers, mids.size());
+}
+
+TEST_F(ObserveTest, SharedNotificationIsReleasedWithItsLastUser) {
+	pRes->Options.Flags |= RES_FLAG_SHARED_NOTIFICATION;
+	Register(0);
+	Register(1);
+	Update("v1");
+	Work(4);
+	AckSent();
+	Work(4);
+	long allocations = Allocations;
+
+	Update("v2"); // replaces the shared notification of v1
+	Work(4);
+	AckSent();
+	Work(4);
+	EXPECT_EQ(allocations, Allocations);
+	EXPECT_EQ(2, NotifierCalls);
+}
+
+TEST_F(ObserveTest, ReregistrationRefreshesObserverInPlace) {
+	NetEp_t ep = ObserverEp(0);
+	Register(0);
+	CoAP_Observer_t* pObserver = CoAP_FindObserver(pRes, Sock(), &ep);
+	ASSERT_NE(nullptr, pObserver);
+	Register(0, "obs", 0, 0x77); // same endpoint, new token
+	EXPECT_EQ(1u, CountObservers());
+	EXPECT_EQ(pObserver, CoAP_FindObserver(pRes, Sock(), &ep));
+
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg msg(Sent[0]);
+	EXPECT_EQ(0x77, msg->Token.Token[1]);
+}
+
+TEST_F(ObserveTest, DeregistrationRemovesObserver) {
+	Register(0);
+	Register(1);
+	Register(0, "obs", 1);
+	EXPECT_EQ(1u, CountObservers());
+
+	Update("v1");
+	Work(4);
+	std::map<uint16_t, int> cnt = NotificationsPerObserver();
+	EXPECT_EQ(0u, cnt.count(ObserverEp(0).NetPort));
+	EXPECT_EQ(1u, cnt.count(ObserverEp(1).NetPort));
+}
+
+TEST_F(ObserveTest, DeregistrationWithOtherTokenIsIgnored) {
+	Register(0);
+	Register(0, "obs", 1, 0x77);
+	EXPECT_EQ(1u, CountObservers());
+}
+
+TEST_F(ObserveTest, ResetCancelsObservation) {
+	Register(0);
+	Register(1);
+	Update("v1");
+	Work(4);
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg msg(Sent[0]);
+	CoAP_Token_t noToken = { 0 };
+	Receive(Sent[0].Ep, Msg(RST, EMPTY, msg->MessageID, noToken));
+	Work(4);
+	EXPECT_EQ(1u, CountObservers());
+	EXPECT_EQ(nullptr, CoAP_FindObserver(pRes, Sock(), &Sent[0].Ep));
+}
+
+TEST_F(ObserveTest, PmaxKeepaliveHasNewSequenceNumber) {
+	Register(0, "obs?pmax=5");
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	uint32_t seq = ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE);
+	AckSent();
+	Sent.clear();
+
+	Advance(7);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg keepalive(Sent[0]);
+	EXPECT_EQ("v1", keepalive.Payload());
+	EXPECT_LT(seq, keepalive.UintOption(OPT_NUM_OBSERVE));
+}
+
+TEST_F(ObserveTest, SharedPmaxKeepaliveHasNewSequenceNumber) {
+	pRes->Options.Flags |= RES_FLAG_SHARED_NOTIFICATION;
+	Register(0, "obs?pmax=5");
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	uint32_t seq = ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE);
+	AckSent();
+	Sent.clear();
+
+	Advance(7);
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_LT(seq, ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE));
+}
+
+TEST_F(ObserveTest, DueKeepalivesShareOneUpdate) {
+	const uint16_t observers = NOTIFY_FANOUT_BUDGET * 2 + 5;
+	pRes->Options.Flags |= RES_FLAG_SHARED_NOTIFICATION;
+	for (uint16_t n = 0; n < observers; n++) {
+		Register(n, "obs?pmax=5");
+	}
+	Update("v1");
+	Work(observers * 2);
+	AckSent();
+	Work(observers * 2);
+	ASSERT_EQ(0u, CountInteractions());
+	Sent.clear();
+	NotifierCalls = 0;
+
+	Advance(6, 0);
+	Work(1);
+	EXPECT_EQ(NOTIFY_FANOUT_BUDGET, CountInteractions()) << "keepalives are started within the fan-out budget";
+	Work(observers * 2);
+
+	EXPECT_EQ(1, NotifierCalls);
+	std::map<uint16_t, int> cnt = NotificationsPerObserver();
+	ASSERT_EQ(observers, cnt.size());
+	for (std::map<uint16_t, int>::iterator it = cnt.begin(); it != cnt.end(); ++it) {
+		EXPECT_EQ(1, it->second) << "port " << it->first;
+	}
+	uint32_t seq = ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE);
+	for (size_t i = 1; i < Sent.size(); i++) {
+		EXPECT_EQ(seq, ParsedMsg(Sent[i]).UintOption(OPT_NUM_OBSERVE));
+	}
+}
+
+TEST_F(ObserveTest, HeldBackUpdateHasNewSequenceNumber) {
+	Register(0, "obs?pmin=5");
+	Register(1);
+	Update("v1"); // observer 0 is within pmin of its registration
+	Work(4);
+	std::map<uint16_t, int> cnt = NotificationsPerObserver();
+	EXPECT_EQ(0u, cnt.count(ObserverEp(0).NetPort));
+	ASSERT_EQ(1u, Sent.size());
+	uint32_t seq = ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE);
+	AckSent();
+	Sent.clear();
+
+	Advance(7);
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(ObserverEp(0).NetPort, Sent[0].Ep.NetPort);
+	EXPECT_LT(seq, ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE));
+}
+
+TEST_F(ObserveTest, NegativePeriodsAreRejected) {
+	Register(0, "obs?pmin=-1&pmax=-5");
+	CoAP_Observer_t* pObserver = pRes->pListObservers;
+	ASSERT_NE(nullptr, pObserver);
+	EXPECT_EQ(0, pObserver->AttrFlags & (OBS_ATTR_PMIN | OBS_ATTR_PMAX));
+
+	Update("v1"); // not held back
+	Work(2);
+	EXPECT_EQ(1u, Sent.size());
+}
+
+TEST_F(ObserveTest, UnchangedOutputIsNotNotified) {
+	pRes->Options.Flags |= RES_FLAG_SKIP_UNCHANGED;
+	Register(0);
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	AckSent();
+	Sent.clear();
+	uint32_t updateCnt = pRes->UpdateCnt;
+
+	Update("v1");
+	Work(2);
+	EXPECT_EQ(0u, Sent.size());
+	EXPECT_EQ(updateCnt, pRes->UpdateCnt);
+
+	Update("v2");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ("v2", ParsedMsg(Sent[0]).Payload());
+}
+
+TEST_F(ObserveTest, UnchangedOutputIsNotifiedAfterMaxAge) {
+	pRes->Options.Flags |= RES_FLAG_SKIP_UNCHANGED | RES_FLAG_UNCHANGED_KEEPALIVE;
+	Register(0);
+	Update("v1");
+	Work(2);
+	AckSent();
+	Sent.clear();
+
+	Now += DEFAULT_MAX_AGE - 1;
+	Update("v1");
+	Work(2);
+	EXPECT_EQ(0u, Sent.size());
+
+	Now += 2;
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ("v1", ParsedMsg(Sent[0]).Payload());
+}
+
+TEST_F(ObserveTest, UnchangedOutputWithoutKeepaliveStaysSuppressed) {
+	pRes->Options.Flags |= RES_FLAG_SKIP_UNCHANGED;
+	Register(0);
+	Update("v1");
+	Work(2);
+	AckSent();
+	Sent.clear();
+
+	Now += DEFAULT_MAX_AGE + 1;
+	Update("v1");
+	Work(2);
+	EXPECT_EQ(0u, Sent.size());
+}
+
+// State snapshot (CoAP_SnapshotState / CoAP_RestoreState) across a simulated warm restart
+class SnapshotTest : public ObserveTest {
+protected:
+	std::vector<uint8_t> Image;
+
+	void Snapshot() {
+		uint32_t len = 0;
+		ASSERT_EQ(COAP_OK, CoAP_SnapshotState(NULL, 0, &len));
+		Image.resize(len);
+		ASSERT_EQ(COAP_OK, CoAP_SnapshotState(Image.data(), (uint32_t) Image.size(), &len));
+		ASSERT_EQ(Image.size(), len);
+	}
+
+	// Drops interactions, observers and sequence numbers as a restart would
+	void Reboot() {
+		CoAP_ClearPendingInteractions();
+		while (pRes->pListObservers != NULL) {
+			CoAP_DetachObserver(pRes->pListObservers, true);
+		}
+		pRes->UpdateCnt = 0;
+		Sent.clear();
+	}
+};
+
+TEST_F(SnapshotTest, RestoresObserversAndSequenceNumbers) {
+	Register(0);
+	Register(1);
+	Update("v1");
+	Work(4);
+	AckSent();
+	Work(4);
+	uint32_t seq = ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE);
+	Snapshot();
+	Reboot();
+
+	ASSERT_EQ(COAP_OK, CoAP_RestoreState(Image.data(), (uint32_t) Image.size()));
+	EXPECT_EQ(2u, CountObservers());
+	Update("v2");
+	Work(4);
+	std::map<uint16_t, int> cnt = NotificationsPerObserver();
+	EXPECT_EQ(2u, cnt.size());
+	ASSERT_FALSE(Sent.empty());
+	EXPECT_LT(seq, ParsedMsg(Sent[0]).UintOption(OPT_NUM_OBSERVE));
+}
+
+TEST_F(SnapshotTest, PendingNotificationIsRetransmittedAfterRestore) {
+	Register(0);
+	Update("v1");
+	Work(2);
+	ASSERT_EQ(1u, Sent.size());
+	uint16_t mid = ParsedMsg(Sent[0])->MessageID;
+	Snapshot();
+	Reboot();
+
+	ASSERT_EQ(COAP_OK, CoAP_RestoreState(Image.data(), (uint32_t) Image.size()));
+	ASSERT_NE(nullptr, pRes->pListObservers);
+	EXPECT_NE(nullptr, pRes->pListObservers->pPendingIA);
+	Advance(10);
+	ASSERT_FALSE(Sent.empty());
+	ParsedMsg retry(Sent[0]);
+	EXPECT_EQ(mid, retry->MessageID);
+	EXPECT_EQ("v1", retry.Payload());
+}
+
+TEST_F(SnapshotTest, DamagedSnapshotIsRejected) {
+	Register(0);
+	Snapshot();
+	Reboot();
+	Image[Image.size() / 2] ^= 0x01;
+
+	EXPECT_EQ(COAP_ERR_ARGUMENT, CoAP_RestoreState(Image.data(), (uint32_t) Image.size()));
+	EXPECT_EQ(0u, CountObservers());
+}
+
+TEST_F(SnapshotTest, TooSmallBufferIsReported) {
+	Register(0);
+	uint32_t len = 0;
+	ASSERT_EQ(COAP_OK, CoAP_SnapshotState(NULL, 0, &len));
+	std::vector<uint8_t> buf(len - 1);
+	EXPECT_EQ(COAP_ERR_OUT_OF_MEMORY, CoAP_SnapshotState(buf.data(), (uint32_t) buf.size(), &len));
+}
+
+// Observer log (CoAP_SetObserverLog) on two in-memory regions
+class ObserverLogTest : public ObserveTest {
+protected:
+	static std::vector<uint8_t> Regions[2];
+	static size_t Capacity; // [byte] per region
+	static int FailRegion; // appends to this region fail once it holds FailAfter bytes (power loss)
+	static size_t FailAfter;
+	static int CorruptRegion; // the byte at offset 12 of this region is written with a flipped bit
+	static int Erases;
+	static const CoAP_ObserverLogBackend_t Backend;
+
+	virtual void SetUp() {
+		ObserveTest::SetUp();
+		Regions[0].clear();
+		Regions[1].clear();
+		Capacity = 4096;
+		FailRegion = -1;
+		CorruptRegion = -1;
+		Erases = 0;
+		EXPECT_EQ(COAP_OK, CoAP_SetObserverLog(&Backend));
+	}
+
+	virtual void TearDown() {
+		CoAP_SetObserverLog(NULL);
+		ObserveTest::TearDown();
+	}
+
+	static bool Append(uint8_t region, const uint8_t* pData, uint32_t len, void* pCtx) {
+		(void) pCtx;
+		for (uint32_t i = 0; i < len; i++) {
+			std::vector<uint8_t>& r = Regions[region];
+			if (r.size() >= Capacity || (region == FailRegion && r.size() >= FailAfter)) {
+				return false;
+			}
+			r.push_back(region == CorruptRegion && r.size() == 12 ? (uint8_t) (pData[i] ^ 0x01) : pData[i]);
+		}
+		return true;
+	}
+
+	static uint32_t Read(uint8_t region, uint32_t offset, uint8_t* pData, uint32_t len, void* pCtx) {
+		(void) pCtx;
+		const std::vector<uint8_t>& r = Regions[region];
+		if (offset >= r.size()) {
+			return 0;
+		}
+		uint32_t n = (uint32_t) std::min<size_t>(len, r.size() - offset);
+		memcpy(pData, &r[offset], n);
+		return n;
+	}
+
+	static bool Erase(uint8_t region, void* pCtx) {
+		(void) pCtx;
+		Regions[region].clear();
+		Erases++;
+		return true;
+	}
+
+	// Reboot: the observers are dropped without logging and restored from the log
+	void Restart() {
+		CoAP_SetObserverLog(NULL);
+		while (pRes->pListObservers != NULL) {
+			CoAP_DetachObserver(pRes->pListObservers, true);
+		}
+		FailRegion = -1;
+		CorruptRegion = -1;
+		EXPECT_EQ(COAP_OK, CoAP_SetObserverLog(&Backend));
+	}
+
+	// Registers and deregisters observer 99 until the active region has been full once
+	void Churn() {
+		for (int i = 0; i < 40; i++) {
+			Register(99);
+			Register(99, "obs", 1);
+		}
+	}
+
+	std::set<uint16_t> ObserverPorts() const {
+		std::set<uint16_t> ports;
+		for (CoAP_Observer_t* pObserver = pRes->pListObservers; pObserver != NULL; pObserver = pObserver->next) {
+			ports.insert(pObserver->Ep.NetPort);
+		}
+		return ports;
+	}
+
+	static std::set<uint16_t> Ports(uint16_t a, uint16_t b, uint16_t c) {
+		std::set<uint16_t> ports;
+		ports.insert(ObserverEp(a).NetPort);
+		ports.insert(ObserverEp(b).NetPort);
+		ports.insert(ObserverEp(c).NetPort);
+		return ports;
+	}
+};
+
+std::vector<uint8_t> ObserverLogTest::Regions[2];
+size_t ObserverLogTest::Capacity;
+int ObserverLogTest::FailRegion;
+size_t ObserverLogTest::FailAfter;
+int ObserverLogTest::CorruptRegion;
+int ObserverLogTest::Erases;
+const CoAP_ObserverLogBackend_t ObserverLogTest::Backend = { Append, Read, Erase, NULL };
+
+TEST_F(ObserverLogTest, RestoresObserversAfterRestart) {
+	Register(0);
+	Register(1);
+	Register(2);
+	Register(3);
+	Register(1, "obs", 1);
+	Restart();
+	EXPECT_EQ(Ports(0, 2, 3), ObserverPorts());
+}
+
+TEST_F(ObserverLogTest, FullRegionIsCompactedIntoTheOtherOne) {
+	Capacity = 1024;
+	Register(0);
+	Register(1);
+	Register(2);
+	ASSERT_FALSE(Regions[0].empty());
+	ASSERT_TRUE(Regions[1].empty());
+	Churn();
+	EXPECT_TRUE(Regions[0].empty() != Regions[1].empty());
+
+	Restart();
+	EXPECT_EQ(Ports(0, 1, 2), ObserverPorts());
+}
+
+TEST_F(ObserverLogTest, PowerLossDuringCompactionKeepsOldLog) {
+	Capacity = 1024;
+	Register(0);
+	Register(1);
+	Register(2);
+	FailRegion = 1;
+	FailAfter = 40; // within the first record of the new image
+	Churn();
+	EXPECT_FALSE(Regions[0].empty());
+	EXPECT_FALSE(Regions[1].empty()); // compaction was attempted
+
+	Restart();
+	EXPECT_EQ(Ports(0, 1, 2), ObserverPorts());
+}
+
+TEST_F(ObserverLogTest, CorruptImageIsNotSwappedIn) {
+	Capacity = 1024;
+	Register(0);
+	Register(1);
+	Register(2);
+	CorruptRegion = 1;
+	Churn();
+	EXPECT_FALSE(Regions[0].empty());
+	EXPECT_FALSE(Regions[1].empty()); // compaction was attempted
+
+	Restart();
+	EXPECT_EQ(Ports(0, 1, 2), ObserverPorts());
+}
+
+TEST_F(ObserverLogTest, FullLogIsReportedAndNotRewrittenOnEveryChange) {
+	Capacity = 400;
+	uint16_t n = 0;
+	while (CoAP_GetObserverLogStatus() == COAP_OK) {
+		ASSERT_LT(n, 100) << "log never got full";
+		Register(n++);
+	}
+	uint8_t committed = Regions[0].empty() ? 1 : 0;
+	std::vector<uint8_t> kept = Regions[committed];
+	int erases = Erases;
+
+	for (uint16_t i = 0; i < 5; i++) {
+		Register(n++);
+	}
+	EXPECT_EQ(erases, Erases) << "no compaction until observers are removed";
+	EXPECT_EQ(kept, Regions[committed]) << "last complete log is kept";
+	EXPECT_EQ(COAP_ERR_OUT_OF_MEMORY, CoAP_GetObserverLogStatus());
+
+	// the overflowing image was not committed, so the restart gets the last complete log
+	Restart();
+	EXPECT_EQ(COAP_OK, CoAP_GetObserverLogStatus()) << "fewer observers restored than registered";
+	EXPECT_GT(n, ObserverPorts().size());
+}
+
+TEST_F(ObserverLogTest, RemovedObserversLetFullLogBeCompactedAgain) {
+	Capacity = 400;
+	uint16_t n = 0;
+	while (CoAP_GetObserverLogStatus() == COAP_OK) {
+		ASSERT_LT(n, 100) << "log never got full";
+		Register(n++);
+	}
+	for (uint16_t i = 0; i < n / 2; i++) {
+		Register(i, "obs", 1);
+	}
+	Register(n++); // compacted, now it fits
+	EXPECT_EQ(COAP_OK, CoAP_GetObserverLogStatus());
+
+	std::set<uint16_t> ports = ObserverPorts();
+	Restart();
+	EXPECT_EQ(ports, ObserverPorts());
+}
+
+TEST_F(ObserverLogTest, NewerImageWinsIfOldOneWasNotErased) {
+	Capacity = 1024;
+	Register(0);
+	Register(1);
+	Register(2);
+	std::vector<uint8_t> old = Regions[0];
+	Churn(); // compacted into region 1, region 0 erased
+	ASSERT_TRUE(Regions[0].empty());
+	Regions[0] = old; // power loss before the erasure
+	Register(1, "obs", 1);
+	Register(3);
+
+	Restart();
+	EXPECT_EQ(Ports(0, 2, 3), ObserverPorts());
+}
+
+static std::vector<uint8_t> NvPage;
+
+static bool NvWrite(uint8_t* data, uint32_t len) {
+	NvPage.assign(data, data + len);
+	return true;
+}
+
+TEST_F(ObserveTest, ObserversAreRestoredFromNvPage) {
+	Register(0);
+	Register(1);
+	ASSERT_EQ(COAP_OK, CoAP_NVsaveObservers(NvWrite));
+	while (pRes->pListObservers != NULL) {
+		CoAP_DetachObserver(pRes->pListObservers, true);
+	}
+
+	std::vector<uint8_t> page(NvPage); // exactly the saved bytes
+	EXPECT_EQ(COAP_OK, CoAP_NVloadObservers(page.data(), (uint32_t) page.size()));
+	EXPECT_EQ(2u, CountObservers());
+}
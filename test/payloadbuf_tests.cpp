@@ -0,0 +1,191 @@
+#include "coap_test.h"
+
+// Reference counted payload buffers shared by messages and caches
+class PayloadBufTest : public CoapTest {
+protected:
+	static std::string Value;
+	static int HandlerCalls;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Value = "v0";
+		HandlerCalls = 0;
+	}
+
+	// Answers with Value and a Max-Age of 10 s, blockwise if it is larger than 32 bytes
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		HandlerCalls++;
+		CoAP_AppendUintOptionToList(&(pResp->pOptionsList), OPT_NUM_MAX_AGE, 10);
+		if (Value.size() > 32) {
+			CoAP_SetPayload_CheckBlockOpt(pReq, pResp, (uint8_t*) Value.data(), Value.size(), true);
+		} else {
+			CoAP_SetPayload(pResp, (uint8_t*) Value.data(), Value.size(), true);
+		}
+		return HANDLER_OK;
+	}
+
+	static CoAP_HandlerResult_t Notifier(CoAP_Observer_t* pObserver, CoAP_Message_t* pResp) {
+		(void) pObserver;
+		CoAP_SetPayload(pResp, (uint8_t*) Value.data(), Value.size(), true);
+		return HANDLER_OK;
+	}
+
+	static CoAP_Message_t* Message(const char* payload) {
+		CoAP_Message_t* pMsg = CoAP_CreateMessage(NON, RESP_SUCCESS_CONTENT_2_05, 0x600, NULL, 0, 0, Token(1));
+		EXPECT_EQ(COAP_OK, CoAP_SetPayload(pMsg, (uint8_t*) payload, strlen(payload), true));
+		return pMsg;
+	}
+
+	static void Get(const char* uri, uint8_t client = 1, bool observe = false, int block = -1) {
+		static uint16_t mid = 0x600;
+		CoAP_Message_t* pReq = Msg(CON, REQ_GET, mid++, Token(client), uri);
+		if (observe) {
+			AddUintOption(pReq, OPT_NUM_OBSERVE, 0);
+		}
+		if (block >= 0) {
+			AddBlockOption(pReq, OPT_NUM_BLOCK2, (uint32_t) block, false, 32);
+		}
+		Receive(Ep(client), pReq);
+		Work(); // answered, the interaction still holds the response
+	}
+
+	// Payload buffers referenced by the responses of pending interactions
+	static std::set<CoAP_PayloadBuf_t*> ResponseBuffers() {
+		std::set<CoAP_PayloadBuf_t*> bufs;
+		for (CoAP_Interaction_t* pIA = CoAP.pInteractions; pIA != NULL; pIA = pIA->next) {
+			if (pIA->pRespMsg != NULL && pIA->pRespMsg->pPayloadBuf != NULL) {
+				bufs.insert(pIA->pRespMsg->pPayloadBuf);
+			}
+		}
+		return bufs;
+	}
+};
+
+std::string PayloadBufTest::Value;
+int PayloadBufTest::HandlerCalls;
+
+TEST_F(PayloadBufTest, BufferIsFreedByLastUser) {
+	long before = Allocations;
+	CoAP_Message_t* pFirst = Message("shared");
+	CoAP_PayloadBuf_t* pBuf = CoAP_SharePayload(pFirst);
+	ASSERT_NE(nullptr, pBuf);
+	EXPECT_EQ(2u, pBuf->RefCnt);
+
+	CoAP_Message_t* pSecond = CoAP_CreateMessage(NON, RESP_SUCCESS_CONTENT_2_05, 0x601, NULL, 0, 0, Token(2));
+	CoAP_SetSharedPayload(pSecond, pBuf, pFirst->Payload, pFirst->PayloadLength);
+	CoAP_ReleasePayloadBuf(&pBuf);
+	EXPECT_EQ(nullptr, pBuf);
+	EXPECT_EQ(2u, pSecond->pPayloadBuf->RefCnt);
+	EXPECT_EQ(pFirst->Payload, pSecond->Payload);
+
+	CoAP_free_Message(&pFirst);
+	EXPECT_EQ(1u, pSecond->pPayloadBuf->RefCnt);
+	EXPECT_EQ(COAP_OK, CoAP_SendMsg(pSecond, Sock(), Ep(1)));
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ("shared", ParsedMsg(Sent[0]).Payload());
+	CoAP_free_Message(&pSecond);
+	EXPECT_EQ(before, Allocations);
+}
+
+TEST_F(PayloadBufTest, SharedPayloadIsReadOnly) {
+	CoAP_Message_t* pMsg = Message("old");
+	CoAP_PayloadBuf_t* pBuf = CoAP_SharePayload(pMsg);
+	ASSERT_NE(nullptr, pBuf);
+	EXPECT_FALSE(CoAP_PayloadIsWritable(pMsg, 1));
+
+	// the message gets a fresh buffer, the shared one is left alone
+	ASSERT_EQ(COAP_OK, CoAP_SetPayload(pMsg, (uint8_t*) "new", 3, true));
+	EXPECT_NE(pBuf, pMsg->pPayloadBuf);
+	EXPECT_EQ(1u, pBuf->RefCnt);
+	EXPECT_EQ(0, memcmp(PAYLOAD_BUF_DATA(pBuf), "old", 3));
+	EXPECT_EQ(0, memcmp(pMsg->Payload, "new", 3));
+	EXPECT_TRUE(CoAP_PayloadIsWritable(pMsg, 3));
+	CoAP_ReleasePayloadBuf(&pBuf);
+	CoAP_free_Message(&pMsg);
+}
+
+TEST_F(PayloadBufTest, ForeignPayloadIsNotShared) {
+	static const char payload[] = "static";
+	CoAP_Message_t* pMsg = CoAP_CreateMessage(NON, RESP_SUCCESS_CONTENT_2_05, 0x602, NULL, 0, 0, Token(1));
+	ASSERT_EQ(COAP_OK, CoAP_SetPayload(pMsg, (uint8_t*) payload, strlen(payload), false));
+	EXPECT_EQ(nullptr, CoAP_SharePayload(pMsg));
+	EXPECT_FALSE(CoAP_PayloadIsWritable(pMsg, 1));
+
+	long before = Allocations;
+	CoAP_free_Message(&pMsg);
+	EXPECT_EQ(before - 1, Allocations); // the message only, the payload belongs to the application
+}
+
+TEST_F(PayloadBufTest, NotificationsShareOneBuffer) {
+	CoAP_Res_t* pRes = CreateResource("pb", Opts(RES_OPT_GET, RES_FLAG_SHARED_NOTIFICATION), Handler, Notifier);
+	for (uint8_t n = 1; n <= 3; n++) {
+		Get("pb", n, true);
+		Work(4);
+	}
+	CoAP_ClearPendingInteractions();
+	Sent.clear();
+
+	Value = "v1";
+	EXPECT_EQ(COAP_OK, CoAP_NotifyResourceObservers(pRes));
+	Work(8);
+	ASSERT_EQ(3u, Sent.size());
+	for (size_t i = 0; i < Sent.size(); i++) {
+		EXPECT_EQ("v1", ParsedMsg(Sent[i]).Payload());
+	}
+	std::set<CoAP_PayloadBuf_t*> bufs = ResponseBuffers();
+	ASSERT_EQ(1u, bufs.size());
+	EXPECT_LE(3u, (*bufs.begin())->RefCnt);
+}
+
+TEST_F(PayloadBufTest, CachedResponseOutlivesItsMessage) {
+	CoAP_Res_t* pRes = CreateResource("pb", Opts(RES_OPT_GET, RES_FLAG_RESPONSE_CACHE), Handler);
+	long before = Allocations;
+	Get("pb", 1);
+	ASSERT_EQ(1u, Sent.size());
+	std::set<CoAP_PayloadBuf_t*> bufs = ResponseBuffers();
+	ASSERT_EQ(1u, bufs.size());
+	CoAP_PayloadBuf_t* pBuf = *bufs.begin();
+	EXPECT_EQ(2u, pBuf->RefCnt); // response and cache, not copied
+
+	CoAP_ClearPendingInteractions();
+	EXPECT_EQ(1u, pBuf->RefCnt);
+	Value = "v1";
+	Get("pb", 2);
+	ASSERT_EQ(2u, Sent.size());
+	EXPECT_EQ("v0", ParsedMsg(Sent[1]).Payload());
+	EXPECT_EQ(1, HandlerCalls);
+	bufs = ResponseBuffers();
+	ASSERT_EQ(1u, bufs.size());
+	EXPECT_EQ(pBuf, *bufs.begin());
+
+	CoAP_ClearPendingInteractions();
+	CoAP_InvalidateResponseCache(pRes);
+	EXPECT_EQ(before, Allocations);
+}
+
+TEST_F(PayloadBufTest, Block2SnapshotOutlivesItsEntry) {
+	CreateResource("pb", Opts(RES_OPT_GET, RES_FLAG_BLOCK2_CACHE), Handler);
+	Value = std::string(40, 's');
+	long before = Allocations;
+	Get("pb", 1, false, 0);
+	CoAP_ClearPendingInteractions();
+	EXPECT_LT(before, Allocations);
+
+	// the last block releases the entry, its response keeps the snapshot
+	Get("pb", 1, false, 1);
+	ASSERT_EQ(2u, Sent.size());
+	EXPECT_EQ(std::string(8, 's'), ParsedMsg(Sent[1]).Payload());
+	CoAP_Interaction_t* pIA = CoAP.pInteractions;
+	ASSERT_NE(nullptr, pIA);
+	ASSERT_NE(nullptr, pIA->pRespMsg->pPayloadBuf);
+	EXPECT_EQ(1u, pIA->pRespMsg->pPayloadBuf->RefCnt);
+
+	Value = std::string(40, 'n');
+	EXPECT_EQ(COAP_OK, CoAP_SendMsg(pIA->pRespMsg, pIA->socketHandle, pIA->RemoteEp)); // sent again
+	ASSERT_EQ(3u, Sent.size());
+	EXPECT_EQ(std::string(8, 's'), ParsedMsg(Sent[2]).Payload());
+	EXPECT_EQ(1, HandlerCalls);
+
+	CoAP_ClearPendingInteractions();
+	EXPECT_EQ(before, Allocations);
+}
@@ -0,0 +1,105 @@
+#include "coap_test.h"
+
+// Representations generated block by block (CoAP_SetPayload_Producer)
+class ProducerTest : public CoapTest {
+protected:
+	static uint32_t Version;
+	static bool WithETag;
+	static uint32_t Size;
+	static int ProducerCalls;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Version = 1;
+		WithETag = true;
+		Size = 3000;
+		ProducerCalls = 0;
+		CreateResource("gen", Opts(RES_OPT_GET), Handler);
+	}
+
+	static CoAP_Result_t Producer(uint32_t offset, uint8_t* pDest, uint16_t length, void* pCtx) {
+		(void) pCtx;
+		ProducerCalls++;
+		for (uint16_t i = 0; i < length; i++) {
+			pDest[i] = (uint8_t) ('a' + (offset + i) % 26);
+		}
+		return COAP_OK;
+	}
+
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		if (WithETag) {
+			AddETagValueToMsg(pResp, Version);
+		}
+		if (CoAP_SetPayload_Producer(pReq, pResp, Size, Producer, NULL) != COAP_OK) {
+			return HANDLER_ERROR;
+		}
+		return HANDLER_OK;
+	}
+
+	// GET of a block, ifMatch = 0 for none
+	void Get(uint32_t num, uint32_t ifMatch = 0) {
+		CoAP_Message_t* pReq = Msg(CON, REQ_GET, (uint16_t) (0x300 + num), Token((uint8_t) num), "gen");
+		if (ifMatch != 0) {
+			AddETagValueToMsg(pReq, ifMatch);
+			pReq->pOptionsList->Number = OPT_NUM_IF_MATCH;
+		}
+		AddBlockOption(pReq, OPT_NUM_BLOCK2, num, false, 64);
+		Receive(Ep(1), pReq);
+		Work(4);
+	}
+};
+
+uint32_t ProducerTest::Version;
+bool ProducerTest::WithETag;
+uint32_t ProducerTest::Size;
+int ProducerTest::ProducerCalls;
+
+TEST_F(ProducerTest, GeneratesRequestedBlockOnly) {
+	Get(2);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg resp(Sent[0]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ((2u << 4) | 0x08 | 2, resp.UintOption(OPT_NUM_BLOCK2));
+	ASSERT_EQ(64, resp->PayloadLength);
+	EXPECT_EQ('a' + 128 % 26, resp->Payload[0]);
+	EXPECT_NE(nullptr, resp.Option(OPT_NUM_ETAG));
+	EXPECT_EQ(1, ProducerCalls);
+}
+
+TEST_F(ProducerTest, BlockwiseRepresentationNeedsETag) {
+	WithETag = false;
+	Get(0);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg resp(Sent[0]);
+	EXPECT_EQ(RESP_INTERNAL_SERVER_ERROR_5_00, resp->Code);
+	EXPECT_EQ(0, ProducerCalls);
+}
+
+TEST_F(ProducerTest, SingleBlockWithoutETag) {
+	WithETag = false;
+	Size = 10;
+	Get(0);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg resp(Sent[0]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ("abcdefghij", resp.Payload());
+}
+
+TEST_F(ProducerTest, BlockOfChangedRepresentationIsRejected) {
+	Get(0);
+	Version = 2; // representation changed between two block requests
+	Get(1, 1);
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg resp(Sent[1]);
+	EXPECT_EQ(RESP_PRECONDITION_FAILED_4_12, resp->Code);
+	EXPECT_EQ(0, resp->PayloadLength);
+}
+
+TEST_F(ProducerTest, BlockOfSameRepresentationIsServed) {
+	Get(0);
+	Get(1, 1);
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg resp(Sent[1]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ(64, resp->PayloadLength);
+}
@@ -0,0 +1,142 @@
+#include "coap_test.h"
+
+// Resources removed at runtime (CoAP_RemoveResource) and released by CoAP_doWork()
+class RemovalTest : public CoapTest {
+protected:
+	static bool Postpones;
+	static bool RemovesItself;
+	static CoAP_Res_t* pSelf;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Postpones = false;
+		RemovesItself = false;
+		pSelf = NULL;
+	}
+
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		if (Postpones) {
+			return HANDLER_POSTPONE;
+		}
+		if (RemovesItself) {
+			EXPECT_EQ(COAP_OK, CoAP_RemoveResource(pSelf));
+		}
+		CoAP_SetPayload(pResp, (uint8_t*) "v", 1, true);
+		return HANDLER_OK;
+	}
+
+	static CoAP_HandlerResult_t Notifier(CoAP_Observer_t* pObserver, CoAP_Message_t* pResp) {
+		(void) pObserver;
+		CoAP_SetPayload(pResp, (uint8_t*) "n", 1, true);
+		return HANDLER_OK;
+	}
+
+	static void Get(const char* uri, bool observe = false, uint8_t token = 1) {
+		static uint16_t mid = 0xa00;
+		CoAP_Message_t* pReq = Msg(CON, REQ_GET, mid++, Token(token), uri);
+		if (observe) {
+			AddUintOption(pReq, OPT_NUM_OBSERVE, 0);
+		}
+		Receive(Ep(1, (uint16_t) (2000 + token)), pReq);
+		Work(4);
+	}
+};
+
+bool RemovalTest::Postpones;
+bool RemovalTest::RemovesItself;
+CoAP_Res_t* RemovalTest::pSelf;
+
+TEST_F(RemovalTest, RemovedResourceIsNotFound) {
+	CoAP_Res_t* pRes = CreateResource("gone", Opts(RES_OPT_GET), Handler);
+	Get("gone");
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, ParsedMsg(Sent[0])->Code);
+
+	RemoveResource(pRes);
+	Work();
+	Sent.clear();
+	Get("gone");
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, ParsedMsg(Sent[0])->Code);
+}
+
+TEST_F(RemovalTest, RemovingTwiceFails) {
+	CoAP_Res_t* pRes = CreateResource("gone", Opts(RES_OPT_GET), Handler);
+	RemoveResource(pRes);
+	EXPECT_EQ(COAP_ERR_NOT_FOUND, CoAP_RemoveResource(pRes));
+	EXPECT_EQ(COAP_ERR_NOT_FOUND, CoAP_RemoveResource(NULL));
+}
+
+TEST_F(RemovalTest, RemovedResourceCannotBeNotified) {
+	CoAP_Res_t* pRes = CreateResource("gone", Opts(RES_OPT_GET), Handler, Notifier);
+	RemoveResource(pRes);
+	EXPECT_EQ(COAP_ERR_NOT_FOUND, CoAP_NotifyResourceObservers(pRes));
+	EXPECT_EQ(COAP_ERR_NOT_FOUND, CoAP_NotifyResourceObserversValue(pRes, 1.0f));
+	Work();
+}
+
+TEST_F(RemovalTest, ObserversGetFinalNotFound) {
+	CoAP_Res_t* pRes = CreateResource("gone", Opts(RES_OPT_GET), Handler, Notifier);
+	Get("gone", true, 1);
+	Get("gone", true, 2);
+	ASSERT_NE(nullptr, pRes->pListObservers);
+	Sent.clear();
+
+	RemoveResource(pRes);
+	Work(4);
+	ASSERT_EQ(2u, Sent.size());
+	for (size_t i = 0; i < Sent.size(); i++) {
+		ParsedMsg msg(Sent[i]);
+		EXPECT_EQ(CON, msg->Type);
+		EXPECT_EQ(RESP_NOT_FOUND_4_04, msg->Code);
+		EXPECT_EQ(nullptr, msg.Option(OPT_NUM_OBSERVE));
+	}
+}
+
+TEST_F(RemovalTest, PostponedRequestGetsNotFound) {
+	CoAP_Res_t* pRes = CreateResource("slow", Opts(RES_OPT_GET), Handler);
+	Postpones = true;
+	Get("slow");
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(EMPTY, ParsedMsg(Sent[0])->Code); // separate response follows
+	Sent.clear();
+
+	RemoveResource(pRes);
+	Advance(POSTPONE_WAIT_TIME_SEK + 1);
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg resp(Sent[0]);
+	EXPECT_EQ(CON, resp->Type);
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, resp->Code);
+}
+
+TEST_F(RemovalTest, HandlerMayRemoveItsResource) {
+	pSelf = CoAP_CreateResource((char*) "self", (char*) "test", Opts(RES_OPT_GET), Handler, NULL);
+	ASSERT_NE(nullptr, pSelf);
+	RemovesItself = true;
+	Get("self");
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg resp(Sent[0]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ("v", resp.Payload());
+
+	Sent.clear();
+	RemovesItself = false;
+	Get("self");
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, ParsedMsg(Sent[0])->Code);
+}
+
+TEST_F(RemovalTest, MemoryIsReleased) {
+	CoAP_ClearPendingInteractions();
+	long before = Allocations;
+	CoAP_Res_t* pRes = CreateResource("gone", Opts(RES_OPT_GET, RES_FLAG_RESPONSE_CACHE), Handler, Notifier);
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, "sensor", "core.s"));
+	Get("gone", true, 1);
+	EXPECT_NE(before, Allocations);
+
+	RemoveResource(pRes);
+	Work(4);
+	CoAP_ClearPendingInteractions(); // final notification and the answered request
+	EXPECT_EQ(before, Allocations);
+}
@@ -0,0 +1,141 @@
+#include "coap_test.h"
+
+// GET responses kept for their Max-Age by RES_FLAG_RESPONSE_CACHE
+class RespCacheTest : public CoapTest {
+protected:
+	static std::string Value;
+	static int HandlerCalls;
+	static bool PutFails;
+	CoAP_Res_t* pRes;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Value = "v0";
+		HandlerCalls = 0;
+		PutFails = false;
+		pRes = CreateResource("cached", Opts(RES_OPT_GET | RES_OPT_PUT | RES_OPT_POST | RES_OPT_DELETE,
+				RES_FLAG_RESPONSE_CACHE), Handler, Notifier);
+	}
+
+	// GET answers with the value and a Max-Age of 10 s, PUT sets it
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		HandlerCalls++;
+		if (pReq->Code != REQ_GET) {
+			if (PutFails) {
+				pResp->Code = RESP_ERROR_BAD_REQUEST_4_00;
+				return HANDLER_OK;
+			}
+			Value.assign((const char*) pReq->Payload, pReq->PayloadLength);
+			pResp->Code = pReq->Code == REQ_DELETE ? RESP_SUCCESS_DELETED_2_02 : RESP_SUCCESS_CHANGED_2_04;
+			return HANDLER_OK;
+		}
+		CoAP_AppendUintOptionToList(&(pResp->pOptionsList), OPT_NUM_MAX_AGE, 10);
+		CoAP_SetPayload(pResp, (uint8_t*) Value.data(), Value.size(), true);
+		return HANDLER_OK;
+	}
+
+	static CoAP_HandlerResult_t Notifier(CoAP_Observer_t* pObserver, CoAP_Message_t* pResp) {
+		(void) pObserver;
+		CoAP_SetPayload(pResp, (uint8_t*) Value.data(), Value.size(), true);
+		return HANDLER_OK;
+	}
+
+	// Sends a request and returns the response, which is empty if none was sent
+	std::string Request(CoAP_MessageCode_t code, const char* uri = "cached", const char* payload = NULL,
+			bool observe = false, uint32_t* pMaxAge = NULL) {
+		static uint16_t mid = 0xb00;
+		Sent.clear();
+		CoAP_Message_t* pReq = Msg(CON, code, mid++, Token(1), uri, payload);
+		if (observe) {
+			AddUintOption(pReq, OPT_NUM_OBSERVE, 0);
+		}
+		Receive(Ep(1), pReq);
+		Work(4);
+		EXPECT_EQ(1u, Sent.size());
+		if (Sent.size() != 1) {
+			return "";
+		}
+		ParsedMsg resp(Sent[0]);
+		if (pMaxAge != NULL) {
+			*pMaxAge = resp.UintOption(OPT_NUM_MAX_AGE);
+		}
+		return resp.Payload();
+	}
+
+	std::string Get(const char* uri = "cached", uint32_t* pMaxAge = NULL) {
+		return Request(REQ_GET, uri, NULL, false, pMaxAge);
+	}
+};
+
+std::string RespCacheTest::Value;
+int RespCacheTest::HandlerCalls;
+bool RespCacheTest::PutFails;
+
+TEST_F(RespCacheTest, FreshResponseIsServedFromCache) {
+	EXPECT_EQ("v0", Get());
+	Value = "v1";
+	Advance(3);
+	uint32_t maxAge = 0;
+	EXPECT_EQ("v0", Get("cached", &maxAge));
+	EXPECT_EQ(7u, maxAge);
+	EXPECT_EQ(1, HandlerCalls);
+}
+
+TEST_F(RespCacheTest, StaleResponseIsNotServed) {
+	EXPECT_EQ("v0", Get());
+	Value = "v1";
+	Advance(11);
+	EXPECT_EQ("v1", Get());
+	EXPECT_EQ(2, HandlerCalls);
+}
+
+TEST_F(RespCacheTest, ResponsesAreKeyedByQuery) {
+	Get("cached?a");
+	Get("cached?b");
+	Get("cached?a");
+	EXPECT_EQ(2, HandlerCalls);
+}
+
+TEST_F(RespCacheTest, NotificationDropsCache) {
+	EXPECT_EQ("v0", Get());
+	Value = "v1";
+	EXPECT_EQ(COAP_OK, CoAP_NotifyResourceObservers(pRes));
+	EXPECT_EQ("v1", Get());
+}
+
+TEST_F(RespCacheTest, SuccessfulUnsafeRequestsDropCache) {
+	const CoAP_MessageCode_t codes[] = { REQ_PUT, REQ_POST, REQ_DELETE };
+	for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+		std::string value = "u" + std::to_string(i);
+		Get();
+		Request(codes[i], "cached", value.c_str());
+		EXPECT_EQ(value, Get());
+	}
+}
+
+TEST_F(RespCacheTest, FailedUnsafeRequestKeepsCache) {
+	EXPECT_EQ("v0", Get());
+	PutFails = true;
+	Request(REQ_PUT, "cached", "v1");
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(RESP_ERROR_BAD_REQUEST_4_00, ParsedMsg(Sent[0])->Code);
+	EXPECT_EQ("v0", Get());
+	EXPECT_EQ(2, HandlerCalls);
+}
+
+TEST_F(RespCacheTest, ObserveRequestsBypassCache) {
+	EXPECT_EQ("v0", Get());
+	Value = "v1";
+	EXPECT_EQ("v1", Request(REQ_GET, "cached", NULL, true));
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_NE(nullptr, ParsedMsg(Sent[0]).Option(OPT_NUM_OBSERVE));
+	EXPECT_NE(nullptr, pRes->pListObservers);
+	EXPECT_EQ(2, HandlerCalls);
+}
+
+TEST_F(RespCacheTest, ObserveResponseIsNotCached) {
+	EXPECT_EQ("v0", Request(REQ_GET, "cached", NULL, true));
+	Value = "v1";
+	EXPECT_EQ("v1", Get());
+	EXPECT_EQ(2, HandlerCalls);
+}
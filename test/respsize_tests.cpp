@@ -0,0 +1,148 @@
+#include "coap_test.h"
+
+// Initial payload buffer of responses, fixed by RespSizeHint or learned with RES_FLAG_ADAPTIVE_RESP_SIZE
+class RespSizeTest : public CoapTest {
+protected:
+	static uint16_t Length; // payload length of the next responses
+	static uint16_t SeenBufSize; // initial payload buffer of the latest response
+	static bool Fails;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Length = 0;
+		SeenBufSize = 0;
+		Fails = false;
+	}
+
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		SeenBufSize = pResp->PayloadBufSize;
+		std::string payload(Length, 'r');
+		CoAP_SetPayload(pResp, (uint8_t*) payload.data(), payload.size(), true);
+		return Fails ? HANDLER_ERROR : HANDLER_OK;
+	}
+
+	static CoAP_HandlerResult_t Notifier(CoAP_Observer_t* pObserver, CoAP_Message_t* pResp) {
+		(void) pObserver;
+		SeenBufSize = pResp->PayloadBufSize;
+		std::string payload(Length, 'n');
+		CoAP_SetPayload(pResp, (uint8_t*) payload.data(), payload.size(), true);
+		return HANDLER_OK;
+	}
+
+	CoAP_Res_t* Resource(uint16_t hint, uint16_t flags = 0) {
+		CoAP_ResOpts_t opts = Opts(RES_OPT_GET, flags);
+		opts.RespSizeHint = hint;
+		return CreateResource("rs", opts, Handler, Notifier);
+	}
+
+	// Responds with length bytes, returns the initial payload buffer the handler got
+	static uint16_t Get(uint16_t length) {
+		static uint16_t mid = 0xe00;
+		Length = length;
+		SeenBufSize = 0;
+		size_t sent = Sent.size();
+		Receive(Ep(1), Msg(CON, REQ_GET, mid++, Token(1), "rs"));
+		Work(4);
+		EXPECT_EQ(sent + 1, Sent.size());
+		if (!Fails && Sent.size() == sent + 1) {
+			EXPECT_EQ(length, ParsedMsg(Sent.back())->PayloadLength);
+		}
+		return SeenBufSize;
+	}
+};
+
+uint16_t RespSizeTest::Length;
+uint16_t RespSizeTest::SeenBufSize;
+bool RespSizeTest::Fails;
+
+TEST_F(RespSizeTest, DefaultIsPreferredSize) {
+	Resource(0);
+	EXPECT_EQ(PREFERED_PAYLOAD_SIZE, Get(500));
+	EXPECT_EQ(PREFERED_PAYLOAD_SIZE, Get(10)); // nothing learned without the flag
+	EXPECT_EQ(PREFERED_PAYLOAD_SIZE, CoAP_ResponseSizeHint(NULL));
+}
+
+TEST_F(RespSizeTest, HintIsClamped) {
+	CoAP_Res_t* pRes = Resource(300);
+	EXPECT_EQ(300, Get(100));
+	pRes->Options.RespSizeHint = 10;
+	EXPECT_EQ(PREFERED_PAYLOAD_SIZE, Get(10));
+	pRes->Options.RespSizeHint = MAX_PAYLOAD_SIZE + 1;
+	EXPECT_EQ(MAX_PAYLOAD_SIZE, Get(10));
+}
+
+TEST_F(RespSizeTest, LargerResponseIsFollowedAtOnce) {
+	Resource(0, RES_FLAG_ADAPTIVE_RESP_SIZE);
+	EXPECT_EQ(PREFERED_PAYLOAD_SIZE, Get(500));
+	EXPECT_EQ(500, Get(700));
+	EXPECT_EQ(700, Get(700));
+}
+
+TEST_F(RespSizeTest, SmallerResponsesShrinkByAnEighth) {
+	CoAP_Res_t* pRes = Resource(0, RES_FLAG_ADAPTIVE_RESP_SIZE);
+	Get(500);
+	EXPECT_EQ(500, Get(100));
+	EXPECT_EQ(450, Get(100)); // 500 - 400/8
+	EXPECT_EQ(406, Get(100)); // 450 - 350/8 rounded up
+	for (int i = 0; i < 100; i++) {
+		CoAP_LearnResponseSize(pRes, 100);
+	}
+	EXPECT_EQ(100, CoAP_ResponseSizeHint(pRes)); // reached, not just approached
+}
+
+TEST_F(RespSizeTest, LearnedSizeIsClamped) {
+	CoAP_Res_t* pRes = Resource(0, RES_FLAG_ADAPTIVE_RESP_SIZE);
+	Get(10);
+	EXPECT_EQ(10u, pRes->RespSize);
+	EXPECT_EQ(PREFERED_PAYLOAD_SIZE, Get(10));
+
+	CoAP_LearnResponseSize(pRes, 5000);
+	EXPECT_EQ(MAX_PAYLOAD_SIZE, pRes->RespSize);
+	EXPECT_EQ(MAX_PAYLOAD_SIZE, Get(10));
+}
+
+TEST_F(RespSizeTest, HintIsUsedUntilSizeIsLearned) {
+	Resource(200, RES_FLAG_ADAPTIVE_RESP_SIZE);
+	EXPECT_EQ(200, Get(100));
+	EXPECT_EQ(100, Get(100));
+}
+
+TEST_F(RespSizeTest, FailedHandlerIsNotLearned) {
+	CoAP_Res_t* pRes = Resource(0, RES_FLAG_ADAPTIVE_RESP_SIZE);
+	Fails = true;
+	Get(800);
+	Fails = false;
+	EXPECT_EQ(0u, pRes->RespSize);
+	EXPECT_EQ(PREFERED_PAYLOAD_SIZE, Get(100));
+}
+
+TEST_F(RespSizeTest, SharedNotificationsAreLearned) {
+	CoAP_Res_t* pRes = Resource(0, RES_FLAG_ADAPTIVE_RESP_SIZE | RES_FLAG_SHARED_NOTIFICATION);
+	CoAP_Message_t* pReq = Msg(CON, REQ_GET, 0xeff, Token(2), "rs");
+	AddUintOption(pReq, OPT_NUM_OBSERVE, 0);
+	Length = 10;
+	Receive(Ep(2), pReq);
+	Work(4);
+	ASSERT_NE(nullptr, pRes->pListObservers);
+
+	Length = 600;
+	EXPECT_EQ(COAP_OK, CoAP_NotifyResourceObservers(pRes));
+	Work(4);
+	EXPECT_EQ(600u, pRes->RespSize);
+	EXPECT_EQ(COAP_OK, CoAP_NotifyResourceObservers(pRes));
+	Work(4);
+	EXPECT_EQ(600, SeenBufSize);
+}
+
+TEST_F(RespSizeTest, GrownBuffersAreFreed) {
+	Resource(0, RES_FLAG_ADAPTIVE_RESP_SIZE);
+	Get(100);
+	CoAP_ClearPendingInteractions();
+	long before = Allocations;
+	Get(900);
+	Get(100);
+	Get(1000);
+	CoAP_ClearPendingInteractions();
+	EXPECT_EQ(before, Allocations);
+}
@@ -0,0 +1,153 @@
+#include "coap_test.h"
+
+// Routing of requests to resources through the resource index
+class RoutingTest : public CoapTest {
+protected:
+	// Answers with its name as payload
+	template<char Name>
+	static CoAP_HandlerResult_t Named(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		uint8_t name = (uint8_t) Name;
+		CoAP_SetPayload(pResp, &name, 1, true);
+		return HANDLER_OK;
+	}
+
+	// Answers with the requested path
+	static CoAP_HandlerResult_t Echo(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		std::string path;
+		for (CoAP_option_t* pOpt = pReq->pOptionsList; pOpt != NULL; pOpt = pOpt->next) {
+			if (pOpt->Number == OPT_NUM_URI_PATH) {
+				path += (path.empty() ? "" : "/") + std::string((const char*) pOpt->Value, pOpt->Length);
+			}
+		}
+		CoAP_SetPayload(pResp, (uint8_t*) path.data(), path.size(), true);
+		return HANDLER_OK;
+	}
+
+	// Answers with the segment(s) matched by "{id}" or "*"
+	static CoAP_HandlerResult_t Param(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		char buf[32];
+		if (CoAP_GetUriParamByName(pReq, "id", buf, sizeof(buf)) != COAP_OK
+				&& CoAP_GetUriParamByName(pReq, "*", buf, sizeof(buf)) != COAP_OK) {
+			return HANDLER_ERROR;
+		}
+		CoAP_SetPayload(pResp, (uint8_t*) buf, strlen(buf), true);
+		return HANDLER_OK;
+	}
+
+	static CoAP_HandlerResult_t Notifier(CoAP_Observer_t* pObserver, CoAP_Message_t* pResp) {
+		(void) pObserver;
+		(void) pResp;
+		return HANDLER_OK;
+	}
+
+	// GET of uri, returns the response code and sets payload
+	CoAP_MessageCode_t Get(const char* uri, std::string* pPayload = NULL, bool observe = false) {
+		static uint16_t mid = 0x700;
+		Sent.clear();
+		CoAP_Message_t* pReq = Msg(CON, REQ_GET, mid++, Token(1), uri);
+		if (observe) {
+			AddUintOption(pReq, OPT_NUM_OBSERVE, 0);
+		}
+		Receive(Ep(1), pReq);
+		Work(4);
+		EXPECT_EQ(1u, Sent.size());
+		if (Sent.size() != 1) {
+			return EMPTY;
+		}
+		ParsedMsg resp(Sent[0]);
+		if (pPayload != NULL) {
+			*pPayload = resp.Payload();
+		}
+		return resp->Code;
+	}
+};
+
+TEST_F(RoutingTest, RoutesToResourceWithSamePath) {
+	CreateResource("a/b", Opts(RES_OPT_GET), Named<'b'>);
+	CreateResource("a/c", Opts(RES_OPT_GET), Named<'c'>);
+	std::string payload;
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("a/c", &payload));
+	EXPECT_EQ("c", payload);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("a/b", &payload));
+	EXPECT_EQ("b", payload);
+}
+
+TEST_F(RoutingTest, UnknownPathIsNotFound) {
+	CreateResource("a/b", Opts(RES_OPT_GET), Named<'b'>);
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, Get("a"));
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, Get("a/b/c"));
+}
+
+TEST_F(RoutingTest, OldestOfDuplicateUrisAnswers) {
+	CoAP_Res_t* pFirst = CreateResource("dup", Opts(RES_OPT_GET), Named<'1'>);
+	CreateResource("dup", Opts(RES_OPT_GET), Named<'2'>);
+	std::string payload;
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("dup", &payload));
+	EXPECT_EQ("1", payload);
+
+	RemoveResource(pFirst);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("dup", &payload));
+	EXPECT_EQ("2", payload);
+}
+
+TEST_F(RoutingTest, ResourcesSharingBucketsAreToldApart) {
+	const int count = RESOURCE_INDEX_SIZE * 2 + 3;
+	std::vector<std::string> uris;
+	for (int i = 0; i < count; i++) {
+		uris.push_back("r/" + std::to_string(i));
+		ASSERT_NE(nullptr, CreateResource(uris.back().c_str(), Opts(RES_OPT_GET), Echo));
+	}
+	for (int i = 0; i < count; i++) {
+		std::string payload;
+		EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get(uris[i].c_str(), &payload));
+		EXPECT_EQ(uris[i], payload);
+	}
+}
+
+TEST_F(RoutingTest, NamedSegmentMatchesOneSegment) {
+	CreateResource("dev/{id}/temp", Opts(RES_OPT_GET), Param);
+	std::string payload;
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("dev/42/temp", &payload));
+	EXPECT_EQ("42", payload);
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, Get("dev/42/hum"));
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, Get("dev/temp"));
+	EXPECT_EQ(RESP_NOT_FOUND_4_04, Get("dev/1/2/temp"));
+}
+
+TEST_F(RoutingTest, WildcardMatchesRemainingSegments) {
+	CreateResource("files/*", Opts(RES_OPT_GET), Param);
+	std::string payload;
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("files/a/b/c", &payload));
+	EXPECT_EQ("a/b/c", payload);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("files/a", &payload));
+	EXPECT_EQ("a", payload);
+}
+
+TEST_F(RoutingTest, ExactMatchIsPreferredToPattern) {
+	CreateResource("dev/{id}", Opts(RES_OPT_GET), Param);
+	CreateResource("dev/self", Opts(RES_OPT_GET), Named<'s'>);
+	std::string payload;
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("dev/self", &payload));
+	EXPECT_EQ("s", payload);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("dev/7", &payload));
+	EXPECT_EQ("7", payload);
+}
+
+TEST_F(RoutingTest, PatternsAreTriedInOrderOfCreation) {
+	CreateResource("x/{id}", Opts(RES_OPT_GET), Named<'1'>);
+	CreateResource("x/*", Opts(RES_OPT_GET), Named<'2'>);
+	std::string payload;
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("x/y", &payload));
+	EXPECT_EQ("1", payload);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("x/y/z", &payload));
+	EXPECT_EQ("2", payload);
+}
+
+TEST_F(RoutingTest, PatternResourceIsNotObserved) {
+	CoAP_Res_t* pRes = CreateResource("dev/{id}", Opts(RES_OPT_GET), Param, Notifier);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, Get("dev/1", NULL, true));
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(nullptr, ParsedMsg(Sent[0]).Option(OPT_NUM_OBSERVE));
+	EXPECT_EQ(nullptr, pRes->pListObservers);
+}
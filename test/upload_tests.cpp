@@ -0,0 +1,98 @@
+#include "coap_test.h"
+
+// Block1 uploads passed to an upload sink (CoAP_SetResourceUploadSink)
+class UploadTest : public CoapTest {
+protected:
+	static std::string Data;
+	static int Aborts;
+	static int HandlerCalls;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		Data.clear();
+		Aborts = 0;
+		HandlerCalls = 0;
+		pRes = CreateResource("up", Opts(RES_OPT_PUT), Handler);
+		CoAP_SetResourceUploadSink(pRes, Sink);
+	}
+
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		HandlerCalls++;
+		pResp->Code = RESP_SUCCESS_CHANGED_2_04;
+		return HANDLER_OK;
+	}
+
+	static CoAP_Result_t Sink(CoAP_Message_t* pReq, uint32_t offset, const uint8_t* pData, uint16_t length, bool last, void** ppCtx) {
+		(void) pReq;
+		(void) last;
+		(void) ppCtx;
+		if (pData == NULL) {
+			Aborts++;
+			return COAP_OK;
+		}
+		EXPECT_EQ(Data.size(), offset);
+		Data.append((const char*) pData, length);
+		return COAP_OK;
+	}
+
+	// Sends a block and returns the code of the response
+	CoAP_MessageCode_t PutBlock(uint16_t mid, uint32_t num, bool more, const char* payload) {
+		CoAP_Message_t* pReq = Msg(CON, REQ_PUT, mid, Token((uint8_t) mid), "up", payload);
+		AddBlockOption(pReq, OPT_NUM_BLOCK1, num, more, 16);
+		size_t before = Sent.size();
+		Receive(Ep(1), pReq);
+		Work(4);
+		if (Sent.size() == before) {
+			return EMPTY;
+		}
+		ParsedMsg resp(Sent.back());
+		return resp->Code;
+	}
+
+	CoAP_Res_t* pRes;
+};
+
+std::string UploadTest::Data;
+int UploadTest::Aborts;
+int UploadTest::HandlerCalls;
+
+TEST_F(UploadTest, PassesBlocksInOrder) {
+	EXPECT_EQ(RESP_SUCCESS_CONTINUE_2_31, PutBlock(1, 0, true, "0123456789abcdef"));
+	EXPECT_EQ(RESP_SUCCESS_CONTINUE_2_31, PutBlock(2, 1, true, "ghijklmnopqrstuv"));
+	EXPECT_EQ(0, HandlerCalls);
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, PutBlock(3, 2, false, "wxyz"));
+	EXPECT_EQ(1, HandlerCalls);
+	EXPECT_EQ("0123456789abcdefghijklmnopqrstuvwxyz", Data);
+	EXPECT_EQ(0, Aborts);
+}
+
+TEST_F(UploadTest, RejectsMissingBlock) {
+	EXPECT_EQ(RESP_SUCCESS_CONTINUE_2_31, PutBlock(1, 0, true, "0123456789abcdef"));
+	EXPECT_EQ(RESP_REQUEST_ENTITY_INCOMPLETE_4_08, PutBlock(2, 2, true, "ghijklmnopqrstuv"));
+	EXPECT_EQ(1, Aborts);
+	EXPECT_EQ(0, HandlerCalls);
+}
+
+TEST_F(UploadTest, IdleUploadIsDroppedWithoutFurtherBlocks) {
+	EXPECT_EQ(RESP_SUCCESS_CONTINUE_2_31, PutBlock(1, 0, true, "0123456789abcdef"));
+	Advance(UPLOAD_IDLE_TIMEOUT + 2);
+	EXPECT_EQ(1, Aborts) << "sink must learn about the abort even if no other upload arrives";
+	EXPECT_EQ(RESP_REQUEST_ENTITY_INCOMPLETE_4_08, PutBlock(2, 1, true, "ghijklmnopqrstuv"));
+}
+
+TEST_F(UploadTest, ActiveUploadIsKept) {
+	EXPECT_EQ(RESP_SUCCESS_CONTINUE_2_31, PutBlock(1, 0, true, "0123456789abcdef"));
+	Advance(UPLOAD_IDLE_TIMEOUT - 10);
+	EXPECT_EQ(RESP_SUCCESS_CONTINUE_2_31, PutBlock(2, 1, true, "ghijklmnopqrstuv"));
+	Advance(UPLOAD_IDLE_TIMEOUT - 10);
+	EXPECT_EQ(0, Aborts);
+	EXPECT_EQ(RESP_SUCCESS_CHANGED_2_04, PutBlock(3, 2, false, "wxyz"));
+}
+
+TEST_F(UploadTest, RemovedResourceAbortsUpload) {
+	EXPECT_EQ(RESP_SUCCESS_CONTINUE_2_31, PutBlock(1, 0, true, "0123456789abcdef"));
+	RemoveResource(pRes);
+	Work(1);
+	EXPECT_EQ(1, Aborts);
+}
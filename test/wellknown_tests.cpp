@@ -0,0 +1,160 @@
+#include "coap_test.h"
+
+// /.well-known/core generated block by block from the cached links
+class WellKnownTest : public CoapTest {
+protected:
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		(void) pResp;
+		return HANDLER_OK;
+	}
+
+	// GET of a 16 byte block of the document, returns the ETag of the response (0 if failed)
+	uint32_t GetBlock(const char* query, uint32_t num, std::string* pPayload, bool* pMore) {
+		static uint16_t mid = 0x900;
+		std::string uri = std::string(".well-known/core") + (query != NULL ? "?" : "") + (query != NULL ? query : "");
+		Sent.clear();
+		CoAP_Message_t* pReq = Msg(CON, REQ_GET, mid++, Token((uint8_t) num), uri.c_str());
+		AddBlockOption(pReq, OPT_NUM_BLOCK2, num, false, 16);
+		Receive(Ep(1), pReq);
+		Work(4);
+		EXPECT_EQ(1u, Sent.size());
+		if (Sent.size() != 1) {
+			return 0;
+		}
+		ParsedMsg resp(Sent[0]);
+		EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+		*pPayload = resp.Payload();
+		*pMore = (resp.UintOption(OPT_NUM_BLOCK2) & 0x08) != 0;
+		return resp.UintOption(OPT_NUM_ETAG);
+	}
+
+	// The whole document fetched blockwise, all blocks have to carry the same ETag
+	std::string Get(const char* query = NULL) {
+		std::string doc;
+		uint32_t etag = 0;
+		bool more = true;
+		for (uint32_t num = 0; more && num < 100; num++) {
+			std::string block;
+			uint32_t blockETag = GetBlock(query, num, &block, &more);
+			if (num == 0) {
+				etag = blockETag;
+			}
+			EXPECT_EQ(etag, blockETag);
+			doc += block;
+		}
+		return doc;
+	}
+};
+
+TEST_F(WellKnownTest, ListsAllResources) {
+	CreateResource("sensors/temp", Opts(RES_OPT_GET), Handler);
+	CreateResource("sensors/hum", Opts(RES_OPT_GET), Handler);
+	EXPECT_EQ("</.well-known/core>,</sensors/temp>;title=\"test\";ct=0,</sensors/hum>;title=\"test\";ct=0", Get());
+}
+
+TEST_F(WellKnownTest, QueryFiltersLinks) {
+	CoAP_Res_t* pTemp = CreateResource("temp", Opts(RES_OPT_GET), Handler);
+	CoAP_Res_t* pHum = CreateResource("hum", Opts(RES_OPT_GET), Handler);
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pTemp, "sensor temperature", NULL));
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pHum, "sensor", "core.s"));
+	EXPECT_EQ("</temp>;title=\"test\";ct=0;rt=\"sensor temperature\"", Get("rt=temp*"));
+	EXPECT_EQ("</hum>;title=\"test\";ct=0;rt=\"sensor\";if=\"core.s\"", Get("if=core.s"));
+	EXPECT_EQ("</temp>;title=\"test\";ct=0;rt=\"sensor temperature\",</hum>;title=\"test\";ct=0;rt=\"sensor\";if=\"core.s\"",
+			Get("rt=sensor"));
+	EXPECT_EQ("", Get("unknown=1"));
+}
+
+TEST_F(WellKnownTest, InterleavedQueriesKeepTheirBlocks) {
+	for (int i = 0; i < 6; i++) {
+		CoAP_Res_t* pRes = CreateResource(("r" + std::to_string(i)).c_str(), Opts(RES_OPT_GET), Handler);
+		ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, i % 2 ? "odd" : "even", NULL));
+	}
+	std::string odd = Get("rt=odd");
+	std::string even = Get("rt=even");
+
+	std::string a, b;
+	bool moreA = true, moreB = true;
+	for (uint32_t num = 0; (moreA || moreB) && num < 100; num++) {
+		std::string block;
+		if (moreA) {
+			GetBlock("rt=odd", num, &block, &moreA);
+			a += block;
+		}
+		if (moreB) {
+			GetBlock("rt=even", num, &block, &moreB);
+			b += block;
+		}
+	}
+	EXPECT_EQ(odd, a);
+	EXPECT_EQ(even, b);
+
+	// a block again after later ones
+	std::string block;
+	bool more;
+	GetBlock("rt=odd", 1, &block, &more);
+	EXPECT_EQ(odd.substr(16, 16), block);
+}
+
+TEST_F(WellKnownTest, ETagChangesWithLinks) {
+	CoAP_Res_t* pRes = CreateResource("temp", Opts(RES_OPT_GET), Handler);
+	std::string block;
+	bool more;
+	uint32_t before = GetBlock(NULL, 0, &block, &more);
+	EXPECT_EQ(before, GetBlock(NULL, 0, &block, &more));
+
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, "sensor", NULL));
+	uint32_t attrs = GetBlock(NULL, 0, &block, &more);
+	EXPECT_NE(before, attrs);
+
+	CreateResource("hum", Opts(RES_OPT_GET), Handler);
+	EXPECT_NE(attrs, GetBlock(NULL, 0, &block, &more));
+}
+
+TEST_F(WellKnownTest, ETagFollowsContent) {
+	CoAP_Res_t* pRes = CreateResource("temp", Opts(RES_OPT_GET), Handler);
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, "aa", NULL));
+	std::string block;
+	bool more;
+	uint32_t aa = GetBlock(NULL, 0, &block, &more);
+
+	// same size, other content
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, "bb", NULL));
+	EXPECT_NE(aa, GetBlock(NULL, 0, &block, &more));
+
+	// same content after other changes, e.g. in the next run
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, "aa", NULL));
+	EXPECT_EQ(aa, GetBlock(NULL, 0, &block, &more));
+}
+
+TEST_F(WellKnownTest, ETagDiffersPerQuery) {
+	CoAP_Res_t* pA = CreateResource("a", Opts(RES_OPT_GET), Handler);
+	CoAP_Res_t* pB = CreateResource("b", Opts(RES_OPT_GET), Handler);
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pA, "x", NULL));
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pB, "y", NULL));
+	std::string a, b;
+	bool more;
+	uint32_t etagA = GetBlock("rt=x", 0, &a, &more);
+	uint32_t etagB = GetBlock("rt=y", 0, &b, &more);
+	ASSERT_EQ(a.size(), b.size());
+	EXPECT_NE(a, b);
+	EXPECT_NE(etagA, etagB);
+}
+
+TEST_F(WellKnownTest, SizeOfQueryIsKeptUntilLinksChange) {
+	CoAP_Res_t* pRes = CreateResource("temp", Opts(RES_OPT_GET), Handler);
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, "aa", NULL));
+	std::string block;
+	bool more;
+	uint32_t etag = GetBlock("rt=a*", 0, &block, &more);
+	EXPECT_TRUE(more);
+
+	// later blocks do not filter all links again, a change behind the back of the stack stays unseen
+	pRes->pRt[0] = 'b';
+	EXPECT_EQ(etag, GetBlock("rt=a*", 1, &block, &more));
+	EXPECT_EQ(etag, GetBlock("rt=a*", 0, &block, &more));
+
+	// changed by the api the document is rebuilt
+	ASSERT_EQ(COAP_OK, CoAP_SetResourceLinkAttributes(pRes, "bb", NULL));
+	EXPECT_EQ("", Get("rt=a*"));
+}
@@ -0,0 +1,200 @@
+#include "coap_test.h"
+
+// Payloads written in place and sent with the head encoded into the headroom in front of them
+class ZeroCopyTest : public CoapTest {
+protected:
+	static uint16_t ReserveSize;
+	static uint16_t CommitLength;
+	static bool FailMallocAfterHandler;
+	static const uint16_t LOCATION_PATH = 8;
+
+	virtual void SetUp() {
+		CoapTest::SetUp();
+		ReserveSize = 200;
+		CommitLength = 200;
+		FailMallocAfterHandler = false;
+	}
+
+	static uint8_t Pattern(size_t i) {
+		return (uint8_t) ('a' + i % 26);
+	}
+
+	static std::string Expected(size_t length) {
+		std::string s;
+		for (size_t i = 0; i < length; i++) {
+			s += (char) Pattern(i);
+		}
+		return s;
+	}
+
+	// Writes the pattern to a reserved buffer
+	static CoAP_HandlerResult_t Handler(CoAP_Message_t* pReq, CoAP_Message_t* pResp) {
+		(void) pReq;
+		uint8_t* pBuf = CoAP_ReservePayload(pResp, ReserveSize);
+		EXPECT_NE(nullptr, pBuf);
+		if (pBuf == NULL) {
+			return HANDLER_ERROR;
+		}
+		for (uint16_t i = 0; i < ReserveSize; i++) {
+			pBuf[i] = Pattern(i);
+		}
+		EXPECT_EQ(COAP_OK, CoAP_CommitPayload(pResp, CommitLength));
+		MallocFails = FailMallocAfterHandler;
+		return HANDLER_OK;
+	}
+
+	static CoAP_Message_t* Response(uint16_t mid = 0x700) {
+		return CoAP_CreateMessage(NON, RESP_SUCCESS_CONTENT_2_05, mid, NULL, 0, 0, Token(1));
+	}
+
+	static void Get(const char* uri) {
+		static uint16_t mid = 0x700;
+		Receive(Ep(1), Msg(CON, REQ_GET, mid++, Token(1), uri));
+		Work(4);
+	}
+};
+
+uint16_t ZeroCopyTest::ReserveSize;
+uint16_t ZeroCopyTest::CommitLength;
+bool ZeroCopyTest::FailMallocAfterHandler;
+
+TEST_F(ZeroCopyTest, ReservedPayloadIsSentWithoutAllocation) {
+	CoAP_Message_t* pMsg = Response();
+	uint8_t* pBuf = CoAP_ReservePayload(pMsg, 100);
+	ASSERT_NE(nullptr, pBuf);
+	memset(pBuf, 'x', 100);
+	ASSERT_EQ(COAP_OK, CoAP_CommitPayload(pMsg, 100));
+	AddUintOption(pMsg, OPT_NUM_MAX_AGE, 30);
+
+	MallocFails = true; // the copying path would need a datagram buffer
+	EXPECT_EQ(COAP_OK, CoAP_SendMsg(pMsg, Sock(), Ep(1)));
+	MallocFails = false;
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg sent(Sent[0]);
+	EXPECT_EQ(std::string(100, 'x'), sent.Payload());
+	EXPECT_EQ(30u, sent.UintOption(OPT_NUM_MAX_AGE));
+	EXPECT_TRUE(CoAP_TokenEqual(Token(1), sent->Token));
+
+	// sent again, e.g. on retransmission, with an option added after the first encoding
+	AddUintOption(pMsg, OPT_NUM_CONTENT_FORMAT, 50);
+	EXPECT_EQ(COAP_OK, CoAP_SendMsg(pMsg, Sock(), Ep(1)));
+	ASSERT_EQ(2u, Sent.size());
+	ParsedMsg again(Sent[1]);
+	EXPECT_EQ(std::string(100, 'x'), again.Payload());
+	EXPECT_EQ(50u, again.UintOption(OPT_NUM_CONTENT_FORMAT));
+	CoAP_free_Message(&pMsg);
+}
+
+TEST_F(ZeroCopyTest, LargeHeadIsSentByCopy) {
+	CoAP_Message_t* pMsg = Response();
+	uint8_t* pBuf = CoAP_ReservePayload(pMsg, 20);
+	ASSERT_NE(nullptr, pBuf);
+	memset(pBuf, 'y', 20);
+	ASSERT_EQ(COAP_OK, CoAP_CommitPayload(pMsg, 20));
+	std::string path(TX_HEADROOM, 'p'); // head does not fit into the headroom
+	CoAP_AppendOptionToList(&(pMsg->pOptionsList), LOCATION_PATH, (uint8_t*) path.data(), (uint16_t) path.size());
+
+	EXPECT_EQ(COAP_OK, CoAP_SendMsg(pMsg, Sock(), Ep(1)));
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg sent(Sent[0]);
+	EXPECT_EQ(std::string(20, 'y'), sent.Payload());
+	ASSERT_NE(nullptr, sent.Option(LOCATION_PATH));
+	EXPECT_EQ(path.size(), sent.Option(LOCATION_PATH)->Length);
+	CoAP_free_Message(&pMsg);
+}
+
+TEST_F(ZeroCopyTest, StaticPayloadIsSentByCopy) {
+	static const char payload[] = "static payload longer than the quick buffer";
+	CoAP_Message_t* pMsg = Response();
+	ASSERT_EQ(COAP_OK, CoAP_SetPayload(pMsg, (uint8_t*) payload, strlen(payload), false));
+	EXPECT_EQ(PAYLOAD_STATIC, pMsg->PayloadMode);
+	EXPECT_EQ((uint8_t*) payload, pMsg->Payload);
+
+	MallocFails = true;
+	EXPECT_EQ(COAP_ERR_OUT_OF_MEMORY, CoAP_SendMsg(pMsg, Sock(), Ep(1)));
+	MallocFails = false;
+	EXPECT_EQ(COAP_OK, CoAP_SendMsg(pMsg, Sock(), Ep(1)));
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(payload, ParsedMsg(Sent[0]).Payload());
+	CoAP_free_Message(&pMsg);
+}
+
+TEST_F(ZeroCopyTest, ReserveReusesWritableBuffer) {
+	CoAP_Message_t* pMsg = Response();
+	uint8_t* pBuf = CoAP_ReservePayload(pMsg, 64);
+	ASSERT_NE(nullptr, pBuf);
+	long allocations = Allocations;
+	EXPECT_EQ(pBuf, CoAP_ReservePayload(pMsg, 32));
+	EXPECT_EQ(allocations, Allocations);
+
+	uint8_t* pBigger = CoAP_ReservePayload(pMsg, 128);
+	ASSERT_NE(nullptr, pBigger);
+	EXPECT_EQ(allocations, Allocations); // old buffer freed
+	EXPECT_EQ(128u, pMsg->PayloadBufSize);
+	CoAP_free_Message(&pMsg);
+}
+
+TEST_F(ZeroCopyTest, InvalidReservationsFail) {
+	CoAP_Message_t* pMsg = Response();
+	EXPECT_EQ(nullptr, CoAP_ReservePayload(pMsg, MAX_PAYLOAD_SIZE + 1));
+	EXPECT_EQ(COAP_ERR_ARGUMENT, CoAP_CommitPayload(pMsg, 1)); // nothing reserved
+
+	ASSERT_NE(nullptr, CoAP_ReservePayload(pMsg, 16));
+	EXPECT_EQ(COAP_ERR_ARGUMENT, CoAP_CommitPayload(pMsg, 17));
+	EXPECT_EQ(COAP_OK, CoAP_CommitPayload(pMsg, 16));
+
+	MallocFails = true;
+	EXPECT_EQ(nullptr, CoAP_ReservePayload(pMsg, 32));
+	MallocFails = false;
+	EXPECT_EQ(16u, pMsg->PayloadLength); // left as it was
+	CoAP_free_Message(&pMsg);
+}
+
+TEST_F(ZeroCopyTest, VolatilePayloadIsCopiedOnce) {
+	std::string payload(100, 'v');
+	CoAP_Message_t* pMsg = Response();
+	ASSERT_EQ(COAP_OK, CoAP_SetPayload(pMsg, (uint8_t*) payload.data(), payload.size(), true));
+	payload.assign(100, 'w'); // the copy is independent of the source
+
+	MallocFails = true;
+	EXPECT_EQ(COAP_OK, CoAP_SendMsg(pMsg, Sock(), Ep(1)));
+	MallocFails = false;
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(std::string(100, 'v'), ParsedMsg(Sent[0]).Payload());
+	CoAP_free_Message(&pMsg);
+}
+
+TEST_F(ZeroCopyTest, HandlerWritesPayloadInPlace) {
+	CreateResource("zc", Opts(RES_OPT_GET), Handler);
+	FailMallocAfterHandler = true;
+	Get("zc");
+	MallocFails = false;
+	ASSERT_EQ(1u, Sent.size());
+	ParsedMsg resp(Sent[0]);
+	EXPECT_EQ(RESP_SUCCESS_CONTENT_2_05, resp->Code);
+	EXPECT_EQ(Expected(200), resp.Payload());
+
+	Sent.clear();
+	FailMallocAfterHandler = false;
+	CommitLength = 150; // less than reserved
+	Get("zc");
+	ASSERT_EQ(1u, Sent.size());
+	EXPECT_EQ(Expected(150), ParsedMsg(Sent[0]).Payload());
+}
+
+TEST_F(ZeroCopyTest, ReservedBuffersAreFreed) {
+	CreateResource("zc", Opts(RES_OPT_GET), Handler);
+	CoAP_ClearPendingInteractions();
+	long before = Allocations;
+	for (int i = 0; i < 3; i++) {
+		Get("zc");
+	}
+	CoAP_ClearPendingInteractions();
+	EXPECT_EQ(before, Allocations);
+	EXPECT_EQ(3u, Sent.size());
+
+	CoAP_Message_t* pMsg = Response();
+	ASSERT_NE(nullptr, CoAP_ReservePayload(pMsg, 300));
+	CoAP_free_Message(&pMsg);
+	EXPECT_EQ(before, Allocations);
+}